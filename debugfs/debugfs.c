@@ -101,6 +101,7 @@ static void open_filesystem(char *device, int open_flags, blk64_t superblock,
 		return;
 	}
 	current_fs->default_bitmap_type = EXT2FS_BMAP64_RBTREE;
+	ext2fs_init_pathname_cache(current_fs, 0);
 
 	if (catastrophic)
 		com_err(device, 0, "catastrophic mode - not reading inode or group bitmaps");
@@ -22,6 +22,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <utime.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #ifdef HAVE_GETOPT_H
 #include <getopt.h>
 #else
@@ -35,6 +37,12 @@ extern char *optarg;
 #define O_LARGEFILE 0
 #endif
 
+/*
+ * Number of filesystem blocks copied per ext2fs_file_read() call, so
+ * that contiguous runs of a file are read with a single large I/O.
+ */
+#define DUMP_BLOCKS	256
+
 /*
  * The mode_xlate function translates a linux mode into a native-OS mode_t.
  */
@@ -90,24 +98,51 @@ static void fix_perms(const char *cmd, const struct ext2_inode *inode,
 	if (i == -1)
 		com_err(cmd, errno, "while changing ownership of %s", name);
 
-	if (fd != -1)
-		close(fd);
-
 	ut.actime = inode->i_atime;
 	ut.modtime = inode->i_mtime;
 	if (utime(name, &ut) == -1)
 		com_err(cmd, errno, "while setting times of %s", name);
 }
 
+static int is_zero_block(const char *buf, unsigned int len)
+{
+	while (len--)
+		if (*buf++)
+			return 0;
+	return 1;
+}
+
+/*
+ * Write out a buffer, seeking over (rather than writing) any whole
+ * blocks of zeros so that holes are preserved in the output file.
+ */
+static int write_sparse(int fd, const char *buf, unsigned int len,
+			unsigned int blocksize)
+{
+	unsigned int	c;
+
+	while (len) {
+		c = (len < blocksize) ? len : blocksize;
+		if (c == blocksize && is_zero_block(buf, c)) {
+			if (ext2fs_llseek(fd, c, SEEK_CUR) < 0)
+				return -1;
+		} else if (write(fd, buf, c) != (ssize_t) c)
+			return -1;
+		buf += c;
+		len -= c;
+	}
+	return 0;
+}
+
 static void dump_file(const char *cmdname, ext2_ino_t ino, int fd,
-		      int preserve, char *outname)
+		      int preserve, int sparse, char *outname)
 {
 	errcode_t retval;
 	struct ext2_inode	inode;
 	char		*buf = 0;
 	ext2_file_t	e2_file;
 	int		nbytes;
-	unsigned int	got, blocksize = current_fs->blocksize;
+	unsigned int	got, bufsize = current_fs->blocksize * DUMP_BLOCKS;
 
 	if (debugfs_read_inode(ino, &inode, cmdname))
 		return;
@@ -117,21 +152,30 @@ static void dump_file(const char *cmdname, ext2_ino_t ino, int fd,
 		com_err(cmdname, retval, "while opening ext2 file");
 		return;
 	}
-	retval = ext2fs_get_mem(blocksize, &buf);
+	retval = ext2fs_get_mem(bufsize, &buf);
 	if (retval) {
 		com_err(cmdname, retval, "while allocating memory");
 		return;
 	}
 	while (1) {
-		retval = ext2fs_file_read(e2_file, buf, blocksize, &got);
+		retval = ext2fs_file_read(e2_file, buf, bufsize, &got);
 		if (retval)
 			com_err(cmdname, retval, "while reading ext2 file");
 		if (got == 0)
 			break;
+		if (sparse) {
+			if (write_sparse(fd, buf, got,
+					 current_fs->blocksize) < 0)
+				com_err(cmdname, errno, "while writing file");
+			continue;
+		}
 		nbytes = write(fd, buf, got);
 		if ((unsigned) nbytes != got)
 			com_err(cmdname, errno, "while writing file");
 	}
+	/* Set the length in case the file ends in a hole */
+	if (sparse && ftruncate(fd, EXT2_I_SIZE(&inode)) < 0)
+		com_err(cmdname, errno, "while writing file");
 	if (buf)
 		ext2fs_free_mem(&buf);
 	retval = ext2fs_file_close(e2_file);
@@ -187,7 +231,7 @@ void do_dump(int argc, char **argv)
 		return;
 	}
 
-	dump_file(argv[0], inode, fd, preserve, out_fn);
+	dump_file(argv[0], inode, fd, preserve, 0, out_fn);
 	if (close(fd) != 0) {
 		com_err(argv[0], errno, "while closing %s for dump_inode",
 			out_fn);
@@ -249,9 +293,112 @@ errout:
 	free(buf);
 }
 
+/*
+ * rdump first walks the directory tree, creating directories and
+ * symlinks as it goes and queueing up the regular files.  The files
+ * are then sorted by their starting physical block and copied, either
+ * in this process or split up among several worker processes, so
+ * that the device is read in (mostly) ascending order.  Directory
+ * permissions are fixed up last, once their contents are in place.
+ */
+#define RDUMP_FL_SPARSE		0x0001
+#define RDUMP_FL_PROGRESS	0x0002
+
+struct rdump_file {
+	ext2_ino_t	ino;
+	blk64_t		pblk;
+	__u64		size;
+	char		*name;
+};
+
+struct rdump_dir {
+	struct ext2_inode	inode;
+	char			*name;
+};
+
+struct rdump_ctx {
+	int			flags;
+	int			jobs;
+	struct rdump_file	*files;
+	unsigned long		num_files, max_files;
+	struct rdump_dir	*dirs;
+	unsigned long		num_dirs, max_dirs;
+	__u64			total_bytes;
+	__u64			done_files, done_bytes;
+	struct timeval		start, last;
+};
+
+/* What a worker sends back for each file it has copied */
+struct rdump_report {
+	unsigned long	index;
+	__u64		bytes;
+};
+
+struct rdump_walk {
+	struct rdump_ctx	*ctx;
+	const char		*dumproot;
+};
+
 static int rdump_dirent(struct ext2_dir_entry *, int, int, char *, void *);
 
-static void rdump_inode(ext2_ino_t ino, struct ext2_inode *inode,
+static void rdump_queue_file(struct rdump_ctx *ctx, ext2_ino_t ino,
+			     struct ext2_inode *inode, char *fullname)
+{
+	struct rdump_file	*f;
+	errcode_t		retval;
+
+	if (ctx->num_files >= ctx->max_files) {
+		unsigned long	new_max = ctx->max_files ?
+			ctx->max_files * 2 : 1024;
+
+		retval = ext2fs_resize_mem(ctx->max_files * sizeof(*f),
+					   new_max * sizeof(*f),
+					   &ctx->files);
+		if (retval) {
+			com_err("rdump", retval, "while queueing %s",
+				fullname);
+			free(fullname);
+			return;
+		}
+		ctx->max_files = new_max;
+	}
+	f = &ctx->files[ctx->num_files++];
+	f->ino = ino;
+	f->size = EXT2_I_SIZE(inode);
+	f->name = fullname;
+	if (ext2fs_bmap2(current_fs, ino, inode, NULL, 0, 0, 0, &f->pblk))
+		f->pblk = 0;
+	ctx->total_bytes += f->size;
+}
+
+static void rdump_queue_dir(struct rdump_ctx *ctx, struct ext2_inode *inode,
+			    char *fullname)
+{
+	struct rdump_dir	*d;
+	errcode_t		retval;
+
+	if (ctx->num_dirs >= ctx->max_dirs) {
+		unsigned long	new_max = ctx->max_dirs ?
+			ctx->max_dirs * 2 : 256;
+
+		retval = ext2fs_resize_mem(ctx->max_dirs * sizeof(*d),
+					   new_max * sizeof(*d),
+					   &ctx->dirs);
+		if (retval) {
+			/* Don't defer it, then */
+			fix_perms("rdump", inode, -1, fullname);
+			free(fullname);
+			return;
+		}
+		ctx->max_dirs = new_max;
+	}
+	d = &ctx->dirs[ctx->num_dirs++];
+	d->inode = *inode;
+	d->name = fullname;
+}
+
+static void rdump_inode(struct rdump_ctx *ctx, ext2_ino_t ino,
+			struct ext2_inode *inode,
 			const char *name, const char *dumproot)
 {
 	char *fullname;
@@ -268,35 +415,31 @@ static void rdump_inode(ext2_ino_t ino, struct ext2_inode *inode,
 	if (LINUX_S_ISLNK(inode->i_mode))
 		rdump_symlink(ino, inode, fullname);
 	else if (LINUX_S_ISREG(inode->i_mode)) {
-		int fd;
-		fd = open(fullname, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, S_IRWXU);
-		if (fd == -1) {
-			com_err("rdump", errno, "while dumping %s", fullname);
-			goto errout;
-		}
-		dump_file("rdump", ino, fd, 1, fullname);
-		if (close(fd) != 0) {
-			com_err("rdump", errno, "while dumping %s", fullname);
-			goto errout;
-		}
+		/* The queue takes over fullname */
+		rdump_queue_file(ctx, ino, inode, fullname);
+		return;
 	}
 	else if (LINUX_S_ISDIR(inode->i_mode) && strcmp(name, ".") && strcmp(name, "..")) {
-		errcode_t retval;
+		struct rdump_walk	walk;
+		errcode_t		retval;
 
 		/* Create the directory with 0700 permissions, because we
 		 * expect to have to create entries it.  Then fix its perms
-		 * once we've done the traversal. */
+		 * once all of the files have been copied. */
 		if (mkdir(fullname, S_IRWXU) == -1) {
 			com_err("rdump", errno, "while making directory %s", fullname);
 			goto errout;
 		}
 
+		walk.ctx = ctx;
+		walk.dumproot = fullname;
 		retval = ext2fs_dir_iterate(current_fs, ino, 0, 0,
-					    rdump_dirent, (void *) fullname);
+					    rdump_dirent, (void *) &walk);
 		if (retval)
 			com_err("rdump", retval, "while dumping %s", fullname);
 
-		fix_perms("rdump", inode, -1, fullname);
+		rdump_queue_dir(ctx, inode, fullname);
+		return;
 	}
 	/* else do nothing (don't dump device files, sockets, fifos, etc.) */
 
@@ -311,7 +454,7 @@ static int rdump_dirent(struct ext2_dir_entry *dirent,
 {
 	char name[EXT2_NAME_LEN + 1];
 	int thislen;
-	const char *dumproot = private;
+	struct rdump_walk *walk = private;
 	struct ext2_inode inode;
 
 	thislen = dirent->name_len & 0xFF;
@@ -321,48 +464,309 @@ static int rdump_dirent(struct ext2_dir_entry *dirent,
 	if (debugfs_read_inode(dirent->inode, &inode, name))
 		return 0;
 
-	rdump_inode(dirent->inode, &inode, name, dumproot);
+	rdump_inode(walk->ctx, dirent->inode, &inode, name, walk->dumproot);
+
+	return 0;
+}
+
+static int rdump_file_cmp(const void *a, const void *b)
+{
+	const struct rdump_file *fa = a, *fb = b;
+
+	if (fa->pblk < fb->pblk)
+		return -1;
+	if (fa->pblk > fb->pblk)
+		return 1;
+	return 0;
+}
+
+static double rdump_elapsed(struct timeval *from, struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) +
+		(to->tv_usec - from->tv_usec) / 1000000.0;
+}
+
+/*
+ * Account for a copied file, and print progress at most once a second
+ * if it was asked for.
+ */
+static void rdump_account(struct rdump_ctx *ctx, __u64 bytes)
+{
+	struct timeval	now;
+
+	ctx->done_files++;
+	ctx->done_bytes += bytes;
+	if (!(ctx->flags & RDUMP_FL_PROGRESS))
+		return;
+	gettimeofday(&now, 0);
+	if (ctx->done_files != ctx->num_files &&
+	    rdump_elapsed(&ctx->last, &now) < 1.0)
+		return;
+	ctx->last = now;
+	printf("\r%llu/%lu files, %llu/%llu MB",
+	       (unsigned long long) ctx->done_files, ctx->num_files,
+	       (unsigned long long) ctx->done_bytes >> 20,
+	       (unsigned long long) ctx->total_bytes >> 20);
+	fflush(stdout);
+}
+
+static void rdump_copy_one(struct rdump_ctx *ctx, struct rdump_file *f)
+{
+	int fd;
 
+	fd = open(f->name, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, S_IRWXU);
+	if (fd == -1) {
+		com_err("rdump", errno, "while dumping %s", f->name);
+		return;
+	}
+	dump_file("rdump", f->ino, fd, 1, ctx->flags & RDUMP_FL_SPARSE,
+		  f->name);
+	if (close(fd) != 0)
+		com_err("rdump", errno, "while dumping %s", f->name);
+}
+
+/*
+ * Give a worker process its own I/O channel, so that it does not
+ * share a file offset (or a block cache) with its siblings.
+ */
+static errcode_t rdump_reopen_io(void)
+{
+	io_channel	io;
+	errcode_t	retval;
+
+	retval = current_fs->io->manager->open(current_fs->device_name,
+					       0, &io);
+	if (retval)
+		return retval;
+	retval = io_channel_set_blksize(io, current_fs->blocksize);
+	if (retval) {
+		io_channel_close(io);
+		return retval;
+	}
+	if (current_fs->image_io == current_fs->io)
+		current_fs->image_io = io;
+	current_fs->io = io;
 	return 0;
 }
 
+static void rdump_worker(struct rdump_ctx *ctx, unsigned long first,
+			 unsigned long last, int report_fd)
+{
+	struct rdump_report	rep;
+	errcode_t		retval;
+	unsigned long		i;
+
+	retval = rdump_reopen_io();
+	if (retval) {
+		com_err("rdump", retval, "while reopening %s",
+			current_fs->device_name);
+		_exit(1);
+	}
+	memset(&rep, 0, sizeof(rep));
+	for (i = first; i < last; i++) {
+		rdump_copy_one(ctx, &ctx->files[i]);
+		rep.index = i;
+		rep.bytes = ctx->files[i].size;
+		if (write(report_fd, &rep, sizeof(rep)) != sizeof(rep))
+			_exit(1);
+	}
+	io_channel_close(current_fs->io);
+	_exit(0);
+}
+
+/*
+ * Split the (sorted) file list into ctx->jobs runs of roughly equal
+ * size and hand each run to a worker process.  The workers report
+ * back each file they finish over a pipe; any file which was not
+ * reported, because a worker failed or could not be started, is
+ * copied by the parent afterwards.
+ */
+static void rdump_copy_parallel(struct rdump_ctx *ctx)
+{
+	struct rdump_report rep;
+	pid_t		*pids;
+	char		*done;
+	int		pfd[2], i, nworkers = 0, status;
+	unsigned long	first = 0, last;
+	__u64		share, sum;
+
+	pids = calloc(ctx->jobs, sizeof(pid_t));
+	done = calloc(ctx->num_files, 1);
+	if (!pids || !done) {
+		com_err("rdump", errno, "while allocating memory");
+		goto copy_rest;
+	}
+	if (pipe(pfd) < 0) {
+		com_err("rdump", errno, "while creating pipe");
+		goto copy_rest;
+	}
+
+	/* Workers read straight from the device */
+	io_channel_flush(current_fs->io);
+	fflush(stdout);
+	fflush(stderr);
+
+	share = ctx->total_bytes / ctx->jobs + 1;
+	for (i = 0; i < ctx->jobs && first < ctx->num_files; i++) {
+		for (last = first, sum = 0; last < ctx->num_files; last++) {
+			if (sum >= share && i < ctx->jobs - 1)
+				break;
+			sum += ctx->files[last].size;
+		}
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			com_err("rdump", errno, "while forking worker");
+			break;
+		}
+		if (pids[i] == 0) {
+			close(pfd[0]);
+			rdump_worker(ctx, first, last, pfd[1]);
+		}
+		nworkers++;
+		first = last;
+	}
+	close(pfd[1]);
+
+	while (read(pfd[0], &rep, sizeof(rep)) == sizeof(rep)) {
+		if (rep.index >= ctx->num_files || done[rep.index])
+			continue;
+		done[rep.index] = 1;
+		rdump_account(ctx, rep.bytes);
+	}
+	close(pfd[0]);
+
+	for (i = 0; i < nworkers; i++) {
+		if (waitpid(pids[i], &status, 0) < 0)
+			continue;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			com_err("rdump", 0, "worker %d failed; copying the "
+				"rest of its files directly", (int) pids[i]);
+	}
+
+copy_rest:
+	/* Whatever the workers didn't finish, copy here */
+	for (first = 0; first < ctx->num_files; first++) {
+		if (done && done[first])
+			continue;
+		rdump_copy_one(ctx, &ctx->files[first]);
+		rdump_account(ctx, ctx->files[first].size);
+	}
+	free(done);
+	free(pids);
+}
+
+static void rdump_finish(struct rdump_ctx *ctx)
+{
+	struct timeval	now;
+	double		secs;
+	unsigned long	i;
+
+	qsort(ctx->files, ctx->num_files, sizeof(struct rdump_file),
+	      rdump_file_cmp);
+
+	if (ctx->jobs > 1 && ctx->num_files > 1)
+		rdump_copy_parallel(ctx);
+	else {
+		for (i = 0; i < ctx->num_files; i++) {
+			rdump_copy_one(ctx, &ctx->files[i]);
+			rdump_account(ctx, ctx->files[i].size);
+		}
+	}
+
+	/* Children before their parents */
+	for (i = ctx->num_dirs; i > 0; i--) {
+		fix_perms("rdump", &ctx->dirs[i-1].inode, -1,
+			  ctx->dirs[i-1].name);
+		free(ctx->dirs[i-1].name);
+	}
+	for (i = 0; i < ctx->num_files; i++)
+		free(ctx->files[i].name);
+
+	if (ctx->flags & RDUMP_FL_PROGRESS) {
+		gettimeofday(&now, 0);
+		secs = rdump_elapsed(&ctx->start, &now);
+		if (ctx->num_files)
+			fputc('\n', stdout);
+		printf("rdump: %llu files, %llu bytes in %.2f seconds "
+		       "(%.1f MB/s)\n", (unsigned long long) ctx->done_files,
+		       (unsigned long long) ctx->done_bytes, secs,
+		       secs > 0 ? ctx->done_bytes / secs / (1024 * 1024) : 0);
+	}
+	ext2fs_free_mem(&ctx->files);
+	ext2fs_free_mem(&ctx->dirs);
+}
+
 void do_rdump(int argc, char **argv)
 {
+	struct rdump_ctx ctx;
 	ext2_ino_t ino;
 	struct ext2_inode inode;
 	struct stat st;
-	int i;
-	char *p;
+	int i, c, err;
+	char *p, *in_fn, *out_fn;
 
-	if (common_args_process(argc, argv, 3, 3, "rdump",
-				"<directory> <native directory>", 0))
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.jobs = 1;
+	reset_getopt();
+	while ((c = getopt (argc, argv, "j:pS")) != EOF) {
+		switch (c) {
+		case 'j':
+			ctx.jobs = parse_ulong(optarg, argv[0], "jobs", &err);
+			if (err)
+				return;
+			if (ctx.jobs < 1)
+				ctx.jobs = 1;
+			break;
+		case 'p':
+			ctx.flags |= RDUMP_FL_PROGRESS;
+			break;
+		case 'S':
+			ctx.flags |= RDUMP_FL_SPARSE;
+			break;
+		default:
+		print_usage:
+			com_err(argv[0], 0, "Usage: rdump [-p] [-S] [-j jobs] "
+				"<directory> <native directory>");
+			return;
+		}
+	}
+	if (optind != argc-2)
+		goto print_usage;
+
+	if (check_fs_open(argv[0]))
 		return;
 
-	ino = string_to_inode(argv[1]);
+	in_fn = argv[optind];
+	out_fn = argv[optind+1];
+
+	ino = string_to_inode(in_fn);
 	if (!ino)
 		return;
 
-	/* Ensure ARGV[2] is a directory. */
-	i = stat(argv[2], &st);
+	/* Ensure the destination is a directory. */
+	i = stat(out_fn, &st);
 	if (i == -1) {
-		com_err("rdump", errno, "while statting %s", argv[2]);
+		com_err("rdump", errno, "while statting %s", out_fn);
 		return;
 	}
 	if (!S_ISDIR(st.st_mode)) {
-		com_err("rdump", 0, "%s is not a directory", argv[2]);
+		com_err("rdump", 0, "%s is not a directory", out_fn);
 		return;
 	}
 
-	if (debugfs_read_inode(ino, &inode, argv[1]))
+	if (debugfs_read_inode(ino, &inode, in_fn))
 		return;
 
-	p = strrchr(argv[1], '/');
+	p = strrchr(in_fn, '/');
 	if (p)
 		p++;
 	else
-		p = argv[1];
+		p = in_fn;
 
-	rdump_inode(ino, &inode, p, argv[2]);
+	gettimeofday(&ctx.start, 0);
+	ctx.last = ctx.start;
+	rdump_inode(&ctx, ino, &inode, p, out_fn);
+	rdump_finish(&ctx);
 }
 
 void do_cat(int argc, char **argv)
@@ -374,7 +778,7 @@ void do_cat(int argc, char **argv)
 
 	fflush(stdout);
 	fflush(stderr);
-	dump_file(argv[0], inode, 1, 0, argv[2]);
+	dump_file(argv[0], inode, 1, 0, 0, argv[2]);
 
 	return;
 }
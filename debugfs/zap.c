@@ -160,6 +160,8 @@ void do_zap_block(int argc, char *argv[])
 			"while write block %llu\n", block);
 		goto errout;
 	}
+	/* The block may have belonged to a directory */
+	ext2fs_flush_pathname_cache(current_fs);
 
 errout:
 	free(buf);
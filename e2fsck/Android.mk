@@ -91,6 +91,8 @@ e2fsck_src_files :=  \
 	pass4.c \
 	pass5.c \
 	logfile.c \
+	checkpoint.c \
+	batch.c \
 	journal.c \
 	recovery.c \
 	revoke.c \
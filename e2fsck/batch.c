@@ -0,0 +1,251 @@
+/*
+ * batch.c --- check a list of devices or image files from one e2fsck
+ * 	process.
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ *
+ * The parent parses the command line and the configuration file,
+ * sets up the problem table and reads the list of devices once.  It
+ * then forks a child per device, which checks it exactly as a normal
+ * e2fsck run would, starting from the already initialised context.
+ * Running each check in its own process keeps the many exit() and
+ * fatal_error() paths in e2fsck safe, and gives every check a fresh
+ * copy of the state that e2fsck keeps in globals.
+ *
+ * With batch_jobs > 1, several children run at the same time; each
+ * child's output is then collected in a temporary file and copied to
+ * standard output as a whole once it has finished.  After each device
+ * the parent prints a "batch:" line with its result, and a totals line
+ * at the end.  The exit code is the bitwise OR of the children's exit
+ * codes, as with fsck(8).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "e2fsck.h"
+#include "problem.h"
+
+enum batch_status {
+	BATCH_CLEAN,
+	BATCH_FIXED,
+	BATCH_UNCORRECTED,
+	BATCH_ERROR,
+	BATCH_CANCELED,
+	BATCH_SKIPPED,
+	BATCH_NUM_STATUS
+};
+
+static const char *batch_status_names[BATCH_NUM_STATUS] = {
+	"clean", "fixed", "uncorrected", "error", "canceled", "skipped"
+};
+
+struct batch_job {
+	pid_t		pid;
+	const char	*device;
+	FILE		*out;		/* captured output, if any */
+	struct timeval	start;
+};
+
+/*
+ * Read the list of devices, one per line.  Blank lines and lines
+ * starting with '#' are skipped; "-" reads the list from stdin.
+ */
+static void read_batch_list(e2fsck_t ctx, char ***ret_list, int *ret_num)
+{
+	FILE		*f;
+	char		line[4096], *cp, **list = 0;
+	int		num = 0, max = 0;
+	errcode_t	retval;
+
+	if (strcmp(ctx->batch_fn, "-") == 0)
+		f = stdin;
+	else
+		f = fopen(ctx->batch_fn, "r");
+	if (!f) {
+		com_err(ctx->program_name, errno,
+			_("while opening batch list %s"), ctx->batch_fn);
+		fatal_error(ctx, 0);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		cp = line + strlen(line);
+		while (cp > line && isspace(cp[-1]))
+			*--cp = 0;
+		for (cp = line; isspace(*cp); cp++)
+			;
+		if (*cp == 0 || *cp == '#')
+			continue;
+		if (num >= max) {
+			retval = ext2fs_resize_mem(max * sizeof(char *),
+					(max ? max * 2 : 64) * sizeof(char *),
+					&list);
+			if (retval) {
+				com_err(ctx->program_name, retval, "%s",
+					_("while reading the batch list"));
+				fatal_error(ctx, 0);
+			}
+			max = max ? max * 2 : 64;
+		}
+		list[num++] = string_copy(ctx, cp, 0);
+	}
+	if (f != stdin)
+		fclose(f);
+	*ret_list = list;
+	*ret_num = num;
+}
+
+static enum batch_status exit_to_status(int status, int *exit_value)
+{
+	int	code;
+
+	if (!WIFEXITED(status)) {
+		*exit_value = FSCK_ERROR;
+		return BATCH_ERROR;
+	}
+	code = *exit_value = WEXITSTATUS(status);
+	if (code & (FSCK_ERROR | FSCK_USAGE | FSCK_LIBRARY))
+		return BATCH_ERROR;
+	if (code & FSCK_UNCORRECTED)
+		return BATCH_UNCORRECTED;
+	if (code & FSCK_CANCELED)
+		return BATCH_CANCELED;
+	if (code & (FSCK_NONDESTRUCT | FSCK_REBOOT))
+		return BATCH_FIXED;
+	return BATCH_CLEAN;
+}
+
+static void report_job(struct batch_job *job, int status,
+		       int *counts, int *exit_value)
+{
+	struct timeval	now;
+	enum batch_status st;
+	char		buf[8192];
+	size_t		n;
+	int		code;
+
+	gettimeofday(&now, 0);
+	if (job->out) {
+		rewind(job->out);
+		while ((n = fread(buf, 1, sizeof(buf), job->out)) > 0)
+			fwrite(buf, 1, n, stdout);
+		fclose(job->out);
+		job->out = 0;
+	}
+	st = exit_to_status(status, &code);
+	counts[st]++;
+	*exit_value |= code;
+	printf("batch: status=%s exit=%d", batch_status_names[st], code);
+	if (WIFSIGNALED(status))
+		printf(" signal=%d", WTERMSIG(status));
+	printf(" time=%.3f device=%s\n", (now.tv_sec - job->start.tv_sec) +
+	       (now.tv_usec - job->start.tv_usec) / 1000000.0, job->device);
+	job->pid = 0;
+}
+
+/*
+ * Check every device in ctx->batch_fn.  In the parent this returns the
+ * combined exit code once all the children have finished, with
+ * *ret_device set to NULL.  In each child it returns 0 with
+ * *ret_device set to the device that the child should go on to check.
+ */
+int e2fsck_batch_run(e2fsck_t ctx, char **ret_device)
+{
+	struct batch_job *jobs;
+	char		**list;
+	int		num, next = 0, running = 0, jobs_max, i;
+	int		counts[BATCH_NUM_STATUS];
+	int		exit_value = 0, status;
+	pid_t		pid;
+
+	*ret_device = 0;
+	read_batch_list(ctx, &list, &num);
+	e2fsck_configure_problems(ctx);
+
+	jobs_max = ctx->batch_jobs ? ctx->batch_jobs : 1;
+	if (jobs_max > num)
+		jobs_max = num;
+	jobs = e2fsck_allocate_memory(ctx, (jobs_max ? jobs_max : 1) *
+				      sizeof(struct batch_job), "batch jobs");
+	memset(counts, 0, sizeof(counts));
+
+	while (next < num || running) {
+		for (i = 0; i < jobs_max && next < num &&
+			     !(ctx->flags & E2F_FLAG_SIGNAL_MASK); i++) {
+			struct batch_job *job = &jobs[i];
+
+			if (job->pid)
+				continue;
+			job->device = list[next++];
+			job->out = 0;
+			if (jobs_max > 1 && !(job->out = tmpfile())) {
+				com_err(ctx->program_name, errno, "%s",
+					_("while creating a batch output file"));
+				fatal_error(ctx, 0);
+			}
+			gettimeofday(&job->start, 0);
+			pid = fork();
+			if (pid < 0) {
+				com_err(ctx->program_name, errno, "%s",
+					_("while starting a batch job"));
+				fatal_error(ctx, 0);
+			}
+			if (pid == 0) {
+				if (job->out) {
+					dup2(fileno(job->out), 1);
+					dup2(fileno(job->out), 2);
+				}
+				if (!getenv("E2FSCK_TIME"))
+					ctx->now = time(0);
+				*ret_device = (char *) job->device;
+				return 0;
+			}
+			job->pid = pid;
+			running++;
+		}
+		if (!running)
+			break;
+		pid = wait(&status);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			com_err(ctx->program_name, errno, "%s",
+				_("while waiting for a batch job"));
+			fatal_error(ctx, 0);
+		}
+		for (i = 0; i < jobs_max; i++)
+			if (jobs[i].pid == pid)
+				break;
+		if (i == jobs_max)
+			continue;
+		report_job(&jobs[i], status, counts, &exit_value);
+		running--;
+	}
+
+	if (next < num) {
+		counts[BATCH_SKIPPED] = num - next;
+		exit_value |= FSCK_CANCELED;
+	}
+	printf("batch: total=%d", num);
+	for (i = 0; i < BATCH_NUM_STATUS; i++)
+		printf(" %s=%d", batch_status_names[i], counts[i]);
+	fputc('\n', stdout);
+
+	for (i = 0; i < num; i++)
+		ext2fs_free_mem(&list[i]);
+	ext2fs_free_mem(&list);
+	ext2fs_free_mem(&jobs);
+	return exit_value;
+}
@@ -0,0 +1,923 @@
+/*
+ * checkpoint.c --- save e2fsck's pass 1 and pass 2 results to a file,
+ * 	so that an interrupted run can be resumed later.
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ *
+ * A checkpoint is written after pass 1, after pass 2 and, if asked
+ * for, every N block groups during pass 1.  It holds everything the
+ * later passes need from the earlier ones: the inode and block maps,
+ * the link counts, the directory information, the directory block
+ * list and so on.  It also holds a copy of the superblock and a
+ * checksum of the group descriptors as they were when pass 1 started.
+ * A later run only uses the checkpoint if both still match, which
+ * means that nothing has written to the file system in between.
+ *
+ * Once e2fsck has changed the file system itself, a checkpoint would
+ * describe a state that the disk may or may not be in after a crash,
+ * so no more checkpoints are written from that point on.  The same
+ * goes for read-only mode: changes made only in memory (relocated
+ * group metadata, updated descriptors and so on) are not part of the
+ * checkpoint, so a resumed run would not see them.  An earlier
+ * checkpoint is kept in that case, since the resumed run repeats
+ * whatever made those changes.
+ *
+ * The file is written in host byte order; it is meant to be read back
+ * by the same e2fsck binary on the same machine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <sys/stat.h>
+
+#include "e2fsck.h"
+
+#define CKPT_MAGIC	0x45324350	/* "E2CP" */
+#define CKPT_VERSION	1
+
+/* Default number of block groups between pass 1 checkpoints */
+#define CKPT_GROUPS	1024
+
+/* Number of bits of a bitmap saved per chunk */
+#define CKPT_CHUNK_BITS	32768
+
+/* Options which change what the passes do */
+#define CKPT_OPTIONS	(E2F_OPT_READONLY | E2F_OPT_PREEN | E2F_OPT_YES | \
+			 E2F_OPT_NO | E2F_OPT_COMPRESS_DIRS | \
+			 E2F_OPT_FRAGCHECK | E2F_OPT_CHECKBLOCKS)
+
+struct ckpt_header {
+	__u32	magic;
+	__u32	version;
+	__u32	pass;		/* last pass completed */
+	__u32	next_group;	/* pass 1: first group not yet scanned */
+	__u32	options;
+	__u32	desc_csum;
+	__u32	ext_attr_ver;
+	__u32	fs_valid;
+	struct ext2_super_block	super;
+};
+
+/*
+ * The header is followed by a series of records, each introduced by
+ * one of these, and by a crc32c of everything before it.
+ */
+struct ckpt_record {
+	__u32	tag;
+	__u32	which;
+	__u64	count;
+};
+
+enum {
+	CKPT_END = 0,
+	CKPT_BITMAP,
+	CKPT_ICOUNT,
+	CKPT_REFCOUNT,
+	CKPT_DIR_INFO,
+	CKPT_DX_DIR_INFO,
+	CKPT_DBLIST,
+	CKPT_U32_LIST,
+	CKPT_INVALID,
+	CKPT_COUNTERS
+};
+
+struct e2fsck_checkpoint {
+	struct ckpt_header	start;	/* the file system at pass 1 */
+	int			disabled;
+	int			resume;	/* restore pass 1 state */
+};
+
+struct ckpt_file {
+	FILE		*f;
+	__u32		crc;
+	errcode_t	err;
+};
+
+#define CTX_FIELD(ctx, off, type) (*(type *) ((char *) (ctx) + (off)))
+
+static const struct ckpt_bitmap {
+	size_t		offset;
+	int		block;
+	int		type;
+	const char	*descr;
+	const char	*name;
+} ckpt_bitmaps[] = {
+	{ offsetof(struct e2fsck_struct, inode_used_map), 0,
+	  EXT2FS_BMAP64_RBTREE, N_("in-use inode map"), "inode_used_map" },
+	{ offsetof(struct e2fsck_struct, inode_bad_map), 0,
+	  EXT2FS_BMAP64_RBTREE, N_("bad inode map"), "inode_bad_map" },
+	{ offsetof(struct e2fsck_struct, inode_dir_map), 0,
+	  EXT2FS_BMAP64_AUTODIR, N_("directory inode map"),
+	  "inode_dir_map" },
+	{ offsetof(struct e2fsck_struct, inode_bb_map), 0,
+	  EXT2FS_BMAP64_RBTREE, N_("inode in bad block map"),
+	  "inode_bb_map" },
+	{ offsetof(struct e2fsck_struct, inode_imagic_map), 0,
+	  EXT2FS_BMAP64_RBTREE, N_("imagic inode map"),
+	  "inode_imagic_map" },
+	{ offsetof(struct e2fsck_struct, inode_reg_map), 0,
+	  EXT2FS_BMAP64_RBTREE, N_("regular file inode map"),
+	  "inode_reg_map" },
+	{ offsetof(struct e2fsck_struct, block_found_map), 1,
+	  EXT2FS_BMAP64_RBTREE, N_("in-use block map"), "block_found_map" },
+	{ offsetof(struct e2fsck_struct, block_dup_map), 1,
+	  EXT2FS_BMAP64_RBTREE, N_("multiply claimed block map"),
+	  "block_dup_map" },
+	{ offsetof(struct e2fsck_struct, block_ea_map), 1,
+	  EXT2FS_BMAP64_RBTREE, N_("ext attr block map"), "block_ea_map" },
+};
+#define CKPT_NUM_BITMAPS (sizeof(ckpt_bitmaps) / sizeof(ckpt_bitmaps[0]))
+
+static const size_t ckpt_counters[] = {
+	offsetof(struct e2fsck_struct, fs_directory_count),
+	offsetof(struct e2fsck_struct, fs_regular_count),
+	offsetof(struct e2fsck_struct, fs_blockdev_count),
+	offsetof(struct e2fsck_struct, fs_chardev_count),
+	offsetof(struct e2fsck_struct, fs_links_count),
+	offsetof(struct e2fsck_struct, fs_symlinks_count),
+	offsetof(struct e2fsck_struct, fs_fast_symlinks_count),
+	offsetof(struct e2fsck_struct, fs_fifo_count),
+	offsetof(struct e2fsck_struct, fs_total_count),
+	offsetof(struct e2fsck_struct, fs_badblocks_count),
+	offsetof(struct e2fsck_struct, fs_sockets_count),
+	offsetof(struct e2fsck_struct, fs_ind_count),
+	offsetof(struct e2fsck_struct, fs_dind_count),
+	offsetof(struct e2fsck_struct, fs_tind_count),
+	offsetof(struct e2fsck_struct, fs_fragmented),
+	offsetof(struct e2fsck_struct, fs_fragmented_dir),
+	offsetof(struct e2fsck_struct, large_files),
+	offsetof(struct e2fsck_struct, fs_ext_attr_inodes),
+	offsetof(struct e2fsck_struct, fs_ext_attr_blocks),
+};
+#define CKPT_NUM_COUNTERS (sizeof(ckpt_counters) / sizeof(ckpt_counters[0]))
+
+static void ck_write(struct ckpt_file *ck, const void *buf, size_t len)
+{
+	if (ck->err)
+		return;
+	if (fwrite(buf, 1, len, ck->f) != len) {
+		ck->err = errno ? errno : EXT2_ET_SHORT_WRITE;
+		return;
+	}
+	ck->crc = ext2fs_crc32c_le(ck->crc, buf, len);
+}
+
+static int ck_read(struct ckpt_file *ck, void *buf, size_t len)
+{
+	if (ck->err)
+		return -1;
+	if (fread(buf, 1, len, ck->f) != len) {
+		ck->err = ferror(ck->f) ? errno : EXT2_ET_SHORT_READ;
+		return -1;
+	}
+	ck->crc = ext2fs_crc32c_le(ck->crc, buf, len);
+	return 0;
+}
+
+static void ck_record(struct ckpt_file *ck, __u32 tag, __u32 which,
+		      __u64 count)
+{
+	struct ckpt_record	rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.tag = tag;
+	rec.which = which;
+	rec.count = count;
+	ck_write(ck, &rec, sizeof(rec));
+}
+
+static __u32 desc_csum(ext2_filsys fs)
+{
+	return ext2fs_crc32c_le(~0, (unsigned char *) fs->group_desc,
+				(size_t) fs->group_desc_count *
+				EXT2_DESC_SIZE(fs->super));
+}
+
+/*
+ * Saving
+ */
+static void save_bitmap(struct ckpt_file *ck, int which,
+			ext2fs_generic_bitmap bmap)
+{
+	unsigned char	buf[CKPT_CHUNK_BITS / 8];
+	__u64		start, end, n, i;
+
+	ck_record(ck, CKPT_BITMAP, which, 0);
+	start = ext2fs_get_generic_bmap_start(bmap);
+	end = ext2fs_get_generic_bmap_end(bmap);
+	for (; start <= end && !ck->err; start += n) {
+		n = end - start + 1;
+		if (n > CKPT_CHUNK_BITS)
+			n = CKPT_CHUNK_BITS;
+		memset(buf, 0, sizeof(buf));
+		ck->err = ext2fs_get_generic_bmap_range(bmap, start, n, buf);
+		for (i = 0; i < (n + 7) / 8; i++)
+			if (buf[i])
+				break;
+		if (i == (n + 7) / 8)
+			continue;
+		ck_write(ck, &start, sizeof(start));
+		ck_write(ck, &n, sizeof(n));
+		ck_write(ck, buf, (n + 7) / 8);
+	}
+	n = 0;
+	ck_write(ck, &start, sizeof(start));
+	ck_write(ck, &n, sizeof(n));
+}
+
+static void save_icount(struct ckpt_file *ck, int which, ext2_icount_t ic)
+{
+	ext2_ino_t	ino = 0;
+	__u32		ent[2];
+
+	ck_record(ck, CKPT_ICOUNT, which, 0);
+	while (!ck->err && ext2fs_icount_next(ic, &ino, &ent[1]) == 0) {
+		ent[0] = ino;
+		ck_write(ck, ent, sizeof(ent));
+	}
+	ent[0] = ent[1] = 0;
+	ck_write(ck, ent, sizeof(ent));
+}
+
+static void save_refcount(struct ckpt_file *ck, int which,
+			  ext2_refcount_t refcount)
+{
+	__u64	ent[2];
+	int	count;
+
+	ck_record(ck, CKPT_REFCOUNT, which, 0);
+	ea_refcount_intr_begin(refcount);
+	while ((ent[0] = ea_refcount_intr_next(refcount, &count)) != 0) {
+		ent[1] = count;
+		ck_write(ck, ent, sizeof(ent));
+	}
+	ent[0] = ent[1] = 0;
+	ck_write(ck, ent, sizeof(ent));
+}
+
+static void save_dir_info(e2fsck_t ctx, struct ckpt_file *ck)
+{
+	struct dir_info_iter	*iter;
+	struct dir_info		*dir, end;
+
+	ck_record(ck, CKPT_DIR_INFO, 0, 0);
+	iter = e2fsck_dir_info_iter_begin(ctx);
+	while ((dir = e2fsck_dir_info_iter(ctx, iter)) != 0)
+		ck_write(ck, dir, sizeof(*dir));
+	e2fsck_dir_info_iter_end(ctx, iter);
+	memset(&end, 0, sizeof(end));
+	ck_write(ck, &end, sizeof(end));
+}
+
+#ifdef ENABLE_HTREE
+static void save_dx_dir_info(e2fsck_t ctx, struct ckpt_file *ck)
+{
+	struct dx_dir_info	*dx_dir;
+	__u32			ent[4];
+	int			i = 0;
+
+	ck_record(ck, CKPT_DX_DIR_INFO, 0, 0);
+	while ((dx_dir = e2fsck_dx_dir_info_iter(ctx, &i)) != 0) {
+		ent[0] = dx_dir->ino;
+		ent[1] = dx_dir->numblocks;
+		ent[2] = dx_dir->hashversion;
+		ent[3] = dx_dir->depth;
+		ck_write(ck, ent, sizeof(ent));
+		ck_write(ck, dx_dir->dx_block,
+			 dx_dir->numblocks * sizeof(struct dx_dirblock_info));
+	}
+	memset(ent, 0, sizeof(ent));
+	ck_write(ck, ent, sizeof(ent));
+}
+#endif
+
+static int save_db(ext2_filsys fs EXT2FS_ATTR((unused)),
+		   struct ext2_db_entry2 *db, void *priv_data)
+{
+	struct ckpt_file	*ck = (struct ckpt_file *) priv_data;
+
+	ck_write(ck, db, sizeof(*db));
+	return ck->err ? DBLIST_ABORT : 0;
+}
+
+static void save_dblist(ext2_filsys fs, struct ckpt_file *ck)
+{
+	struct ext2_db_entry2	end;
+
+	ck_record(ck, CKPT_DBLIST, 0, 0);
+	ext2fs_dblist_iterate2(fs->dblist, save_db, ck);
+	memset(&end, 0, sizeof(end));
+	ck_write(ck, &end, sizeof(end));
+}
+
+static void save_u32_list(struct ckpt_file *ck, int which,
+			  ext2_u32_list list)
+{
+	ext2_u32_iterate	iter;
+	blk_t			blk;
+
+	ck_record(ck, CKPT_U32_LIST, which, 0);
+	if (ext2fs_u32_list_iterate_begin(list, &iter) == 0) {
+		while (ext2fs_u32_list_iterate(iter, &blk))
+			ck_write(ck, &blk, sizeof(blk));
+		ext2fs_u32_list_iterate_end(iter);
+	}
+	blk = 0;
+	ck_write(ck, &blk, sizeof(blk));
+}
+
+static void save_state(e2fsck_t ctx, struct ckpt_file *ck)
+{
+	ext2_filsys	fs = ctx->fs;
+	__u32		counters[CKPT_NUM_COUNTERS + MAX_EXTENT_DEPTH_COUNT];
+	unsigned int	i;
+
+	for (i = 0; i < CKPT_NUM_BITMAPS; i++)
+		if (CTX_FIELD(ctx, ckpt_bitmaps[i].offset,
+			      ext2fs_generic_bitmap))
+			save_bitmap(ck, i, CTX_FIELD(ctx,
+				ckpt_bitmaps[i].offset, ext2fs_generic_bitmap));
+	if (ctx->inode_link_info)
+		save_icount(ck, 0, ctx->inode_link_info);
+	if (ctx->inode_count)
+		save_icount(ck, 1, ctx->inode_count);
+	if (ctx->refcount)
+		save_refcount(ck, 0, ctx->refcount);
+	if (ctx->refcount_extra)
+		save_refcount(ck, 1, ctx->refcount_extra);
+	if (ctx->dir_info)
+		save_dir_info(ctx, ck);
+#ifdef ENABLE_HTREE
+	if (ctx->dx_dir_info)
+		save_dx_dir_info(ctx, ck);
+#endif
+	if (fs->dblist)
+		save_dblist(fs, ck);
+	if (ctx->dirs_to_hash)
+		save_u32_list(ck, 0, ctx->dirs_to_hash);
+	if (ctx->encrypted_dirs)
+		save_u32_list(ck, 1, ctx->encrypted_dirs);
+	if (ctx->invalid_inode_bitmap_flag) {
+		ck_record(ck, CKPT_INVALID, ctx->invalid_bitmaps,
+			  fs->group_desc_count);
+		ck_write(ck, ctx->invalid_inode_bitmap_flag,
+			 fs->group_desc_count * sizeof(int));
+		ck_write(ck, ctx->invalid_block_bitmap_flag,
+			 fs->group_desc_count * sizeof(int));
+		ck_write(ck, ctx->invalid_inode_table_flag,
+			 fs->group_desc_count * sizeof(int));
+	}
+	for (i = 0; i < CKPT_NUM_COUNTERS; i++)
+		counters[i] = CTX_FIELD(ctx, ckpt_counters[i], __u32);
+	for (i = 0; i < MAX_EXTENT_DEPTH_COUNT; i++)
+		counters[CKPT_NUM_COUNTERS + i] = ctx->extent_depth_count[i];
+	ck_record(ck, CKPT_COUNTERS, 0,
+		  CKPT_NUM_COUNTERS + MAX_EXTENT_DEPTH_COUNT);
+	ck_write(ck, counters, sizeof(counters));
+	ck_record(ck, CKPT_END, 0, 0);
+}
+
+/*
+ * Write a checkpoint recording that the given pass has completed, or,
+ * if pass is 0, that pass 1 has finished every group before
+ * next_group.
+ */
+void e2fsck_checkpoint_save(e2fsck_t ctx, int pass, dgrp_t next_group)
+{
+	struct e2fsck_checkpoint *cp = ctx->checkpoint;
+	ext2_filsys		fs = ctx->fs;
+	struct ckpt_header	hdr;
+	struct ckpt_file	ck;
+	char			*tmp;
+
+	if (!cp || cp->disabled || (ctx->flags & E2F_FLAG_RUN_RETURN))
+		return;
+	if (ext2fs_test_changed(fs) || (fs->flags & EXT2_FLAG_DIRTY)) {
+		log_out(ctx, _("%s: the file system has been modified; "
+			       "no further checkpoints will be saved.\n"),
+			ctx->device_name);
+		/* An earlier checkpoint no longer describes the disk */
+		if (!(ctx->options & E2F_OPT_READONLY))
+			unlink(ctx->checkpoint_fn);
+		cp->disabled = 1;
+		return;
+	}
+
+	tmp = malloc(strlen(ctx->checkpoint_fn) + 5);
+	if (!tmp)
+		return;
+	sprintf(tmp, "%s.new", ctx->checkpoint_fn);
+
+	memset(&ck, 0, sizeof(ck));
+	ck.crc = ~0;
+	ck.f = fopen(tmp, "w");
+	if (!ck.f) {
+		ck.err = errno;
+		goto errout;
+	}
+	hdr = cp->start;
+	hdr.pass = pass;
+	hdr.next_group = next_group;
+	hdr.fs_valid = ext2fs_test_valid(fs);
+	ck_write(&ck, &hdr, sizeof(hdr));
+	save_state(ctx, &ck);
+	ck_write(&ck, &ck.crc, sizeof(ck.crc));
+	if (!ck.err && fflush(ck.f))
+		ck.err = errno;
+#ifdef HAVE_FSYNC
+	if (!ck.err && fsync(fileno(ck.f)))
+		ck.err = errno;
+#endif
+	if (fclose(ck.f) && !ck.err)
+		ck.err = errno;
+	if (!ck.err && rename(tmp, ctx->checkpoint_fn))
+		ck.err = errno;
+errout:
+	if (ck.err) {
+		com_err(ctx->program_name, ck.err,
+			_("while saving checkpoint %s"), ctx->checkpoint_fn);
+		unlink(tmp);
+		cp->disabled = 1;
+	}
+	free(tmp);
+}
+
+/*
+ * Restoring
+ */
+static void free_bitmap(e2fsck_t ctx, const struct ckpt_bitmap *b)
+{
+	ext2fs_generic_bitmap	*bmap;
+
+	bmap = &CTX_FIELD(ctx, b->offset, ext2fs_generic_bitmap);
+	if (*bmap) {
+		ext2fs_free_generic_bmap(*bmap);
+		*bmap = 0;
+	}
+}
+
+static errcode_t load_bitmap(e2fsck_t ctx, struct ckpt_file *ck,
+			     const struct ckpt_bitmap *b)
+{
+	ext2fs_generic_bitmap	*bmap;
+	unsigned char		buf[CKPT_CHUNK_BITS / 8];
+	__u64			start, n;
+	errcode_t		retval = 0;
+
+	bmap = &CTX_FIELD(ctx, b->offset, ext2fs_generic_bitmap);
+	if (*bmap)
+		ext2fs_clear_generic_bmap(*bmap);
+	else if (b->block)
+		retval = e2fsck_allocate_block_bitmap(ctx->fs, _(b->descr),
+				b->type, b->name, (ext2fs_block_bitmap *) bmap);
+	else
+		retval = e2fsck_allocate_inode_bitmap(ctx->fs, _(b->descr),
+				b->type, b->name, (ext2fs_inode_bitmap *) bmap);
+	if (!*bmap)
+		return retval;
+
+	while (1) {
+		if (ck_read(ck, &start, sizeof(start)) ||
+		    ck_read(ck, &n, sizeof(n)))
+			return ck->err;
+		if (n == 0)
+			return 0;
+		if (n > CKPT_CHUNK_BITS ||
+		    ck_read(ck, buf, (n + 7) / 8))
+			return ck->err ? ck->err : EXT2_ET_INVALID_ARGUMENT;
+		retval = ext2fs_set_generic_bmap_range(*bmap, start, n, buf);
+		if (retval)
+			return retval;
+	}
+}
+
+static errcode_t load_icount(e2fsck_t ctx, struct ckpt_file *ck, int which)
+{
+	ext2_icount_t	*ic, hint = 0;
+	int		flags = 0;
+	unsigned int	save_type;
+	__u32		ent[2];
+	errcode_t	retval = 0;
+
+	if (which == 0)
+		ic = &ctx->inode_link_info;
+	else {
+		ic = &ctx->inode_count;
+		flags = EXT2_ICOUNT_OPT_INCREMENT;
+		hint = ctx->inode_link_info;
+	}
+	if (*ic) {
+		ext2fs_free_icount(*ic);
+		*ic = 0;
+	}
+	e2fsck_setup_tdb_icount(ctx, flags, ic);
+	if (!*ic) {
+		e2fsck_set_bitmap_type(ctx->fs, EXT2FS_BMAP64_RBTREE,
+				       which ? "inode_count" :
+				       "inode_link_info", &save_type);
+		retval = ext2fs_create_icount2(ctx->fs, flags, 0, hint, ic);
+		ctx->fs->default_bitmap_type = save_type;
+		if (retval)
+			return retval;
+	}
+	while (ck_read(ck, ent, sizeof(ent)) == 0 && ent[0]) {
+		retval = ext2fs_icount_store(*ic, ent[0],
+					     ent[1] > 65500 ? 65500 : ent[1]);
+		for (; !retval && ent[1] > 65500; ent[1]--)
+			retval = ext2fs_icount_increment(*ic, ent[0], 0);
+		if (retval)
+			return retval;
+	}
+	return ck->err;
+}
+
+static errcode_t load_refcount(e2fsck_t ctx, struct ckpt_file *ck,
+			       int which)
+{
+	ext2_refcount_t	*refcount;
+	__u64		ent[2];
+	errcode_t	retval;
+
+	refcount = which ? &ctx->refcount_extra : &ctx->refcount;
+	if (*refcount)
+		ea_refcount_free(*refcount);
+	*refcount = 0;
+	retval = ea_refcount_create(0, refcount);
+	if (retval)
+		return retval;
+	while (ck_read(ck, ent, sizeof(ent)) == 0 && ent[0]) {
+		retval = ea_refcount_store(*refcount, ent[0], ent[1]);
+		if (retval)
+			return retval;
+	}
+	return ck->err;
+}
+
+static errcode_t load_dir_info(e2fsck_t ctx, struct ckpt_file *ck)
+{
+	struct dir_info	dir;
+
+	e2fsck_free_dir_info(ctx);
+	while (ck_read(ck, &dir, sizeof(dir)) == 0 && dir.ino) {
+		e2fsck_add_dir_info(ctx, dir.ino, dir.parent);
+		e2fsck_dir_info_set_dotdot(ctx, dir.ino, dir.dotdot);
+	}
+	return ck->err;
+}
+
+#ifdef ENABLE_HTREE
+static errcode_t load_dx_dir_info(e2fsck_t ctx, struct ckpt_file *ck)
+{
+	struct dx_dir_info	*dx_dir;
+	__u32			ent[4];
+
+	e2fsck_free_dx_dir_info(ctx);
+	while (ck_read(ck, ent, sizeof(ent)) == 0 && ent[0]) {
+		e2fsck_add_dx_dir(ctx, ent[0], ent[1]);
+		dx_dir = e2fsck_get_dx_dir_info(ctx, ent[0]);
+		if (!dx_dir)
+			return EXT2_ET_NO_MEMORY;
+		dx_dir->hashversion = ent[2];
+		dx_dir->depth = ent[3];
+		if (ck_read(ck, dx_dir->dx_block,
+			    ent[1] * sizeof(struct dx_dirblock_info)))
+			break;
+	}
+	return ck->err;
+}
+#endif
+
+static errcode_t load_dblist(ext2_filsys fs, struct ckpt_file *ck)
+{
+	struct ext2_db_entry2	db;
+	errcode_t		retval;
+
+	if (fs->dblist)
+		ext2fs_free_dblist(fs->dblist);
+	fs->dblist = 0;
+	retval = ext2fs_init_dblist(fs, 0);
+	if (retval)
+		return retval;
+	while (ck_read(ck, &db, sizeof(db)) == 0 && db.ino) {
+		retval = ext2fs_add_dir_block2(fs->dblist, db.ino, db.blk,
+					       db.blockcnt);
+		if (retval)
+			return retval;
+	}
+	return ck->err;
+}
+
+static errcode_t load_u32_list(e2fsck_t ctx, struct ckpt_file *ck,
+			       int which)
+{
+	ext2_u32_list	*list;
+	__u32		val;
+	errcode_t	retval;
+
+	list = which ? &ctx->encrypted_dirs : &ctx->dirs_to_hash;
+	if (*list)
+		ext2fs_u32_list_free(*list);
+	*list = 0;
+	retval = ext2fs_u32_list_create(list, 0);
+	if (retval)
+		return retval;
+	while (ck_read(ck, &val, sizeof(val)) == 0 && val) {
+		retval = ext2fs_u32_list_add(*list, val);
+		if (retval)
+			return retval;
+	}
+	return ck->err;
+}
+
+static errcode_t load_state(e2fsck_t ctx, struct ckpt_file *ck)
+{
+	ext2_filsys		fs = ctx->fs;
+	struct ckpt_record	rec;
+	int			seen[CKPT_NUM_BITMAPS + 8];
+	__u32			counters[CKPT_NUM_COUNTERS +
+					 MAX_EXTENT_DEPTH_COUNT];
+	unsigned int		i;
+	errcode_t		retval;
+
+	memset(seen, 0, sizeof(seen));
+	while (1) {
+		if (ck_read(ck, &rec, sizeof(rec)))
+			return ck->err;
+		switch (rec.tag) {
+		case CKPT_END:
+			goto done;
+		case CKPT_BITMAP:
+			if (rec.which >= CKPT_NUM_BITMAPS)
+				return EXT2_ET_INVALID_ARGUMENT;
+			retval = load_bitmap(ctx, ck, &ckpt_bitmaps[rec.which]);
+			seen[rec.which] = 1;
+			break;
+		case CKPT_ICOUNT:
+			retval = load_icount(ctx, ck, rec.which);
+			seen[CKPT_NUM_BITMAPS + rec.which] = 1;
+			break;
+		case CKPT_REFCOUNT:
+			retval = load_refcount(ctx, ck, rec.which);
+			seen[CKPT_NUM_BITMAPS + 2 + rec.which] = 1;
+			break;
+		case CKPT_DIR_INFO:
+			retval = load_dir_info(ctx, ck);
+			seen[CKPT_NUM_BITMAPS + 4] = 1;
+			break;
+#ifdef ENABLE_HTREE
+		case CKPT_DX_DIR_INFO:
+			retval = load_dx_dir_info(ctx, ck);
+			seen[CKPT_NUM_BITMAPS + 5] = 1;
+			break;
+#endif
+		case CKPT_DBLIST:
+			retval = load_dblist(fs, ck);
+			seen[CKPT_NUM_BITMAPS + 6] = 1;
+			break;
+		case CKPT_U32_LIST:
+			retval = load_u32_list(ctx, ck, rec.which);
+			break;
+		case CKPT_INVALID:
+			if (rec.count != fs->group_desc_count ||
+			    !ctx->invalid_inode_bitmap_flag)
+				return EXT2_ET_INVALID_ARGUMENT;
+			ctx->invalid_bitmaps = rec.which;
+			ck_read(ck, ctx->invalid_inode_bitmap_flag,
+				rec.count * sizeof(int));
+			ck_read(ck, ctx->invalid_block_bitmap_flag,
+				rec.count * sizeof(int));
+			ck_read(ck, ctx->invalid_inode_table_flag,
+				rec.count * sizeof(int));
+			retval = ck->err;
+			break;
+		case CKPT_COUNTERS:
+			if (rec.count != CKPT_NUM_COUNTERS +
+					 MAX_EXTENT_DEPTH_COUNT)
+				return EXT2_ET_INVALID_ARGUMENT;
+			if (ck_read(ck, counters, sizeof(counters)))
+				return ck->err;
+			for (i = 0; i < CKPT_NUM_COUNTERS; i++)
+				CTX_FIELD(ctx, ckpt_counters[i], __u32) =
+					counters[i];
+			for (i = 0; i < MAX_EXTENT_DEPTH_COUNT; i++)
+				ctx->extent_depth_count[i] =
+					counters[CKPT_NUM_COUNTERS + i];
+			retval = 0;
+			break;
+		default:
+			return EXT2_ET_INVALID_ARGUMENT;
+		}
+		if (retval)
+			return retval;
+	}
+done:
+	/* Whatever was not saved did not exist when it was written */
+	for (i = 0; i < CKPT_NUM_BITMAPS; i++)
+		if (!seen[i])
+			free_bitmap(ctx, &ckpt_bitmaps[i]);
+	if (!seen[CKPT_NUM_BITMAPS + 1] && ctx->inode_count) {
+		ext2fs_free_icount(ctx->inode_count);
+		ctx->inode_count = 0;
+	}
+	if (!seen[CKPT_NUM_BITMAPS + 2] && ctx->refcount) {
+		ea_refcount_free(ctx->refcount);
+		ctx->refcount = 0;
+	}
+	if (!seen[CKPT_NUM_BITMAPS + 3] && ctx->refcount_extra) {
+		ea_refcount_free(ctx->refcount_extra);
+		ctx->refcount_extra = 0;
+	}
+#ifdef ENABLE_HTREE
+	if (!seen[CKPT_NUM_BITMAPS + 5])
+		e2fsck_free_dx_dir_info(ctx);
+#endif
+	if (!seen[CKPT_NUM_BITMAPS + 6] && fs->dblist) {
+		ext2fs_free_dblist(fs->dblist);
+		fs->dblist = 0;
+	}
+	return 0;
+}
+
+/*
+ * Open the checkpoint file and check that it is intact and that it
+ * was written for the file system in its current state.  Returns the
+ * open file positioned after the header, or NULL.
+ */
+static FILE *open_checkpoint(e2fsck_t ctx, struct ckpt_header *hdr)
+{
+	struct e2fsck_checkpoint *cp = ctx->checkpoint;
+	struct ckpt_file	ck;
+	struct stat		st;
+	unsigned char		buf[8192];
+	__u32			crc;
+	size_t			left, n;
+
+	memset(&ck, 0, sizeof(ck));
+	ck.crc = ~0;
+	ck.f = fopen(ctx->checkpoint_fn, "r");
+	if (!ck.f) {
+		if (errno != ENOENT)
+			com_err(ctx->program_name, errno,
+				_("while opening checkpoint %s"),
+				ctx->checkpoint_fn);
+		return NULL;
+	}
+	if (fstat(fileno(ck.f), &st) ||
+	    st.st_size < (off_t) (sizeof(*hdr) + sizeof(crc)))
+		goto corrupt;
+	for (left = st.st_size - sizeof(crc); left; left -= n) {
+		n = left < sizeof(buf) ? left : sizeof(buf);
+		if (ck_read(&ck, buf, n))
+			goto corrupt;
+	}
+	crc = ck.crc;
+	if (fread(&n, 1, sizeof(crc), ck.f) != sizeof(crc) ||
+	    memcmp(&n, &crc, sizeof(crc)))
+		goto corrupt;
+
+	rewind(ck.f);
+	if (fread(hdr, sizeof(*hdr), 1, ck.f) != 1 ||
+	    hdr->magic != CKPT_MAGIC || hdr->version != CKPT_VERSION)
+		goto corrupt;
+	if (hdr->options != cp->start.options ||
+	    hdr->desc_csum != cp->start.desc_csum ||
+	    hdr->ext_attr_ver != cp->start.ext_attr_ver ||
+	    memcmp(&hdr->super, &cp->start.super, sizeof(hdr->super))) {
+		log_out(ctx, _("%s: checkpoint %s does not match the "
+			       "file system or the options given; "
+			       "ignoring it.\n"),
+			ctx->device_name, ctx->checkpoint_fn);
+		fclose(ck.f);
+		return NULL;
+	}
+	return ck.f;
+
+corrupt:
+	log_out(ctx, _("%s: checkpoint %s is damaged; ignoring it.\n"),
+		ctx->device_name, ctx->checkpoint_fn);
+	fclose(ck.f);
+	return NULL;
+}
+
+static void load_checkpoint(e2fsck_t ctx, FILE *f,
+			    struct ckpt_header *hdr)
+{
+	struct ckpt_file	ck;
+	errcode_t		retval;
+
+	memset(&ck, 0, sizeof(ck));
+	ck.f = f;
+	retval = load_state(ctx, &ck);
+	fclose(f);
+	if (retval) {
+		com_err(ctx->program_name, retval,
+			_("while loading checkpoint %s"), ctx->checkpoint_fn);
+		fatal_error(ctx, 0);
+	}
+	if (!hdr->fs_valid)
+		ext2fs_unmark_valid(ctx->fs);
+}
+
+/*
+ * Called when e2fsck_run() starts.  Records the state of the file
+ * system and, if we were asked to resume, restores a matching
+ * checkpoint.  Returns the number of passes that need not be run
+ * again.
+ */
+int e2fsck_checkpoint_begin(e2fsck_t ctx)
+{
+	struct e2fsck_checkpoint *cp;
+	struct ckpt_header	hdr;
+	ext2_filsys		fs = ctx->fs;
+	FILE			*f;
+
+	if (!ctx->checkpoint_fn)
+		return 0;
+	if (!ctx->checkpoint_groups)
+		ctx->checkpoint_groups = CKPT_GROUPS;
+	if (!ctx->checkpoint)
+		ctx->checkpoint = e2fsck_allocate_memory(ctx,
+					sizeof(struct e2fsck_checkpoint),
+					"checkpoint state");
+	cp = ctx->checkpoint;
+	memset(cp, 0, sizeof(*cp));
+	if (ctx->qctx) {
+		log_out(ctx, "%s", _("Checkpoints are not supported on file "
+				     "systems with quotas.\n"));
+		cp->disabled = 1;
+		return 0;
+	}
+
+	cp->start.magic = CKPT_MAGIC;
+	cp->start.version = CKPT_VERSION;
+	cp->start.options = ctx->options & CKPT_OPTIONS;
+	cp->start.desc_csum = desc_csum(fs);
+	cp->start.ext_attr_ver = ctx->ext_attr_ver;
+	cp->start.super = *fs->super;
+
+	/* Resume at most once, not again after a restart */
+	if (!(ctx->options & E2F_OPT_RESUME))
+		return 0;
+	ctx->options &= ~E2F_OPT_RESUME;
+
+	f = open_checkpoint(ctx, &hdr);
+	if (!f)
+		return 0;
+	if (hdr.pass == 0) {
+		fclose(f);
+		cp->resume = 1;
+		return 0;
+	}
+	load_checkpoint(ctx, f, &hdr);
+	log_out(ctx, _("%s: resuming from checkpoint after pass %u.\n"),
+		ctx->device_name, hdr.pass);
+	return hdr.pass;
+}
+
+/*
+ * Called by pass 1 once it has set up its own data structures.  If a
+ * checkpoint taken in the middle of pass 1 is to be resumed, load it
+ * and return the first group that still needs to be scanned.
+ */
+dgrp_t e2fsck_checkpoint_resume_pass1(e2fsck_t ctx)
+{
+	struct e2fsck_checkpoint *cp = ctx->checkpoint;
+	struct ckpt_header	hdr;
+	FILE			*f;
+
+	if (!cp || !cp->resume)
+		return 0;
+	cp->resume = 0;
+	f = open_checkpoint(ctx, &hdr);
+	if (!f)
+		return 0;
+	if (hdr.pass != 0 || hdr.next_group >= ctx->fs->group_desc_count) {
+		fclose(f);
+		return 0;
+	}
+	load_checkpoint(ctx, f, &hdr);
+	log_out(ctx, _("%s: resuming pass 1 from checkpoint at group %u.\n"),
+		ctx->device_name, hdr.next_group);
+	return hdr.next_group;
+}
+
+/*
+ * Called when all passes have completed; the checkpoint is of no
+ * further use.
+ */
+void e2fsck_checkpoint_finish(e2fsck_t ctx)
+{
+	if (ctx->checkpoint_fn && !(ctx->flags & E2F_FLAG_RUN_RETURN))
+		unlink(ctx->checkpoint_fn);
+}
@@ -189,6 +189,13 @@ void e2fsck_free_context(e2fsck_t ctx)
 	if (ctx->log_fn)
 		free(ctx->log_fn);
 
+	if (ctx->checkpoint_fn)
+		free(ctx->checkpoint_fn);
+	if (ctx->batch_fn)
+		free(ctx->batch_fn);
+	if (ctx->checkpoint)
+		ext2fs_free_mem(&ctx->checkpoint);
+
 	ext2fs_free_mem(&ctx);
 }
 
@@ -202,8 +209,6 @@ static pass_t e2fsck_passes[] = {
 	e2fsck_pass1, e2fsck_pass2, e2fsck_pass3, e2fsck_pass4,
 	e2fsck_pass5, 0 };
 
-#define E2F_FLAG_RUN_RETURN	(E2F_FLAG_SIGNAL_MASK|E2F_FLAG_RESTART)
-
 int e2fsck_run(e2fsck_t ctx)
 {
 	int	i;
@@ -217,7 +222,8 @@ int e2fsck_run(e2fsck_t ctx)
 	ctx->flags |= E2F_FLAG_SETJMP_OK;
 #endif
 
-	for (i=0; (e2fsck_pass = e2fsck_passes[i]); i++) {
+	for (i = e2fsck_checkpoint_begin(ctx);
+	     (e2fsck_pass = e2fsck_passes[i]); i++) {
 		if (ctx->flags & E2F_FLAG_RUN_RETURN)
 			break;
 		if (e2fsck_mmp_update(ctx->fs))
@@ -225,8 +231,11 @@ int e2fsck_run(e2fsck_t ctx)
 		e2fsck_pass(ctx);
 		if (ctx->progress)
 			(void) (ctx->progress)(ctx, 0, 0, 0);
+		if (e2fsck_pass == e2fsck_pass1 || e2fsck_pass == e2fsck_pass2)
+			e2fsck_checkpoint_save(ctx, i + 1, 0);
 	}
 	ctx->flags &= ~E2F_FLAG_SETJMP_OK;
+	e2fsck_checkpoint_finish(ctx);
 
 	if (ctx->flags & E2F_FLAG_RUN_RETURN)
 		return (ctx->flags & E2F_FLAG_RUN_RETURN);
@@ -167,6 +167,7 @@ struct resource_track {
 #define E2F_OPT_FRAGCHECK	0x0800
 #define E2F_OPT_JOURNAL_ONLY	0x1000 /* only replay the journal */
 #define E2F_OPT_DISCARD		0x2000
+#define E2F_OPT_RESUME		0x4000 /* resume from a checkpoint */
 
 /*
  * E2fsck flags
@@ -192,6 +193,8 @@ struct resource_track {
 
 #define E2F_RESET_FLAGS (E2F_FLAG_TIME_INSANE)
 
+#define E2F_FLAG_RUN_RETURN	(E2F_FLAG_SIGNAL_MASK|E2F_FLAG_RESTART)
+
 /*
  * Defines for indicating the e2fsck pass number
  */
@@ -321,6 +324,22 @@ struct e2fsck_struct {
 	 * Ext4 quota support
 	 */
 	quota_ctx_t qctx;
+
+	/*
+	 * Checkpoints of the pass 1 and 2 results (see checkpoint.c)
+	 */
+	char	*checkpoint_fn;
+	dgrp_t	checkpoint_groups;	/* save every N groups in pass 1 */
+	struct e2fsck_checkpoint *checkpoint;
+
+	int	problem_samples;	/* reports shown per problem code */
+	int	rehash_jobs;		/* worker processes for pass 3A */
+
+	/*
+	 * Checking a list of devices (see batch.c)
+	 */
+	char	*batch_fn;		/* file listing the devices */
+	int	batch_jobs;		/* devices checked at the same time */
 #ifdef RESOURCE_TRACK
 	/*
 	 * For timing purposes
@@ -406,6 +425,15 @@ extern int e2fsck_run(e2fsck_t ctx);
 extern void read_bad_blocks_file(e2fsck_t ctx, const char *bad_blocks_file,
 				 int replace_bad_blocks);
 
+/* batch.c */
+extern int e2fsck_batch_run(e2fsck_t ctx, char **ret_device);
+
+/* checkpoint.c */
+extern int e2fsck_checkpoint_begin(e2fsck_t ctx);
+extern dgrp_t e2fsck_checkpoint_resume_pass1(e2fsck_t ctx);
+extern void e2fsck_checkpoint_save(e2fsck_t ctx, int pass, dgrp_t next_group);
+extern void e2fsck_checkpoint_finish(e2fsck_t ctx);
+
 /* crc32.c */
 extern __u32 crc32_be(__u32 crc, unsigned char const *p, size_t len);
 
@@ -17,6 +17,7 @@
 struct buffer_head {
 	e2fsck_t	b_ctx;
 	io_channel 	b_io;
+	struct kdev_s	*b_kdev;
 	int	 	b_size;
 	unsigned long long b_blocknr;
 	int	 	b_dirty;
@@ -31,9 +32,30 @@ struct inode {
 	struct ext2_inode i_ext2;
 };
 
+struct replay_write {
+	unsigned long long	blocknr;
+	unsigned int		seq;
+	struct buffer_head	*bh;
+};
+
 struct kdev_s {
 	e2fsck_t	k_ctx;
 	int		k_dev;
+
+	/*
+	 * Batched I/O, only set up while the journal is being
+	 * recovered: dirty buffers released on the filesystem device
+	 * are queued in k_pending and written out sorted and
+	 * coalesced; reads on the journal device are served from a
+	 * readahead window of k_ra_max blocks.
+	 */
+	struct replay_write	*k_pending;
+	int			k_npending;
+	int			k_maxpending;
+	char			*k_ra_buf;
+	unsigned long long	k_ra_start;
+	int			k_ra_count;
+	int			k_ra_max;
 };
 
 #define K_DEV_FS	1
@@ -65,6 +65,16 @@ int journal_bmap(journal_t *journal, blk64_t block, unsigned long long *phys)
 #endif
 }
 
+/*
+ * While the journal is being recovered, journal blocks are read in
+ * windows of JOURNAL_RA_BYTES, and replayed filesystem blocks are
+ * queued (up to JOURNAL_REPLAY_BYTES worth) and then written out
+ * sorted by block number, with adjacent blocks merged into a single
+ * write of at most JOURNAL_RA_BYTES.
+ */
+#define JOURNAL_RA_BYTES	(1024 * 1024)
+#define JOURNAL_REPLAY_BYTES	(16 * 1024 * 1024)
+
 struct buffer_head *getblk(kdev_t kdev, blk64_t blocknr, int blocksize)
 {
 	struct buffer_head *bh;
@@ -83,6 +93,7 @@ struct buffer_head *getblk(kdev_t kdev, blk64_t blocknr, int blocksize)
 		  (unsigned long long) blocknr, blocksize, bh_count);
 
 	bh->b_ctx = kdev->k_ctx;
+	bh->b_kdev = kdev;
 	if (kdev->k_dev == K_DEV_FS)
 		bh->b_io = kdev->k_ctx->fs->io;
 	else
@@ -93,28 +104,183 @@ struct buffer_head *getblk(kdev_t kdev, blk64_t blocknr, int blocksize)
 	return bh;
 }
 
-void sync_blockdev(kdev_t kdev)
+static io_channel kdev_io(kdev_t kdev)
 {
-	io_channel	io;
-
 	if (kdev->k_dev == K_DEV_FS)
-		io = kdev->k_ctx->fs->io;
+		return kdev->k_ctx->fs->io;
+	return kdev->k_ctx->journal_io;
+}
+
+static int replay_write_cmp(const void *a, const void *b)
+{
+	const struct replay_write *wa = a, *wb = b;
+
+	if (wa->blocknr != wb->blocknr)
+		return wa->blocknr < wb->blocknr ? -1 : 1;
+	return wa->seq < wb->seq ? -1 : (wa->seq > wb->seq);
+}
+
+/*
+ * Write out the queued buffers of a device.  Only the last copy of a
+ * block queued more than once is written, since a later transaction
+ * supersedes an earlier one.
+ */
+static void flush_replay_writes(kdev_t kdev)
+{
+	struct replay_write	*w = kdev->k_pending;
+	int			n = kdev->k_npending;
+	io_channel		io = kdev_io(kdev);
+	int			blocksize = kdev->k_ctx->fs->blocksize;
+	int			max_run = JOURNAL_RA_BYTES / blocksize;
+	char			*buf = NULL;
+	errcode_t		retval;
+	int			i, j, count;
+
+	if (n == 0)
+		return;
+	qsort(w, n, sizeof(struct replay_write), replay_write_cmp);
+	if (max_run > 1 &&
+	    io_channel_alloc_buf(io, max_run, &buf))
+		buf = NULL;
+
+	for (i = 0; i < n; i = j) {
+		count = 0;
+		for (j = i; j < n; j++) {
+			if (j + 1 < n && w[j + 1].blocknr == w[j].blocknr)
+				continue;
+			if (count &&
+			    (w[j].blocknr != w[i].blocknr + count ||
+			     count >= max_run || !buf))
+				break;
+			if (count == 0)
+				w[i].blocknr = w[j].blocknr;
+			if (buf)
+				memcpy(buf + count * blocksize,
+				       w[j].bh->b_data, blocksize);
+			else
+				memcpy(w[i].bh->b_data, w[j].bh->b_data,
+				       blocksize);
+			count++;
+		}
+		jfs_debug(3, "writing blocks %llu-%llu\n", w[i].blocknr,
+			  w[i].blocknr + count - 1);
+		retval = io_channel_write_blk64(io, w[i].blocknr, count,
+						buf ? buf : w[i].bh->b_data);
+		if (retval)
+			com_err(kdev->k_ctx->device_name, retval,
+				"while writing blocks %llu-%llu\n",
+				w[i].blocknr, w[i].blocknr + count - 1);
+	}
+
+	for (i = 0; i < n; i++) {
+		jfs_debug(3, "freeing block %llu/%p (total %d)\n",
+			  w[i].bh->b_blocknr, (void *) w[i].bh, --bh_count);
+		ext2fs_free_mem(&w[i].bh);
+	}
+	if (buf)
+		ext2fs_free_mem(&buf);
+	kdev->k_npending = 0;
+}
+
+static void queue_replay_write(struct buffer_head *bh)
+{
+	kdev_t kdev = bh->b_kdev;
+	struct replay_write *w;
+
+	if (kdev->k_npending >= kdev->k_maxpending)
+		flush_replay_writes(kdev);
+	w = &kdev->k_pending[kdev->k_npending];
+	w->blocknr = bh->b_blocknr;
+	w->seq = kdev->k_npending++;
+	w->bh = bh;
+}
+
+/*
+ * Serve a read from the readahead window of the journal device,
+ * refilling the window if the block is not in it.  Returns 0 if the
+ * caller has to read the block itself.
+ */
+static int readahead_block(struct buffer_head *bh)
+{
+	kdev_t		kdev = bh->b_kdev;
+	int		blocksize = kdev->k_ctx->fs->blocksize;
+
+	if (!kdev->k_ra_buf)
+		return 0;
+	if (bh->b_blocknr < kdev->k_ra_start ||
+	    bh->b_blocknr >= kdev->k_ra_start + kdev->k_ra_count) {
+		kdev->k_ra_count = 0;
+		if (io_channel_read_blk64(bh->b_io, bh->b_blocknr,
+					  kdev->k_ra_max, kdev->k_ra_buf))
+			return 0;
+		kdev->k_ra_start = bh->b_blocknr;
+		kdev->k_ra_count = kdev->k_ra_max;
+	}
+	memcpy(bh->b_data, kdev->k_ra_buf +
+	       (bh->b_blocknr - kdev->k_ra_start) * blocksize, blocksize);
+	return 1;
+}
+
+static void start_replay_io(journal_t *journal)
+{
+	kdev_t		dev_fs = journal->j_fs_dev;
+	kdev_t		dev_journal = journal->j_dev;
+	e2fsck_t	ctx = dev_fs->k_ctx;
+	int		blocksize = ctx->fs->blocksize;
+
+	if (ext2fs_get_array(JOURNAL_REPLAY_BYTES / blocksize,
+			     sizeof(struct replay_write),
+			     &dev_fs->k_pending) == 0)
+		dev_fs->k_maxpending = JOURNAL_REPLAY_BYTES / blocksize;
 	else
-		io = kdev->k_ctx->journal_io;
+		dev_fs->k_pending = NULL;
+
+	dev_journal->k_ra_max = JOURNAL_RA_BYTES / blocksize;
+	if (dev_journal->k_ra_max < 2 ||
+	    io_channel_alloc_buf(ctx->journal_io, dev_journal->k_ra_max,
+				 &dev_journal->k_ra_buf))
+		dev_journal->k_ra_buf = NULL;
+	dev_journal->k_ra_count = 0;
+}
+
+static void finish_replay_io(journal_t *journal)
+{
+	kdev_t		dev_fs = journal->j_fs_dev;
+	kdev_t		dev_journal = journal->j_dev;
+
+	if (dev_fs->k_pending) {
+		flush_replay_writes(dev_fs);
+		ext2fs_free_mem(&dev_fs->k_pending);
+		dev_fs->k_maxpending = 0;
+	}
+	if (dev_journal->k_ra_buf)
+		ext2fs_free_mem(&dev_journal->k_ra_buf);
+	dev_journal->k_ra_count = 0;
+}
 
-	io_channel_flush(io);
+void sync_blockdev(kdev_t kdev)
+{
+	if (kdev->k_pending)
+		flush_replay_writes(kdev);
+	io_channel_flush(kdev_io(kdev));
 }
 
 void ll_rw_block(int rw, int nr, struct buffer_head *bhp[])
 {
 	errcode_t retval;
 	struct buffer_head *bh;
+	kdev_t kdev;
 
 	for (; nr > 0; --nr) {
 		bh = *bhp++;
+		kdev = bh->b_kdev;
 		if (rw == READ && !bh->b_uptodate) {
 			jfs_debug(3, "reading block %llu/%p\n",
 				  bh->b_blocknr, (void *) bh);
+			if (readahead_block(bh)) {
+				bh->b_uptodate = 1;
+				continue;
+			}
 			retval = io_channel_read_blk64(bh->b_io,
 						     bh->b_blocknr,
 						     1, bh->b_data);
@@ -130,6 +296,10 @@ void ll_rw_block(int rw, int nr, struct buffer_head *bhp[])
 			jfs_debug(3, "writing block %llu/%p\n",
 				  bh->b_blocknr,
 				  (void *) bh);
+			if (bh->b_blocknr >= kdev->k_ra_start &&
+			    bh->b_blocknr < kdev->k_ra_start +
+					    kdev->k_ra_count)
+				kdev->k_ra_count = 0;
 			retval = io_channel_write_blk64(bh->b_io,
 						      bh->b_blocknr,
 						      1, bh->b_data);
@@ -162,6 +332,10 @@ static void mark_buffer_clean(struct buffer_head * bh)
 
 void brelse(struct buffer_head *bh)
 {
+	if (bh->b_dirty && bh->b_kdev->k_pending) {
+		queue_replay_write(bh);
+		return;
+	}
 	if (bh->b_dirty)
 		ll_rw_block(WRITE, 1, &bh);
 	jfs_debug(3, "freeing block %llu/%p (total %d)\n",
@@ -832,6 +1006,19 @@ no_has_journal:
 	return retval;
 }
 
+/*
+ * Size the revoke hash to the journal: roughly one bucket for every
+ * eight journal blocks, rounded up to a power of two.
+ */
+static int revoke_hash_size(journal_t *journal)
+{
+	int size = 256;
+
+	while (size < (1 << 18) && size < (int) (journal->j_maxlen / 8))
+		size <<= 1;
+	return size;
+}
+
 static errcode_t recover_ext3_journal(e2fsck_t ctx)
 {
 	struct problem_context	pctx;
@@ -849,11 +1036,13 @@ static errcode_t recover_ext3_journal(e2fsck_t ctx)
 	if (retval)
 		goto errout;
 
-	retval = journal_init_revoke(journal, 1024);
+	retval = journal_init_revoke(journal, revoke_hash_size(journal));
 	if (retval)
 		goto errout;
 
+	start_replay_io(journal);
 	retval = -journal_recover(journal);
+	finish_replay_io(journal);
 	if (retval)
 		goto errout;
 
@@ -914,6 +1103,7 @@ errcode_t e2fsck_run_ext3_journal(e2fsck_t ctx)
 	}
 	ctx->fs->priv_data = ctx;
 	ctx->fs->now = ctx->now;
+	ext2fs_init_pathname_cache(ctx->fs, 0);
 	ctx->fs->flags |= EXT2_FLAG_MASTER_SB_ONLY;
 	ctx->fs->super->s_kbytes_written += kbytes_written;
 
@@ -545,6 +545,51 @@ void e2fsck_setup_tdb_icount(e2fsck_t ctx, int flags,
 		*ret = 0;
 }
 
+/*
+ * Fetch the next inode pass 1 needs to look at.  Inodes are taken
+ * from the scan a batch at a time, and unused inodes which pass 1
+ * would not act on are skipped without being copied out.
+ */
+static errcode_t next_inode(e2fsck_t ctx, ext2_inode_scan scan,
+			    struct ext2_inode_batch *batch, int *idx,
+			    int busted_fs_time, ext2_ino_t *ino,
+			    struct ext2_inode *inode, int inode_size)
+{
+	ext2_filsys fs = ctx->fs;
+	const struct ext2_inode *di;
+	errcode_t	retval;
+
+	while (1) {
+		if (*idx >= batch->count) {
+			*idx = 0;
+			retval = ext2fs_get_next_inode_batch(scan, batch);
+			if (retval)
+				return retval;
+			if (batch->count == 0) {
+				*ino = 0;
+				return 0;
+			}
+		}
+		*ino = batch->first_ino + *idx;
+		di = EXT2_BATCH_INODE(batch, *idx);
+		(*idx)++;
+		if (*ino % (fs->super->s_inodes_per_group * 4) == 1) {
+			if (e2fsck_mmp_update(fs))
+				fatal_error(ctx, 0);
+		}
+		if (batch->flags & EXT2_IB_BAD_BLOCK)
+			return EXT2_ET_BAD_BLOCK_IN_INODE_TABLE;
+		/* See the dtime checks in e2fsck_pass1() */
+		if (*ino >= EXT2_FIRST_INODE(fs->super) &&
+		    !di->i_links_count && (di->i_dtime || !di->i_mode) &&
+		    (!di->i_dtime || busted_fs_time ||
+		     di->i_dtime >= fs->super->s_inodes_count))
+			continue;
+		memcpy(inode, di, inode_size);
+		return 0;
+	}
+}
+
 void e2fsck_pass1(e2fsck_t ctx)
 {
 	int	i;
@@ -566,6 +611,9 @@ void e2fsck_pass1(e2fsck_t ctx)
 	int		imagic_fs, extent_fs;
 	int		busted_fs_time = 0;
 	int		inode_size;
+	dgrp_t		resume_group;
+	struct ext2_inode_batch batch;
+	int		batch_idx = 0;
 
 	init_resource_track(&rtrack, ctx->fs->io);
 	clear_problem_context(&pctx);
@@ -726,14 +774,23 @@ void e2fsck_pass1(e2fsck_t ctx)
 		ext2fs_mark_block_bitmap2(ctx->block_found_map,
 					  fs->super->s_mmp_block);
 
-	while (1) {
-		if (ino % (fs->super->s_inodes_per_group * 4) == 1) {
-			if (e2fsck_mmp_update(fs))
-				fatal_error(ctx, 0);
+	resume_group = e2fsck_checkpoint_resume_pass1(ctx);
+	if (resume_group) {
+		pctx.errcode = ext2fs_inode_scan_goto_blockgroup(scan,
+							 resume_group);
+		if (pctx.errcode) {
+			fix_problem(ctx, PR_1_ISCAN_ERROR, &pctx);
+			ctx->flags |= E2F_FLAG_ABORT;
+			goto endit;
 		}
+	}
+
+	memset(&batch, 0, sizeof(batch));
+	while (1) {
 		old_op = ehandler_operation(_("getting next inode from scan"));
-		pctx.errcode = ext2fs_get_next_inode_full(scan, &ino,
-							  inode, inode_size);
+		pctx.errcode = next_inode(ctx, scan, &batch, &batch_idx,
+					  busted_fs_time, &ino, inode,
+					  inode_size);
 		ehandler_operation(old_op);
 		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
 			return;
@@ -1262,6 +1319,11 @@ static errcode_t scan_callback(ext2_filsys fs,
 
 	process_inodes((e2fsck_t) fs->priv_data, scan_struct->block_buf);
 
+	if (ctx->checkpoint_groups &&
+	    ((group + 1) % ctx->checkpoint_groups) == 0 &&
+	    group + 1 < fs->group_desc_count)
+		e2fsck_checkpoint_save(ctx, 0, group + 1);
+
 	if (ctx->progress)
 		if ((ctx->progress)(ctx, 1, group+1,
 				    ctx->fs->group_desc_count))
@@ -1995,6 +2057,7 @@ static void check_blocks_extents(e2fsck_t ctx, struct problem_context *pctx,
 		pctx->errcode = 0;
 		return;
 	}
+	ext2fs_extent_set_prefetch(ehandle, 1);
 
 	retval = ext2fs_extent_get_info(ehandle, &info);
 	if (retval == 0) {
@@ -17,13 +17,15 @@
  *
  * Then, pass3 interates over all directory inodes; for each directory
  * it attempts to trace up the filesystem tree, using dirinfo.parent
- * until it reaches a directory which has been marked "done".  If it
- * can not do so, then the directory must be disconnected, and e2fsck
- * will offer to reconnect it to /lost+found.  While it is chasing
- * parent pointers up the filesystem tree, if pass3 sees a directory
- * twice, then it has detected a filesystem loop, and it will again
- * offer to reconnect the directory to /lost+found in to break the
- * filesystem loop.
+ * until it reaches a directory whose connectivity is already known.
+ * If it can not reach the root, then the directory must be
+ * disconnected, and e2fsck will offer to reconnect the top of its
+ * chain to /lost+found.  While it is chasing parent pointers up the
+ * filesystem tree, if pass3 sees a directory twice, then it has
+ * detected a filesystem loop, and it will again offer to reconnect
+ * the directory to /lost+found in to break the filesystem loop.
+ * Every directory records the result of the walk which first reached
+ * it, so each one is only visited once.
  *
  * Pass 3 also contains the subroutine, e2fsck_reconnect_file() to
  * reconnect inodes to /lost+found; this subroutine is also used by
@@ -32,6 +34,7 @@
  *
  * Pass 3 frees the following data structures:
  *     	- The dirinfo directory information cache.
+ *     	- The directory connectivity array.
  */
 
 #ifdef HAVE_ERRNO_H
@@ -42,22 +45,35 @@
 #include "problem.h"
 
 static void check_root(e2fsck_t ctx);
-static int check_directory(e2fsck_t ctx, ext2_ino_t ino,
+static int check_directory(e2fsck_t ctx, ext2_ino_t i,
 			   struct problem_context *pctx);
 static void fix_dotdot(e2fsck_t ctx, ext2_ino_t ino, ext2_ino_t parent);
+static void setup_dir_conn(e2fsck_t ctx, struct dir_info_iter *iter,
+			   ext2_ino_t maxdirs);
 
-static ext2fs_inode_bitmap inode_loop_detect = 0;
-static ext2fs_inode_bitmap inode_done_map = 0;
+/*
+ * A snapshot of the dirinfo parent pointers, sorted by inode number.
+ * Entries refer to each other by index + 1, so that 0 means "none".
+ */
+struct dir_conn {
+	ext2_ino_t	ino;
+	ext2_ino_t	parent;
+	ext2_ino_t	parent_idx;	/* entry of the parent */
+	ext2_ino_t	walk;		/* entry the visiting walk began at */
+	ext2_ino_t	top;		/* entry to reconnect; 0 if connected */
+};
+
+static struct dir_conn *dir_conn = 0;
+static ext2_ino_t dir_conn_count = 0;
 
 void e2fsck_pass3(e2fsck_t ctx)
 {
-	ext2_filsys fs = ctx->fs;
 	struct dir_info_iter *iter = NULL;
 #ifdef RESOURCE_TRACK
 	struct resource_track	rtrack;
 #endif
 	struct problem_context	pctx;
-	struct dir_info	*dir;
+	ext2_ino_t	i;
 	unsigned long maxdirs, count;
 
 	init_resource_track(&rtrack, ctx->fs->io);
@@ -70,26 +86,12 @@ void e2fsck_pass3(e2fsck_t ctx)
 	if (!(ctx->options & E2F_OPT_PREEN))
 		fix_problem(ctx, PR_3_PASS_HEADER, &pctx);
 
-	/*
-	 * Allocate some bitmaps to do loop detection.
-	 */
-	pctx.errcode = e2fsck_allocate_inode_bitmap(fs, _("inode done bitmap"),
-					EXT2FS_BMAP64_AUTODIR,
-					"inode_done_map", &inode_done_map);
-	if (pctx.errcode) {
-		pctx.num = 2;
-		fix_problem(ctx, PR_3_ALLOCATE_IBITMAP_ERROR, &pctx);
-		ctx->flags |= E2F_FLAG_ABORT;
-		goto abort_exit;
-	}
 	print_resource_track(ctx, _("Peak memory"), &ctx->global_rtrack, NULL);
 
 	check_root(ctx);
 	if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
 		goto abort_exit;
 
-	ext2fs_mark_inode_bitmap2(inode_done_map, EXT2_ROOT_INO);
-
 	maxdirs = e2fsck_get_num_dirinfo(ctx);
 	count = 1;
 
@@ -97,14 +99,26 @@ void e2fsck_pass3(e2fsck_t ctx)
 		if ((ctx->progress)(ctx, 3, 0, maxdirs))
 			goto abort_exit;
 
+	/*
+	 * Take a snapshot of the parent pointers.  Directories added
+	 * from here on (/lost+found) are connected by construction.
+	 */
+	dir_conn = e2fsck_allocate_memory(ctx, maxdirs *
+					  sizeof(struct dir_conn),
+					  "directory connectivity array");
 	iter = e2fsck_dir_info_iter_begin(ctx);
-	while ((dir = e2fsck_dir_info_iter(ctx, iter)) != 0) {
+	setup_dir_conn(ctx, iter, maxdirs);
+	e2fsck_dir_info_iter_end(ctx, iter);
+	iter = NULL;
+
+	for (i = 0; i < dir_conn_count; i++) {
 		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
 			goto abort_exit;
 		if (ctx->progress && (ctx->progress)(ctx, 3, count++, maxdirs))
 			goto abort_exit;
-		if (ext2fs_test_inode_bitmap2(ctx->inode_dir_map, dir->ino))
-			if (check_directory(ctx, dir->ino, &pctx))
+		if (ext2fs_test_inode_bitmap2(ctx->inode_dir_map,
+					      dir_conn[i].ino))
+			if (check_directory(ctx, i, &pctx))
 				goto abort_exit;
 	}
 
@@ -124,13 +138,9 @@ abort_exit:
 	if (iter)
 		e2fsck_dir_info_iter_end(ctx, iter);
 	e2fsck_free_dir_info(ctx);
-	if (inode_loop_detect) {
-		ext2fs_free_inode_bitmap(inode_loop_detect);
-		inode_loop_detect = 0;
-	}
-	if (inode_done_map) {
-		ext2fs_free_inode_bitmap(inode_done_map);
-		inode_done_map = 0;
+	if (dir_conn) {
+		ext2fs_free_mem(&dir_conn);
+		dir_conn_count = 0;
 	}
 
 	print_resource_track(ctx, _("Pass 3"), &rtrack, ctx->fs->io);
@@ -242,93 +252,166 @@ static void check_root(e2fsck_t ctx)
 	ext2fs_mark_ib_dirty(fs);
 }
 
+static int dir_conn_cmp(const void *a, const void *b)
+{
+	const struct dir_conn *da = (const struct dir_conn *) a;
+	const struct dir_conn *db = (const struct dir_conn *) b;
+
+	if (da->ino < db->ino)
+		return -1;
+	return da->ino > db->ino;
+}
+
 /*
- * This subroutine is responsible for making sure that a particular
- * directory is connected to the root; if it isn't we trace it up as
- * far as we can go, and then offer to connect the resulting parent to
- * the lost+found.  We have to do loop detection; if we ever discover
- * a loop, we treat that as a disconnected directory and offer to
- * reparent it to lost+found.
- *
- * However, loop detection is expensive, because for very large
- * filesystems, the inode_loop_detect bitmap is huge, and clearing it
- * is non-trivial.  Loops in filesystems are also a rare error case,
- * and we shouldn't optimize for error cases.  So we try two passes of
- * the algorithm.  The first time, we ignore loop detection and merely
- * increment a counter; if the counter exceeds some extreme threshold,
- * then we try again with the loop detection bitmap enabled.
+ * Returns the entry (index + 1) for a directory, or 0 if there is none
  */
-static int check_directory(e2fsck_t ctx, ext2_ino_t dir,
-			   struct problem_context *pctx)
+static ext2_ino_t dir_conn_lookup(ext2_ino_t ino)
 {
-	ext2_filsys 	fs = ctx->fs;
-	ext2_ino_t	ino = dir, parent;
-	int		loop_pass = 0, parent_count = 0;
+	ext2_ino_t	low = 0, high = dir_conn_count, mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (dir_conn[mid].ino == ino)
+			return mid + 1;
+		if (dir_conn[mid].ino < ino)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return 0;
+}
+
+static void setup_dir_conn(e2fsck_t ctx, struct dir_info_iter *iter,
+			   ext2_ino_t maxdirs)
+{
+	struct dir_info	*dir;
+	ext2_ino_t	i;
+	int		sorted = 1;
+
+	dir_conn_count = 0;
+	while (dir_conn_count < maxdirs &&
+	       (dir = e2fsck_dir_info_iter(ctx, iter)) != 0) {
+		if (dir_conn_count &&
+		    dir->ino < dir_conn[dir_conn_count - 1].ino)
+			sorted = 0;
+		dir_conn[dir_conn_count].ino = dir->ino;
+		dir_conn[dir_conn_count].parent = dir->parent;
+		dir_conn_count++;
+	}
+	/* The tdb backend returns the directories in hash order */
+	if (!sorted)
+		qsort(dir_conn, dir_conn_count, sizeof(struct dir_conn),
+		      dir_conn_cmp);
+	for (i = 0; i < dir_conn_count; i++)
+		if (dir_conn[i].parent)
+			dir_conn[i].parent_idx =
+				dir_conn_lookup(dir_conn[i].parent);
+}
+
+/*
+ * Trace the parent chain up from entry i until it reaches the root,
+ * a directory an earlier walk already classified, a directory without
+ * a parent, or a directory this walk has already seen (a loop).  All
+ * of the directories on the way share the result: either connected,
+ * or the entry which has to be reconnected to lost+found.
+ */
+static ext2_ino_t find_chain_top(e2fsck_t ctx, ext2_ino_t i,
+				 struct problem_context *pctx)
+{
+	struct dir_conn	*dc;
+	ext2_ino_t	j = i, k, top;
 
 	while (1) {
-		/*
-		 * Mark this inode as being "done"; by the time we
-		 * return from this function, the inode we either be
-		 * verified as being connected to the directory tree,
-		 * or we will have offered to reconnect this to
-		 * lost+found.
-		 *
-		 * If it was marked done already, then we've reached a
-		 * parent we've already checked.
-		 */
-	  	if (ext2fs_mark_inode_bitmap2(inode_done_map, ino))
+		dc = &dir_conn[j];
+		dc->walk = i + 1;
+		if (dc->ino == EXT2_ROOT_INO) {
+			top = 0;
 			break;
-
-		if (e2fsck_dir_info_get_parent(ctx, ino, &parent)) {
+		}
+		if (!dc->parent) {
+			top = j + 1;
+			break;
+		}
+		k = dc->parent_idx;
+		if (!k) {
+			pctx->ino = dc->parent;
 			fix_problem(ctx, PR_3_NO_DIRINFO, pctx);
-			return 0;
+			top = 0;
+			break;
 		}
-
-		/*
-		 * If this directory doesn't have a parent, or we've
-		 * seen the parent once already, then offer to
-		 * reparent it to lost+found
-		 */
-		if (!parent ||
-		    (loop_pass &&
-		     (ext2fs_test_inode_bitmap2(inode_loop_detect,
-					       parent)))) {
-			pctx->ino = ino;
-			if (fix_problem(ctx, PR_3_UNCONNECTED_DIR, pctx)) {
-				if (e2fsck_reconnect_file(ctx, pctx->ino))
-					ext2fs_unmark_valid(fs);
-				else {
-					fix_dotdot(ctx, pctx->ino,
-						   ctx->lost_and_found);
-					parent = ctx->lost_and_found;
-				}
-			}
+		if (dir_conn[k - 1].walk == i + 1) {
+			top = j + 1;
+			break;
+		}
+		if (dir_conn[k - 1].walk) {
+			top = dir_conn[k - 1].top;
 			break;
 		}
-		ino = parent;
-		if (loop_pass) {
-			ext2fs_mark_inode_bitmap2(inode_loop_detect, ino);
-		} else if (parent_count++ > 2048) {
-			/*
-			 * If we've run into a path depth that's
-			 * greater than 2048, try again with the inode
-			 * loop bitmap turned on and start from the
-			 * top.
-			 */
-			loop_pass = 1;
-			if (inode_loop_detect)
-				ext2fs_clear_inode_bitmap(inode_loop_detect);
+		j = k - 1;
+	}
+
+	for (k = i; k != j; k = dir_conn[k].parent_idx - 1)
+		dir_conn[k].top = top;
+	dir_conn[j].top = top;
+	return top;
+}
+
+/*
+ * A directory which closed a loop has been moved to lost+found;
+ * remove its entry in the old parent, which would otherwise leave
+ * the directory with two names.
+ */
+static void break_dir_loop(e2fsck_t ctx, ext2_ino_t parent, ext2_ino_t ino)
+{
+	struct problem_context pctx;
+
+	clear_problem_context(&pctx);
+	pctx.ino = ino;
+	pctx.errcode = ext2fs_unlink(ctx->fs, parent, 0, ino, 0);
+	if (pctx.errcode) {
+		fix_problem(ctx, PR_3_FIX_PARENT_ERR, &pctx);
+		ext2fs_unmark_valid(ctx->fs);
+		return;
+	}
+	e2fsck_adjust_inode_count(ctx, ino, -1);
+}
+
+/*
+ * This subroutine is responsible for making sure that a particular
+ * directory is connected to the root; if it isn't we offer to connect
+ * the top of its parent chain to lost+found.  If the chain ends in a
+ * loop, we treat that as a disconnected directory and offer to
+ * reparent the directory which closes the loop, dropping its entry in
+ * the directory it used to hang from.
+ *
+ * Each chain top is only offered once; after that every directory
+ * beneath it counts as connected, whatever the answer was.
+ */
+static int check_directory(e2fsck_t ctx, ext2_ino_t i,
+			   struct problem_context *pctx)
+{
+	ext2_filsys 	fs = ctx->fs;
+	ext2_ino_t	dir = dir_conn[i].ino, top;
+
+	if (dir_conn[i].walk)
+		top = dir_conn[i].top;
+	else
+		top = find_chain_top(ctx, i, pctx);
+
+	if (top && dir_conn[top - 1].top) {
+		dir_conn[top - 1].top = 0;
+		pctx->ino = dir_conn[top - 1].ino;
+		if (fix_problem(ctx, PR_3_UNCONNECTED_DIR, pctx)) {
+			if (e2fsck_reconnect_file(ctx, pctx->ino))
+				ext2fs_unmark_valid(fs);
 			else {
-				pctx->errcode = e2fsck_allocate_inode_bitmap(fs, _("inode loop detection bitmap"), EXT2FS_BMAP64_AUTODIR, "inode_loop_detect", &inode_loop_detect);
-				if (pctx->errcode) {
-					pctx->num = 1;
-					fix_problem(ctx,
-				    PR_3_ALLOCATE_IBITMAP_ERROR, pctx);
-					ctx->flags |= E2F_FLAG_ABORT;
-					return -1;
-				}
+				fix_dotdot(ctx, pctx->ino,
+					   ctx->lost_and_found);
+				if (dir_conn[top - 1].parent)
+					break_dir_loop(ctx,
+						       dir_conn[top - 1].parent,
+						       pctx->ino);
 			}
-			ino = dir;
 		}
 	}
 
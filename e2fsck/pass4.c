@@ -87,6 +87,33 @@ static int disconnect_inode(e2fsck_t ctx, ext2_ino_t i,
 }
 
 
+/*
+ * Walks an icount in inode order alongside the pass 4 loop, so the
+ * link counts come from one pass over each icount rather than a
+ * lookup per inode.  next is the first inode with a non-zero count
+ * at or after the last inode asked for (0 if there is none).
+ */
+struct icount_cursor {
+	ext2_icount_t	icount;
+	ext2_ino_t	next;
+	__u32		count;
+	int		valid;
+};
+
+static __u16 cursor_fetch(struct icount_cursor *c, ext2_ino_t ino)
+{
+	if (!c->valid || (c->next && c->next < ino)) {
+		c->next = ino - 1;
+		if (ext2fs_icount_next(c->icount, &c->next, &c->count))
+			c->next = 0;
+		c->valid = 1;
+	}
+	if (c->next != ino)
+		return 0;
+	/* Same clamping as ext2fs_icount_fetch() */
+	return c->count > 65500 ? 65500 : c->count;
+}
+
 void e2fsck_pass4(e2fsck_t ctx)
 {
 	ext2_filsys fs = ctx->fs;
@@ -99,6 +126,7 @@ void e2fsck_pass4(e2fsck_t ctx)
 	__u16	link_count, link_counted;
 	char	*buf = 0;
 	dgrp_t	group, maxgroup;
+	struct icount_cursor	link_info, counted;
 
 	init_resource_track(&rtrack, ctx->fs->io);
 
@@ -120,14 +148,26 @@ void e2fsck_pass4(e2fsck_t ctx)
 	inode = e2fsck_allocate_memory(ctx, EXT2_INODE_SIZE(fs->super),
 				       "scratch inode");
 
-	/* Protect loop from wrap-around if s_inodes_count maxed */
-	for (i=1; i <= fs->super->s_inodes_count && i > 0; i++) {
+	memset(&link_info, 0, sizeof(link_info));
+	link_info.icount = ctx->inode_link_info;
+	memset(&counted, 0, sizeof(counted));
+	counted.icount = ctx->inode_count;
+
+	/*
+	 * Only visit the inodes pass 1 found in use; uninitialized
+	 * groups and the unused tail of each inode table are never
+	 * marked, so the bitmap search skips over them.
+	 */
+	for (i = 0; i < fs->super->s_inodes_count; ) {
 		int isdir;
 
+		if (ext2fs_find_first_set_inode_bitmap2(ctx->inode_used_map,
+					i + 1, fs->super->s_inodes_count, &i))
+			break;
 		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
 			goto errout;
-		if ((i % fs->super->s_inodes_per_group) == 0) {
-			group++;
+		if (i / fs->super->s_inodes_per_group != group) {
+			group = i / fs->super->s_inodes_per_group;
 			if (ctx->progress)
 				if ((ctx->progress)(ctx, 4, group, maxgroup))
 					goto errout;
@@ -135,15 +175,19 @@ void e2fsck_pass4(e2fsck_t ctx)
 		if (i == EXT2_BAD_INO ||
 		    (i > EXT2_ROOT_INO && i < EXT2_FIRST_INODE(fs->super)))
 			continue;
-		if (!(ext2fs_test_inode_bitmap2(ctx->inode_used_map, i)) ||
-		    (ctx->inode_imagic_map &&
+		if ((ctx->inode_imagic_map &&
 		     ext2fs_test_inode_bitmap2(ctx->inode_imagic_map, i)) ||
 		    (ctx->inode_bb_map &&
 		     ext2fs_test_inode_bitmap2(ctx->inode_bb_map, i)))
 			continue;
-		ext2fs_icount_fetch(ctx->inode_link_info, i, &link_count);
-		ext2fs_icount_fetch(ctx->inode_count, i, &link_counted);
+		link_count = cursor_fetch(&link_info, i);
+		link_counted = cursor_fetch(&counted, i);
 		if (link_counted == 0) {
+			/*
+			 * Reconnecting may change the counts of other
+			 * inodes (lost+found), so restart both walks.
+			 */
+			link_info.valid = counted.valid = 0;
 			if (!buf)
 				buf = e2fsck_allocate_memory(ctx,
 				     fs->blocksize, "bad_inode buffer");
@@ -181,6 +225,9 @@ void e2fsck_pass4(e2fsck_t ctx)
 			}
 		}
 	}
+	if (ctx->progress && group < maxgroup)
+		if ((ctx->progress)(ctx, 4, maxgroup, maxgroup))
+			goto errout;
 	ext2fs_free_icount(ctx->inode_link_info); ctx->inode_link_info = 0;
 	ext2fs_free_icount(ctx->inode_count); ctx->inode_count = 0;
 	ext2fs_free_inode_bitmap(ctx->inode_bb_map);
@@ -1742,26 +1742,41 @@ static struct latch_descr pr_latch_info[] = {
 	{ -1, 0, 0 },
 };
 
+/*
+ * The problem table is kept sorted by problem code (tst_problem checks
+ * this at build time), so we can binary search it rather than walking
+ * all of it for every problem reported.
+ */
 static struct e2fsck_problem *find_problem(problem_t code)
 {
-	int	i;
-
-	for (i=0; problem_table[i].e2p_code; i++) {
-		if (problem_table[i].e2p_code == code)
-			return &problem_table[i];
+	int	low, high, mid;
+
+	low = 0;
+	high = (sizeof(problem_table) / sizeof(problem_table[0])) - 2;
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (problem_table[mid].e2p_code == code)
+			return &problem_table[mid];
+		if (problem_table[mid].e2p_code < code)
+			low = mid + 1;
+		else
+			high = mid - 1;
 	}
 	return 0;
 }
 
+/*
+ * The latch table is indexed directly by PR_LATCH().
+ */
 static struct latch_descr *find_latch(int code)
 {
-	int	i;
+	int	i, nlatch;
 
-	for (i=0; pr_latch_info[i].latch_code >= 0; i++) {
-		if (pr_latch_info[i].latch_code == code)
-			return &pr_latch_info[i];
-	}
-	return 0;
+	nlatch = (sizeof(pr_latch_info) / sizeof(pr_latch_info[0])) - 1;
+	i = PR_LATCH(code);
+	if (i < 0 || i >= nlatch || pr_latch_info[i].latch_code != code)
+		return 0;
+	return &pr_latch_info[i];
 }
 
 int end_problem_latch(e2fsck_t ctx, int mask)
@@ -1822,6 +1837,51 @@ static void reconfigure_bool(e2fsck_t ctx, struct e2fsck_problem *ptr,
 		ptr->flags &= ~mask;
 }
 
+/*
+ * Apply the [problems] and [options] settings from e2fsck.conf to a
+ * problem table entry.
+ */
+static void configure_problem(e2fsck_t ctx, struct e2fsck_problem *ptr)
+{
+	char	key[9], *new_desc = NULL;
+
+	sprintf(key, "0x%06x", ptr->e2p_code);
+
+	profile_get_string(ctx->profile, "problems", key,
+			   "description", 0, &new_desc);
+	if (new_desc)
+		ptr->e2p_description = new_desc;
+
+	reconfigure_bool(ctx, ptr, key, PR_PREEN_OK, "preen_ok");
+	reconfigure_bool(ctx, ptr, key, PR_NO_OK, "no_ok");
+	reconfigure_bool(ctx, ptr, key, PR_NO_DEFAULT, "no_default");
+	reconfigure_bool(ctx, ptr, key, PR_MSG_ONLY, "print_message_only");
+	reconfigure_bool(ctx, ptr, key, PR_PREEN_NOMSG, "preen_nomessage");
+	reconfigure_bool(ctx, ptr, key, PR_NOCOLLATE, "no_collate");
+	reconfigure_bool(ctx, ptr, key, PR_NO_NOMSG, "no_nomsg");
+	reconfigure_bool(ctx, ptr, key, PR_PREEN_NOHDR, "preen_noheader");
+	reconfigure_bool(ctx, ptr, key, PR_FORCE_NO, "force_no");
+	profile_get_integer(ctx->profile, "options",
+			    "max_count_problems", 0, 0,
+			    &ptr->max_count);
+	profile_get_integer(ctx->profile, "problems", key, "max_count",
+			    ptr->max_count, &ptr->max_count);
+
+	ptr->flags |= PR_CONFIG;
+}
+
+/*
+ * Configure the whole problem table up front, so that processes forked
+ * later on (see batch.c) start with it already set up.
+ */
+void e2fsck_configure_problems(e2fsck_t ctx)
+{
+	struct e2fsck_problem *ptr;
+
+	for (ptr = problem_table; ptr->e2p_code; ptr++)
+		if (!(ptr->flags & PR_CONFIG))
+			configure_problem(ctx, ptr);
+}
 
 int fix_problem(e2fsck_t ctx, problem_t code, struct problem_context *pctx)
 {
@@ -1832,39 +1892,15 @@ int fix_problem(e2fsck_t ctx, problem_t code, struct problem_context *pctx)
 	int		def_yn, answer, ans;
 	int		print_answer = 0;
 	int		suppress = 0;
+	int		aggregate = 0;
 
 	ptr = find_problem(code);
 	if (!ptr) {
 		printf(_("Unhandled error code (0x%x)!\n"), code);
 		return 0;
 	}
-	if (!(ptr->flags & PR_CONFIG)) {
-		char	key[9], *new_desc = NULL;
-
-		sprintf(key, "0x%06x", code);
-
-		profile_get_string(ctx->profile, "problems", key,
-				   "description", 0, &new_desc);
-		if (new_desc)
-			ptr->e2p_description = new_desc;
-
-		reconfigure_bool(ctx, ptr, key, PR_PREEN_OK, "preen_ok");
-		reconfigure_bool(ctx, ptr, key, PR_NO_OK, "no_ok");
-		reconfigure_bool(ctx, ptr, key, PR_NO_DEFAULT, "no_default");
-		reconfigure_bool(ctx, ptr, key, PR_MSG_ONLY, "print_message_only");
-		reconfigure_bool(ctx, ptr, key, PR_PREEN_NOMSG, "preen_nomessage");
-		reconfigure_bool(ctx, ptr, key, PR_NOCOLLATE, "no_collate");
-		reconfigure_bool(ctx, ptr, key, PR_NO_NOMSG, "no_nomsg");
-		reconfigure_bool(ctx, ptr, key, PR_PREEN_NOHDR, "preen_noheader");
-		reconfigure_bool(ctx, ptr, key, PR_FORCE_NO, "force_no");
-		profile_get_integer(ctx->profile, "options",
-				    "max_count_problems", 0, 0,
-				    &ptr->max_count);
-		profile_get_integer(ctx->profile, "problems", key, "max_count",
-				    ptr->max_count, &ptr->max_count);
-
-		ptr->flags |= PR_CONFIG;
-	}
+	if (!(ptr->flags & PR_CONFIG))
+		configure_problem(ctx, ptr);
 	def_yn = 1;
 	ptr->count++;
 	if ((ptr->flags & PR_NO_DEFAULT) ||
@@ -1895,6 +1931,23 @@ int fix_problem(e2fsck_t ctx, problem_t code, struct problem_context *pctx)
 	if ((ptr->flags & PR_NO_NOMSG) &&
 	    ((ctx->options & E2F_OPT_NO) || (ptr->flags & PR_FORCE_NO)))
 		suppress++;
+	/*
+	 * In problem summary mode, once a problem has been reported
+	 * problem_samples times, further instances whose answer doesn't
+	 * need the user are only counted, and listed at the end of the
+	 * run by e2fsck_problem_summary().
+	 */
+	if (ctx->problem_samples && (ptr->count > ctx->problem_samples) &&
+	    !(ptr->flags & PR_FATAL) &&
+	    ((ctx->options & (E2F_OPT_NO | E2F_OPT_YES)) ||
+	     ((ctx->options & E2F_OPT_PREEN) && (ptr->flags & PR_PREEN_OK)) ||
+	     ((ptr->flags & PR_LATCH_MASK) &&
+	      (ldesc->flags & (PRL_YES | PRL_NO))) ||
+	     (ptr->prompt == PROMPT_NONE))) {
+		aggregate = 1;
+		suppress++;
+		ptr->aggregated++;
+	}
 	if (ptr->max_count && (ptr->count > ptr->max_count)) {
 		if (ctx->options & (E2F_OPT_NO | E2F_OPT_YES))
 			suppress++;
@@ -1922,7 +1975,7 @@ int fix_problem(e2fsck_t ctx, problem_t code, struct problem_context *pctx)
 		if (*message)
 			print_e2fsck_message(stdout, ctx, message, pctx, 1, 0);
 	}
-	if (ctx->logf && message)
+	if (ctx->logf && message && !aggregate)
 		print_e2fsck_message(ctx->logf, ctx, message, pctx, 1, 0);
 	if (!(ptr->flags & PR_PREEN_OK) && (ptr->prompt != PROMPT_NONE))
 		preenhalt(ctx);
@@ -1950,6 +2003,14 @@ int fix_problem(e2fsck_t ctx, problem_t code, struct problem_context *pctx)
 				answer = 1;
 			else
 				answer = 0;
+		} else if (aggregate) {
+			/* Counted for the summary: answer silently */
+			if (ctx->options & E2F_OPT_YES)
+				answer = 1;
+			else if (ctx->options & E2F_OPT_NO)
+				answer = 0;
+			else
+				answer = def_yn;
 		} else
 			answer = ask(ctx, (ptr->prompt == PROMPT_NULL) ? "" :
 				     _(prompt[(int) ptr->prompt]), def_yn);
@@ -1961,7 +2022,7 @@ int fix_problem(e2fsck_t ctx, problem_t code, struct problem_context *pctx)
 				printf("%s.\n", answer ?
 				       _(preen_msg[(int) ptr->prompt]) :
 				       _("IGNORED"));
-			if (ctx->logf)
+			if (ctx->logf && !aggregate)
 				fprintf(ctx->logf, "%s.\n", answer ?
 					_(preen_msg[(int) ptr->prompt]) :
 					_("IGNORED"));
@@ -1977,6 +2038,30 @@ int fix_problem(e2fsck_t ctx, problem_t code, struct problem_context *pctx)
 	return answer;
 }
 
+/*
+ * Print the number of instances of each problem which were counted
+ * but not shown because of the problem_summary option.
+ */
+void e2fsck_problem_summary(e2fsck_t ctx)
+{
+	struct e2fsck_problem *ptr;
+	int	header = 0;
+
+	if (!ctx->problem_samples)
+		return;
+	for (ptr = problem_table; ptr->e2p_code; ptr++) {
+		if (!ptr->aggregated)
+			continue;
+		if (!header) {
+			log_out(ctx, "%s", _("\nProblem summary:\n"
+				"    Code     Reported  Not shown\n"));
+			header = 1;
+		}
+		log_out(ctx, "  0x%06x %10d %10d\n", ptr->e2p_code,
+			ptr->count, ptr->aggregated);
+	}
+}
+
 #ifdef UNITTEST
 
 #include <stdlib.h>
@@ -2026,10 +2111,15 @@ int ask (e2fsck_t ctx, const char * string, int def)
 	return 0;
 }
 
+void log_out(e2fsck_t ctx, const char *fmt, ...)
+{
+	return;
+}
+
 int verify_problem_table(e2fsck_t ctx)
 {
 	struct e2fsck_problem *curr, *prev = NULL;
-	int rc = 0;
+	int i, rc = 0;
 
 	for (prev = NULL, curr = problem_table; curr->e2p_code; prev = curr++) {
 		if (prev == NULL)
@@ -2054,6 +2144,23 @@ int verify_problem_table(e2fsck_t ctx)
 		rc = 1;
 	}
 
+	for (curr = problem_table; curr->e2p_code; curr++) {
+		if (find_problem(curr->e2p_code) == curr)
+			continue;
+		fprintf(stderr, "*** Lookup of problem code 0x%08x failed\n",
+			curr->e2p_code);
+		rc = 1;
+	}
+
+	for (i = 0; pr_latch_info[i].latch_code >= 0; i++) {
+		if (find_latch(pr_latch_info[i].latch_code) ==
+		    &pr_latch_info[i])
+			continue;
+		fprintf(stderr, "*** Latch 0x%04x is out of order\n",
+			pr_latch_info[i].latch_code);
+		rc = 1;
+	}
+
 	return rc;
 }
 
@@ -1049,6 +1049,8 @@ int end_problem_latch(e2fsck_t ctx, int mask);
 int set_latch_flags(int mask, int setflags, int clearflags);
 int get_latch_flags(int mask, int *value);
 void clear_problem_context(struct problem_context *pctx);
+void e2fsck_problem_summary(e2fsck_t ctx);
+void e2fsck_configure_problems(e2fsck_t ctx);
 
 /* message.c */
 void print_e2fsck_message(FILE *f, e2fsck_t ctx, const char *msg,
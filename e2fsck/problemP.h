@@ -17,6 +17,7 @@ struct e2fsck_problem {
 	problem_t	second_code;
 	int		count;
 	int		max_count;
+	int		aggregated;
 };
 
 struct latch_descr {
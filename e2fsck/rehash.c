@@ -48,6 +48,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "e2fsck.h"
 #include "problem.h"
 
@@ -63,18 +66,35 @@ struct fill_dir_struct {
 	ino_t parent;
 };
 
+/*
+ * The sort records are kept fixed-width and small; the names stay
+ * where they were read, and are found by their offset into fd->buf.
+ */
 struct hash_entry {
 	ext2_dirhash_t	hash;
 	ext2_dirhash_t	minor_hash;
-	ino_t		ino;
-	struct ext2_dir_entry	*dir;
+	__u32		offset;
+	ext2_ino_t	ino;
 };
 
+#define ENT_DIRENT(buf, ent) \
+	((struct ext2_dir_entry *) ((buf) + (ent)->offset))
+
+/*
+ * The new directory.  Only the root and interior nodes are kept in
+ * buf; each leaf block is recorded as the index of its first entry,
+ * and is built from the sorted entries when it is written.  If fd is
+ * NULL, buf holds every block of the directory.
+ */
 struct out_dir {
 	int		num;
 	int		max;
 	char		*buf;
 	ext2_dirhash_t	*hashes;
+	int		*first;
+	int		leaves, max_leaves;
+	unsigned int	slack;
+	struct fill_dir_struct *fd;
 };
 
 static int fill_dir_block(ext2_filsys fs,
@@ -89,7 +109,6 @@ static int fill_dir_block(ext2_filsys fs,
 	struct ext2_dir_entry 	*dirent;
 	char			*dir;
 	unsigned int		offset, dir_offset, rec_len;
-	int			hash_alg;
 
 	if (blockcnt < 0)
 		return 0;
@@ -109,10 +128,6 @@ static int fill_dir_block(ext2_filsys fs,
 		if (fd->err)
 			return BLOCK_ABORT;
 	}
-	hash_alg = fs->super->s_def_hash_version;
-	if ((hash_alg <= EXT2_HASH_TEA) &&
-	    (fs->super->s_flags & EXT2_FLAGS_UNSIGNED_HASH))
-		hash_alg += 3;
 	/* While the directory block is "hot", index it. */
 	dir_offset = 0;
 	while (dir_offset < fs->blocksize) {
@@ -138,86 +153,199 @@ static int fill_dir_block(ext2_filsys fs,
 		}
 		if (fd->num_array >= fd->max_array) {
 			new_array = realloc(fd->harray,
-			    sizeof(struct hash_entry) * (fd->max_array+500));
+			    sizeof(struct hash_entry) * fd->max_array * 2);
 			if (!new_array) {
 				fd->err = ENOMEM;
 				return BLOCK_ABORT;
 			}
 			fd->harray = new_array;
-			fd->max_array += 500;
+			fd->max_array *= 2;
 		}
 		ent = fd->harray + fd->num_array++;
-		ent->dir = dirent;
+		ent->offset = (char *) dirent - fd->buf;
 		fd->dir_size += EXT2_DIR_REC_LEN(dirent->name_len & 0xFF);
 		ent->ino = dirent->inode;
-		if (fd->compress)
-			ent->hash = ent->minor_hash = 0;
-		else {
-			fd->err = ext2fs_dirhash(hash_alg, dirent->name,
-						 dirent->name_len & 0xFF,
-						 fs->super->s_hash_seed,
-						 &ent->hash, &ent->minor_hash);
-			if (fd->err)
-				return BLOCK_ABORT;
-		}
+		ent->hash = ent->minor_hash = 0;
 	}
 
 	return 0;
 }
 
-/* Used for sorting the hash entry */
-static EXT2_QSORT_TYPE ino_cmp(const void *a, const void *b)
+/*
+ * Hash all of the names read by fill_dir_block() in one batch.
+ */
+static errcode_t hash_dir_entries(ext2_filsys fs, struct fill_dir_struct *fd)
 {
-	const struct hash_entry *he_a = (const struct hash_entry *) a;
-	const struct hash_entry *he_b = (const struct hash_entry *) b;
+	struct ext2_dir_entry	*dirent;
+	const char		**names;
+	int			*lens;
+	ext2_dirhash_t		*hashes, *minor_hashes;
+	errcode_t		retval;
+	int			i, n = fd->num_array, hash_alg;
 
-	return (he_a->ino - he_b->ino);
+	hash_alg = fs->super->s_def_hash_version;
+	if ((hash_alg <= EXT2_HASH_TEA) &&
+	    (fs->super->s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+		hash_alg += 3;
+
+	names = malloc(n * sizeof(char *) + n * sizeof(int) +
+		       2 * n * sizeof(ext2_dirhash_t) + 1);
+	if (!names)
+		return ENOMEM;
+	lens = (int *) (names + n);
+	hashes = (ext2_dirhash_t *) (lens + n);
+	minor_hashes = hashes + n;
+	for (i = 0; i < n; i++) {
+		dirent = ENT_DIRENT(fd->buf, fd->harray + i);
+		names[i] = dirent->name;
+		lens[i] = dirent->name_len & 0xFF;
+	}
+	retval = ext2fs_dirhash_batch(hash_alg, names, lens, n,
+				      fs->super->s_hash_seed,
+				      hashes, minor_hashes);
+	for (i = 0; !retval && i < n; i++) {
+		fd->harray[i].hash = hashes[i];
+		fd->harray[i].minor_hash = minor_hashes[i];
+	}
+	free(names);
+	return retval;
 }
 
 /* Used for sorting the hash entry */
-static EXT2_QSORT_TYPE name_cmp(const void *a, const void *b)
+static int name_cmp(const char *buf, const struct hash_entry *he_a,
+		    const struct hash_entry *he_b)
 {
-	const struct hash_entry *he_a = (const struct hash_entry *) a;
-	const struct hash_entry *he_b = (const struct hash_entry *) b;
+	struct ext2_dir_entry	*a = ENT_DIRENT(buf, he_a);
+	struct ext2_dir_entry	*b = ENT_DIRENT(buf, he_b);
 	int	ret;
 	int	min_len;
 
-	min_len = he_a->dir->name_len;
-	if (min_len > he_b->dir->name_len)
-		min_len = he_b->dir->name_len;
+	min_len = a->name_len;
+	if (min_len > b->name_len)
+		min_len = b->name_len;
 
-	ret = strncmp(he_a->dir->name, he_b->dir->name, min_len);
+	ret = strncmp(a->name, b->name, min_len);
 	if (ret == 0) {
-		if (he_a->dir->name_len > he_b->dir->name_len)
+		if (a->name_len > b->name_len)
 			ret = 1;
-		else if (he_a->dir->name_len < he_b->dir->name_len)
+		else if (a->name_len < b->name_len)
 			ret = -1;
 		else
-			ret = he_b->dir->inode - he_a->dir->inode;
+			ret = b->inode - a->inode;
 	}
 	return ret;
 }
 
-/* Used for sorting the hash entry */
-static EXT2_QSORT_TYPE hash_cmp(const void *a, const void *b)
+/*
+ * Sort a run of entries with the same hash by name.  The runs are
+ * nearly always short, but all of a non-indexed directory is one run,
+ * so fall back to a merge sort for the long ones.
+ */
+static void sort_name_run(const char *buf, struct hash_entry *ent,
+			  struct hash_entry *tmp, int n)
 {
-	const struct hash_entry *he_a = (const struct hash_entry *) a;
-	const struct hash_entry *he_b = (const struct hash_entry *) b;
-	int	ret;
-
-	if (he_a->hash > he_b->hash)
-		ret = 1;
-	else if (he_a->hash < he_b->hash)
-		ret = -1;
-	else {
-		if (he_a->minor_hash > he_b->minor_hash)
-			ret = 1;
-		else if (he_a->minor_hash < he_b->minor_hash)
-			ret = -1;
+	struct hash_entry	t;
+	int			i, j, k, mid;
+
+	if (n <= 8) {
+		for (i = 1; i < n; i++) {
+			t = ent[i];
+			for (j = i; j > 0 && name_cmp(buf, &ent[j-1], &t) > 0;
+			     j--)
+				ent[j] = ent[j-1];
+			ent[j] = t;
+		}
+		return;
+	}
+	mid = n / 2;
+	sort_name_run(buf, ent, tmp, mid);
+	sort_name_run(buf, ent + mid, tmp, n - mid);
+	if (name_cmp(buf, &ent[mid-1], &ent[mid]) <= 0)
+		return;
+	memcpy(tmp, ent, mid * sizeof(struct hash_entry));
+	for (i = 0, j = mid, k = 0; i < mid; k++) {
+		if (j < n && name_cmp(buf, &ent[j], &tmp[i]) < 0)
+			ent[k] = ent[j++];
 		else
-			ret = name_cmp(a, b);
+			ent[k] = tmp[i++];
 	}
-	return ret;
+}
+
+static __u64 ent_key(const struct hash_entry *ent, int by_ino)
+{
+	if (by_ino)
+		return ent->ino;
+	return ((__u64) ent->hash << 32) | ent->minor_hash;
+}
+
+/*
+ * Sort the entries by (hash, minor_hash), or by inode number, with a
+ * least significant digit radix sort.  A byte which is the same in
+ * every key doesn't need a pass.
+ */
+static void radix_sort(struct hash_entry *ent, struct hash_entry *tmp,
+		       int n, int by_ino)
+{
+	unsigned int		count[8][256], pos[256], sum;
+	struct hash_entry	*src = ent, *dst = tmp, *swap;
+	__u64			key;
+	int			i, d, shift;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++) {
+		key = ent_key(ent + i, by_ino);
+		for (d = 0; d < 8; d++)
+			count[d][(key >> (d * 8)) & 0xFF]++;
+	}
+	for (d = 0; d < 8; d++) {
+		shift = d * 8;
+		if (count[d][(ent_key(src, by_ino) >> shift) & 0xFF] ==
+		    (unsigned int) n)
+			continue;
+		for (i = 0, sum = 0; i < 256; i++) {
+			pos[i] = sum;
+			sum += count[d][i];
+		}
+		for (i = 0; i < n; i++)
+			dst[pos[(ent_key(src + i, by_ino) >> shift) & 0xFF]++] =
+				src[i];
+		swap = src; src = dst; dst = swap;
+	}
+	if (src != ent)
+		memcpy(ent, src, n * sizeof(struct hash_entry));
+}
+
+static errcode_t sort_entries(struct fill_dir_struct *fd, int by_ino)
+{
+	struct hash_entry	*ent = fd->harray, *tmp;
+	int			i, j, n = fd->num_array;
+
+	if (fd->compress) {
+		/* Leave "." and ".." where they are */
+		ent += 2;
+		n -= 2;
+	}
+	if (n < 2)
+		return 0;
+	tmp = malloc(n * sizeof(struct hash_entry));
+	if (!tmp)
+		return ENOMEM;
+	radix_sort(ent, tmp, n, by_ino);
+	for (i = 0; !by_ino && i < n; i = j) {
+		for (j = i + 1; j < n; j++)
+			if (ent[j].hash != ent[i].hash ||
+			    ent[j].minor_hash != ent[i].minor_hash)
+				break;
+		if (j - i > 1)
+			sort_name_run(fd->buf, ent + i, tmp, j - i);
+	}
+	free(tmp);
+	return 0;
+}
+
+static errcode_t sort_dir(struct fill_dir_struct *fd)
+{
+	return sort_entries(fd, 0);
 }
 
 static errcode_t alloc_size_dir(ext2_filsys fs, struct out_dir *outdir,
@@ -225,21 +353,10 @@ static errcode_t alloc_size_dir(ext2_filsys fs, struct out_dir *outdir,
 {
 	void			*new_mem;
 
-	if (outdir->max) {
-		new_mem = realloc(outdir->buf, blocks * fs->blocksize);
-		if (!new_mem)
-			return ENOMEM;
-		outdir->buf = new_mem;
-		new_mem = realloc(outdir->hashes,
-				  blocks * sizeof(ext2_dirhash_t));
-		if (!new_mem)
-			return ENOMEM;
-		outdir->hashes = new_mem;
-	} else {
-		outdir->buf = malloc(blocks * fs->blocksize);
-		outdir->hashes = malloc(blocks * sizeof(ext2_dirhash_t));
-		outdir->num = 0;
-	}
+	new_mem = realloc(outdir->buf, blocks * fs->blocksize);
+	if (!new_mem)
+		return ENOMEM;
+	outdir->buf = new_mem;
 	outdir->max = blocks;
 	return 0;
 }
@@ -248,21 +365,52 @@ static void free_out_dir(struct out_dir *outdir)
 {
 	free(outdir->buf);
 	free(outdir->hashes);
-	outdir->max = 0;
-	outdir->num =0;
+	free(outdir->first);
+	memset(outdir, 0, sizeof(struct out_dir));
+}
+
+/*
+ * Add a leaf block to the new directory, starting with entry first.
+ */
+static errcode_t add_leaf_block(struct out_dir *outdir, int first)
+{
+	void			*new_mem;
+	int			max;
+
+	if (outdir->num >= outdir->max_leaves) {
+		max = outdir->max_leaves ? outdir->max_leaves * 2 : 16;
+		new_mem = realloc(outdir->hashes,
+				  max * sizeof(ext2_dirhash_t));
+		if (!new_mem)
+			return ENOMEM;
+		outdir->hashes = new_mem;
+		new_mem = realloc(outdir->first, max * sizeof(int));
+		if (!new_mem)
+			return ENOMEM;
+		outdir->first = new_mem;
+		outdir->max_leaves = max;
+	}
+	outdir->hashes[outdir->num] = 0;
+	outdir->first[outdir->num++] = first;
+	return 0;
 }
 
+/*
+ * Add an interior node after the leaf blocks.
+ */
 static errcode_t get_next_block(ext2_filsys fs, struct out_dir *outdir,
 			 char ** ret)
 {
 	errcode_t	retval;
+	int		slot = outdir->num - outdir->leaves + 1;
 
-	if (outdir->num >= outdir->max) {
-		retval = alloc_size_dir(fs, outdir, outdir->max + 50);
+	if (slot >= outdir->max) {
+		retval = alloc_size_dir(fs, outdir, outdir->max * 2);
 		if (retval)
 			return retval;
 	}
-	*ret = outdir->buf + (outdir->num++ * fs->blocksize);
+	outdir->num++;
+	*ret = outdir->buf + (slot * fs->blocksize);
 	memset(*ret, 0, fs->blocksize);
 	return 0;
 }
@@ -332,7 +480,7 @@ static int duplicate_search_and_fix(e2fsck_t ctx, ext2_filsys fs,
 				    struct fill_dir_struct *fd)
 {
 	struct problem_context	pctx;
-	struct hash_entry 	*ent, *prev;
+	struct ext2_dir_entry	*dirent, *prev, *other;
 	int			i, j;
 	int			fixed = 0;
 	char			new_name[256];
@@ -348,31 +496,29 @@ static int duplicate_search_and_fix(e2fsck_t ctx, ext2_filsys fs,
 		hash_alg += 3;
 
 	for (i=1; i < fd->num_array; i++) {
-		ent = fd->harray + i;
-		prev = ent - 1;
-		if (!ent->dir->inode ||
-		    ((ent->dir->name_len & 0xFF) !=
-		     (prev->dir->name_len & 0xFF)) ||
-		    (strncmp(ent->dir->name, prev->dir->name,
-			     ent->dir->name_len & 0xFF)))
+		dirent = ENT_DIRENT(fd->buf, fd->harray + i);
+		prev = ENT_DIRENT(fd->buf, fd->harray + i - 1);
+		if (!dirent->inode ||
+		    ((dirent->name_len & 0xFF) != (prev->name_len & 0xFF)) ||
+		    (strncmp(dirent->name, prev->name,
+			     dirent->name_len & 0xFF)))
 			continue;
-		pctx.dirent = ent->dir;
-		if ((ent->dir->inode == prev->dir->inode) &&
+		pctx.dirent = dirent;
+		if ((dirent->inode == prev->inode) &&
 		    fix_problem(ctx, PR_2_DUPLICATE_DIRENT, &pctx)) {
-			e2fsck_adjust_inode_count(ctx, ent->dir->inode, -1);
-			ent->dir->inode = 0;
+			e2fsck_adjust_inode_count(ctx, dirent->inode, -1);
+			dirent->inode = 0;
 			fixed++;
 			continue;
 		}
-		memcpy(new_name, ent->dir->name, ent->dir->name_len & 0xFF);
-		new_len = ent->dir->name_len;
+		memcpy(new_name, dirent->name, dirent->name_len & 0xFF);
+		new_len = dirent->name_len;
 		mutate_name(new_name, &new_len);
 		for (j=0; j < fd->num_array; j++) {
+			other = ENT_DIRENT(fd->buf, fd->harray + j);
 			if ((i==j) ||
-			    ((new_len & 0xFF) !=
-			     (fd->harray[j].dir->name_len & 0xFF)) ||
-			    (strncmp(new_name, fd->harray[j].dir->name,
-				     new_len & 0xFF)))
+			    ((new_len & 0xFF) != (other->name_len & 0xFF)) ||
+			    (strncmp(new_name, other->name, new_len & 0xFF)))
 				continue;
 			mutate_name(new_name, &new_len);
 
@@ -381,12 +527,13 @@ static int duplicate_search_and_fix(e2fsck_t ctx, ext2_filsys fs,
 		new_name[new_len & 0xFF] = 0;
 		pctx.str = new_name;
 		if (fix_problem(ctx, PR_2_NON_UNIQUE_FILE, &pctx)) {
-			memcpy(ent->dir->name, new_name, new_len & 0xFF);
-			ent->dir->name_len = new_len;
-			ext2fs_dirhash(hash_alg, ent->dir->name,
-				       ent->dir->name_len & 0xFF,
+			memcpy(dirent->name, new_name, new_len & 0xFF);
+			dirent->name_len = new_len;
+			ext2fs_dirhash(hash_alg, dirent->name,
+				       dirent->name_len & 0xFF,
 				       fs->super->s_hash_seed,
-				       &ent->hash, &ent->minor_hash);
+				       &fd->harray[i].hash,
+				       &fd->harray[i].minor_hash);
 			fixed++;
 		}
 	}
@@ -394,16 +541,19 @@ static int duplicate_search_and_fix(e2fsck_t ctx, ext2_filsys fs,
 }
 
 
-static errcode_t copy_dir_entries(e2fsck_t ctx,
-				  struct fill_dir_struct *fd,
-				  struct out_dir *outdir)
+/*
+ * Decide which entries go in which leaf block, without copying them
+ * yet; build_leaf_block() must lay them out the same way.
+ */
+static errcode_t plan_dir_blocks(e2fsck_t ctx,
+				 struct fill_dir_struct *fd,
+				 struct out_dir *outdir)
 {
 	ext2_filsys 		fs = ctx->fs;
 	errcode_t		retval;
-	char			*block_start;
 	struct hash_entry 	*ent;
 	struct ext2_dir_entry	*dirent;
-	unsigned int		rec_len, prev_rec_len, left, slack, offset;
+	unsigned int		rec_len, left, slack, offset;
 	int			i;
 	ext2_dirhash_t		prev_hash;
 
@@ -416,73 +566,119 @@ static errcode_t copy_dir_entries(e2fsck_t ctx,
 			ctx->htree_slack_percentage = 20;
 	}
 
-	outdir->max = 0;
-	retval = alloc_size_dir(fs, outdir,
-				(fd->dir_size / fs->blocksize) + 2);
+	outdir->fd = fd;
+	outdir->num = 0;
+	/* The root node, or the first leaf of a non-indexed directory */
+	retval = alloc_size_dir(fs, outdir, 4);
 	if (retval)
 		return retval;
-	outdir->num = fd->compress ? 0 : 1;
-	offset = 0;
-	outdir->hashes[0] = 0;
+	memset(outdir->buf, 0, fs->blocksize);
+	if (!fd->compress && (retval = add_leaf_block(outdir, 0)))
+		return retval;
 	prev_hash = 1;
-	if ((retval = get_next_block(fs, outdir, &block_start)))
+	if ((retval = add_leaf_block(outdir, 0)))
 		return retval;
-	dirent = (struct ext2_dir_entry *) block_start;
-	prev_rec_len = 0;
-	rec_len = 0;
+	offset = 0;
 	left = fs->blocksize;
 	slack = fd->compress ? 12 :
 		(fs->blocksize * ctx->htree_slack_percentage)/100;
 	if (slack < 12)
 		slack = 12;
+	outdir->slack = slack;
 	for (i = 0; i < fd->num_array; i++) {
 		ent = fd->harray + i;
-		if (ent->dir->inode == 0)
+		dirent = ENT_DIRENT(fd->buf, ent);
+		if (dirent->inode == 0)
 			continue;
-		rec_len = EXT2_DIR_REC_LEN(ent->dir->name_len & 0xFF);
+		rec_len = EXT2_DIR_REC_LEN(dirent->name_len & 0xFF);
 		if (rec_len > left) {
-			if (left) {
-				left += prev_rec_len;
-				retval = ext2fs_set_rec_len(fs, left, dirent);
-				if (retval)
-					return retval;
-			}
-			if ((retval = get_next_block(fs, outdir,
-						      &block_start)))
+			if ((retval = add_leaf_block(outdir, i)))
 				return retval;
 			offset = 0;
 		}
 		left = fs->blocksize - offset;
-		dirent = (struct ext2_dir_entry *) (block_start + offset);
 		if (offset == 0) {
 			if (ent->hash == prev_hash)
 				outdir->hashes[outdir->num-1] = ent->hash | 1;
 			else
 				outdir->hashes[outdir->num-1] = ent->hash;
 		}
-		dirent->inode = ent->dir->inode;
-		dirent->name_len = ent->dir->name_len;
-		retval = ext2fs_set_rec_len(fs, rec_len, dirent);
-		if (retval)
-			return retval;
-		prev_rec_len = rec_len;
-		memcpy(dirent->name, ent->dir->name, dirent->name_len & 0xFF);
 		offset += rec_len;
 		left -= rec_len;
 		if (left < slack) {
-			prev_rec_len += left;
-			retval = ext2fs_set_rec_len(fs, prev_rec_len, dirent);
-			if (retval)
-				return retval;
 			offset += left;
 			left = 0;
 		}
 		prev_hash = ent->hash;
 	}
+	outdir->leaves = outdir->num;
+	return 0;
+}
+
+/*
+ * Copy the entries planned for leaf block blk into buf.
+ */
+static errcode_t build_leaf_block(ext2_filsys fs, struct out_dir *outdir,
+				  int blk, char *buf)
+{
+	struct fill_dir_struct	*fd = outdir->fd;
+	struct ext2_dir_entry	*src, *dirent = 0;
+	unsigned int		rec_len = 0, left, offset = 0;
+	errcode_t		retval;
+	int			i, end;
+
+	end = (blk + 1 < outdir->leaves) ? outdir->first[blk + 1] :
+		fd->num_array;
+	memset(buf, 0, fs->blocksize);
+	left = fs->blocksize;
+	for (i = outdir->first[blk]; i < end; i++) {
+		src = ENT_DIRENT(fd->buf, fd->harray + i);
+		if (src->inode == 0)
+			continue;
+		rec_len = EXT2_DIR_REC_LEN(src->name_len & 0xFF);
+		dirent = (struct ext2_dir_entry *) (buf + offset);
+		dirent->inode = src->inode;
+		dirent->name_len = src->name_len;
+		memcpy(dirent->name, src->name, src->name_len & 0xFF);
+		offset += rec_len;
+		left -= rec_len;
+		if (left < outdir->slack) {
+			rec_len += left;
+			offset += left;
+			left = 0;
+		}
+		retval = ext2fs_set_rec_len(fs, rec_len, dirent);
+		if (retval)
+			return retval;
+	}
+	if (!dirent) {
+		dirent = (struct ext2_dir_entry *) buf;
+		rec_len = 0;
+	}
 	if (left)
-		retval = ext2fs_set_rec_len(fs, rec_len + left, dirent);
+		return ext2fs_set_rec_len(fs, rec_len + left, dirent);
+	return 0;
+}
 
-	return retval;
+/*
+ * Return block blk of the new directory, building it in buf if it is
+ * a leaf.
+ */
+static errcode_t get_dir_block(ext2_filsys fs, struct out_dir *outdir,
+			       int blk, char *buf, char **ret)
+{
+	if (!outdir->fd)
+		*ret = outdir->buf + (blk * fs->blocksize);
+	else if (blk == 0 && !outdir->fd->compress)
+		*ret = outdir->buf;
+	else if (blk >= outdir->leaves)
+		*ret = outdir->buf +
+			((blk - outdir->leaves + 1) * fs->blocksize);
+	else {
+		*ret = buf;
+		return build_leaf_block(fs, outdir, blk, buf);
+	}
+	return 0;
 }
 
 
@@ -626,6 +822,7 @@ struct write_dir_struct {
 	errcode_t	err;
 	e2fsck_t	ctx;
 	blk64_t		cleared;
+	char		*buf;
 };
 
 /*
@@ -664,7 +861,9 @@ static int write_dir_block(ext2_filsys fs,
 	if (blockcnt < 0)
 		return 0;
 
-	dir = wd->outdir->buf + (blockcnt * fs->blocksize);
+	wd->err = get_dir_block(fs, wd->outdir, blockcnt, wd->buf, &dir);
+	if (wd->err)
+		return BLOCK_ABORT;
 	wd->err = ext2fs_write_dir_block3(fs, *block_nr, dir, 0);
 	if (wd->err)
 		return BLOCK_ABORT;
@@ -687,9 +886,13 @@ static errcode_t write_directory(e2fsck_t ctx, ext2_filsys fs,
 	wd.err = 0;
 	wd.ctx = ctx;
 	wd.cleared = 0;
+	retval = ext2fs_get_mem(fs->blocksize, &wd.buf);
+	if (retval)
+		return retval;
 
 	retval = ext2fs_block_iterate3(fs, ino, 0, 0,
 				       write_dir_block, &wd);
+	ext2fs_free_mem(&wd.buf);
 	if (retval)
 		return retval;
 	if (wd.err)
@@ -707,122 +910,387 @@ static errcode_t write_directory(e2fsck_t ctx, ext2_filsys fs,
 	return 0;
 }
 
-errcode_t e2fsck_rehash_dir(e2fsck_t ctx, ext2_ino_t ino)
+/*
+ * Read the whole directory into memory, index its entries and sort
+ * them by hash.  The caller frees fd->buf and fd->harray.
+ */
+static errcode_t read_dir(e2fsck_t ctx, ext2_ino_t ino,
+			  struct ext2_inode *inode,
+			  struct fill_dir_struct *fd)
 {
 	ext2_filsys 		fs = ctx->fs;
 	errcode_t		retval;
-	struct ext2_inode 	inode;
-	char			*dir_buf = 0;
-	struct fill_dir_struct	fd;
-	struct out_dir		outdir;
-
-	outdir.max = outdir.num = 0;
-	outdir.buf = 0;
-	outdir.hashes = 0;
-	e2fsck_read_inode(ctx, ino, &inode, "rehash_dir");
-
-	retval = ENOMEM;
-	fd.harray = 0;
-	dir_buf = malloc(inode.i_size);
-	if (!dir_buf)
-		goto errout;
-
-	fd.max_array = inode.i_size / 32;
-	fd.num_array = 0;
-	fd.harray = malloc(fd.max_array * sizeof(struct hash_entry));
-	if (!fd.harray)
-		goto errout;
 
-	fd.ctx = ctx;
-	fd.buf = dir_buf;
-	fd.inode = &inode;
-	fd.err = 0;
-	fd.dir_size = 0;
-	fd.compress = 0;
+	fd->harray = 0;
+	fd->buf = malloc(inode->i_size);
+	if (!fd->buf)
+		return ENOMEM;
+
+	fd->max_array = inode->i_size / 32 + 16;
+	fd->num_array = 0;
+	fd->harray = malloc(fd->max_array * sizeof(struct hash_entry));
+	if (!fd->harray)
+		return ENOMEM;
+
+	fd->ctx = ctx;
+	fd->inode = inode;
+	fd->err = 0;
+	fd->dir_size = 0;
+	fd->compress = 0;
 	if (!(fs->super->s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) ||
-	    (inode.i_size / fs->blocksize) < 2)
-		fd.compress = 1;
-	fd.parent = 0;
+	    (inode->i_size / fs->blocksize) < 2)
+		fd->compress = 1;
+	fd->parent = 0;
 
 retry_nohash:
 	/* Read in the entire directory into memory */
-	retval = ext2fs_block_iterate3(fs, ino, 0, 0,
-				       fill_dir_block, &fd);
-	if (fd.err) {
-		retval = fd.err;
-		goto errout;
-	}
+	ext2fs_block_iterate3(fs, ino, 0, 0, fill_dir_block, fd);
+	if (fd->err)
+		return fd->err;
 
 	/* 
 	 * If the entries read are less than a block, then don't index
 	 * the directory
 	 */
-	if (!fd.compress && (fd.dir_size < (fs->blocksize - 24))) {
-		fd.compress = 1;
-		fd.dir_size = 0;
-		fd.num_array = 0;
+	if (!fd->compress && (fd->dir_size < (fs->blocksize - 24))) {
+		fd->compress = 1;
+		fd->dir_size = 0;
+		fd->num_array = 0;
 		goto retry_nohash;
 	}
 
 #if 0
 	printf("%d entries (%d bytes) found in inode %d\n",
-	       fd.num_array, fd.dir_size, ino);
+	       fd->num_array, fd->dir_size, ino);
 #endif
 
-	/* Sort the list */
-resort:
-	if (fd.compress)
-		qsort(fd.harray+2, fd.num_array-2, sizeof(struct hash_entry),
-		      hash_cmp);
-	else
-		qsort(fd.harray, fd.num_array, sizeof(struct hash_entry),
-		      hash_cmp);
+	if (!fd->compress) {
+		retval = hash_dir_entries(fs, fd);
+		if (retval)
+			return retval;
+	}
+	return sort_dir(fd);
+}
+
+/*
+ * Lay the sorted entries out in their new blocks and, for an indexed
+ * directory, build the interior nodes above them.
+ */
+static errcode_t layout_dir(e2fsck_t ctx, ext2_ino_t ino,
+			    struct fill_dir_struct *fd,
+			    struct out_dir *outdir)
+{
+	errcode_t		retval;
+
+	/* Sort non-hashed directories by inode number */
+	if (fd->compress) {
+		retval = sort_entries(fd, 1);
+		if (retval)
+			return retval;
+	}
 
 	/*
-	 * Look for duplicates
+	 * Place the directory entries.  In a htree directory these
+	 * will become the leaf nodes.  They are copied out of fd->buf
+	 * as the blocks are written.
 	 */
-	if (duplicate_search_and_fix(ctx, fs, ino, &fd))
-		goto resort;
+	retval = plan_dir_blocks(ctx, fd, outdir);
+	if (retval)
+		return retval;
 
-	if (ctx->options & E2F_OPT_NO) {
-		retval = 0;
-		goto errout;
+	if (!fd->compress) {
+		/* Calculate the interior nodes */
+		retval = calculate_tree(ctx->fs, outdir, ino, fd->parent);
+		if (retval)
+			return retval;
 	}
+	return 0;
+}
 
-	/* Sort non-hashed directories by inode number */
-	if (fd.compress)
-		qsort(fd.harray+2, fd.num_array-2,
-		      sizeof(struct hash_entry), ino_cmp);
+errcode_t e2fsck_rehash_dir(e2fsck_t ctx, ext2_ino_t ino)
+{
+	ext2_filsys 		fs = ctx->fs;
+	errcode_t		retval;
+	struct ext2_inode 	inode;
+	struct fill_dir_struct	fd;
+	struct out_dir		outdir;
 
-	/*
-	 * Copy the directory entries.  In a htree directory these
-	 * will become the leaf nodes.
-	 */
-	retval = copy_dir_entries(ctx, &fd, &outdir);
+	memset(&outdir, 0, sizeof(outdir));
+	e2fsck_read_inode(ctx, ino, &inode, "rehash_dir");
+
+	retval = read_dir(ctx, ino, &inode, &fd);
 	if (retval)
 		goto errout;
 
-	free(dir_buf); dir_buf = 0;
-
-	if (!fd.compress) {
-		/* Calculate the interior nodes */
-		retval = calculate_tree(fs, &outdir, ino, fd.parent);
+	/*
+	 * Look for duplicates
+	 */
+	while (duplicate_search_and_fix(ctx, fs, ino, &fd)) {
+		retval = sort_dir(&fd);
 		if (retval)
 			goto errout;
 	}
 
+	if (ctx->options & E2F_OPT_NO) {
+		retval = 0;
+		goto errout;
+	}
+
+	retval = layout_dir(ctx, ino, &fd, &outdir);
+	if (retval)
+		goto errout;
+
 	retval = write_directory(ctx, fs, &outdir, ino, fd.compress);
 	if (retval)
 		goto errout;
 
 errout:
-	free(dir_buf);
+	free(fd.buf);
 	free(fd.harray);
 
 	free_out_dir(&outdir);
 	return retval;
 }
 
+/*
+ * Parallel rebuilding.  Worker processes read, hash, sort and lay out
+ * the directories, and send the finished blocks back over a pipe; the
+ * parent allocates and writes them.  Directory i is handled by worker
+ * i % jobs, and the parent collects the results in the original
+ * order, so blocks are allocated exactly as they would be serially.
+ * Directories with duplicate names, which need fix_problem(), and
+ * anything a worker couldn't handle are rebuilt by the parent.
+ */
+struct rehash_result {
+	ext2_ino_t	ino;
+	int		redo;		/* rebuild it in the parent */
+	int		compress;
+	int		num;		/* blocks which follow */
+};
+
+struct rehash_jobs {
+	int		jobs;
+	pid_t		*pids;
+	int		*fds;
+};
+
+static int rehash_write(int fd, const void *buf, size_t count)
+{
+	const char	*cp = buf;
+	ssize_t		ret;
+
+	while (count) {
+		ret = write(fd, cp, count);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		cp += ret;
+		count -= ret;
+	}
+	return 0;
+}
+
+static int rehash_read(int fd, void *buf, size_t count)
+{
+	char		*cp = buf;
+	ssize_t		ret;
+
+	while (count) {
+		ret = read(fd, cp, count);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		cp += ret;
+		count -= ret;
+	}
+	return 0;
+}
+
+static int has_duplicates(struct fill_dir_struct *fd)
+{
+	struct ext2_dir_entry	*dirent, *prev;
+	int			i;
+
+	for (i=1; i < fd->num_array; i++) {
+		dirent = ENT_DIRENT(fd->buf, fd->harray + i);
+		prev = ENT_DIRENT(fd->buf, fd->harray + i - 1);
+		if (dirent->inode &&
+		    ((dirent->name_len & 0xFF) == (prev->name_len & 0xFF)) &&
+		    !strncmp(dirent->name, prev->name,
+			     dirent->name_len & 0xFF))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Give a worker its own I/O channel, so that it does not share a file
+ * offset with the parent or its siblings.  The channel gets the same
+ * options (such as "offset=") as the one ext2fs_open2() set up.
+ */
+static errcode_t rehash_reopen_io(e2fsck_t ctx)
+{
+	ext2_filsys	fs = ctx->fs;
+	io_channel	io;
+	errcode_t	retval;
+
+	retval = fs->io->manager->open(fs->device_name, 0, &io);
+	if (retval)
+		return retval;
+	if (ctx->io_options &&
+	    (retval = io_channel_set_options(io, ctx->io_options))) {
+		io_channel_close(io);
+		return retval;
+	}
+	retval = io_channel_set_blksize(io, fs->blocksize);
+	if (retval) {
+		io_channel_close(io);
+		return retval;
+	}
+	if (fs->image_io == fs->io)
+		fs->image_io = io;
+	fs->io = io;
+	return 0;
+}
+
+static void rehash_worker(e2fsck_t ctx, ext2_ino_t *dirs, int num_dirs,
+			  int first, int jobs, int out_fd)
+{
+	ext2_filsys 		fs = ctx->fs;
+	struct rehash_result	res;
+	struct ext2_inode 	inode;
+	struct fill_dir_struct	fd;
+	struct out_dir		outdir;
+	char			*buf, *dir;
+	int			i, blk, failed;
+
+	if (rehash_reopen_io(ctx) || ext2fs_get_mem(fs->blocksize, &buf))
+		_exit(1);
+
+	for (i = first; i < num_dirs; i += jobs) {
+		memset(&res, 0, sizeof(res));
+		res.ino = dirs[i];
+		res.redo = 1;
+		fd.buf = 0;
+		fd.harray = 0;
+		memset(&outdir, 0, sizeof(outdir));
+
+		if (!ext2fs_read_inode(fs, dirs[i], &inode) &&
+		    !read_dir(ctx, dirs[i], &inode, &fd) &&
+		    !has_duplicates(&fd) &&
+		    !layout_dir(ctx, dirs[i], &fd, &outdir)) {
+			res.redo = 0;
+			res.compress = fd.compress;
+			res.num = outdir.num;
+		}
+
+		/*
+		 * If a block can't be built, the parent sees a short
+		 * read and rebuilds the directory itself.
+		 */
+		failed = rehash_write(out_fd, &res, sizeof(res));
+		for (blk = 0; !failed && !res.redo && blk < res.num; blk++)
+			failed = get_dir_block(fs, &outdir, blk, buf, &dir) ||
+				rehash_write(out_fd, dir, fs->blocksize);
+		free(fd.buf);
+		free(fd.harray);
+		free_out_dir(&outdir);
+		if (failed)
+			break;
+	}
+	_exit(0);
+}
+
+static void rehash_start_jobs(e2fsck_t ctx, struct rehash_jobs *rj,
+			      ext2_ino_t *dirs, int num_dirs)
+{
+	int	i, pfd[2];
+
+	rj->pids = e2fsck_allocate_memory(ctx, rj->jobs * sizeof(pid_t),
+					  "rehash worker pids");
+	rj->fds = e2fsck_allocate_memory(ctx, rj->jobs * sizeof(int),
+					 "rehash worker pipes");
+
+	/* The workers read straight from the device */
+	io_channel_flush(ctx->fs->io);
+	fflush(stdout);
+	fflush(stderr);
+	if (ctx->logf)
+		fflush(ctx->logf);
+
+	for (i = 0; i < rj->jobs; i++) {
+		rj->fds[i] = -1;
+		rj->pids[i] = -1;
+		if (pipe(pfd) < 0)
+			continue;
+		rj->pids[i] = fork();
+		if (rj->pids[i] == 0) {
+			close(pfd[0]);
+			rehash_worker(ctx, dirs, num_dirs, i, rj->jobs,
+				      pfd[1]);
+		}
+		close(pfd[1]);
+		if (rj->pids[i] < 0)
+			close(pfd[0]);
+		else
+			rj->fds[i] = pfd[0];
+	}
+}
+
+static void rehash_end_jobs(struct rehash_jobs *rj)
+{
+	int	i;
+
+	for (i = 0; i < rj->jobs; i++) {
+		if (rj->fds[i] >= 0)
+			close(rj->fds[i]);
+		if (rj->pids[i] > 0)
+			waitpid(rj->pids[i], 0, 0);
+	}
+	ext2fs_free_mem(&rj->pids);
+	ext2fs_free_mem(&rj->fds);
+}
+
+/*
+ * Write out directory i as prepared by its worker, or rebuild it here
+ * if the worker couldn't.
+ */
+static errcode_t rehash_collect(e2fsck_t ctx, struct rehash_jobs *rj,
+				int i, ext2_ino_t ino)
+{
+	ext2_filsys 		fs = ctx->fs;
+	struct rehash_result	res;
+	struct out_dir		outdir;
+	errcode_t		retval;
+	int			*fd = &rj->fds[i % rj->jobs];
+
+	if (*fd < 0)
+		return e2fsck_rehash_dir(ctx, ino);
+	if (rehash_read(*fd, &res, sizeof(res)) || (res.ino != ino))
+		goto lost_worker;
+	if (res.redo)
+		return e2fsck_rehash_dir(ctx, ino);
+
+	memset(&outdir, 0, sizeof(outdir));
+	retval = alloc_size_dir(fs, &outdir, res.num);
+	if (retval || !outdir.buf ||
+	    rehash_read(*fd, outdir.buf, res.num * fs->blocksize)) {
+		free_out_dir(&outdir);
+		goto lost_worker;
+	}
+	outdir.num = res.num;
+	retval = write_directory(ctx, fs, &outdir, ino, res.compress);
+	free_out_dir(&outdir);
+	return retval;
+
+lost_worker:
+	close(*fd);
+	*fd = -1;
+	return e2fsck_rehash_dir(ctx, ino);
+}
+
 void e2fsck_rehash_directories(e2fsck_t ctx)
 {
 	struct problem_context	pctx;
@@ -832,9 +1300,10 @@ void e2fsck_rehash_directories(e2fsck_t ctx)
 	struct dir_info		*dir;
 	ext2_u32_iterate 	iter;
 	struct dir_info_iter *	dirinfo_iter = 0;
-	ext2_ino_t		ino;
+	struct rehash_jobs	rj;
+	ext2_ino_t		ino, *dirs;
 	errcode_t		retval;
-	int			cur, max, all_dirs, first = 1;
+	int			i, num_dirs, cur, max, all_dirs, first = 1;
 
 	init_resource_track(&rtrack, ctx->fs->io);
 	all_dirs = ctx->options & E2F_OPT_COMPRESS_DIRS;
@@ -860,7 +1329,10 @@ void e2fsck_rehash_directories(e2fsck_t ctx)
 		}
 		max = ext2fs_u32_list_count(ctx->dirs_to_hash);
 	}
-	while (1) {
+	dirs = e2fsck_allocate_memory(ctx, (max + 1) * sizeof(ext2_ino_t),
+				      "directories to rehash");
+	num_dirs = 0;
+	while (num_dirs < max) {
 		if (all_dirs) {
 			if ((dir = e2fsck_dir_info_iter(ctx,
 							dirinfo_iter)) == 0)
@@ -872,6 +1344,24 @@ void e2fsck_rehash_directories(e2fsck_t ctx)
 		}
 		if (ino == ctx->lost_and_found)
 			continue;
+		dirs[num_dirs++] = ino;
+	}
+	if (all_dirs)
+		e2fsck_dir_info_iter_end(ctx, dirinfo_iter);
+	else
+		ext2fs_u32_list_iterate_end(iter);
+
+	memset(&rj, 0, sizeof(rj));
+	rj.jobs = ctx->rehash_jobs;
+	if (rj.jobs > num_dirs)
+		rj.jobs = num_dirs;
+	if (ctx->options & E2F_OPT_NO)
+		rj.jobs = 0;
+	if (rj.jobs > 1)
+		rehash_start_jobs(ctx, &rj, dirs, num_dirs);
+
+	for (i = 0; i < num_dirs; i++) {
+		ino = dirs[i];
 		pctx.dir = ino;
 		if (first) {
 			fix_problem(ctx, PR_3A_PASS_HEADER, &pctx);
@@ -880,7 +1370,10 @@ void e2fsck_rehash_directories(e2fsck_t ctx)
 #if 0
 		fix_problem(ctx, PR_3A_OPTIMIZE_DIR, &pctx);
 #endif
-		pctx.errcode = e2fsck_rehash_dir(ctx, ino);
+		if (rj.jobs > 1)
+			pctx.errcode = rehash_collect(ctx, &rj, i, ino);
+		else
+			pctx.errcode = e2fsck_rehash_dir(ctx, ino);
 		if (pctx.errcode) {
 			end_problem_latch(ctx, PR_LATCH_OPTIMIZE_DIR);
 			fix_problem(ctx, PR_3A_OPTIMIZE_DIR_ERR, &pctx);
@@ -890,10 +1383,9 @@ void e2fsck_rehash_directories(e2fsck_t ctx)
 			       100.0 * (float) (++cur) / (float) max, ino);
 	}
 	end_problem_latch(ctx, PR_LATCH_OPTIMIZE_DIR);
-	if (all_dirs)
-		e2fsck_dir_info_iter_end(ctx, dirinfo_iter);
-	else
-		ext2fs_u32_list_iterate_end(iter);
+	if (rj.jobs > 1)
+		rehash_end_jobs(&rj);
+	ext2fs_free_mem(&dirs);
 
 	if (ctx->dirs_to_hash)
 		ext2fs_u32_list_free(ctx->dirs_to_hash);
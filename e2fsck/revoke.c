@@ -106,15 +106,20 @@ static void flush_descriptor(journal_t *, struct journal_head *, int);
 
 /* Utility functions to maintain the revoke table */
 
-/* Borrowed from buffer.c: this is a tried and tested block hash function */
+/*
+ * Multiplicative hash: the shift-and-xor hash borrowed from buffer.c
+ * shifts by a negative amount for tables smaller than 4096 buckets and
+ * clusters badly once the table is sized to a large journal.
+ */
 static inline int hash(journal_t *journal, unsigned long block)
 {
 	struct jbd_revoke_table_s *table = journal->j_revoke;
-	int hash_shift = table->hash_shift;
+	unsigned long long h = (unsigned long long) block *
+		0x9e37fffffffc0001ULL;
 
-	return ((block << (hash_shift - 6)) ^
-		(block >> 13) ^
-		(block << (hash_shift - 12))) & (table->hash_size - 1);
+	if (table->hash_shift == 0)
+		return 0;
+	return (int) (h >> (64 - table->hash_shift));
 }
 
 static int insert_revoke_hash(journal_t *journal, unsigned long blocknr,
@@ -480,6 +480,8 @@ void check_super_block(e2fsck_t ctx)
 	blk64_t	free_blocks = 0;
 	ino_t	free_inodes = 0;
 	int     csum_flag, clear_test_fs_flag;
+	int	desc_changed;
+	dgrp_t	next_bad_csum;
 
 	inodes_per_block = EXT2_INODES_PER_BLOCK(fs->super);
 	ipg_max = inodes_per_block * (blocks_per_group - 4);
@@ -598,8 +600,10 @@ void check_super_block(e2fsck_t ctx)
 
 	csum_flag = EXT2_HAS_RO_COMPAT_FEATURE(fs->super,
 					       EXT4_FEATURE_RO_COMPAT_GDT_CSUM);
+	next_bad_csum = ext2fs_group_desc_csum_find_bad(fs, 0);
 	for (i = 0; i < fs->group_desc_count; i++) {
 		pctx.group = i;
+		desc_changed = 0;
 
 		if (!EXT2_HAS_INCOMPAT_FEATURE(fs->super,
 					       EXT4_FEATURE_INCOMPAT_FLEX_BG)) {
@@ -610,8 +614,10 @@ void check_super_block(e2fsck_t ctx)
 		if ((ext2fs_block_bitmap_loc(fs, i) < first_block) ||
 		    (ext2fs_block_bitmap_loc(fs, i) > last_block)) {
 			pctx.blk = ext2fs_block_bitmap_loc(fs, i);
-			if (fix_problem(ctx, PR_0_BB_NOT_GROUP, &pctx))
+			if (fix_problem(ctx, PR_0_BB_NOT_GROUP, &pctx)) {
 				ext2fs_block_bitmap_loc_set(fs, i, 0);
+				desc_changed = 1;
+			}
 		}
 		if (ext2fs_block_bitmap_loc(fs, i) == 0) {
 			ctx->invalid_block_bitmap_flag[i]++;
@@ -620,8 +626,10 @@ void check_super_block(e2fsck_t ctx)
 		if ((ext2fs_inode_bitmap_loc(fs, i) < first_block) ||
 		    (ext2fs_inode_bitmap_loc(fs, i) > last_block)) {
 			pctx.blk = ext2fs_inode_bitmap_loc(fs, i);
-			if (fix_problem(ctx, PR_0_IB_NOT_GROUP, &pctx))
+			if (fix_problem(ctx, PR_0_IB_NOT_GROUP, &pctx)) {
 				ext2fs_inode_bitmap_loc_set(fs, i, 0);
+				desc_changed = 1;
+			}
 		}
 		if (ext2fs_inode_bitmap_loc(fs, i) == 0) {
 			ctx->invalid_inode_bitmap_flag[i]++;
@@ -631,8 +639,10 @@ void check_super_block(e2fsck_t ctx)
 		    ((ext2fs_inode_table_loc(fs, i) +
 		      fs->inode_blocks_per_group - 1) > last_block)) {
 			pctx.blk = ext2fs_inode_table_loc(fs, i);
-			if (fix_problem(ctx, PR_0_ITABLE_NOT_GROUP, &pctx))
+			if (fix_problem(ctx, PR_0_ITABLE_NOT_GROUP, &pctx)) {
 				ext2fs_inode_table_loc_set(fs, i, 0);
+				desc_changed = 1;
+			}
 		}
 		if (ext2fs_inode_table_loc(fs, i) == 0) {
 			ctx->invalid_inode_table_flag[i]++;
@@ -647,7 +657,17 @@ void check_super_block(e2fsck_t ctx)
 			ext2fs_unmark_valid(fs);
 
 		should_be = 0;
-		if (!ext2fs_group_desc_csum_verify(fs, i)) {
+		/*
+		 * The checksums were verified in one pass before the
+		 * loop; only recheck the groups found bad there or
+		 * changed since.
+		 */
+		if (i == next_bad_csum) {
+			next_bad_csum = ext2fs_group_desc_csum_find_bad(fs,
+									i + 1);
+			desc_changed = 1;
+		}
+		if (desc_changed && !ext2fs_group_desc_csum_verify(fs, i)) {
 			pctx.csum1 = ext2fs_bg_checksum(fs, i);
 			pctx.csum2 = ext2fs_group_desc_csum(fs, i);
 			if (fix_problem(ctx, PR_0_GDT_CSUM, &pctx)) {
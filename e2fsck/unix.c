@@ -77,7 +77,7 @@ static void usage(e2fsck_t ctx)
 		_("Usage: %s [-panyrcdfvtDFV] [-b superblock] [-B blocksize]\n"
 		"\t\t[-I inode_buffer_blocks] [-P process_inode_size]\n"
 		"\t\t[-l|-L bad_blocks_file] [-C fd] [-j external_journal]\n"
-		"\t\t[-E extended-options] device\n"),
+		"\t\t[-E extended-options] [-R checkpoint_file] device\n"),
 		ctx->program_name);
 
 	fprintf(stderr, "%s", _("\nEmergency help:\n"
@@ -695,6 +695,69 @@ static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 			else
 				ctx->log_fn = string_copy(ctx, arg, 0);
 			continue;
+		} else if (strcmp(token, "checkpoint") == 0) {
+			if (!arg) {
+				extended_usage++;
+				continue;
+			}
+			if (ctx->checkpoint_fn)
+				free(ctx->checkpoint_fn);
+			ctx->checkpoint_fn = string_copy(ctx, arg, 0);
+		} else if (strcmp(token, "checkpoint_groups") == 0) {
+			if (!arg) {
+				extended_usage++;
+				continue;
+			}
+			ctx->checkpoint_groups = strtoul(arg, &p, 0);
+			if (*p || !ctx->checkpoint_groups) {
+				fprintf(stderr, "%s",
+					_("Invalid checkpoint interval.\n"));
+				extended_usage++;
+				continue;
+			}
+		} else if (strcmp(token, "rehash_jobs") == 0) {
+			if (!arg) {
+				extended_usage++;
+				continue;
+			}
+			ctx->rehash_jobs = strtoul(arg, &p, 0);
+			if (*p || ctx->rehash_jobs < 1) {
+				fprintf(stderr, "%s",
+					_("Invalid number of rehash jobs.\n"));
+				extended_usage++;
+				continue;
+			}
+		} else if (strcmp(token, "batch") == 0) {
+			if (!arg) {
+				extended_usage++;
+				continue;
+			}
+			if (ctx->batch_fn)
+				free(ctx->batch_fn);
+			ctx->batch_fn = string_copy(ctx, arg, 0);
+		} else if (strcmp(token, "batch_jobs") == 0) {
+			if (!arg) {
+				extended_usage++;
+				continue;
+			}
+			ctx->batch_jobs = strtoul(arg, &p, 0);
+			if (*p || ctx->batch_jobs < 1) {
+				fprintf(stderr, "%s",
+					_("Invalid number of batch jobs.\n"));
+				extended_usage++;
+				continue;
+			}
+		} else if (strcmp(token, "problem_summary") == 0) {
+			ctx->problem_samples = 10;
+			if (!arg)
+				continue;
+			ctx->problem_samples = strtoul(arg, &p, 0);
+			if (*p || !ctx->problem_samples) {
+				fprintf(stderr, "%s",
+					_("Invalid problem sample count.\n"));
+				extended_usage++;
+				continue;
+			}
 		} else {
 			fprintf(stderr, _("Unknown extended option: %s\n"),
 				token);
@@ -703,6 +766,15 @@ static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 	}
 	free(buf);
 
+	if (ctx->batch_jobs && !ctx->batch_fn) {
+		fprintf(stderr, "%s", _("batch_jobs requires batch=<file>.\n"));
+		extended_usage++;
+	}
+	if (ctx->checkpoint_groups && !ctx->checkpoint_fn) {
+		fprintf(stderr, "%s", _("checkpoint_groups requires "
+					"checkpoint=<file>.\n"));
+		extended_usage++;
+	}
 	if (extended_usage) {
 		fputs(("\nExtended options are separated by commas, "
 		       "and may take an argument which\n"
@@ -713,6 +785,14 @@ static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 		fputs(("\tjournal_only\n"), stderr);
 		fputs(("\tdiscard\n"), stderr);
 		fputs(("\tnodiscard\n"), stderr);
+		fputs(("\tcheckpoint=<file>\n"), stderr);
+		fputs(("\tcheckpoint_groups=<groups between checkpoints>\n"),
+		      stderr);
+		fputs(("\tproblem_summary[=<reports per problem>]\n"), stderr);
+		fputs(("\trehash_jobs=<worker processes>\n"), stderr);
+		fputs(("\tbatch=<file listing the devices to check>\n"), stderr);
+		fputs(("\tbatch_jobs=<devices checked at the same time>\n"),
+		      stderr);
 		fputc('\n', stderr);
 		exit(1);
 	}
@@ -726,6 +806,19 @@ static void syntax_err_report(const char *filename, long err, int line_num)
 	exit(FSCK_ERROR);
 }
 
+static void set_filesystem_name(e2fsck_t ctx, char *name)
+{
+	ctx->io_options = strchr(name, '?');
+	if (ctx->io_options)
+		*ctx->io_options++ = 0;
+	ctx->filesystem_name = blkid_get_devname(ctx->blkid, name, 0);
+	if (!ctx->filesystem_name) {
+		com_err(ctx->program_name, 0, _("Unable to resolve '%s'"),
+			name);
+		fatal_error(ctx, 0);
+	}
+}
+
 static const char *config_fn[] = { ROOT_SYSCONFDIR "/e2fsck.conf", 0 };
 
 static errcode_t PRS(int argc, char *argv[], e2fsck_t *ret_ctx)
@@ -772,7 +865,7 @@ static errcode_t PRS(int argc, char *argv[], e2fsck_t *ret_ctx)
 	else
 		ctx->program_name = "e2fsck";
 
-	while ((c = getopt (argc, argv, "panyrcC:B:dE:fvtFVM:b:I:j:P:l:L:N:SsDk")) != EOF)
+	while ((c = getopt (argc, argv, "panyrcC:B:dE:fvtFVM:b:I:j:P:l:L:N:R:SsDk")) != EOF)
 		switch (c) {
 		case 'C':
 			ctx->progress = e2fsck_update_progress;
@@ -904,12 +997,18 @@ static errcode_t PRS(int argc, char *argv[], e2fsck_t *ret_ctx)
 		case 'k':
 			keep_bad_blocks++;
 			break;
+		case 'R':
+			ctx->checkpoint_fn = string_copy(ctx, optarg, 0);
+			ctx->options |= E2F_OPT_RESUME;
+			break;
 		default:
 			usage(ctx);
 		}
 	if (show_version_only)
 		return 0;
-	if (optind != argc - 1)
+	if (extended_opts)
+		parse_extended_opts(ctx, extended_opts);
+	if (optind != argc - (ctx->batch_fn ? 0 : 1))
 		usage(ctx);
 	if ((ctx->options & E2F_OPT_NO) &&
 	    (ctx->options & E2F_OPT_COMPRESS_DIRS)) {
@@ -929,18 +1028,24 @@ static errcode_t PRS(int argc, char *argv[], e2fsck_t *ret_ctx)
 	}
 	if (ctx->options & E2F_OPT_NO)
 		ctx->options |= E2F_OPT_READONLY;
-
-	ctx->io_options = strchr(argv[optind], '?');
-	if (ctx->io_options)
-		*ctx->io_options++ = 0;
-	ctx->filesystem_name = blkid_get_devname(ctx->blkid, argv[optind], 0);
-	if (!ctx->filesystem_name) {
-		com_err(ctx->program_name, 0, _("Unable to resolve '%s'"),
-			argv[optind]);
-		fatal_error(ctx, 0);
-	}
-	if (extended_opts)
-		parse_extended_opts(ctx, extended_opts);
+	if (ctx->batch_fn) {
+		if (ctx->device_name || ctx->checkpoint_fn || flush) {
+			com_err(ctx->program_name, 0, "%s",
+				_("The -N, -R, -F and checkpoint options "
+				  "cannot be used in batch mode."));
+			fatal_error(ctx, 0);
+		}
+		if (ctx->batch_jobs > 1 &&
+		    (ctx->progress ||
+		     !(ctx->options & (E2F_OPT_PREEN | E2F_OPT_NO |
+				       E2F_OPT_YES)))) {
+			com_err(ctx->program_name, 0, "%s",
+				_("Checking several devices at once requires "
+				  "one of -p, -n or -y, and no -C."));
+			fatal_error(ctx, 0);
+		}
+	} else
+		set_filesystem_name(ctx, argv[optind]);
 
 	if ((cp = getenv("E2FSCK_CONFIG")) != NULL)
 		config_fn[0] = cp;
@@ -1211,6 +1316,17 @@ int main (int argc, char *argv[])
 	}
 	reserve_stdio_fds();
 
+	if (ctx->batch_fn && !show_version_only) {
+		exit_value = e2fsck_batch_run(ctx, &cp);
+		if (!cp) {
+			e2fsck_free_context(ctx);
+			remove_error_table(&et_ext2_error_table);
+			remove_error_table(&et_prof_error_table);
+			return exit_value;
+		}
+		set_filesystem_name(ctx, cp);
+	}
+
 	set_up_logging(ctx);
 	if (ctx->logf) {
 		int i;
@@ -1422,6 +1538,7 @@ failure:
 	ctx->fs = fs;
 	fs->priv_data = ctx;
 	fs->now = ctx->now;
+	ext2fs_init_pathname_cache(fs, 0);
 	sb = fs->super;
 
 	if (sb->s_rev_level > E2FSCK_CURRENT_REV) {
@@ -1700,8 +1817,10 @@ no_journal:
 		fatal_error(ctx, _("aborted"));
 	if (check_backup_super_block(ctx)) {
 		fs->flags &= ~EXT2_FLAG_MASTER_SB_ONLY;
+		fs->flags |= EXT2_FLAG_REFRESH_BACKUPS;
 		ext2fs_mark_super_dirty(fs);
 	}
+	e2fsck_problem_summary(ctx);
 
 #ifdef MTRACE
 	mtrace_print("Cleanup");
@@ -398,6 +398,8 @@ errcode_t ext2fs_block_iterate3(ext2_filsys fs,
 		ctx.errcode = ext2fs_extent_open2(fs, ino, &inode, &handle);
 		if (ctx.errcode)
 			goto abort_exit;
+		if (flags & BLOCK_FLAG_PREFETCH)
+			ext2fs_extent_set_prefetch(handle, 1);
 
 		while (1) {
 			if (op == EXT2_EXTENT_CURRENT)
@@ -260,6 +260,107 @@ static errcode_t write_backup_super(ext2_filsys fs, dgrp_t group,
 				    super_shadow);
 }
 
+struct ext2_orig_meta *ext2fs_get_orig_meta(ext2_filsys fs)
+{
+	if (!fs->orig_meta &&
+	    ext2fs_get_memzero(sizeof(struct ext2_orig_meta), &fs->orig_meta))
+		return NULL;
+	return fs->orig_meta;
+}
+
+void ext2fs_free_orig_meta(ext2_filsys fs)
+{
+	struct ext2_orig_meta *meta = fs->orig_meta;
+
+	if (!meta)
+		return;
+	if (meta->group_desc)
+		ext2fs_free_mem(&meta->group_desc);
+	if (meta->bitmap_blks)
+		ext2fs_free_mem(&meta->bitmap_blks);
+	if (meta->bitmaps)
+		ext2fs_free_mem(&meta->bitmaps);
+	ext2fs_free_mem(&fs->orig_meta);
+}
+
+/*
+ * Work out which of the first num descriptor blocks differ from what
+ * was last read from or written to the primary location.  Only those
+ * blocks are written, to the primary and to each backup.  Everything
+ * is dirty if there is no usable copy, or if EXT2_FLAG_REFRESH_BACKUPS
+ * asks for every copy to be rewritten (e.g. because e2fsck found the
+ * backups out of date).
+ */
+static void find_dirty_desc(ext2_filsys fs, char *group_ptr,
+			    int old_desc_blocks, char *dirty, blk_t num)
+{
+	struct ext2_orig_meta *meta = fs->orig_meta;
+	blk_t	i;
+
+	if (!meta || !meta->group_desc ||
+	    meta->desc_blocks != fs->desc_blocks ||
+	    meta->old_desc_blocks != (blk_t) old_desc_blocks) {
+		memset(dirty, 1, num);
+		return;
+	}
+	if (fs->flags & EXT2_FLAG_REFRESH_BACKUPS) {
+		memset(dirty, 1, num);
+		return;
+	}
+	for (i = 0; i < num; i++)
+		dirty[i] = i >= fs->desc_blocks ||
+			memcmp(group_ptr + (size_t) i * fs->blocksize,
+			       meta->group_desc + (size_t) i * fs->blocksize,
+			       fs->blocksize) != 0;
+}
+
+/* Remember the descriptors just written as the on-disk copy */
+static void save_orig_desc(ext2_filsys fs, char *group_ptr,
+			   int old_desc_blocks)
+{
+	struct ext2_orig_meta *meta;
+
+	meta = ext2fs_get_orig_meta(fs);
+	if (!meta)
+		return;
+	if (meta->group_desc && meta->desc_blocks != fs->desc_blocks)
+		ext2fs_free_mem(&meta->group_desc);
+	if (!meta->group_desc &&
+	    ext2fs_get_array(fs->desc_blocks, fs->blocksize,
+			     &meta->group_desc))
+		return;
+	memcpy(meta->group_desc, group_ptr,
+	       (size_t) fs->desc_blocks * fs->blocksize);
+	meta->desc_blocks = fs->desc_blocks;
+	meta->old_desc_blocks = old_desc_blocks;
+}
+
+/*
+ * Write one copy of the old-style descriptor table, skipping clean
+ * blocks and merging neighbouring dirty ones into a single write.
+ */
+static errcode_t write_desc_runs(ext2_filsys fs, blk64_t blk, int count,
+				 char *group_ptr, char *dirty)
+{
+	int		start, end;
+	errcode_t	retval;
+
+	for (start = 0; start < count; start = end) {
+		if (!dirty[start]) {
+			end = start + 1;
+			continue;
+		}
+		for (end = start + 1; end < count && dirty[end]; end++)
+			;
+		retval = io_channel_write_blk64(fs->io, blk + start,
+				end - start,
+				group_ptr + (size_t) start * fs->blocksize);
+		if (retval)
+			return retval;
+	}
+	return 0;
+}
+
 errcode_t ext2fs_flush(ext2_filsys fs)
 {
 	return ext2fs_flush2(fs, 0);
@@ -278,7 +379,9 @@ errcode_t ext2fs_flush2(ext2_filsys fs, int flags)
 	dgrp_t		j;
 #endif
 	char	*group_ptr;
+	char	*dirty = 0;
 	int	old_desc_blocks;
+	blk_t	dirty_blocks;
 	struct ext2fs_numeric_progress_struct progress;
 
 	EXT2_CHECK_MAGIC(fs, EXT2_ET_MAGIC_EXT2FS_FILSYS);
@@ -340,6 +443,14 @@ errcode_t ext2fs_flush2(ext2_filsys fs, int flags)
 	else
 		old_desc_blocks = fs->desc_blocks;
 
+	dirty_blocks = fs->desc_blocks;
+	if ((blk_t) old_desc_blocks > dirty_blocks)
+		dirty_blocks = old_desc_blocks;
+	retval = ext2fs_get_mem(dirty_blocks, &dirty);
+	if (retval)
+		goto errout;
+	find_dirty_desc(fs, group_ptr, old_desc_blocks, dirty, dirty_blocks);
+
 	ext2fs_numeric_progress_init(fs, &progress, NULL,
 				     fs->group_desc_count);
 
@@ -359,16 +470,18 @@ errcode_t ext2fs_flush2(ext2_filsys fs, int flags)
 		}
 		if (fs->flags & EXT2_FLAG_SUPER_ONLY)
 			continue;
-		if ((old_desc_blk) &&
-		    (!(fs->flags & EXT2_FLAG_MASTER_SB_ONLY) || (i == 0))) {
-			retval = io_channel_write_blk64(fs->io,
-			      old_desc_blk, old_desc_blocks, group_ptr);
+		if (old_desc_blk &&
+		    (i == 0 || !(fs->flags & EXT2_FLAG_MASTER_SB_ONLY))) {
+			retval = write_desc_runs(fs, old_desc_blk,
+					old_desc_blocks, group_ptr, dirty);
 			if (retval)
 				goto errout;
 		}
 		if (new_desc_blk) {
 			int meta_bg = i / EXT2_DESC_PER_BLOCK(fs->super);
 
+			if (!dirty[meta_bg])
+				continue;
 			retval = io_channel_write_blk64(fs->io, new_desc_blk,
 				1, group_ptr + (meta_bg*fs->blocksize));
 			if (retval)
@@ -378,6 +491,9 @@ errcode_t ext2fs_flush2(ext2_filsys fs, int flags)
 
 	ext2fs_numeric_progress_close(fs, &progress, NULL);
 
+	if (!(fs->flags & EXT2_FLAG_SUPER_ONLY))
+		save_orig_desc(fs, group_ptr, old_desc_blocks);
+
 	/*
 	 * If the write_bitmaps() function is present, call it to
 	 * flush the bitmaps.  This is done this way so that a simple
@@ -419,6 +535,8 @@ write_primary_superblock_only:
 		retval = io_channel_flush(fs->io);
 errout:
 	fs->super->s_state = fs_state;
+	if (dirty)
+		ext2fs_free_mem(&dirty);
 #ifdef WORDS_BIGENDIAN
 	if (super_shadow)
 		ext2fs_free_mem(&super_shadow);
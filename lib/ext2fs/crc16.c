@@ -48,6 +48,29 @@ static __u16 const crc16_table[256] = {
 	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
 };
 
+/*
+ * Tables for processing eight bytes at a time ("slice-by-8"):
+ * crc16_slice[k][i] is the CRC of byte i followed by k zero bytes.
+ * They are derived from crc16_table the first time they are needed.
+ */
+static __u16 crc16_slice[8][256];
+static int crc16_slice_init;
+
+static void init_crc16_slice(void)
+{
+	unsigned int i, k, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc16_table[i];
+		crc16_slice[0][i] = crc;
+		for (k = 1; k < 8; k++) {
+			crc = (crc >> 8) ^ crc16_table[crc & 0xffU];
+			crc16_slice[k][i] = crc;
+		}
+	}
+	crc16_slice_init = 1;
+}
+
 /**
  * Compute the CRC-16 for the data buffer
  *
@@ -60,13 +83,27 @@ crc16_t ext2fs_crc16(crc16_t crc, const void *buffer, unsigned int len)
 {
 	const unsigned char *cp = buffer;
 
+	/*
+	 * for an unknown reason, PPC treats __u16 as signed
+	 * and keeps doing sign extension on the value.
+	 * Instead, use only the low 16 bits of an unsigned
+	 * int for holding the CRC value to avoid this.
+	 */
+	crc &= 0x0000ffffU;
+	if (len >= 16) {
+		if (!crc16_slice_init)
+			init_crc16_slice();
+		for (; len >= 8; len -= 8, cp += 8)
+			crc = crc16_slice[7][(crc ^ cp[0]) & 0xffU] ^
+				crc16_slice[6][((crc >> 8) ^ cp[1]) & 0xffU] ^
+				crc16_slice[5][cp[2]] ^
+				crc16_slice[4][cp[3]] ^
+				crc16_slice[3][cp[4]] ^
+				crc16_slice[2][cp[5]] ^
+				crc16_slice[1][cp[6]] ^
+				crc16_slice[0][cp[7]];
+	}
 	while (len--)
-		/*
-		 * for an unknown reason, PPC treats __u16 as signed
-		 * and keeps doing sign extension on the value.
-		 * Instead, use only the low 16 bits of an unsigned
-		 * int for holding the CRC value to avoid this.
-		 */
 		crc = (((crc >> 8) & 0xffU) ^
 		       crc16_table[(crc ^ *cp++) & 0xffU]) & 0x0000ffffU;
 	return crc;
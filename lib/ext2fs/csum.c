@@ -29,59 +29,90 @@
 #define STATIC static
 #endif
 
-__u16 ext2fs_group_desc_csum(ext2_filsys fs, dgrp_t group)
+/*
+ * Checksum a group descriptor, starting from uuid_crc, the CRC of the
+ * filesystem UUID, which is the same for every group.
+ */
+static __u16 group_desc_csum(ext2_filsys fs, dgrp_t group, __u16 uuid_crc)
 {
 	struct ext2_group_desc *desc = ext2fs_group_desc(fs, fs->group_desc,
 							 group);
 	size_t size = EXT2_DESC_SIZE(fs->super);
-	size_t offset;
+	size_t offset = offsetof(struct ext2_group_desc, bg_checksum);
 	__u16 crc;
+#ifdef WORDS_BIGENDIAN
+	struct ext4_group_desc swabdesc;
+	size_t save_size = size;
+	const size_t ext4_bg_size = sizeof(struct ext4_group_desc);
+	struct ext2_group_desc *save_desc = desc;
 
-	if (fs->super->s_feature_ro_compat & EXT4_FEATURE_RO_COMPAT_GDT_CSUM) {
-		size_t offset = offsetof(struct ext2_group_desc, bg_checksum);
+	/* Have to swab back to little-endian to do the checksum */
+	if (size > ext4_bg_size)
+		size = ext4_bg_size;
+	memcpy(&swabdesc, desc, size);
+	ext2fs_swap_group_desc2(fs,
+				(struct ext2_group_desc *) &swabdesc);
+	desc = (struct ext2_group_desc *) &swabdesc;
 
-#ifdef WORDS_BIGENDIAN
-		struct ext4_group_desc swabdesc;
-		size_t save_size = size;
-		const size_t ext4_bg_size = sizeof(struct ext4_group_desc);
-		struct ext2_group_desc *save_desc = desc;
-
-		/* Have to swab back to little-endian to do the checksum */
-		if (size > ext4_bg_size)
-			size = ext4_bg_size;
-		memcpy(&swabdesc, desc, size);
-		ext2fs_swap_group_desc2(fs,
-					(struct ext2_group_desc *) &swabdesc);
-		desc = (struct ext2_group_desc *) &swabdesc;
-
-		group = ext2fs_swab32(group);
+	group = ext2fs_swab32(group);
 #endif
-		crc = ext2fs_crc16(~0, fs->super->s_uuid,
-				   sizeof(fs->super->s_uuid));
-		crc = ext2fs_crc16(crc, &group, sizeof(group));
-		crc = ext2fs_crc16(crc, desc, offset);
-		offset += sizeof(desc->bg_checksum); /* skip checksum */
-		/* for checksum of struct ext4_group_desc do the rest...*/
-		if (offset < size) {
-			crc = ext2fs_crc16(crc, (char *)desc + offset,
-					   size - offset);
-		}
+	crc = ext2fs_crc16(uuid_crc, &group, sizeof(group));
+	crc = ext2fs_crc16(crc, desc, offset);
+	offset += sizeof(desc->bg_checksum); /* skip checksum */
+	/* for checksum of struct ext4_group_desc do the rest...*/
+	if (offset < size) {
+		crc = ext2fs_crc16(crc, (char *)desc + offset,
+				   size - offset);
+	}
 #ifdef WORDS_BIGENDIAN
-		/*
-		 * If the size of the bg descriptor is greater than 64
-		 * bytes, which is the size of the traditional ext4 bg
-		 * descriptor, checksum the rest of the descriptor here
-		 */
-		if (save_size > ext4_bg_size)
-			crc = ext2fs_crc16(crc,
-					   (char *)save_desc + ext4_bg_size,
-					   save_size - ext4_bg_size);
+	/*
+	 * If the size of the bg descriptor is greater than 64
+	 * bytes, which is the size of the traditional ext4 bg
+	 * descriptor, checksum the rest of the descriptor here
+	 */
+	if (save_size > ext4_bg_size)
+		crc = ext2fs_crc16(crc,
+				   (char *)save_desc + ext4_bg_size,
+				   save_size - ext4_bg_size);
 #endif
-	}
-
 	return crc;
 }
 
+__u16 ext2fs_group_desc_csum(ext2_filsys fs, dgrp_t group)
+{
+	if (!(fs->super->s_feature_ro_compat &
+	      EXT4_FEATURE_RO_COMPAT_GDT_CSUM))
+		return 0;
+
+	return group_desc_csum(fs, group,
+			       ext2fs_crc16(~0, fs->super->s_uuid,
+					    sizeof(fs->super->s_uuid)));
+}
+
+/*
+ * Return the first group at or after start whose descriptor checksum
+ * does not verify, or fs->group_desc_count if they all do.  This is
+ * cheaper than calling ext2fs_group_desc_csum_verify() on every group,
+ * since the UUID is only checksummed once.
+ */
+dgrp_t ext2fs_group_desc_csum_find_bad(ext2_filsys fs, dgrp_t start)
+{
+	dgrp_t	group;
+	__u16	uuid_crc;
+
+	if (!EXT2_HAS_RO_COMPAT_FEATURE(fs->super,
+					EXT4_FEATURE_RO_COMPAT_GDT_CSUM))
+		return fs->group_desc_count;
+
+	uuid_crc = ext2fs_crc16(~0, fs->super->s_uuid,
+				sizeof(fs->super->s_uuid));
+	for (group = start; group < fs->group_desc_count; group++)
+		if (ext2fs_bg_checksum(fs, group) !=
+		    group_desc_csum(fs, group, uuid_crc))
+			break;
+	return group;
+}
+
 int ext2fs_group_desc_csum_verify(ext2_filsys fs, dgrp_t group)
 {
 	if (EXT2_HAS_RO_COMPAT_FEATURE(fs->super,
@@ -225,6 +256,7 @@ int main(int argc, char **argv)
 	errcode_t		retval;
 	ext2_filsys		fs;
 	int			i;
+	unsigned char		buf[576];
 	__u16 csum1, csum2, csum_known = 0xd3a4;
 
 	memset(&param, 0, sizeof(param));
@@ -291,6 +323,37 @@ int main(int argc, char **argv)
 		printf("checksums for different filesystems shouldn't match\n");
 		exit(1);
 	}
+	for (i = 0; i < fs->group_desc_count; i++)
+		ext2fs_group_desc_csum_set(fs, i);
+	if (ext2fs_group_desc_csum_find_bad(fs, 0) != fs->group_desc_count) {
+		printf("all group checksums should verify\n");
+		exit(1);
+	}
+	ext2fs_bg_checksum_set(fs, 1, ext2fs_bg_checksum(fs, 1) ^ 1);
+	if (ext2fs_group_desc_csum_find_bad(fs, 0) != 1 ||
+	    ext2fs_group_desc_csum_find_bad(fs, 2) != fs->group_desc_count) {
+		printf("bad checksum of group 1 not found\n");
+		exit(1);
+	}
+
+	/* The sliced crc16 must match the one byte at a time version */
+	for (i = 0; i < (int) sizeof(buf); i++)
+		buf[i] = random();
+	for (i = 0; i < 64; i++) {
+		unsigned int off = random() % 64, len = random() % 512;
+		unsigned int j;
+
+		csum1 = ext2fs_crc16(i, buf + off, len);
+		csum2 = i;
+		for (j = 0; j < len; j++)
+			csum2 = ext2fs_crc16(csum2, buf + off + j, 1);
+		if (csum1 != csum2) {
+			printf("crc16 of %u bytes at %u: %04x should be %04x\n",
+			       len, off, csum1, csum2);
+			exit(1);
+		}
+	}
+
 	csum1 = ext2fs_group_desc_csum(fs, 0);
 	ext2fs_bg_checksum_set(fs, 0, csum1);
 	print_csum("csum_new", fs, 0);
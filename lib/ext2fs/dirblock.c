@@ -74,6 +74,8 @@ errcode_t ext2fs_read_dir_block(ext2_filsys fs, blk_t block,
 errcode_t ext2fs_write_dir_block3(ext2_filsys fs, blk64_t block,
 				  void *inbuf, int flags EXT2FS_ATTR((unused)))
 {
+	if (fs->pathname_cache)
+		ext2fs_flush_pathname_cache(fs);
 #ifdef WORDS_BIGENDIAN
 	errcode_t	retval;
 	char		*p, *end;
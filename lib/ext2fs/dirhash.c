@@ -13,6 +13,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "ext2_fs.h"
 #include "ext2fs.h"
@@ -173,6 +176,27 @@ static void str2hashbuf(const char *msg, int len, __u32 *buf, int num,
 		*buf++ = pad;
 }
 
+static void init_hash_buf(const __u32 *seed, __u32 buf[4])
+{
+	int	i;
+
+	/* Initialize the default seed for the hash checksum functions */
+	buf[0] = 0x67452301;
+	buf[1] = 0xefcdab89;
+	buf[2] = 0x98badcfe;
+	buf[3] = 0x10325476;
+
+	/* Check to see if the seed is all zero's */
+	if (seed) {
+		for (i=0; i < 4; i++) {
+			if (seed[i])
+				break;
+		}
+		if (i < 4)
+			memcpy(buf, seed, 4 * sizeof(__u32));
+	}
+}
+
 /*
  * Returns the hash of a filename.  If len is 0 and name is NULL, then
  * this function can be used to test whether or not a hash version is
@@ -194,25 +218,10 @@ errcode_t ext2fs_dirhash(int version, const char *name, int len,
 	__u32	hash;
 	__u32	minor_hash = 0;
 	const char	*p;
-	int		i;
 	__u32 		in[8], buf[4];
 	int		unsigned_flag = 0;
 
-	/* Initialize the default seed for the hash checksum functions */
-	buf[0] = 0x67452301;
-	buf[1] = 0xefcdab89;
-	buf[2] = 0x98badcfe;
-	buf[3] = 0x10325476;
-
-	/* Check to see if the seed is all zero's */
-	if (seed) {
-		for (i=0; i < 4; i++) {
-			if (seed[i])
-				break;
-		}
-		if (i < 4)
-			memcpy(buf, seed, sizeof(buf));
-	}
+	init_hash_buf(seed, buf);
 
 	switch (version) {
 	case EXT2_HASH_LEGACY_UNSIGNED:
@@ -258,3 +267,378 @@ errcode_t ext2fs_dirhash(int version, const char *name, int len,
 		*ret_minor_hash = minor_hash;
 	return 0;
 }
+
+#ifdef __SSE2__
+/*
+ * SSE2 versions of the half-MD4 and TEA transforms, which hash four
+ * names at once, one per 32-bit lane.
+ */
+#define VADD(x, y)	_mm_add_epi32(x, y)
+#define VXOR(x, y)	_mm_xor_si128(x, y)
+#define VAND(x, y)	_mm_and_si128(x, y)
+#define VROL(x, s)	_mm_or_si128(_mm_slli_epi32(x, s), \
+				     _mm_srli_epi32(x, 32-(s)))
+
+#define F(x, y, z) VXOR(z, VAND(x, VXOR(y, z)))
+#define G(x, y, z) VADD(VAND(x, y), VAND(VXOR(x, y), z))
+#define H(x, y, z) VXOR(VXOR(x, y), z)
+
+#define ROUND(f, a, b, c, d, x, s)	\
+	(a = VADD(a, VADD(f(b, c, d), x)), a = VROL(a, s))
+
+static void halfMD4Transform_x4(__m128i buf[4], const __m128i in[8])
+{
+	__m128i	a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+	__m128i	k2 = _mm_set1_epi32(013240474631UL);
+	__m128i	k3 = _mm_set1_epi32(015666365641UL);
+
+	/* Round 1 */
+	ROUND(F, a, b, c, d, in[0],  3);
+	ROUND(F, d, a, b, c, in[1],  7);
+	ROUND(F, c, d, a, b, in[2], 11);
+	ROUND(F, b, c, d, a, in[3], 19);
+	ROUND(F, a, b, c, d, in[4],  3);
+	ROUND(F, d, a, b, c, in[5],  7);
+	ROUND(F, c, d, a, b, in[6], 11);
+	ROUND(F, b, c, d, a, in[7], 19);
+
+	/* Round 2 */
+	ROUND(G, a, b, c, d, VADD(in[1], k2),  3);
+	ROUND(G, d, a, b, c, VADD(in[3], k2),  5);
+	ROUND(G, c, d, a, b, VADD(in[5], k2),  9);
+	ROUND(G, b, c, d, a, VADD(in[7], k2), 13);
+	ROUND(G, a, b, c, d, VADD(in[0], k2),  3);
+	ROUND(G, d, a, b, c, VADD(in[2], k2),  5);
+	ROUND(G, c, d, a, b, VADD(in[4], k2),  9);
+	ROUND(G, b, c, d, a, VADD(in[6], k2), 13);
+
+	/* Round 3 */
+	ROUND(H, a, b, c, d, VADD(in[3], k3),  3);
+	ROUND(H, d, a, b, c, VADD(in[7], k3),  9);
+	ROUND(H, c, d, a, b, VADD(in[2], k3), 11);
+	ROUND(H, b, c, d, a, VADD(in[6], k3), 15);
+	ROUND(H, a, b, c, d, VADD(in[1], k3),  3);
+	ROUND(H, d, a, b, c, VADD(in[5], k3),  9);
+	ROUND(H, c, d, a, b, VADD(in[0], k3), 11);
+	ROUND(H, b, c, d, a, VADD(in[4], k3), 15);
+
+	buf[0] = VADD(buf[0], a);
+	buf[1] = VADD(buf[1], b);
+	buf[2] = VADD(buf[2], c);
+	buf[3] = VADD(buf[3], d);
+}
+
+#undef ROUND
+#undef F
+#undef G
+#undef H
+
+static void TEA_transform_x4(__m128i buf[4], const __m128i in[4])
+{
+	__m128i	sum = _mm_setzero_si128();
+	__m128i	delta = _mm_set1_epi32(DELTA);
+	__m128i	b0 = buf[0], b1 = buf[1];
+	int	n = 16;
+
+	do {
+		sum = VADD(sum, delta);
+		b0 = VADD(b0, VXOR(VXOR(VADD(_mm_slli_epi32(b1, 4), in[0]),
+					VADD(b1, sum)),
+				   VADD(_mm_srli_epi32(b1, 5), in[1])));
+		b1 = VADD(b1, VXOR(VXOR(VADD(_mm_slli_epi32(b0, 4), in[2]),
+					VADD(b0, sum)),
+				   VADD(_mm_srli_epi32(b0, 5), in[3])));
+	} while(--n);
+
+	buf[0] = VADD(buf[0], b0);
+	buf[1] = VADD(buf[1], b1);
+}
+
+/*
+ * Same as str2hashbuf(), but a word at a time, and storing every
+ * stride'th word of buf so the words land directly in their lanes.
+ */
+static void str2hashbuf_lane(const char *msg, int len, __u32 *buf, int num,
+			     int stride, int unsigned_flag)
+{
+	const unsigned char *ucp = (const unsigned char *) msg;
+	const signed char *scp = (const signed char *) msg;
+	__u32	pad, val;
+	int	i, j, full;
+
+	pad = (__u32)len | ((__u32)len << 8);
+	pad |= pad << 16;
+
+	if (len > num*4)
+		len = num * 4;
+	full = len / 4;
+	for (i = 0; i < full; i++, ucp += 4, scp += 4) {
+		if (unsigned_flag)
+			val = ((__u32) ucp[0] << 24) + ((__u32) ucp[1] << 16) +
+				((__u32) ucp[2] << 8) + ucp[3];
+		else
+			val = ((__u32) scp[0] << 24) + ((__u32) scp[1] << 16) +
+				((__u32) scp[2] << 8) + (__u32) scp[3];
+		buf[i * stride] = val;
+	}
+	if (i < num) {
+		val = pad;
+		for (j = 0; j < (len & 3); j++)
+			val = (unsigned_flag ? (__u32) ucp[j] :
+			       (__u32) scp[j]) + (val << 8);
+		buf[i++ * stride] = val;
+	}
+	for (; i < num; i++)
+		buf[i * stride] = pad;
+}
+
+/*
+ * Hash all of the names, four at a time.  Each lane works through one
+ * name a chunk per pass, and picks up the next name as soon as its own
+ * is used up, so long names don't hold up the other lanes.
+ */
+static void dirhash_x4(int md4, int unsigned_flag, const __u32 seed_buf[4],
+		       const char * const *names, const int *lens, int count,
+		       ext2_dirhash_t *ret_hash, ext2_dirhash_t *ret_minor_hash)
+{
+	__m128i	buf[4], out[4], in[8], active;
+	__u32	state[4][4], words[8][4], mask[4];
+	int	name[4], off[4], i, k, l, num, chunk, next = 0, busy;
+
+	num = md4 ? 8 : 4;
+	chunk = num * 4;
+	for (l = 0; l < 4; l++)
+		name[l] = -1;
+
+	while (1) {
+		busy = 0;
+		for (l = 0; l < 4; l++) {
+			/* Finish this lane's name and start the next one */
+			while (name[l] < 0 || off[l] >= lens[name[l]]) {
+				if (name[l] >= 0) {
+					i = name[l];
+					ret_hash[i] = state[md4 ? 1 : 0][l] & ~1;
+					if (ret_minor_hash)
+						ret_minor_hash[i] =
+							state[md4 ? 2 : 1][l];
+				}
+				if (next >= count) {
+					name[l] = -1;
+					break;
+				}
+				name[l] = next++;
+				off[l] = 0;
+				for (k = 0; k < 4; k++)
+					state[k][l] = seed_buf[k];
+			}
+			if (name[l] < 0) {
+				for (k = 0; k < num; k++)
+					words[k][l] = 0;
+				mask[l] = 0;
+				continue;
+			}
+			str2hashbuf_lane(names[name[l]] + off[l],
+					 lens[name[l]] - off[l], &words[0][l],
+					 num, 4, unsigned_flag);
+			mask[l] = ~0U;
+			off[l] += chunk;
+			busy++;
+		}
+		if (!busy)
+			break;
+
+		for (k = 0; k < num; k++)
+			in[k] = _mm_loadu_si128((__m128i *) words[k]);
+		active = _mm_loadu_si128((__m128i *) mask);
+		for (k = 0; k < 4; k++)
+			out[k] = buf[k] =
+				_mm_loadu_si128((__m128i *) state[k]);
+		if (md4)
+			halfMD4Transform_x4(out, in);
+		else
+			TEA_transform_x4(out, in);
+		for (k = 0; k < 4; k++) {
+			buf[k] = _mm_or_si128(_mm_and_si128(active, out[k]),
+					      _mm_andnot_si128(active, buf[k]));
+			_mm_storeu_si128((__m128i *) state[k], buf[k]);
+		}
+	}
+}
+
+#undef VADD
+#undef VXOR
+#undef VAND
+#undef VROL
+#endif /* __SSE2__ */
+
+/*
+ * Hash count names at once; names[i] is lens[i] bytes long.  The
+ * results are the same as calling ext2fs_dirhash() on each name, but
+ * where SSE2 is available, several names go through the half-MD4 and
+ * TEA transforms together.  ret_minor_hash may be NULL.
+ */
+errcode_t ext2fs_dirhash_batch(int version, const char * const *names,
+			       const int *lens, int count, const __u32 *seed,
+			       ext2_dirhash_t *ret_hash,
+			       ext2_dirhash_t *ret_minor_hash)
+{
+	errcode_t	retval;
+	int		i = 0;
+#ifdef __SSE2__
+	__u32		buf[4];
+	int		md4, unsigned_flag = 0;
+
+	switch (version) {
+	case EXT2_HASH_HALF_MD4_UNSIGNED:
+	case EXT2_HASH_TEA_UNSIGNED:
+		unsigned_flag++;
+		/* fallthrough */
+	case EXT2_HASH_HALF_MD4:
+	case EXT2_HASH_TEA:
+		md4 = (version == EXT2_HASH_HALF_MD4 ||
+		       version == EXT2_HASH_HALF_MD4_UNSIGNED);
+		init_hash_buf(seed, buf);
+		dirhash_x4(md4, unsigned_flag, buf, names, lens, count,
+			   ret_hash, ret_minor_hash);
+		return 0;
+	}
+#endif
+	for (; i < count; i++) {
+		retval = ext2fs_dirhash(version, names[i], lens[i], seed,
+					&ret_hash[i],
+					ret_minor_hash ? &ret_minor_hash[i] : 0);
+		if (retval)
+			return retval;
+	}
+	return 0;
+}
+
+#ifdef UNITTEST
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define NUM_NAMES	10000
+
+static const int hash_versions[] = {
+	EXT2_HASH_LEGACY, EXT2_HASH_HALF_MD4, EXT2_HASH_TEA,
+	EXT2_HASH_LEGACY_UNSIGNED, EXT2_HASH_HALF_MD4_UNSIGNED,
+	EXT2_HASH_TEA_UNSIGNED, -1
+};
+
+static const __u32 test_seed[4] = {
+	0x4f3f1ba4, 0x2c5e8a77, 0x9e11d3c2, 0x01f0b6e5
+};
+
+static char		*names[NUM_NAMES];
+static int		lens[NUM_NAMES];
+static ext2_dirhash_t	hash[NUM_NAMES], minor_hash[NUM_NAMES];
+
+/*
+ * Names of every length from 0 to 255, with bytes above 0x7f so that
+ * the signed and unsigned variants differ.
+ */
+static void make_names(void)
+{
+	unsigned int	x = 1;
+	int		i, j;
+
+	for (i = 0; i < NUM_NAMES; i++) {
+		lens[i] = (i < 256) ? i : (x >> 16) % 256;
+		names[i] = malloc(lens[i] + 1);
+		if (!names[i]) {
+			fprintf(stderr, "Couldn't allocate names\n");
+			exit(1);
+		}
+		for (j = 0; j < lens[i]; j++) {
+			x = x * 1103515245 + 12345;
+			names[i][j] = (x >> 16) & 0xff;
+		}
+		x = x * 1103515245 + 12345;
+	}
+}
+
+static int test_batch(int version, const __u32 *seed, int count)
+{
+	ext2_dirhash_t	h, m;
+	errcode_t	retval;
+	int		i, failures = 0;
+
+	retval = ext2fs_dirhash_batch(version, (const char * const *) names,
+				      lens, count, seed, hash, minor_hash);
+	if (retval) {
+		printf("Batch hash version %d failed: %ld\n", version,
+		       (long) retval);
+		return 1;
+	}
+	for (i = 0; i < count; i++) {
+		ext2fs_dirhash(version, names[i], lens[i], seed, &h, &m);
+		if (h == hash[i] && m == minor_hash[i])
+			continue;
+		printf("Version %d name %d (len %d): batch %08x:%08x, "
+		       "expected %08x:%08x\n", version, i, lens[i],
+		       hash[i], minor_hash[i], h, m);
+		failures++;
+	}
+	return failures;
+}
+
+static double now(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void benchmark(int loops)
+{
+	ext2_dirhash_t	h, m;
+	double		t;
+	int		i, j, v;
+
+	for (v = 0; hash_versions[v] >= 0; v++) {
+		t = now();
+		for (j = 0; j < loops; j++)
+			for (i = 0; i < NUM_NAMES; i++)
+				ext2fs_dirhash(hash_versions[v], names[i],
+					       lens[i], test_seed, &h, &m);
+		printf("version %d: single %.3fs", hash_versions[v],
+		       now() - t);
+		t = now();
+		for (j = 0; j < loops; j++)
+			ext2fs_dirhash_batch(hash_versions[v],
+					     (const char * const *) names,
+					     lens, NUM_NAMES, test_seed,
+					     hash, minor_hash);
+		printf(", batch %.3fs\n", now() - t);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int	v, failures = 0;
+
+	make_names();
+
+	/* Usage: tst_dirhash [-b loops] to time the two interfaces */
+	if (argc == 3 && !strcmp(argv[1], "-b")) {
+		benchmark(atoi(argv[2]));
+		return 0;
+	}
+
+	for (v = 0; hash_versions[v] >= 0; v++) {
+		failures += test_batch(hash_versions[v], 0, NUM_NAMES);
+		failures += test_batch(hash_versions[v], test_seed, NUM_NAMES);
+		failures += test_batch(hash_versions[v], test_seed, 7);
+	}
+	if (ext2fs_dirhash_batch(42, (const char * const *) names, lens,
+				 NUM_NAMES, 0, hash, 0) !=
+	    EXT2_ET_DIRHASH_UNSUPP) {
+		printf("Unknown hash version not rejected\n");
+		failures++;
+	}
+	if (!failures)
+		printf("Batched directory hashes verified.\n");
+	return failures ? 1 : 0;
+}
+#endif /* UNITTEST */
@@ -42,6 +42,8 @@ errcode_t ext2fs_dup_handle(ext2_filsys src, ext2_filsys *dest)
 	fs->mmp_buf = 0;
 	fs->mmp_cmp = 0;
 	fs->mmp_fd = -1;
+	fs->orig_meta = 0;
+	fs->pathname_cache = 0;
 
 	io_channel_bumpcount(fs->io);
 	if (fs->icache)
@@ -191,6 +191,7 @@ typedef struct ext2_file *ext2_file_t;
 #define EXT2_FLAG_PRINT_PROGRESS	0x40000
 #define EXT2_FLAG_DIRECT_IO		0x80000
 #define EXT2_FLAG_SKIP_MMP		0x100000
+#define EXT2_FLAG_REFRESH_BACKUPS	0x200000
 
 /*
  * Special flag in the ext2 inode i_flag field that means that this is
@@ -273,6 +274,17 @@ struct struct_ext2_filsys {
 	 * Time at which e2fsck last updated the MMP block.
 	 */
 	long mmp_last_written;
+
+	/*
+	 * Metadata as last read from or written to disk, used to avoid
+	 * rewriting unchanged descriptor and bitmap blocks.
+	 */
+	struct ext2_orig_meta *orig_meta;
+
+	/*
+	 * Directory pathnames cached by ext2fs_get_pathname()
+	 */
+	struct ext2_pathname_cache *pathname_cache;
 };
 
 #if EXT2_FLAT_INCLUDES
@@ -316,6 +328,9 @@ struct struct_ext2_filsys {
  * BLOCK_FLAG_READ_ONLY is a promise by the caller that it will not
  * modify returned block number.
  *
+ * BLOCK_FLAG_PREFETCH asks for the extent tree of an extent-mapped
+ * inode to be read in sorted batches (see ext2fs_extent_set_prefetch).
+ *
  * BLOCK_FLAG_NO_LARGE is for internal use only.  It informs
  * ext2fs_block_iterate2 that large files won't be accepted.
  */
@@ -324,6 +339,7 @@ struct struct_ext2_filsys {
 #define BLOCK_FLAG_DEPTH_TRAVERSE	2
 #define BLOCK_FLAG_DATA_ONLY	4
 #define BLOCK_FLAG_READ_ONLY	8
+#define BLOCK_FLAG_PREFETCH	16
 
 #define BLOCK_FLAG_NO_LARGE	0x1000
 
@@ -450,6 +466,28 @@ typedef struct ext2_struct_inode_scan *ext2_inode_scan;
 #define EXT2_SF_SKIP_MISSING_ITABLE	0x0008
 #define EXT2_SF_DO_LAZY		0x0010
 
+/*
+ * A run of on-disk inodes returned by ext2fs_get_next_inode_batch().
+ * The inodes point into the scan's buffer and are only valid until
+ * the next call on the scan; they must not be modified.
+ */
+struct ext2_inode_batch {
+	ext2_ino_t	first_ino;	/* number of the first inode */
+	int		count;		/* number of inodes in the batch */
+	int		inode_size;	/* bytes between inodes */
+	int		flags;		/* EXT2_IB_* flags */
+	const char	*inodes;
+};
+
+/*
+ * ext2_inode_batch flags
+ */
+#define EXT2_IB_BAD_BLOCK	0x0001	/* inode table block is bad */
+
+#define EXT2_BATCH_INODE(batch, i) \
+	((const struct ext2_inode *) ((batch)->inodes + \
+				      (i) * (batch)->inode_size))
+
 /*
  * ext2fs_check_if_mounted flags
  */
@@ -952,6 +990,7 @@ extern void ext2fs_group_desc_csum_set(ext2_filsys fs, dgrp_t group);
 extern int ext2fs_group_desc_csum_verify(ext2_filsys fs, dgrp_t group);
 extern errcode_t ext2fs_set_gdt_csum(ext2_filsys fs);
 extern __u16 ext2fs_group_desc_csum(ext2_filsys fs, dgrp_t group);
+extern dgrp_t ext2fs_group_desc_csum_find_bad(ext2_filsys fs, dgrp_t start);
 
 /* dblist.c */
 
@@ -1022,6 +1061,12 @@ extern errcode_t ext2fs_dirhash(int version, const char *name, int len,
 				const __u32 *seed,
 				ext2_dirhash_t *ret_hash,
 				ext2_dirhash_t *ret_minor_hash);
+extern errcode_t ext2fs_dirhash_batch(int version,
+				      const char * const *names,
+				      const int *lens, int count,
+				      const __u32 *seed,
+				      ext2_dirhash_t *ret_hash,
+				      ext2_dirhash_t *ret_minor_hash);
 
 
 /* dir_iterate.c */
@@ -1096,6 +1141,8 @@ extern errcode_t ext2fs_extent_set_bmap(ext2_extent_handle_t handle,
 					blk64_t logical, blk64_t physical,
 					int flags);
 extern errcode_t ext2fs_extent_delete(ext2_extent_handle_t handle, int flags);
+extern errcode_t ext2fs_extent_set_prefetch(ext2_extent_handle_t handle,
+					    int enable);
 extern errcode_t ext2fs_extent_get_info(ext2_extent_handle_t handle,
 					struct ext2_extent_info *info);
 extern errcode_t ext2fs_extent_goto(ext2_extent_handle_t handle,
@@ -1179,6 +1226,9 @@ extern errcode_t ext2fs_set_generic_bitmap_range(ext2fs_generic_bitmap bmap,
 extern errcode_t ext2fs_find_first_zero_generic_bitmap(ext2fs_generic_bitmap bitmap,
 						       __u32 start, __u32 end,
 						       __u32 *out);
+extern errcode_t ext2fs_find_first_set_generic_bitmap(ext2fs_generic_bitmap bitmap,
+						      __u32 start, __u32 end,
+						      __u32 *out);
 
 /* gen_bitmap64.c */
 
@@ -1266,6 +1316,8 @@ extern errcode_t ext2fs_icount_decrement(ext2_icount_t icount, ext2_ino_t ino,
 					 __u16 *ret);
 extern errcode_t ext2fs_icount_store(ext2_icount_t icount, ext2_ino_t ino,
 				     __u16 count);
+extern errcode_t ext2fs_icount_next(ext2_icount_t icount, ext2_ino_t *ino,
+				    __u32 *count);
 extern ext2_ino_t ext2fs_get_icount_size(ext2_icount_t icount);
 errcode_t ext2fs_icount_validate(ext2_icount_t icount, FILE *);
 
@@ -1285,6 +1337,8 @@ extern errcode_t ext2fs_open_inode_scan(ext2_filsys fs, int buffer_blocks,
 extern void ext2fs_close_inode_scan(ext2_inode_scan scan);
 extern errcode_t ext2fs_get_next_inode(ext2_inode_scan scan, ext2_ino_t *ino,
 			       struct ext2_inode *inode);
+extern errcode_t ext2fs_get_next_inode_batch(ext2_inode_scan scan,
+					     struct ext2_inode_batch *batch);
 extern errcode_t ext2fs_inode_scan_goto_blockgroup(ext2_inode_scan scan,
 						   int	group);
 extern void ext2fs_set_inode_callback
@@ -1388,6 +1442,10 @@ errcode_t ext2fs_rewrite_to_io(ext2_filsys fs, io_channel new_io);
 /* get_pathname.c */
 extern errcode_t ext2fs_get_pathname(ext2_filsys fs, ext2_ino_t dir, ext2_ino_t ino,
 			       char **name);
+extern errcode_t ext2fs_init_pathname_cache(ext2_filsys fs,
+					    unsigned int size);
+extern void ext2fs_flush_pathname_cache(ext2_filsys fs);
+extern void ext2fs_free_pathname_cache(ext2_filsys fs);
 
 /* link.c */
 errcode_t ext2fs_link(ext2_filsys fs, ext2_ino_t dir, const char *name,
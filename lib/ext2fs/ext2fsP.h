@@ -78,6 +78,39 @@ struct ext2_inode_cache_ent {
 	struct ext2_inode	inode;
 };
 
+/*
+ * What is known to be on disk, so that ext2fs_flush() and
+ * ext2fs_write_bitmaps() can skip metadata blocks which have not
+ * changed since they were last read or written.
+ */
+struct ext2_orig_meta {
+	char		*group_desc;	/* primary descriptors, disk order */
+	blk_t		desc_blocks;
+	blk_t		old_desc_blocks;
+	blk64_t		*bitmap_blks;	/* block, then inode, per group */
+	char		*bitmaps;	/* the contents of those blocks */
+	dgrp_t		bitmap_groups;
+};
+
+/*
+ * Pathname cache, indexed by directory inode number modulo size.  The
+ * entry for a directory is only filled in after those of all of its
+ * ancestors, and entries are never replaced, only flushed all at once;
+ * so a change to any directory on a cached path either hits a cached
+ * inode or a directory block and flushes the whole cache.
+ */
+struct ext2_pathname_cache_ent {
+	ext2_ino_t	ino;
+	int		depth;		/* recursion depth the path needs */
+	char		*path;
+};
+
+struct ext2_pathname_cache {
+	unsigned int			size;
+	unsigned int			used;
+	struct ext2_pathname_cache_ent	*cache;
+};
+
 /* Function prototypes */
 
 extern int ext2fs_process_dir_block(ext2_filsys  	fs,
@@ -87,6 +120,13 @@ extern int ext2fs_process_dir_block(ext2_filsys  	fs,
 				    int			ref_offset,
 				    void		*priv_data);
 
+/* get_pathname.c */
+extern void ext2fs_pathname_inode_changed(ext2_filsys fs, ext2_ino_t ino);
+
+/* closefs.c */
+extern struct ext2_orig_meta *ext2fs_get_orig_meta(ext2_filsys fs);
+extern void ext2fs_free_orig_meta(ext2_filsys fs);
+
 /* Generic numeric progress meter */
 
 struct ext2fs_numeric_progress_struct {
@@ -45,6 +45,10 @@ struct extent_path {
 	int		flags;
 	blk64_t		end_blk;
 	void		*curr;
+	/* prefetched copies of the sibling nodes at this level */
+	char		*ra_buf;
+	blk64_t		*ra_blk;
+	int		ra_count;
 };
 
 
@@ -57,9 +61,15 @@ struct ext2_extent_handle {
 	int			type;
 	int			level;
 	int			max_depth;
+	int			prefetch;
 	struct extent_path	*path;
 };
 
+/*
+ * Upper bound on the bytes of tree blocks read by one prefetch batch
+ */
+#define EXTENT_PREFETCH_BYTES	(256 * 1024)
+
 struct ext2_extent_path {
 	errcode_t		magic;
 	int			leaf_height;
@@ -170,6 +180,10 @@ void ext2fs_extent_free(ext2_extent_handle_t handle)
 		for (i=1; i <= handle->max_depth; i++) {
 			if (handle->path[i].buf)
 				ext2fs_free_mem(&handle->path[i].buf);
+			if (handle->path[i].ra_buf)
+				ext2fs_free_mem(&handle->path[i].ra_buf);
+			if (handle->path[i].ra_blk)
+				ext2fs_free_mem(&handle->path[i].ra_blk);
 		}
 		ext2fs_free_mem(&handle->path);
 	}
@@ -267,6 +281,180 @@ errout:
 	return retval;
 }
 
+static void drop_prefetch(ext2_extent_handle_t handle)
+{
+	int	i;
+
+	for (i = 1; i <= handle->max_depth; i++)
+		handle->path[i].ra_count = 0;
+}
+
+/*
+ * Turn batched reads of the extent tree on or off for this handle.
+ * When it is on, the first descent into a child of an index node
+ * reads that child and the siblings following it in traversal order
+ * with a few large sorted reads, and hints the kernel about the rest.
+ * Later descents into those siblings are served from memory.  Any
+ * change made to the tree through the handle discards the copies.
+ */
+errcode_t ext2fs_extent_set_prefetch(ext2_extent_handle_t handle,
+				     int enable)
+{
+	EXT2_CHECK_MAGIC(handle, EXT2_ET_MAGIC_EXTENT_HANDLE);
+
+	if (!enable) {
+		drop_prefetch(handle);
+		handle->prefetch = 0;
+		return 0;
+	}
+	handle->prefetch = EXTENT_PREFETCH_BYTES / handle->fs->blocksize;
+	if (handle->prefetch < 2)
+		handle->prefetch = 2;
+	return 0;
+}
+
+static int blk64_cmp(const void *a, const void *b)
+{
+	blk64_t	ba = *(const blk64_t *) a;
+	blk64_t	bb = *(const blk64_t *) b;
+
+	if (ba < bb)
+		return -1;
+	return ba > bb;
+}
+
+static int prefetch_lookup(struct extent_path *path, blk64_t blk)
+{
+	int	low = 0, high = path->ra_count - 1, mid;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (path->ra_blk[mid] == blk)
+			return mid;
+		if (path->ra_blk[mid] < blk)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+	return -1;
+}
+
+static blk64_t index_leaf(struct ext3_extent_idx *ix)
+{
+	return ext2fs_le32_to_cpu(ix->ei_leaf) +
+		((__u64) ext2fs_le16_to_cpu(ix->ei_leaf_hi) << 32);
+}
+
+/*
+ * Read the children of the current entry of path, starting with the
+ * current one and moving forward (or backward, if backward is set),
+ * into the prefetch area of the level below.
+ */
+static errcode_t prefetch_children(ext2_extent_handle_t handle,
+				   struct extent_path *path, int backward)
+{
+	ext2_filsys		fs = handle->fs;
+	struct extent_path	*newpath = path + 1;
+	struct ext3_extent_idx	*first;
+	blk64_t			blk, start;
+	errcode_t		retval;
+	int			cur, i, j, n, step, count, out;
+
+	if (!newpath->ra_buf) {
+		retval = io_channel_alloc_buf(fs->io, handle->prefetch,
+					      &newpath->ra_buf);
+		if (retval)
+			return retval;
+		retval = ext2fs_get_array(handle->prefetch, sizeof(blk64_t),
+					  &newpath->ra_blk);
+		if (retval) {
+			ext2fs_free_mem(&newpath->ra_buf);
+			return retval;
+		}
+	}
+	newpath->ra_count = 0;
+
+	first = EXT_FIRST_INDEX((struct ext3_extent_header *) path->buf);
+	cur = (struct ext3_extent_idx *) path->curr - first;
+	step = backward ? -1 : 1;
+	count = 0;
+	for (i = cur; i >= 0 && i < path->entries; i += step) {
+		blk = index_leaf(first + i);
+		if (blk < fs->super->s_first_data_block ||
+		    blk >= ext2fs_blocks_count(fs->super))
+			continue;
+		if (count >= handle->prefetch) {
+			/* let the kernel start on the rest of the node */
+			for (n = 0; i >= 0 && i < path->entries &&
+				     n < handle->prefetch; i += step, n++) {
+				blk = index_leaf(first + i);
+				if (blk < ext2fs_blocks_count(fs->super))
+					io_channel_cache_readahead(fs->io,
+								   blk, 1);
+			}
+			break;
+		}
+		newpath->ra_blk[count++] = blk;
+	}
+	if (count == 0)
+		return 0;
+
+	qsort(newpath->ra_blk, count, sizeof(blk64_t), blk64_cmp);
+	for (i = 1, j = 1; i < count; i++)
+		if (newpath->ra_blk[i] != newpath->ra_blk[j - 1])
+			newpath->ra_blk[j++] = newpath->ra_blk[i];
+	count = j;
+
+	/*
+	 * Read each run of adjacent blocks with one request.  A run that
+	 * fails is left out, so that the caller rereads its blocks one
+	 * at a time and reports the error for the right block.
+	 */
+	for (i = 0, out = 0; i < count; i = j) {
+		start = newpath->ra_blk[i];
+		for (j = i + 1; j < count; j++)
+			if (newpath->ra_blk[j] != start + (j - i))
+				break;
+		retval = io_channel_read_blk64(fs->io, start, j - i,
+				newpath->ra_buf + (size_t) out * fs->blocksize);
+		if (retval)
+			continue;
+		if (out != i)
+			memmove(newpath->ra_blk + out, newpath->ra_blk + i,
+				(j - i) * sizeof(blk64_t));
+		out += j - i;
+	}
+	newpath->ra_count = out;
+	return 0;
+}
+
+/*
+ * Read the tree block blk, which the current entry of path points
+ * to, into the buffer of the level below.
+ */
+static errcode_t read_child_node(ext2_extent_handle_t handle,
+				 struct extent_path *path, blk64_t blk,
+				 int backward)
+{
+	struct extent_path	*newpath = path + 1;
+	int			i;
+
+	if (handle->prefetch) {
+		i = prefetch_lookup(newpath, blk);
+		if (i < 0 &&
+		    prefetch_children(handle, path, backward) == 0)
+			i = prefetch_lookup(newpath, blk);
+		if (i >= 0) {
+			memcpy(newpath->buf,
+			       newpath->ra_buf +
+			       (size_t) i * handle->fs->blocksize,
+			       handle->fs->blocksize);
+			return 0;
+		}
+	}
+	return io_channel_read_blk64(handle->fs->io, blk, 1, newpath->buf);
+}
+
 /*
  * This function is responsible for (optionally) moving through the
  * extent tree and then returning the current extent
@@ -439,8 +627,8 @@ retry:
 		    (handle->fs->io != handle->fs->image_io))
 			memset(newpath->buf, 0, handle->fs->blocksize);
 		else {
-			retval = io_channel_read_blk64(handle->fs->io,
-						     blk, 1, newpath->buf);
+			retval = read_child_node(handle, path, blk,
+					op == EXT2_EXTENT_DOWN_AND_LAST);
 			if (retval)
 				return retval;
 		}
@@ -549,6 +737,7 @@ static errcode_t update_path(ext2_extent_handle_t handle)
 		blk = ext2fs_le32_to_cpu(ix->ei_leaf) +
 			((__u64) ext2fs_le16_to_cpu(ix->ei_leaf_hi) << 32);
 
+		drop_prefetch(handle);
 		retval = io_channel_write_blk64(handle->fs->io,
 				      blk, 1, handle->path[handle->level].buf);
 	}
@@ -963,6 +1152,7 @@ errcode_t ext2fs_extent_node_split(ext2_extent_handle_t handle)
 	new_node_start = ext2fs_le32_to_cpu(EXT_FIRST_INDEX(neweh)->ei_block);
 
 	/* ...and write the new node block out to disk. */
+	drop_prefetch(handle);
 	retval = io_channel_write_blk64(handle->fs->io, new_node_pblk, 1,
 					block_buf);
 
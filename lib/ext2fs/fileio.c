@@ -185,14 +185,17 @@ static errcode_t load_buffer(ext2_file_t file, int dontfill)
 	ext2_filsys	fs = file->fs;
 	errcode_t	retval;
 
+	int		ret_flags;
+
 	if (!(file->flags & EXT2_FILE_BUF_VALID)) {
 		retval = ext2fs_bmap2(fs, file->ino, &file->inode,
-				     BMAP_BUFFER, 0, file->blockno, 0,
+				     BMAP_BUFFER, 0, file->blockno, &ret_flags,
 				     &file->physblock);
 		if (retval)
 			return retval;
 		if (!dontfill) {
-			if (file->physblock) {
+			if (file->physblock &&
+			    !(ret_flags & BMAP_RET_UNINIT)) {
 				retval = io_channel_read_blk64(fs->io,
 							       file->physblock,
 							       1, file->buf);
@@ -206,6 +209,226 @@ static errcode_t load_buffer(ext2_file_t file, int dontfill)
 	return 0;
 }
 
+/*
+ * This function maps a run of up to max_blocks logical blocks starting
+ * at lblk.  On return *pblk is the physical block backing lblk (zero
+ * for a hole), and *count is the number of blocks which are either
+ * physically contiguous with it or part of the same hole.  If the run
+ * is an uninitialized extent, BMAP_RET_UNINIT is set in *ret_flags.
+ *
+ * If handle is non-NULL the inode is extent mapped, and the run is
+ * taken from the extent tree directly; otherwise we fall back to
+ * ext2fs_bmap2() a block at a time.
+ */
+static errcode_t map_block_run(ext2_file_t file, ext2_extent_handle_t handle,
+			       blk64_t lblk, blk64_t max_blocks,
+			       blk64_t *pblk, blk64_t *count, int *ret_flags)
+{
+	ext2_filsys		fs = file->fs;
+	struct ext2fs_extent	extent;
+	errcode_t		retval;
+	blk64_t			b, next;
+	int			flags;
+
+	*ret_flags = 0;
+	*count = 1;
+	if (!handle) {
+		retval = ext2fs_bmap2(fs, file->ino, &file->inode,
+				      BMAP_BUFFER, 0, lblk, ret_flags, pblk);
+		if (retval)
+			return retval;
+		while (*count < max_blocks) {
+			retval = ext2fs_bmap2(fs, file->ino, &file->inode,
+					      BMAP_BUFFER, 0, lblk + *count,
+					      &flags, &b);
+			if (retval)
+				return retval;
+			if (*pblk)
+				next = *pblk + *count;
+			else
+				next = 0;
+			if (b != next || flags != *ret_flags)
+				break;
+			(*count)++;
+		}
+		return 0;
+	}
+
+	retval = ext2fs_extent_goto(handle, lblk);
+	if (retval == 0) {
+		retval = ext2fs_extent_get(handle, EXT2_EXTENT_CURRENT,
+					   &extent);
+		if (retval)
+			return retval;
+		*pblk = extent.e_pblk + (lblk - extent.e_lblk);
+		*count = extent.e_lblk + extent.e_len - lblk;
+		if (extent.e_flags & EXT2_EXTENT_FLAGS_UNINIT)
+			*ret_flags |= BMAP_RET_UNINIT;
+		goto out;
+	}
+	if (retval != EXT2_ET_EXTENT_NOT_FOUND)
+		return retval;
+
+	/*
+	 * lblk falls in a hole; find where the next mapped extent
+	 * starts so that the whole hole can be handled at once.
+	 */
+	*pblk = 0;
+	*count = max_blocks;
+	retval = ext2fs_extent_get(handle, EXT2_EXTENT_CURRENT, &extent);
+	if (retval == 0 && extent.e_lblk + extent.e_len <= lblk)
+		retval = ext2fs_extent_get(handle, EXT2_EXTENT_NEXT_LEAF,
+					   &extent);
+	if (retval == EXT2_ET_EXTENT_NO_NEXT || retval == EXT2_ET_NO_CURRENT_NODE)
+		return 0;
+	if (retval)
+		return retval;
+	if (extent.e_lblk > lblk)
+		*count = extent.e_lblk - lblk;
+	else
+		*count = 1;
+out:
+	if (*count > max_blocks)
+		*count = max_blocks;
+	return 0;
+}
+
+/*
+ * Open an extent handle for the file if it is extent mapped; *handle
+ * is left NULL otherwise.
+ */
+static errcode_t open_run_handle(ext2_file_t file,
+				 ext2_extent_handle_t *handle)
+{
+	*handle = NULL;
+	if (!(file->inode.i_flags & EXT4_EXTENTS_FL))
+		return 0;
+	return ext2fs_extent_open2(file->fs, file->ino, &file->inode, handle);
+}
+
+/*
+ * This function reads nblocks whole blocks starting at the (block
+ * aligned) current file position directly into the caller's buffer,
+ * issuing one read for each physically contiguous run of blocks.
+ * Holes and uninitialized extents read back as zeros.
+ */
+static errcode_t file_read_blocks(ext2_file_t file, char *ptr,
+				  blk64_t nblocks)
+{
+	ext2_filsys		fs = file->fs;
+	ext2_extent_handle_t	handle;
+	blk64_t			lblk, pblk, count;
+	int			ret_flags;
+	errcode_t		retval;
+
+	/* Make sure the disk reflects anything still in the buffer */
+	retval = ext2fs_file_flush(file);
+	if (retval)
+		return retval;
+
+	retval = open_run_handle(file, &handle);
+	if (retval)
+		return retval;
+
+	lblk = file->pos / fs->blocksize;
+	while (nblocks > 0) {
+		retval = map_block_run(file, handle, lblk, nblocks,
+				       &pblk, &count, &ret_flags);
+		if (retval)
+			break;
+		if (pblk && !(ret_flags & BMAP_RET_UNINIT)) {
+			retval = io_channel_read_blk64(fs->io, pblk,
+						       count, ptr);
+			if (retval)
+				break;
+		} else
+			memset(ptr, 0, count * fs->blocksize);
+		ptr += count * fs->blocksize;
+		file->pos += count * fs->blocksize;
+		lblk += count;
+		nblocks -= count;
+	}
+
+	if (handle)
+		ext2fs_extent_free(handle);
+	return retval;
+}
+
+/*
+ * This function writes nblocks whole blocks starting at the (block
+ * aligned) current file position directly from the caller's buffer.
+ * Blocks which are already mapped are written one contiguous run at a
+ * time; holes are allocated block by block and the newly allocated
+ * blocks are coalesced into as few writes as possible.
+ */
+static errcode_t file_write_blocks(ext2_file_t file, const char *ptr,
+				   blk64_t nblocks)
+{
+	ext2_filsys		fs = file->fs;
+	ext2_extent_handle_t	handle;
+	blk64_t			lblk, pblk, count, b, i;
+	int			ret_flags;
+	errcode_t		retval;
+
+	lblk = file->pos / fs->blocksize;
+
+	/* The block buffer must not shadow what we write directly */
+	retval = ext2fs_file_flush(file);
+	if (retval)
+		return retval;
+	if (file->blockno >= lblk && file->blockno < lblk + nblocks)
+		file->flags &= ~EXT2_FILE_BUF_VALID;
+
+	retval = open_run_handle(file, &handle);
+	if (retval)
+		return retval;
+
+	while (nblocks > 0) {
+		retval = map_block_run(file, handle, lblk, nblocks,
+				       &pblk, &count, &ret_flags);
+		if (retval)
+			break;
+		if (!pblk) {
+			/*
+			 * Allocate the hole one block at a time, stopping
+			 * as soon as the allocator hands back a block that
+			 * does not extend the current run.
+			 */
+			for (i = 0; i < count; i++) {
+				retval = ext2fs_bmap2(fs, file->ino,
+						      &file->inode,
+						      BMAP_BUFFER, BMAP_ALLOC,
+						      lblk + i, 0, &b);
+				if (retval)
+					goto out;
+				if (i == 0)
+					pblk = b;
+				else if (b != pblk + i)
+					break;
+			}
+			count = i;
+
+			/* The allocation invalidated the extent path */
+			if (handle) {
+				ext2fs_extent_free(handle);
+				retval = open_run_handle(file, &handle);
+				if (retval)
+					goto out;
+			}
+		}
+		retval = io_channel_write_blk64(fs->io, pblk, count, ptr);
+		if (retval)
+			break;
+		ptr += count * fs->blocksize;
+		file->pos += count * fs->blocksize;
+		lblk += count;
+		nblocks -= count;
+	}
+out:
+	if (handle)
+		ext2fs_extent_free(handle);
+	return retval;
+}
 
 errcode_t ext2fs_file_close(ext2_file_t file)
 {
@@ -229,13 +452,33 @@ errcode_t ext2fs_file_read(ext2_file_t file, void *buf,
 	ext2_filsys	fs;
 	errcode_t	retval = 0;
 	unsigned int	start, c, count = 0;
-	__u64		left;
+	__u64		left, pos;
+	blk64_t		nblocks;
 	char		*ptr = (char *) buf;
 
 	EXT2_CHECK_MAGIC(file, EXT2_ET_MAGIC_EXT2_FILE);
 	fs = file->fs;
 
 	while ((file->pos < EXT2_I_SIZE(&file->inode)) && (wanted > 0)) {
+		/*
+		 * If we're block aligned and want at least one whole
+		 * block, bypass the block buffer and read straight into
+		 * the caller's buffer a contiguous run at a time.
+		 */
+		left = EXT2_I_SIZE(&file->inode) - file->pos;
+		nblocks = (left < wanted ? left : wanted) / fs->blocksize;
+		if ((file->pos % fs->blocksize) == 0 && nblocks) {
+			pos = file->pos;
+			retval = file_read_blocks(file, ptr, nblocks);
+			c = file->pos - pos;
+			ptr += c;
+			count += c;
+			wanted -= c;
+			if (retval)
+				goto fail;
+			continue;
+		}
+
 		retval = sync_buffer_position(file);
 		if (retval)
 			goto fail;
@@ -271,6 +514,8 @@ errcode_t ext2fs_file_write(ext2_file_t file, const void *buf,
 	ext2_filsys	fs;
 	errcode_t	retval = 0;
 	unsigned int	start, c, count = 0;
+	__u64		pos;
+	blk64_t		nblocks;
 	const char	*ptr = (const char *) buf;
 
 	EXT2_CHECK_MAGIC(file, EXT2_ET_MAGIC_EXT2_FILE);
@@ -280,6 +525,24 @@ errcode_t ext2fs_file_write(ext2_file_t file, const void *buf,
 		return EXT2_ET_FILE_RO;
 
 	while (nbytes > 0) {
+		/*
+		 * Whole, block aligned writes go straight from the
+		 * caller's buffer to disk.
+		 */
+		nblocks = nbytes / fs->blocksize;
+		if ((file->pos % fs->blocksize) == 0 && nblocks &&
+		    file->ino) {
+			pos = file->pos;
+			retval = file_write_blocks(file, ptr, nblocks);
+			c = file->pos - pos;
+			ptr += c;
+			count += c;
+			nbytes -= c;
+			if (retval)
+				goto fail;
+			continue;
+		}
+
 		retval = sync_buffer_position(file);
 		if (retval)
 			goto fail;
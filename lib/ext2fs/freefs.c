@@ -60,6 +60,12 @@ void ext2fs_free(ext2_filsys fs)
 	if (fs->mmp_cmp)
 		ext2fs_free_mem(&fs->mmp_cmp);
 
+	if (fs->orig_meta)
+		ext2fs_free_orig_meta(fs);
+
+	if (fs->pathname_cache)
+		ext2fs_free_pathname_cache(fs);
+
 	fs->magic = 0;
 
 	ext2fs_free_mem(&fs);
@@ -19,6 +19,13 @@
  * 	<ino> is zero, then ext2fs_get_pathname will return pathname
  * 	of the the directory <dir>.
  *
+ * 	If ext2fs_init_pathname_cache() has been called, the pathnames
+ * 	of the directories walked through are remembered, so that
+ * 	printing many names in the same part of the tree doesn't reread
+ * 	every directory up to the root each time.  The cache is flushed
+ * 	whenever a directory block is written, or a cached directory's
+ * 	inode is written.
+ *
  */
 
 #include <stdio.h>
@@ -28,7 +35,15 @@
 #endif
 
 #include "ext2_fs.h"
-#include "ext2fs.h"
+#include "ext2fsP.h"
+
+/*
+ * Depth reported for names which must not be cached, because they
+ * depend on the recursion limit or on the type of an uncached inode.
+ */
+#define PATHNAME_UNCACHED	1000
+
+#define PATHNAME_CACHE_SIZE	1024
 
 struct get_pathname_struct {
 	ext2_ino_t	search_ino;
@@ -68,19 +83,156 @@ static int get_pathname_proc(struct ext2_dir_entry *dirent,
 	return 0;
 }
 
+errcode_t ext2fs_init_pathname_cache(ext2_filsys fs, unsigned int size)
+{
+	struct ext2_pathname_cache *pc;
+	errcode_t	retval;
+
+	EXT2_CHECK_MAGIC(fs, EXT2_ET_MAGIC_EXT2FS_FILSYS);
+
+	if (fs->pathname_cache)
+		return 0;
+	if (!size)
+		size = PATHNAME_CACHE_SIZE;
+	retval = ext2fs_get_memzero(sizeof(struct ext2_pathname_cache), &pc);
+	if (retval)
+		return retval;
+	retval = ext2fs_get_arrayzero(size,
+				      sizeof(struct ext2_pathname_cache_ent),
+				      &pc->cache);
+	if (retval) {
+		ext2fs_free_mem(&pc);
+		return retval;
+	}
+	pc->size = size;
+	fs->pathname_cache = pc;
+	return 0;
+}
+
+void ext2fs_flush_pathname_cache(ext2_filsys fs)
+{
+	struct ext2_pathname_cache *pc = fs->pathname_cache;
+	unsigned int	i;
+
+	if (!pc || !pc->used)
+		return;
+	for (i = 0; i < pc->size; i++) {
+		if (!pc->cache[i].ino)
+			continue;
+		ext2fs_free_mem(&pc->cache[i].path);
+		pc->cache[i].ino = 0;
+	}
+	pc->used = 0;
+}
+
+void ext2fs_free_pathname_cache(ext2_filsys fs)
+{
+	struct ext2_pathname_cache *pc = fs->pathname_cache;
+
+	if (!pc)
+		return;
+	ext2fs_flush_pathname_cache(fs);
+	ext2fs_free_mem(&pc->cache);
+	ext2fs_free_mem(&fs->pathname_cache);
+}
+
+/*
+ * Called when an inode is written; if it is a cached directory, every
+ * name cached below it may have changed.
+ */
+void ext2fs_pathname_inode_changed(ext2_filsys fs, ext2_ino_t ino)
+{
+	struct ext2_pathname_cache *pc = fs->pathname_cache;
+
+	if (pc->used && pc->cache[ino % pc->size].ino == ino)
+		ext2fs_flush_pathname_cache(fs);
+}
+
+static struct ext2_pathname_cache_ent *cache_lookup(ext2_filsys fs,
+						    ext2_ino_t dir,
+						    int maxdepth)
+{
+	struct ext2_pathname_cache_ent *ent;
+
+	if (!fs->pathname_cache)
+		return 0;
+	ent = &fs->pathname_cache->cache[dir % fs->pathname_cache->size];
+	if (ent->ino != dir || ent->depth > maxdepth)
+		return 0;
+	return ent;
+}
+
+static errcode_t copy_pathname(const char *path, char **name)
+{
+	errcode_t	retval;
+
+	retval = ext2fs_get_mem(strlen(path) + 1, name);
+	if (retval)
+		return retval;
+	strcpy(*name, path);
+	return 0;
+}
+
+static errcode_t ext2fs_get_pathname_int(ext2_filsys fs, ext2_ino_t dir,
+					 ext2_ino_t ino, int maxdepth,
+					 char *buf, char **name, int *depth);
+
+/*
+ * Return the pathname of directory <dir>, whose ".." entry is
+ * <parent>, along with the smallest maxdepth which yields the same
+ * name.  Since <parent> is always read from <dir> itself, the name
+ * only depends on <dir> and can be cached under its inode number.
+ */
+static errcode_t get_dir_pathname(ext2_filsys fs, ext2_ino_t parent,
+				  ext2_ino_t dir, int maxdepth,
+				  char *buf, char **name, int *depth)
+{
+	struct ext2_pathname_cache *pc = fs->pathname_cache;
+	struct ext2_pathname_cache_ent *ent;
+	errcode_t	retval;
+
+	ent = cache_lookup(fs, dir, maxdepth);
+	if (ent) {
+		*depth = ent->depth;
+		return copy_pathname(ent->path, name);
+	}
+
+	retval = ext2fs_get_pathname_int(fs, parent, dir, maxdepth,
+					 buf, name, depth);
+	if (retval || !pc || *depth > maxdepth)
+		return retval;
+
+	/*
+	 * Entries are never replaced, so that the directories above a
+	 * cached one stay cached until the next flush.  If this one
+	 * can't be cached, neither can any directory below it.
+	 */
+	ent = &pc->cache[dir % pc->size];
+	if (ent->ino || copy_pathname(*name, &ent->path)) {
+		*depth = PATHNAME_UNCACHED;
+		return 0;
+	}
+	ent->ino = dir;
+	ent->depth = *depth;
+	pc->used++;
+	return 0;
+}
+
 static errcode_t ext2fs_get_pathname_int(ext2_filsys fs, ext2_ino_t dir,
 					 ext2_ino_t ino, int maxdepth,
-					 char *buf, char **name)
+					 char *buf, char **name, int *depth)
 {
 	struct get_pathname_struct gp;
 	char	*parent_name = 0, *ret;
 	errcode_t	retval;
+	int	parent_depth;
 
 	if (dir == ino) {
 		retval = ext2fs_get_mem(2, name);
 		if (retval)
 			return retval;
 		strcpy(*name, (dir == EXT2_ROOT_INO) ? "/" : ".");
+		*depth = -1;
 		return 0;
 	}
 
@@ -89,6 +241,7 @@ static errcode_t ext2fs_get_pathname_int(ext2_filsys fs, ext2_ino_t dir,
 		if (retval)
 			return retval;
 		strcpy(*name, "...");
+		*depth = dir ? PATHNAME_UNCACHED : -1;
 		return 0;
 	}
 
@@ -109,6 +262,7 @@ static errcode_t ext2fs_get_pathname_int(ext2_filsys fs, ext2_ino_t dir,
 		if (retval)
 			goto cleanup;
 		strcpy(*name, tmp);
+		*depth = PATHNAME_UNCACHED;
 		return 0;
 	} else if (retval)
 		goto cleanup;
@@ -117,10 +271,11 @@ static errcode_t ext2fs_get_pathname_int(ext2_filsys fs, ext2_ino_t dir,
 		goto cleanup;
 	}
 
-	retval = ext2fs_get_pathname_int(fs, gp.parent, dir, maxdepth-1,
-					 buf, &parent_name);
+	retval = get_dir_pathname(fs, gp.parent, dir, maxdepth-1,
+				  buf, &parent_name, &parent_depth);
 	if (retval)
 		goto cleanup;
+	*depth = parent_depth + 1;
 	if (!ino) {
 		*name = parent_name;
 		return 0;
@@ -154,17 +309,22 @@ cleanup:
 errcode_t ext2fs_get_pathname(ext2_filsys fs, ext2_ino_t dir, ext2_ino_t ino,
 			      char **name)
 {
+	struct ext2_pathname_cache_ent *ent;
 	char	*buf;
 	errcode_t	retval;
+	int	depth;
 
 	EXT2_CHECK_MAGIC(fs, EXT2_ET_MAGIC_EXT2FS_FILSYS);
 
+	if (dir == ino)
+		ino = 0;
+	if (!ino && dir && (ent = cache_lookup(fs, dir, 31)))
+		return copy_pathname(ent->path, name);
+
 	retval = ext2fs_get_mem(fs->blocksize, &buf);
 	if (retval)
 		return retval;
-	if (dir == ino)
-		ino = 0;
-	retval = ext2fs_get_pathname_int(fs, dir, ino, 32, buf, name);
+	retval = ext2fs_get_pathname_int(fs, dir, ino, 32, buf, name, &depth);
 	ext2fs_free_mem(&buf);
 	return retval;
 
@@ -58,6 +58,9 @@ struct ext2_icount {
 	struct ext2_icount_el	*last_lookup;
 	char			*tdb_fn;
 	TDB_CONTEXT		*tdb;
+	ext2_ino_t		*tdb_keys;	/* sorted, for icount_next */
+	ext2_ino_t		tdb_nkeys, tdb_maxkeys;
+	int			tdb_keys_valid;
 };
 
 /*
@@ -83,6 +86,8 @@ void ext2fs_free_icount(ext2_icount_t icount)
 		ext2fs_free_inode_bitmap(icount->multiple);
 	if (icount->tdb)
 		tdb_close(icount->tdb);
+	if (icount->tdb_keys)
+		ext2fs_free_mem(&icount->tdb_keys);
 	if (icount->tdb_fn) {
 		unlink(icount->tdb_fn);
 		free(icount->tdb_fn);
@@ -400,6 +405,7 @@ static errcode_t set_inode_count(ext2_icount_t icount, ext2_ino_t ino,
 	TDB_DATA key, data;
 
 	if (icount->tdb) {
+		icount->tdb_keys_valid = 0;
 		key.dptr = (unsigned char *) &ino;
 		key.dsize = sizeof(ext2_ino_t);
 		data.dptr = (unsigned char *) &count;
@@ -634,6 +640,139 @@ errcode_t ext2fs_icount_store(ext2_icount_t icount, ext2_ino_t ino,
 	return 0;
 }
 
+static int tdb_key_cmp(const void *a, const void *b)
+{
+	ext2_ino_t	i = *(const ext2_ino_t *) a;
+	ext2_ino_t	j = *(const ext2_ino_t *) b;
+
+	return (i > j) - (i < j);
+}
+
+struct tdb_keys_struct {
+	ext2_icount_t	icount;
+	errcode_t	err;
+};
+
+static int add_tdb_key(TDB_CONTEXT *tdb EXT2FS_ATTR((unused)),
+		       TDB_DATA key, TDB_DATA data EXT2FS_ATTR((unused)),
+		       void *priv)
+{
+	struct tdb_keys_struct *ks = (struct tdb_keys_struct *) priv;
+	ext2_icount_t	icount = ks->icount;
+	ext2_ino_t	max;
+
+	if (key.dsize != sizeof(ext2_ino_t))
+		return 0;
+	if (icount->tdb_nkeys >= icount->tdb_maxkeys) {
+		max = icount->tdb_maxkeys ? icount->tdb_maxkeys * 2 : 1024;
+		ks->err = ext2fs_resize_mem(icount->tdb_maxkeys *
+					    sizeof(ext2_ino_t),
+					    max * sizeof(ext2_ino_t),
+					    &icount->tdb_keys);
+		if (ks->err)
+			return 1;
+		icount->tdb_maxkeys = max;
+	}
+	icount->tdb_keys[icount->tdb_nkeys++] = *(ext2_ino_t *) key.dptr;
+	return 0;
+}
+
+/*
+ * The tdb is not ordered by inode number, so collect and sort its keys
+ * once, rather than looking up every inode number in turn.
+ */
+static errcode_t load_tdb_keys(ext2_icount_t icount)
+{
+	struct tdb_keys_struct ks;
+
+	ks.icount = icount;
+	ks.err = 0;
+	icount->tdb_nkeys = 0;
+	if (tdb_traverse(icount->tdb, add_tdb_key, &ks) < 0)
+		return tdb_error(icount->tdb) + EXT2_ET_TDB_SUCCESS;
+	if (ks.err)
+		return ks.err;
+	qsort(icount->tdb_keys, icount->tdb_nkeys, sizeof(ext2_ino_t),
+	      tdb_key_cmp);
+	icount->tdb_keys_valid = 1;
+	return 0;
+}
+
+/*
+ * Find the first inode after *ino whose count is not zero, and return
+ * it in *ino with its full (untruncated) count.  Returns ENOENT when
+ * there is no such inode.
+ */
+errcode_t ext2fs_icount_next(ext2_icount_t icount, ext2_ino_t *ino,
+			     __u32 *count)
+{
+	ext2_ino_t	start = *ino + 1, next, lnext;
+	int		low, high, mid;
+	errcode_t	retval;
+
+	EXT2_CHECK_MAGIC(icount, EXT2_ET_MAGIC_ICOUNT);
+
+	if (icount->tdb && !icount->tdb_keys_valid) {
+		retval = load_tdb_keys(icount);
+		if (retval)
+			return retval;
+	}
+	while (start && start <= icount->num_inodes) {
+		if (ext2fs_find_first_set_inode_bitmap2(icount->single, start,
+							icount->num_inodes,
+							&next))
+			next = 0;
+		if (icount->tdb) {
+			low = 0;
+			high = (int) icount->tdb_nkeys - 1;
+			while (low <= high) {
+				mid = ((unsigned)low + (unsigned)high) >> 1;
+				if (icount->tdb_keys[mid] < start)
+					low = mid + 1;
+				else
+					high = mid - 1;
+			}
+			lnext = (low < (int) icount->tdb_nkeys) ?
+				icount->tdb_keys[low] : 0;
+		} else if (icount->cursor < icount->count &&
+			   icount->list[icount->cursor].ino >= start &&
+			   (icount->cursor == 0 ||
+			    icount->list[icount->cursor - 1].ino < start)) {
+			/* sequential walks hit the lookup cursor */
+			lnext = icount->list[icount->cursor].ino;
+		} else {
+			low = 0;
+			high = (int) icount->count - 1;
+			while (low <= high) {
+				mid = ((unsigned)low + (unsigned)high) >> 1;
+				if (icount->list[mid].ino < start)
+					low = mid + 1;
+				else
+					high = mid - 1;
+			}
+			lnext = (low < (int) icount->count) ?
+				icount->list[low].ino : 0;
+		}
+		if (next && (!lnext || next <= lnext)) {
+			*ino = next;
+			*count = 1;
+			return 0;
+		}
+		if (!lnext)
+			break;
+		if (!icount->multiple ||
+		    ext2fs_test_inode_bitmap2(icount->multiple, lnext)) {
+			get_inode_count(icount, lnext, count);
+			if (*count) {
+				*ino = lnext;
+				return 0;
+			}
+		}
+		start = lnext + 1;
+	}
+	return ENOENT;
+}
+
 ext2_ino_t ext2fs_get_icount_size(ext2_icount_t icount)
 {
 	if (!icount || icount->magic != EXT2_ET_MAGIC_ICOUNT)
@@ -748,6 +887,34 @@ static void setup(void)
 	}
 }
 
+/*
+ * Check that ext2fs_icount_next() visits exactly the inodes with a
+ * non-zero count, in order.
+ */
+static int check_next(ext2_icount_t icount)
+{
+	ext2_ino_t	ino, next = 0;
+	__u32		count;
+	__u16		result;
+
+	for (ino = 1; ino <= test_fs->super->s_inodes_count; ino++) {
+		ext2fs_icount_fetch(icount, ino, &result);
+		if (!result)
+			continue;
+		if (ext2fs_icount_next(icount, &next, &count) ||
+		    next != ino || icount_16_xlate(count) != result) {
+			printf("icount_next: expected %u (%u), got %u (NOT OK)\n",
+			       ino, result, next);
+			return 1;
+		}
+	}
+	if (ext2fs_icount_next(icount, &next, &count) != ENOENT) {
+		printf("icount_next: unexpected inode %u (NOT OK)\n", next);
+		return 1;
+	}
+	return 0;
+}
+
 int run_test(int flags, int size, char *dir, struct test_program *prog)
 {
 	errcode_t	retval;
@@ -816,6 +983,7 @@ int run_test(int flags, int size, char *dir, struct test_program *prog)
 		if (result != pc->expected)
 			problem++;
 	}
+	problem += check_next(icount);
 	printf("icount size is %u\n", ext2fs_get_icount_size(icount));
 	retval = ext2fs_icount_validate(icount, stdout);
 	if (retval) {
@@ -516,6 +516,94 @@ errcode_t ext2fs_get_next_inode(ext2_inode_scan scan, ext2_ino_t *ino,
 						sizeof(struct ext2_inode));
 }
 
+/*
+ * Return the next run of inodes from the scan without copying them.
+ * A batch never crosses a block group, and, like the single inode
+ * interface, skips uninitialized groups and the unused tail of each
+ * inode table when bg_itable_unused is valid.  If the inodes came
+ * from a bad block of the inode table, EXT2_IB_BAD_BLOCK is set and
+ * they are all zero.  A count of zero means the scan is finished.
+ */
+errcode_t ext2fs_get_next_inode_batch(ext2_inode_scan scan,
+				      struct ext2_inode_batch *batch)
+{
+	errcode_t	retval;
+	ext2_ino_t	count;
+#ifdef WORDS_BIGENDIAN
+	ext2_ino_t	i;
+#endif
+
+	EXT2_CHECK_MAGIC(scan, EXT2_ET_MAGIC_INODE_SCAN);
+
+	memset(batch, 0, sizeof(struct ext2_inode_batch));
+	batch->inode_size = scan->inode_size;
+
+	if (scan->inodes_left <= 0) {
+	force_new_group:
+		if (scan->done_group) {
+			retval = (scan->done_group)
+				(scan->fs, scan, scan->current_group,
+				 scan->done_group_data);
+			if (retval)
+				return retval;
+		}
+		if (scan->groups_left <= 0)
+			return 0;
+		retval = get_next_blockgroup(scan);
+		if (retval)
+			return retval;
+	}
+	if ((scan->scan_flags & EXT2_SF_DO_LAZY) &&
+	    (ext2fs_bg_flags_test(scan->fs, scan->current_group,
+				  EXT2_BG_INODE_UNINIT)))
+		goto force_new_group;
+	if (scan->inodes_left == 0)
+		goto force_new_group;
+	if (scan->current_block == 0) {
+		if (scan->scan_flags & EXT2_SF_SKIP_MISSING_ITABLE)
+			goto force_new_group;
+		else
+			return EXT2_ET_MISSING_INODE_TABLE;
+	}
+
+	/*
+	 * The inode size divides the block size, so whole inodes are
+	 * always left in the buffer; a mix of single inode and batch
+	 * calls simply continues where the buffer left off.
+	 */
+	if (scan->bytes_left < scan->inode_size) {
+		retval = get_next_blocks(scan);
+		if (retval)
+			return retval;
+	}
+
+	count = scan->bytes_left / scan->inode_size;
+	if (count > scan->inodes_left)
+		count = scan->inodes_left;
+
+	batch->first_ino = scan->current_inode + 1;
+	batch->count = count;
+	batch->inodes = scan->ptr;
+	if (scan->scan_flags & EXT2_SF_BAD_INODE_BLK)
+		batch->flags |= EXT2_IB_BAD_BLOCK;
+
+#ifdef WORDS_BIGENDIAN
+	for (i = 0; i < count; i++)
+		ext2fs_swap_inode_full(scan->fs,
+			(struct ext2_inode_large *)
+				(scan->ptr + i * scan->inode_size),
+			(struct ext2_inode_large *)
+				(scan->ptr + i * scan->inode_size),
+			0, scan->inode_size);
+#endif
+
+	scan->ptr += count * scan->inode_size;
+	scan->bytes_left -= count * scan->inode_size;
+	scan->inodes_left -= count;
+	scan->current_inode += count;
+	return 0;
+}
+
 /*
  * Functions to read and write a single inode.
  */
@@ -647,6 +735,9 @@ errcode_t ext2fs_write_inode_full(ext2_filsys fs, ext2_ino_t ino,
 			return retval;
 	}
 
+	if (fs->pathname_cache)
+		ext2fs_pathname_inode_changed(fs, ino);
+
 	/* Check to see if the inode cache needs to be updated */
 	if (fs->icache) {
 		for (i=0; i < fs->icache->cache_size; i++) {
@@ -111,6 +111,23 @@ errcode_t io_channel_discard(io_channel channel, unsigned long long block,
 	return EXT2_ET_UNIMPLEMENTED;
 }
 
+/*
+ * Hint that the given blocks will be read soon.  This never blocks
+ * on the I/O, and it is fine for an io_manager not to support it.
+ */
+errcode_t io_channel_cache_readahead(io_channel channel,
+				     unsigned long long block,
+				     unsigned long long count)
+{
+	EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
+
+	if (channel->manager->cache_readahead)
+		return (channel->manager->cache_readahead)(channel, block,
+							   count);
+
+	return EXT2_ET_UNIMPLEMENTED;
+}
+
 errcode_t io_channel_alloc_buf(io_channel io, int count, void *ptr)
 {
 	size_t	size;
@@ -29,7 +29,7 @@
 #include "ext2_fs.h"
 
 
-#include "ext2fs.h"
+#include "ext2fsP.h"
 #include "e2image.h"
 
 blk64_t ext2fs_descriptor_block_loc2(ext2_filsys fs, blk64_t group_block,
@@ -380,6 +380,31 @@ errcode_t ext2fs_open2(const char *name, const char *io_options,
 		dest += fs->blocksize;
 	}
 
+	/*
+	 * Keep a copy of the primary descriptors as they are on disk, so
+	 * that ext2fs_flush() only has to write the blocks that change.
+	 */
+	if (fs->orig_super && (flags & EXT2_FLAG_RW) &&
+	    !(flags & EXT2_FLAG_IMAGE_FILE)) {
+		struct ext2_orig_meta *meta = ext2fs_get_orig_meta(fs);
+
+		if (meta && !ext2fs_get_array(fs->desc_blocks, fs->blocksize,
+					      &meta->group_desc)) {
+			memcpy(meta->group_desc, fs->group_desc,
+			       (size_t) fs->desc_blocks * fs->blocksize);
+#ifdef WORDS_BIGENDIAN
+			for (j = 0; j < fs->group_desc_count; j++) {
+				gdp = ext2fs_group_desc(fs,
+					(struct opaque_ext2_group_desc *)
+					meta->group_desc, j);
+				ext2fs_swap_group_desc2(fs, gdp);
+			}
+#endif
+			meta->desc_blocks = fs->desc_blocks;
+			meta->old_desc_blocks = first_meta_bg;
+		}
+	}
+
 	fs->stride = fs->super->s_raid_stride;
 
 	/*
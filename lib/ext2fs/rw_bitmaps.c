@@ -24,9 +24,115 @@
 #endif
 
 #include "ext2_fs.h"
-#include "ext2fs.h"
+#include "ext2fsP.h"
 #include "e2image.h"
 
+/* Largest number of bitmap blocks read or written in one request */
+#define BITMAP_IO_RUN		256
+
+/* A run of adjacent bitmap blocks waiting to be written */
+struct bitmap_run {
+	char		*buf;
+	blk64_t		blk;
+	unsigned int	count;
+	unsigned int	max;
+	errcode_t	err;	/* returned if the write fails */
+};
+
+/*
+ * Find the on-disk copy of a group's bitmap block.  Returns 0 and
+ * leaves *blk and *data alone if it is not being tracked; only
+ * read-write file systems keep track.  *blk is 0 until the block has
+ * been read or written.
+ */
+static int orig_bitmap(ext2_filsys fs, dgrp_t group, int do_inode,
+		       blk64_t **blk, char **data)
+{
+	struct ext2_orig_meta *meta;
+	size_t		i = (size_t) group * 2 + do_inode;
+
+	if (!(fs->flags & EXT2_FLAG_RW) || (fs->flags & EXT2_FLAG_IMAGE_FILE))
+		return 0;
+	meta = ext2fs_get_orig_meta(fs);
+	if (!meta)
+		return 0;
+	if (meta->bitmap_groups != fs->group_desc_count) {
+		if (meta->bitmap_blks)
+			ext2fs_free_mem(&meta->bitmap_blks);
+		if (meta->bitmaps)
+			ext2fs_free_mem(&meta->bitmaps);
+		meta->bitmap_groups = 0;
+		if (ext2fs_get_memzero((size_t) fs->group_desc_count * 2 *
+				       sizeof(blk64_t), &meta->bitmap_blks))
+			return 0;
+		if (ext2fs_get_array((size_t) fs->group_desc_count * 2,
+				     fs->blocksize, &meta->bitmaps)) {
+			ext2fs_free_mem(&meta->bitmap_blks);
+			return 0;
+		}
+		meta->bitmap_groups = fs->group_desc_count;
+	}
+	*blk = &meta->bitmap_blks[i];
+	*data = meta->bitmaps + i * fs->blocksize;
+	return 1;
+}
+
+static void forget_orig_bitmaps(ext2_filsys fs)
+{
+	struct ext2_orig_meta *meta = fs->orig_meta;
+
+	if (meta && meta->bitmap_blks) {
+		ext2fs_free_mem(&meta->bitmap_blks);
+		ext2fs_free_mem(&meta->bitmaps);
+		meta->bitmap_groups = 0;
+	}
+}
+
+static errcode_t flush_bitmap_run(ext2_filsys fs, struct bitmap_run *run)
+{
+	errcode_t	retval;
+
+	if (!run->count)
+		return 0;
+	retval = io_channel_write_blk64(fs->io, run->blk, run->count,
+					run->buf);
+	run->count = 0;
+	return retval ? run->err : 0;
+}
+
+/*
+ * Queue one bitmap block for writing, unless it is known to be on disk
+ * already.  Blocks which follow each other on disk, as they do with
+ * flex_bg, are written together.
+ */
+static errcode_t write_bitmap_block(ext2_filsys fs, struct bitmap_run *run,
+				    dgrp_t group, int do_inode, blk64_t blk,
+				    char *buf)
+{
+	blk64_t		*orig_blk;
+	char		*orig;
+	errcode_t	retval;
+
+	if (orig_bitmap(fs, group, do_inode, &orig_blk, &orig)) {
+		if (*orig_blk == blk && !memcmp(orig, buf, fs->blocksize))
+			return 0;
+		*orig_blk = blk;
+		memcpy(orig, buf, fs->blocksize);
+	}
+	if (run->count &&
+	    (blk != run->blk + run->count || run->count == run->max)) {
+		retval = flush_bitmap_run(fs, run);
+		if (retval)
+			return retval;
+	}
+	if (!run->count)
+		run->blk = blk;
+	memcpy(run->buf + (size_t) run->count * fs->blocksize, buf,
+	       fs->blocksize);
+	run->count++;
+	return 0;
+}
+
 static errcode_t write_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 {
 	dgrp_t 		i;
@@ -35,6 +141,7 @@ static errcode_t write_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 	unsigned int	nbits;
 	errcode_t	retval;
 	char		*block_buf = NULL, *inode_buf = NULL;
+	struct bitmap_run block_run, inode_run;
 	int		csum_flag = 0;
 	blk64_t		blk;
 	blk64_t		blk_itr = EXT2FS_B2C(fs, fs->super->s_first_data_block);
@@ -49,6 +156,14 @@ static errcode_t write_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 				       EXT4_FEATURE_RO_COMPAT_GDT_CSUM))
 		csum_flag = 1;
 
+	memset(&block_run, 0, sizeof(block_run));
+	memset(&inode_run, 0, sizeof(inode_run));
+	block_run.max = inode_run.max = BITMAP_IO_RUN;
+	if (block_run.max > fs->group_desc_count)
+		block_run.max = inode_run.max = fs->group_desc_count;
+	block_run.err = EXT2_ET_BLOCK_BITMAP_WRITE;
+	inode_run.err = EXT2_ET_INODE_BITMAP_WRITE;
+
 	inode_nbytes = block_nbytes = 0;
 	if (do_block) {
 		block_nbytes = EXT2_CLUSTERS_PER_GROUP(fs->super) / 8;
@@ -56,6 +171,10 @@ static errcode_t write_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 		if (retval)
 			goto errout;
 		memset(block_buf, 0xff, fs->blocksize);
+		retval = io_channel_alloc_buf(fs->io, block_run.max,
+					      &block_run.buf);
+		if (retval)
+			goto errout;
 	}
 	if (do_inode) {
 		inode_nbytes = (size_t)
@@ -64,6 +183,10 @@ static errcode_t write_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 		if (retval)
 			goto errout;
 		memset(inode_buf, 0xff, fs->blocksize);
+		retval = io_channel_alloc_buf(fs->io, inode_run.max,
+					      &inode_run.buf);
+		if (retval)
+			goto errout;
 	}
 
 	for (i = 0; i < fs->group_desc_count; i++) {
@@ -91,12 +214,10 @@ static errcode_t write_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 		}
 		blk = ext2fs_block_bitmap_loc(fs, i);
 		if (blk) {
-			retval = io_channel_write_blk64(fs->io, blk, 1,
-							block_buf);
-			if (retval) {
-				retval = EXT2_ET_BLOCK_BITMAP_WRITE;
+			retval = write_bitmap_block(fs, &block_run, i, 0, blk,
+						    block_buf);
+			if (retval)
 				goto errout;
-			}
 		}
 	skip_this_block_bitmap:
 		blk_itr += block_nbytes << 3;
@@ -116,43 +237,168 @@ static errcode_t write_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 
 		blk = ext2fs_inode_bitmap_loc(fs, i);
 		if (blk) {
-			retval = io_channel_write_blk64(fs->io, blk, 1,
-						      inode_buf);
-			if (retval) {
-				retval = EXT2_ET_INODE_BITMAP_WRITE;
+			retval = write_bitmap_block(fs, &inode_run, i, 1, blk,
+						    inode_buf);
+			if (retval)
 				goto errout;
-			}
 		}
 	skip_this_inode_bitmap:
 		ino_itr += inode_nbytes << 3;
 
 	}
+	retval = flush_bitmap_run(fs, &block_run);
+	if (retval)
+		goto errout;
+	retval = flush_bitmap_run(fs, &inode_run);
+	if (retval)
+		goto errout;
 	if (do_block) {
 		fs->flags &= ~EXT2_FLAG_BB_DIRTY;
 		ext2fs_free_mem(&block_buf);
+		ext2fs_free_mem(&block_run.buf);
 	}
 	if (do_inode) {
 		fs->flags &= ~EXT2_FLAG_IB_DIRTY;
 		ext2fs_free_mem(&inode_buf);
+		ext2fs_free_mem(&inode_run.buf);
 	}
 	return 0;
 errout:
+	/* Some of what we recorded as written may not have been */
+	forget_orig_bitmaps(fs);
 	if (inode_buf)
 		ext2fs_free_mem(&inode_buf);
 	if (block_buf)
 		ext2fs_free_mem(&block_buf);
+	if (inode_run.buf)
+		ext2fs_free_mem(&inode_run.buf);
+	if (block_run.buf)
+		ext2fs_free_mem(&block_run.buf);
+	return retval;
+}
+
+/*
+ * Where group's bitmap lives on disk, or 0 if it has none or is known
+ * to be uninitialized.
+ */
+static blk64_t bitmap_block(ext2_filsys fs, dgrp_t group, int do_inode,
+			    int csum_flag)
+{
+	if (do_inode) {
+		if (csum_flag &&
+		    ext2fs_bg_flags_test(fs, group, EXT2_BG_INODE_UNINIT) &&
+		    ext2fs_group_desc_csum_verify(fs, group))
+			return 0;
+		return ext2fs_inode_bitmap_loc(fs, group);
+	}
+	if (csum_flag &&
+	    ext2fs_bg_flags_test(fs, group, EXT2_BG_BLOCK_UNINIT) &&
+	    ext2fs_group_desc_csum_verify(fs, group))
+		return 0;
+	return ext2fs_block_bitmap_loc(fs, group);
+}
+
+static errcode_t set_group_bitmap(ext2_filsys fs, dgrp_t group, int do_inode,
+				  int nbytes, char *buf)
+{
+	blk64_t		blk_itr;
+	ext2_ino_t	ino_itr;
+
+	if (do_inode) {
+		ino_itr = 1 + (ext2_ino_t) group * (nbytes << 3);
+		return ext2fs_set_inode_bitmap_range2(fs->inode_map, ino_itr,
+						      nbytes << 3, buf);
+	}
+	blk_itr = EXT2FS_B2C(fs, fs->super->s_first_data_block) +
+		(blk64_t) group * (nbytes << 3);
+	return ext2fs_set_block_bitmap_range2(fs->block_map, blk_itr,
+					      nbytes << 3, buf);
+}
+
+/*
+ * Load the block or inode bitmap of every group.  With flex_bg the
+ * bitmaps of consecutive groups sit in consecutive blocks, so instead
+ * of one read per group, read each run of adjacent bitmap blocks (up
+ * to BITMAP_IO_RUN of them) with a single request.
+ */
+static errcode_t read_bitmap_runs(ext2_filsys fs, int do_inode, int nbytes)
+{
+	dgrp_t		i, j, first = 0;
+	blk64_t		blk, run_blk = 0;
+	unsigned int	run = 0, max_run = BITMAP_IO_RUN;
+	int		csum_flag = 0;
+	char		*buf, *orig;
+	blk64_t		*orig_blk;
+	errcode_t	retval;
+
+	if (EXT2_HAS_RO_COMPAT_FEATURE(fs->super,
+				       EXT4_FEATURE_RO_COMPAT_GDT_CSUM))
+		csum_flag = 1;
+
+	if (max_run > fs->group_desc_count)
+		max_run = fs->group_desc_count;
+	retval = io_channel_alloc_buf(fs->io, max_run, &buf);
+	if (retval)
+		return retval;
+
+	for (i = 0; i <= fs->group_desc_count; i++) {
+		blk = 0;
+		if (i < fs->group_desc_count)
+			blk = bitmap_block(fs, i, do_inode, csum_flag);
+		if (run && blk && blk == run_blk + run && run < max_run) {
+			run++;
+			continue;
+		}
+		if (run) {
+			retval = io_channel_read_blk64(fs->io, run_blk, run,
+						       buf);
+			if (retval) {
+				retval = do_inode ? EXT2_ET_INODE_BITMAP_READ :
+					EXT2_ET_BLOCK_BITMAP_READ;
+				goto out;
+			}
+			for (j = 0; j < run; j++) {
+				char *cp = buf + (size_t) j * fs->blocksize;
+
+				if (orig_bitmap(fs, first + j, do_inode,
+						&orig_blk, &orig)) {
+					*orig_blk = run_blk + j;
+					memcpy(orig, cp, fs->blocksize);
+				}
+				retval = set_group_bitmap(fs, first + j,
+					do_inode, nbytes, cp);
+				if (retval)
+					goto out;
+			}
+			run = 0;
+		}
+		if (i == fs->group_desc_count)
+			break;
+		if (blk) {
+			first = i;
+			run_blk = blk;
+			run = 1;
+			continue;
+		}
+		if (orig_bitmap(fs, i, do_inode, &orig_blk, &orig))
+			*orig_blk = 0;
+		memset(buf, 0, nbytes);
+		retval = set_group_bitmap(fs, i, do_inode, nbytes, buf);
+		if (retval)
+			goto out;
+	}
+out:
+	ext2fs_free_mem(&buf);
 	return retval;
 }
 
 static errcode_t read_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 {
-	dgrp_t i;
 	char *block_bitmap = 0, *inode_bitmap = 0;
 	char *buf;
 	errcode_t retval;
 	int block_nbytes = EXT2_CLUSTERS_PER_GROUP(fs->super) / 8;
 	int inode_nbytes = EXT2_INODES_PER_GROUP(fs->super) / 8;
-	int csum_flag = 0;
 	unsigned int	cnt;
 	blk64_t	blk;
 	blk64_t	blk_itr = EXT2FS_B2C(fs, fs->super->s_first_data_block);
@@ -168,10 +414,6 @@ static errcode_t read_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 
 	fs->write_bitmaps = ext2fs_write_bitmaps;
 
-	if (EXT2_HAS_RO_COMPAT_FEATURE(fs->super,
-				       EXT4_FEATURE_RO_COMPAT_GDT_CSUM))
-		csum_flag = 1;
-
 	retval = ext2fs_get_mem(strlen(fs->device_name) + 80, &buf);
 	if (retval)
 		return retval;
@@ -245,51 +487,15 @@ static errcode_t read_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 		goto success_cleanup;
 	}
 
-	for (i = 0; i < fs->group_desc_count; i++) {
-		if (block_bitmap) {
-			blk = ext2fs_block_bitmap_loc(fs, i);
-			if (csum_flag &&
-			    ext2fs_bg_flags_test(fs, i, EXT2_BG_BLOCK_UNINIT) &&
-			    ext2fs_group_desc_csum_verify(fs, i))
-				blk = 0;
-			if (blk) {
-				retval = io_channel_read_blk64(fs->io, blk,
-							       1, block_bitmap);
-				if (retval) {
-					retval = EXT2_ET_BLOCK_BITMAP_READ;
-					goto cleanup;
-				}
-			} else
-				memset(block_bitmap, 0, block_nbytes);
-			cnt = block_nbytes << 3;
-			retval = ext2fs_set_block_bitmap_range2(fs->block_map,
-					       blk_itr, cnt, block_bitmap);
-			if (retval)
-				goto cleanup;
-			blk_itr += block_nbytes << 3;
-		}
-		if (inode_bitmap) {
-			blk = ext2fs_inode_bitmap_loc(fs, i);
-			if (csum_flag &&
-			    ext2fs_bg_flags_test(fs, i, EXT2_BG_INODE_UNINIT) &&
-			    ext2fs_group_desc_csum_verify(fs, i))
-				blk = 0;
-			if (blk) {
-				retval = io_channel_read_blk64(fs->io, blk,
-							       1, inode_bitmap);
-				if (retval) {
-					retval = EXT2_ET_INODE_BITMAP_READ;
-					goto cleanup;
-				}
-			} else
-				memset(inode_bitmap, 0, inode_nbytes);
-			cnt = inode_nbytes << 3;
-			retval = ext2fs_set_inode_bitmap_range2(fs->inode_map,
-					       ino_itr, cnt, inode_bitmap);
-			if (retval)
-				goto cleanup;
-			ino_itr += inode_nbytes << 3;
-		}
+	if (block_bitmap) {
+		retval = read_bitmap_runs(fs, 0, block_nbytes);
+		if (retval)
+			goto cleanup;
+	}
+	if (inode_bitmap) {
+		retval = read_bitmap_runs(fs, 1, inode_nbytes);
+		if (retval)
+			goto cleanup;
 	}
 success_cleanup:
 	if (inode_bitmap)
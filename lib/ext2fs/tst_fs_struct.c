@@ -75,6 +75,7 @@ int main(int argc, char **argv)
 	check_field(mmp_cmp);
 	check_field(mmp_fd);
 	check_field(mmp_last_written);
+	check_field(orig_meta);
 	printf("Ending offset is %d\n\n", cur_offset);
 #endif
 	exit(0);
@@ -171,6 +171,55 @@ static void iterate(void)
 	ext2fs_close_inode_scan(scan);
 }
 
+/*
+ * Iterate using the batch interface; the bad inodes must match
+ */
+static void iterate_batch(void)
+{
+	struct ext2_inode_batch batch;
+	ext2_inode_scan	scan;
+	errcode_t	retval;
+	ext2_ino_t	ino, next = 1;
+	int		i;
+
+	retval = ext2fs_open_inode_scan(test_fs, 8, &scan);
+	if (retval) {
+		com_err("iterate_batch", retval, "While opening inode scan");
+		exit(1);
+	}
+	ext2fs_clear_block_bitmap(touched_map);
+	first_no_comma = 1;
+	printf("Reading blocks in batches: ");
+	while (1) {
+		retval = ext2fs_get_next_inode_batch(scan, &batch);
+		if (retval) {
+			com_err("iterate_batch", retval,
+				"while getting next inode batch");
+			exit(1);
+		}
+		if (batch.count == 0)
+			break;
+		if (batch.first_ino != next) {
+			printf("\nBatch starts at %u, expected %u\n",
+			       batch.first_ino, next);
+			failed++;
+			first_no_comma = 1;
+		}
+		for (i = 0; i < batch.count; i++) {
+			ino = batch.first_ino + i;
+			if (!(batch.flags & EXT2_IB_BAD_BLOCK) !=
+			    !ext2fs_test_inode_bitmap2(bad_inode_map, ino)) {
+				printf("\nInode %u bad block mismatch\n", ino);
+				failed++;
+				first_no_comma = 1;
+			}
+		}
+		next = batch.first_ino + batch.count;
+	}
+	printf("\n");
+	ext2fs_close_inode_scan(scan);
+}
+
 /*
  * Verify the touched map
  */
@@ -217,6 +266,8 @@ int main(int argc, char **argv)
 	setup();
 	iterate();
 	check_map();
+	iterate_batch();
+	check_map();
 	if (!failed)
 		printf("Inode scan tested OK!\n");
 	return failed;
@@ -4,8 +4,7 @@ libext2_quota_src_files := \
 	mkquota.c \
 	quotaio.c \
 	quotaio_tree.c \
-	quotaio_v2.c \
-	../../e2fsck/dict.c
+	quotaio_v2.c
 
 libext2_quota_c_includes := external/e2fsprogs/lib
 
@@ -20,9 +20,19 @@
 #include "mkquota.h"
 #include "common.h"
 
-/* Needed for architectures where sizeof(int) != sizeof(void *) */
-#define UINT_TO_VOIDPTR(val)  ((void *)(intptr_t)(val))
-#define VOIDPTR_TO_UINT(ptr)  ((unsigned int)(intptr_t)(ptr))
+/*
+ * The in-memory dquots of one quota type.  They are kept in a dense
+ * array, and found by id through an open-addressing hash table of
+ * indexes into the array.
+ */
+struct quota_dq_table {
+	struct dquot	*dquots;
+	unsigned int	num, max;
+	unsigned int	*slots;		/* index + 1, or 0 if unused */
+	unsigned int	mask;
+	unsigned int	shift;		/* 32 - log2(mask + 1) */
+	unsigned int	last;		/* index of the last dquot found */
+};
 
 #if DEBUG_QUOTA
 static void print_inode(struct ext2_inode *inode)
@@ -103,25 +113,64 @@ errcode_t quota_remove_inode(ext2_filsys fs, int qtype)
 	return 0;
 }
 
-static void write_dquots(dict_t *dict, struct quota_handle *qh)
+static int dquot_id_cmp(const void *a, const void *b)
 {
-	dnode_t		*n;
-	struct dquot	*dq;
+	const struct dquot *dq_a = *(const struct dquot * const *) a;
+	const struct dquot *dq_b = *(const struct dquot * const *) b;
+
+	if (dq_a->dq_id < dq_b->dq_id)
+		return -1;
+	return dq_a->dq_id > dq_b->dq_id;
+}
+
+/*
+ * Return the dquots of a table sorted by id.  The caller frees the
+ * array, but not the dquots.
+ */
+static errcode_t sorted_dquots(struct quota_dq_table *t,
+			       struct dquot ***ret)
+{
+	struct dquot	**dqs;
+	unsigned int	i;
+	errcode_t	err;
 
-	for (n = dict_first(dict); n; n = dict_next(dict, n)) {
-		dq = dnode_get(n);
-		if (dq) {
-			dq->dq_h = qh;
-			update_grace_times(dq);
+	err = ext2fs_get_array(t->num + 1, sizeof(struct dquot *), &dqs);
+	if (err)
+		return err;
+	for (i = 0; i < t->num; i++)
+		dqs[i] = t->dquots + i;
+	qsort(dqs, t->num, sizeof(struct dquot *), dquot_id_cmp);
+	*ret = dqs;
+	return 0;
+}
+
+static errcode_t write_dquots(struct quota_dq_table *t,
+			      struct quota_handle *qh)
+{
+	struct dquot	**dqs, *dq;
+	unsigned int	i;
+	errcode_t	err;
+
+	err = sorted_dquots(t, &dqs);
+	if (err)
+		return err;
+	for (i = 0; i < t->num; i++) {
+		dq = dqs[i];
+		dq->dq_h = qh;
+		update_grace_times(dq);
+		if (!qh->qh_ops->commit_dquots)
 			qh->qh_ops->commit_dquot(dq);
-		}
 	}
+	if (qh->qh_ops->commit_dquots)
+		err = -qh->qh_ops->commit_dquots(qh, dqs, t->num);
+	ext2fs_free_mem(&dqs);
+	return err;
 }
 
 errcode_t quota_write_inode(quota_ctx_t qctx, int qtype)
 {
 	int		retval = 0, i;
-	dict_t		*dict;
+	struct quota_dq_table *t;
 	ext2_filsys	fs;
 	struct quota_handle *h = NULL;
 	int		fmt = QFMT_VFS_V1;
@@ -142,8 +191,8 @@ errcode_t quota_write_inode(quota_ctx_t qctx, int qtype)
 		if ((qtype != -1) && (i != qtype))
 			continue;
 
-		dict = qctx->quota_dict[i];
-		if (!dict)
+		t = qctx->quota_table[i];
+		if (!t)
 			continue;
 
 		retval = quota_file_create(h, fs, i, fmt);
@@ -152,7 +201,15 @@ errcode_t quota_write_inode(quota_ctx_t qctx, int qtype)
 			continue;
 		}
 
-		write_dquots(dict, h);
+		retval = write_dquots(t, h);
+		if (retval) {
+			log_err("Unable to write quota file: %s",
+				error_message(retval));
+			if (h->qh_qf.e2_file)
+				ext2fs_file_close(h->qh_qf.e2_file);
+			quota_inode_truncate(fs, h->qh_qf.ino);
+			break;
+		}
 		retval = quota_file_close(h);
 		if (retval < 0) {
 			log_err("Cannot finish IO on new quotafile: %s",
@@ -181,30 +238,86 @@ out:
 /* Helper functions for computing quota in memory.                */
 /******************************************************************/
 
-static int dict_uint_cmp(const void *a, const void *b)
+static inline qid_t get_qid(struct ext2_inode *inode, int qtype)
+{
+	if (qtype == USRQUOTA)
+		return inode_uid(*inode);
+	return inode_gid(*inode);
+}
+
+static void free_dq_table(struct quota_dq_table *t)
 {
-	unsigned int	c, d;
+	ext2fs_free_mem(&t->dquots);
+	ext2fs_free_mem(&t->slots);
+	ext2fs_free_mem(&t);
+}
 
-	c = VOIDPTR_TO_UINT(a);
-	d = VOIDPTR_TO_UINT(b);
+static errcode_t alloc_dq_table(struct quota_dq_table **ret)
+{
+	struct quota_dq_table *t;
+	errcode_t	err;
 
-	return c - d;
+	err = ext2fs_get_memzero(sizeof(struct quota_dq_table), &t);
+	if (err)
+		return err;
+	t->max = 16;
+	t->mask = 2 * t->max - 1;
+	t->shift = 32 - 5;
+	err = ext2fs_get_array(t->max, sizeof(struct dquot), &t->dquots);
+	if (!err)
+		err = ext2fs_get_array(t->mask + 1, sizeof(unsigned int),
+				       &t->slots);
+	if (err) {
+		free_dq_table(t);
+		return err;
+	}
+	memset(t->slots, 0, (t->mask + 1) * sizeof(unsigned int));
+	*ret = t;
+	return 0;
 }
 
-static inline qid_t get_qid(struct ext2_inode *inode, int qtype)
+/*
+ * Fibonacci hashing.  Take the top bits of the product, which depend on
+ * every bit of the id; ids which only differ in their high bits, such
+ * as container uid ranges 65536 apart, would all collide in the low
+ * bits.
+ */
+static inline unsigned int dq_hash(struct quota_dq_table *t, qid_t id)
 {
-	if (qtype == USRQUOTA)
-		return inode_uid(*inode);
-	return inode_gid(*inode);
+	return (__u32) (id * 0x9E3779B1U) >> t->shift;
 }
 
-static void quota_dnode_free(dnode_t *node,
-			     void *context EXT2FS_ATTR((unused)))
+/*
+ * Double the table.  The hash table is kept at most half full.
+ */
+static errcode_t grow_dq_table(struct quota_dq_table *t)
 {
-	void *ptr = node ? dnode_get(node) : 0;
+	unsigned int	i, h, *slots, mask = 4 * t->max - 1;
+	errcode_t	err;
 
-	ext2fs_free_mem(&ptr);
-	free(node);
+	err = ext2fs_get_array(mask + 1, sizeof(unsigned int), &slots);
+	if (err)
+		return err;
+	err = ext2fs_resize_mem(t->max * sizeof(struct dquot),
+				2 * t->max * sizeof(struct dquot),
+				&t->dquots);
+	if (err) {
+		ext2fs_free_mem(&slots);
+		return err;
+	}
+	memset(slots, 0, (mask + 1) * sizeof(unsigned int));
+	ext2fs_free_mem(&t->slots);
+	t->slots = slots;
+	t->max *= 2;
+	t->mask = mask;
+	t->shift--;
+	for (i = 0; i < t->num; i++) {
+		h = dq_hash(t, t->dquots[i].dq_id);
+		while (t->slots[h])
+			h = (h + 1) & t->mask;
+		t->slots[h] = i + 1;
+	}
+	return 0;
 }
 
 /*
@@ -213,7 +326,6 @@ static void quota_dnode_free(dnode_t *node,
 errcode_t quota_init_context(quota_ctx_t *qctx, ext2_filsys fs, int qtype)
 {
 	int	i, err = 0;
-	dict_t	*dict;
 	quota_ctx_t ctx;
 
 	err = ext2fs_get_mem(sizeof(struct quota_ctx), &ctx);
@@ -226,15 +338,12 @@ errcode_t quota_init_context(quota_ctx_t *qctx, ext2_filsys fs, int qtype)
 	for (i = 0; i < MAXQUOTAS; i++) {
 		if ((qtype != -1) && (i != qtype))
 			continue;
-		err = ext2fs_get_mem(sizeof(dict_t), &dict);
+		err = alloc_dq_table(&ctx->quota_table[i]);
 		if (err) {
-			log_err("Failed to allocate dictionary");
+			log_err("Failed to allocate quota table");
 			quota_release_context(&ctx);
 			return err;
 		}
-		ctx->quota_dict[i] = dict;
-		dict_init(dict, DICTCOUNT_T_MAX, dict_uint_cmp);
-		dict_set_allocator(dict, NULL, quota_dnode_free, NULL);
 	}
 
 	ctx->fs = fs;
@@ -244,7 +353,6 @@ errcode_t quota_init_context(quota_ctx_t *qctx, ext2_filsys fs, int qtype)
 
 void quota_release_context(quota_ctx_t *qctx)
 {
-	dict_t	*dict;
 	int	i;
 	quota_ctx_t ctx;
 
@@ -253,37 +361,78 @@ void quota_release_context(quota_ctx_t *qctx)
 
 	ctx = *qctx;
 	for (i = 0; i < MAXQUOTAS; i++) {
-		dict = ctx->quota_dict[i];
-		ctx->quota_dict[i] = 0;
-		if (dict) {
-			dict_free_nodes(dict);
-			free(dict);
-		}
+		if (ctx->quota_table[i])
+			free_dq_table(ctx->quota_table[i]);
+		ctx->quota_table[i] = 0;
 	}
 	*qctx = NULL;
 	free(ctx);
 }
 
-static struct dquot *get_dq(dict_t *dict, __u32 key)
+/*
+ * Find the dquot for an id, adding it if it isn't there yet.  The
+ * pointer is only good until the next dquot is added.
+ */
+static struct dquot *get_dq(struct quota_dq_table *t, qid_t id)
 {
 	struct dquot	*dq;
-	dnode_t		*n;
+	unsigned int	h;
+
+	/* Runs of inodes usually have the same owner */
+	if (t->num && t->dquots[t->last].dq_id == id)
+		return t->dquots + t->last;
 
-	n = dict_lookup(dict, UINT_TO_VOIDPTR(key));
-	if (n)
-		dq = dnode_get(n);
-	else {
-		if (ext2fs_get_mem(sizeof(struct dquot), &dq)) {
+	for (h = dq_hash(t, id); t->slots[h]; h = (h + 1) & t->mask) {
+		if (t->dquots[t->slots[h] - 1].dq_id == id) {
+			t->last = t->slots[h] - 1;
+			return t->dquots + t->last;
+		}
+	}
+
+	if (t->num >= t->max) {
+		if (grow_dq_table(t)) {
 			log_err("Unable to allocate dquot");
 			return NULL;
 		}
-		memset(dq, 0, sizeof(struct dquot));
-		dict_alloc_insert(dict, UINT_TO_VOIDPTR(key), dq);
-		dq->dq_id = key;
+		for (h = dq_hash(t, id); t->slots[h];
+		     h = (h + 1) & t->mask)
+			;
 	}
+	dq = t->dquots + t->num;
+	memset(dq, 0, sizeof(struct dquot));
+	dq->dq_id = id;
+	t->slots[h] = ++t->num;
+	t->last = t->num - 1;
 	return dq;
 }
 
+/*
+ * Add the usage counted in one context to another, for instance when
+ * the usage of separate parts of a file system was counted apart.
+ */
+errcode_t quota_merge_context(quota_ctx_t to, quota_ctx_t from)
+{
+	struct quota_dq_table *t;
+	struct dquot	*src, *dq;
+	unsigned int	j;
+	int		i;
+
+	for (i = 0; i < MAXQUOTAS; i++) {
+		t = from->quota_table[i];
+		if (!t || !to->quota_table[i])
+			continue;
+		for (j = 0; j < t->num; j++) {
+			src = t->dquots + j;
+			dq = get_dq(to->quota_table[i], src->dq_id);
+			if (!dq)
+				return EXT2_ET_NO_MEMORY;
+			dq->dq_dqb.dqb_curspace += src->dq_dqb.dqb_curspace;
+			dq->dq_dqb.dqb_curinodes += src->dq_dqb.dqb_curinodes;
+		}
+	}
+	return 0;
+}
+
 
 /*
  * Called to update the blocks used by a particular inode
@@ -292,7 +441,6 @@ void quota_data_add(quota_ctx_t qctx, struct ext2_inode *inode, ext2_ino_t ino,
 		    qsize_t space)
 {
 	struct dquot	*dq;
-	dict_t		*dict;
 	int		i;
 
 	if (!qctx)
@@ -302,9 +450,8 @@ void quota_data_add(quota_ctx_t qctx, struct ext2_inode *inode, ext2_ino_t ino,
 			inode_uid(*inode),
 			inode_gid(*inode), space);
 	for (i = 0; i < MAXQUOTAS; i++) {
-		dict = qctx->quota_dict[i];
-		if (dict) {
-			dq = get_dq(dict, get_qid(inode, i));
+		if (qctx->quota_table[i]) {
+			dq = get_dq(qctx->quota_table[i], get_qid(inode, i));
 			if (dq)
 				dq->dq_dqb.dqb_curspace += space;
 		}
@@ -318,7 +465,6 @@ void quota_data_sub(quota_ctx_t qctx, struct ext2_inode *inode, ext2_ino_t ino,
 		    qsize_t space)
 {
 	struct dquot	*dq;
-	dict_t		*dict;
 	int		i;
 
 	if (!qctx)
@@ -328,10 +474,10 @@ void quota_data_sub(quota_ctx_t qctx, struct ext2_inode *inode, ext2_ino_t ino,
 			inode_uid(*inode),
 			inode_gid(*inode), space);
 	for (i = 0; i < MAXQUOTAS; i++) {
-		dict = qctx->quota_dict[i];
-		if (dict) {
-			dq = get_dq(dict, get_qid(inode, i));
-			dq->dq_dqb.dqb_curspace -= space;
+		if (qctx->quota_table[i]) {
+			dq = get_dq(qctx->quota_table[i], get_qid(inode, i));
+			if (dq)
+				dq->dq_dqb.dqb_curspace -= space;
 		}
 	}
 }
@@ -343,7 +489,6 @@ void quota_data_inodes(quota_ctx_t qctx, struct ext2_inode *inode,
 		       ext2_ino_t ino, int adjust)
 {
 	struct dquot	*dq;
-	dict_t		*dict;
 	int		i;
 
 	if (!qctx)
@@ -353,10 +498,10 @@ void quota_data_inodes(quota_ctx_t qctx, struct ext2_inode *inode,
 			inode_uid(*inode),
 			inode_gid(*inode), adjust);
 	for (i = 0; i < MAXQUOTAS; i++) {
-		dict = qctx->quota_dict[i];
-		if (dict) {
-			dq = get_dq(dict, get_qid(inode, i));
-			dq->dq_dqb.dqb_curinodes += adjust;
+		if (qctx->quota_table[i]) {
+			dq = get_dq(qctx->quota_table[i], get_qid(inode, i));
+			if (dq)
+				dq->dq_dqb.dqb_curinodes += adjust;
 		}
 	}
 }
@@ -404,7 +549,7 @@ errcode_t quota_compute_usage(quota_ctx_t qctx)
 }
 
 struct scan_dquots_data {
-	dict_t		*quota_dict;
+	struct quota_dq_table *quota_table;
 	int             update_limits; /* update limits from disk */
 	int		update_usage;
 	int		usage_is_inconsistent;
@@ -413,10 +558,11 @@ struct scan_dquots_data {
 static int scan_dquots_callback(struct dquot *dquot, void *cb_data)
 {
 	struct scan_dquots_data *scan_data = cb_data;
-	dict_t *quota_dict = scan_data->quota_dict;
 	struct dquot *dq;
 
-	dq = get_dq(quota_dict, dquot->dq_id);
+	dq = get_dq(scan_data->quota_table, dquot->dq_id);
+	if (!dq)
+		return -1;
 	dq->dq_id = dquot->dq_id;
 	dq->dq_dqb.u.v2_mdqb.dqb_off = dquot->dq_dqb.u.v2_mdqb.dqb_off;
 
@@ -455,7 +601,7 @@ static errcode_t quota_read_all_dquots(struct quota_handle *qh,
 {
 	struct scan_dquots_data scan_data;
 
-	scan_data.quota_dict = qctx->quota_dict[qh->qh_type];
+	scan_data.quota_table = qctx->quota_table[qh->qh_type];
 	scan_data.update_limits = update_limits;
 	scan_data.update_usage = 0;
 
@@ -474,7 +620,9 @@ static errcode_t quota_write_all_dquots(struct quota_handle *qh,
 	err = ext2fs_read_bitmaps(qctx->fs);
 	if (err)
 		return err;
-	write_dquots(qctx->quota_dict[qh->qh_type], qh);
+	err = write_dquots(qctx->quota_table[qh->qh_type], qh);
+	if (err)
+		return err;
 	ext2fs_mark_bb_dirty(qctx->fs);
 	qctx->fs->flags &= ~EXT2_FLAG_SUPER_ONLY;
 	ext2fs_write_bitmaps(qctx->fs);
@@ -520,8 +668,8 @@ out:
 }
 
 /*
- * Compares the measured quota in qctx->quota_dict with that in the quota inode
- * on disk and updates the limits in qctx->quota_dict. 'usage_inconsistent' is
+ * Compares the measured quota in qctx->quota_table with that in the quota inode
+ * on disk and updates the limits in qctx->quota_table. 'usage_inconsistent' is
  * set to 1 if the supplied and on-disk quota usage values are not identical.
  */
 errcode_t quota_compare_and_update(quota_ctx_t qctx, int qtype,
@@ -533,7 +681,7 @@ errcode_t quota_compare_and_update(quota_ctx_t qctx, int qtype,
 	ext2_ino_t qf_ino;
 	errcode_t err = 0;
 
-	if (!qctx->quota_dict[qtype])
+	if (!qctx->quota_table[qtype])
 		goto out;
 
 	qf_ino = qtype == USRQUOTA ? fs->super->s_usr_quota_inum :
@@ -544,7 +692,7 @@ errcode_t quota_compare_and_update(quota_ctx_t qctx, int qtype,
 		goto out;
 	}
 
-	scan_data.quota_dict = qctx->quota_dict[qtype];
+	scan_data.quota_table = qctx->quota_table[qtype];
 	scan_data.update_limits = 1;
 	scan_data.update_usage = 0;
 	scan_data.usage_is_inconsistent = 0;
@@ -16,6 +16,7 @@
  *		AND/OR
  *		quota_data_add/quota_data_sub/quota_data_inodes();
  *	}
+ *	quota_merge_context(qctx, other_qctx);	(optional)
  *	quota_write_inode(qctx, USRQUOTA);
  *	quota_write_inode(qctx, GRPQUOTA);
  *	quota_release_context(&qctx);
@@ -33,13 +34,13 @@
 #include "ext2fs/ext2_fs.h"
 #include "ext2fs/ext2fs.h"
 #include "quotaio.h"
-#include "../e2fsck/dict.h"
 
 typedef struct quota_ctx *quota_ctx_t;
+struct quota_dq_table;
 
 struct quota_ctx {
 	ext2_filsys	fs;
-	dict_t		*quota_dict[MAXQUOTAS];
+	struct quota_dq_table *quota_table[MAXQUOTAS];
 };
 
 /* In mkquota.c */
@@ -53,6 +54,7 @@ void quota_data_sub(quota_ctx_t qctx, struct ext2_inode *inode, ext2_ino_t ino,
 errcode_t quota_write_inode(quota_ctx_t qctx, int qtype);
 errcode_t quota_update_limits(quota_ctx_t qctx, ext2_ino_t qf_ino, int type);
 errcode_t quota_compute_usage(quota_ctx_t qctx);
+errcode_t quota_merge_context(quota_ctx_t to, quota_ctx_t from);
 void quota_release_context(quota_ctx_t *qctx);
 
 errcode_t quota_remove_inode(ext2_filsys fs, int qtype);
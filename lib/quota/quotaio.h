@@ -120,6 +120,9 @@ struct quotafile_ops {
 	struct dquot *(*read_dquot) (struct quota_handle *h, qid_t id);
 	/* Write given dquot to disk */
 	int (*commit_dquot) (struct dquot *dquot);
+	/* Write given dquots, sorted by id, to disk; may reorder the array */
+	int (*commit_dquots) (struct quota_handle *h, struct dquot **dquots,
+			      int num);
 	/* Scan quotafile and call callback on every structure */
 	int (*scan_dquots) (struct quota_handle *h,
 			    int (*process_dquot) (struct dquot *dquot,
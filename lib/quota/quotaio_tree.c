@@ -318,7 +318,7 @@ void qtree_write_dquot(struct dquot *dquot)
 	log_debug("writing ddquot 1: off=%llu, info->dqi_entry_size=%u",
 			dquot->dq_dqb.u.v2_mdqb.dqb_off,
 			info->dqi_entry_size);
-	ret = ext2fs_get_mem(info->dqi_entry_size, &ddquot);
+	ret = ext2fs_get_memzero(info->dqi_entry_size, &ddquot);
 	if (ret) {
 		errno = ENOMEM;
 		log_err("Quota write failed (id %u): %s",
@@ -344,6 +344,120 @@ void qtree_write_dquot(struct dquot *dquot)
 	ext2fs_free_mem(&ddquot);
 }
 
+/*
+ * A new quota file being built in memory, from block QT_TREEOFF on.
+ */
+struct qtree_bulk {
+	char	*buf;
+	uint	num, max;
+};
+
+#define BULK_BLK(b, blk) \
+	((b)->buf + (((blk) - QT_TREEOFF) << QT_BLKSIZE_BITS))
+
+/* Allocate a zeroed block at the end of the file */
+static int bulk_get_blk(struct quota_handle *h, struct qtree_bulk *b,
+			uint *blk)
+{
+	struct qtree_mem_dqinfo *info = &h->qh_info.u.v2_mdqi.dqi_qtree;
+	uint max;
+
+	if (b->num >= b->max) {
+		max = b->max ? 2 * b->max : 64;
+		if (ext2fs_resize_mem(b->max << QT_BLKSIZE_BITS,
+				      max << QT_BLKSIZE_BITS, &b->buf))
+			return -ENOMEM;
+		b->max = max;
+	}
+	*blk = QT_TREEOFF + b->num++;
+	memset(BULK_BLK(b, *blk), 0, QT_BLKSIZE);
+	if (*blk >= info->dqi_blocks)
+		info->dqi_blocks = *blk + 1;
+	mark_quotafile_info_dirty(h);
+	return 0;
+}
+
+/*
+ * Write dquots, sorted by increasing id, into a newly created quota
+ * file.  The blocks are laid out just as qtree_write_dquot() would
+ * lay them out, but the tree is built in memory and each block is
+ * written once, in order.  Any other file is updated a dquot at a
+ * time.
+ */
+int qtree_write_dquots(struct quota_handle *h, struct dquot **dquots,
+		       int num)
+{
+	struct qtree_mem_dqinfo *info = &h->qh_info.u.v2_mdqi.dqi_qtree;
+	struct qt_disk_dqdbheader *dh;
+	struct qtree_bulk b;
+	struct dquot *dquot;
+	uint treeblk[QT_TREEDEPTH], blk, datablk = 0;
+	int i, depth, idx, entries = 0, ret = 0;
+	u_int32_t *ref;
+	char *ddquot;
+
+	if (info->dqi_blocks != QT_TREEOFF + 1 || info->dqi_free_blk ||
+	    info->dqi_free_entry) {
+		for (i = 0; i < num; i++)
+			qtree_write_dquot(dquots[i]);
+		return 0;
+	}
+	if (!num)
+		return 0;
+
+	memset(&b, 0, sizeof(b));
+	info->dqi_blocks = QT_TREEOFF;
+	ret = bulk_get_blk(h, &b, &treeblk[0]);
+	for (i = 0; !ret && i < num; i++) {
+		dquot = dquots[i];
+		if (i && dquot->dq_id <= dquots[i - 1]->dq_id) {
+			log_err("Quota ids out of order (id %u).",
+				(uint) dquot->dq_id);
+			ret = -EINVAL;
+			break;
+		}
+		for (depth = 0; !ret && depth < QT_TREEDEPTH - 1; depth++) {
+			idx = get_index(dquot->dq_id, depth);
+			ref = (u_int32_t *) BULK_BLK(&b, treeblk[depth]);
+			if (!ref[idx]) {
+				ret = bulk_get_blk(h, &b, &blk);
+				if (ret)
+					break;
+				ref = (u_int32_t *) BULK_BLK(&b, treeblk[depth]);
+				ref[idx] = ext2fs_cpu_to_le32(blk);
+			}
+			treeblk[depth + 1] = ext2fs_le32_to_cpu(ref[idx]);
+		}
+		if (!ret && (!datablk || entries == qtree_dqstr_in_blk(info))) {
+			ret = bulk_get_blk(h, &b, &datablk);
+			entries = 0;
+		}
+		if (ret)
+			break;
+
+		dh = (struct qt_disk_dqdbheader *) BULK_BLK(&b, datablk);
+		ddquot = (char *) dh + sizeof(struct qt_disk_dqdbheader) +
+			entries * info->dqi_entry_size;
+		info->dqi_ops->mem2disk_dqblk(ddquot, dquot);
+		dquot->dq_dqb.u.v2_mdqb.dqb_off =
+			(datablk << QT_BLKSIZE_BITS) + (ddquot - (char *) dh);
+		dh->dqdh_entries = ext2fs_cpu_to_le16(++entries);
+
+		ref = (u_int32_t *) BULK_BLK(&b, treeblk[QT_TREEDEPTH - 1]);
+		ref[get_index(dquot->dq_id, QT_TREEDEPTH - 1)] =
+			ext2fs_cpu_to_le32(datablk);
+	}
+	if (datablk && entries < qtree_dqstr_in_blk(info))
+		info->dqi_free_entry = datablk;
+
+	for (blk = QT_TREEOFF; !ret && blk < QT_TREEOFF + b.num; blk++)
+		ret = write_blk(h, blk, BULK_BLK(&b, blk));
+	if (ret)
+		log_err("Cannot write quota file: %s", strerror(-ret));
+	ext2fs_free_mem(&b.buf);
+	return ret;
+}
+
 /* Free dquot entry in data block */
 static void free_dqentry(struct quota_handle *h, struct dquot *dquot, uint blk)
 {
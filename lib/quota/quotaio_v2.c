@@ -23,6 +23,8 @@ static int v2_new_io(struct quota_handle *h);
 static int v2_write_info(struct quota_handle *h);
 static struct dquot *v2_read_dquot(struct quota_handle *h, qid_t id);
 static int v2_commit_dquot(struct dquot *dquot);
+static int v2_commit_dquots(struct quota_handle *h, struct dquot **dquots,
+			    int num);
 static int v2_scan_dquots(struct quota_handle *h,
 			  int (*process_dquot) (struct dquot *dquot,
 						void *data),
@@ -36,6 +38,7 @@ struct quotafile_ops quotafile_ops_2 = {
 	.write_info	= v2_write_info,
 	.read_dquot	= v2_read_dquot,
 	.commit_dquot	= v2_commit_dquot,
+	.commit_dquots	= v2_commit_dquots,
 	.scan_dquots	= v2_scan_dquots,
 	.report		= v2_report,
 };
@@ -252,18 +255,41 @@ static struct dquot *v2_read_dquot(struct quota_handle *h, qid_t id)
  * became fake one and user has no blocks.
  * User can process use 'errno' to detect errstr.
  */
-static int v2_commit_dquot(struct dquot *dquot)
+static inline int v2_dquot_unused(struct dquot *dquot)
 {
 	struct util_dqblk *b = &dquot->dq_dqb;
 
-	if (!b->dqb_curspace && !b->dqb_curinodes && !b->dqb_bsoftlimit &&
-	    !b->dqb_isoftlimit && !b->dqb_bhardlimit && !b->dqb_ihardlimit)
+	return (!b->dqb_curspace && !b->dqb_curinodes && !b->dqb_bsoftlimit &&
+		!b->dqb_isoftlimit && !b->dqb_bhardlimit && !b->dqb_ihardlimit);
+}
+
+static int v2_commit_dquot(struct dquot *dquot)
+{
+	if (v2_dquot_unused(dquot))
 		qtree_delete_dquot(dquot);
 	else
 		qtree_write_dquot(dquot);
 	return 0;
 }
 
+/*
+ * Commit many dquots at once.  Those which would be deleted are
+ * dropped from the array, and the rest are written in one pass.
+ */
+static int v2_commit_dquots(struct quota_handle *h, struct dquot **dquots,
+			    int num)
+{
+	int i, n = 0;
+
+	for (i = 0; i < num; i++) {
+		if (v2_dquot_unused(dquots[i]))
+			qtree_delete_dquot(dquots[i]);
+		else
+			dquots[n++] = dquots[i];
+	}
+	return qtree_write_dquots(h, dquots, n);
+}
+
 static int v2_scan_dquots(struct quota_handle *h,
 			  int (*process_dquot) (struct dquot *, void *),
 			  void *data)
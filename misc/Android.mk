@@ -4,6 +4,7 @@ LOCAL_PATH := $(call my-dir)
 # Build mke2fs
 mke2fs_src_files := \
 	mke2fs.c \
+	create_inode.c \
 	default_profile.c
 
 mke2fs_c_includes := \
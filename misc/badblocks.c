@@ -53,6 +53,7 @@ extern int optind;
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include "et/com_err.h"
 #include "ext2fs/ext2_io.h"
@@ -80,6 +81,8 @@ static int exclusive_ok;
 static unsigned int max_bb;		/* Abort test if more than this number of bad blocks has been encountered */
 static unsigned int d_flag;		/* delay factor between reads */
 static struct timeval time_start;
+static int num_jobs = 1;		/* readers kept in flight (-j) */
+static char *device_name;
 
 #define T_INC 32
 
@@ -91,8 +94,9 @@ static void usage(void)
 "Usage: %s [-b block_size] [-i input_file] [-o output_file] [-svwnf]\n"
 "       [-c blocks_at_once] [-d delay_factor_between_reads] [-e max_bad_blocks]\n"
 "       [-p num_passes] [-t test_pattern [-t test_pattern [...]]]\n"
-"       device [last_block [first_block]]\n"),
-		 program_name);
+"       [-j jobs] device [last_block [first_block]]\n"
+"       %s [options] device device ...\n"),
+		 program_name, program_name);
 	exit (1);
 }
 
@@ -116,6 +120,40 @@ static ext2_badblocks_iterate bb_iter = NULL;
 
 enum error_types { READ_ERROR, WRITE_ERROR, CORRUPTION_ERROR };
 
+/*
+ * Child processes (parallel readers and the per-device processes of a
+ * multi-device run) pass their results up to the parent through a
+ * pipe as fixed-size records, which are written atomically.
+ */
+#define REPORT_BAD	1	/* block is bad, error is its error_type */
+#define REPORT_DONE	2	/* total blocks from block were tested */
+#define REPORT_STATUS	3	/* now at block, out of total */
+
+struct bb_report {
+	int	type;
+	int	dev;
+	int	error;
+	blk_t	block;
+	blk_t	total;
+};
+
+static int report_fd = -1;
+static int report_dev;
+
+static void send_report(int type, int error, blk_t block, blk_t total)
+{
+	struct bb_report rep;
+
+	memset(&rep, 0, sizeof(rep));
+	rep.type = type;
+	rep.dev = report_dev;
+	rep.error = error;
+	rep.block = block;
+	rep.total = total;
+	if (write(report_fd, &rep, sizeof(rep)) != sizeof(rep))
+		exit(1);
+}
+
 static void *allocate_buffer(size_t size)
 {
 	void	*ret = 0;
@@ -150,8 +188,12 @@ static int bb_output (blk_t bad, enum error_types error_type)
 	if (ext2fs_badblocks_list_test(bb_list, bad))
 		return 0;
 
-	fprintf(out, "%lu\n", (unsigned long) bad);
-	fflush(out);
+	if (report_fd >= 0)
+		send_report(REPORT_BAD, error_type, bad, 0);
+	else {
+		fprintf(out, "%lu\n", (unsigned long) bad);
+		fflush(out);
+	}
 
 	errcode = ext2fs_badblocks_list_add (bb_list, bad);
 	if (errcode) {
@@ -212,6 +254,10 @@ static void print_status(void)
 	char diff_buf[32], line_buf[128];
 	int len;
 
+	if (report_fd >= 0) {
+		send_report(REPORT_STATUS, 0, currently_testing, num_blocks);
+		return;
+	}
 	gettimeofday(&time_end, 0);
 	len = snprintf(line_buf, sizeof(line_buf), 
 		       _("%6.2f%% done, %s elapsed. "
@@ -453,6 +499,52 @@ static int do_write(int dev, unsigned char * buffer, int try, int block_size,
 	return got;
 }
 
+/*
+ * Read count blocks starting at start into buffer, comparing each
+ * block read against cmp (advancing by cmp_stride per block) if cmp
+ * is given.  When the read fails part way, the failed part is split
+ * in half and each half retried, so a bad block in a large read is
+ * found in a logarithmic number of reads.  Returns the number of new
+ * bad blocks.
+ */
+static unsigned int bisect_read(int dev, unsigned char *buffer, int count,
+				int block_size, blk_t start,
+				unsigned char *cmp, int cmp_stride)
+{
+	unsigned int	bb_count = 0;
+	int		got, i, half;
+
+	if (count <= 0)
+		return 0;
+	got = do_read(dev, buffer, count, block_size, start);
+	for (i = 0; cmp && i < got; i++)
+		if (memcmp(buffer + i * block_size, cmp + i * cmp_stride,
+			   block_size))
+			bb_count += bb_output(start + i, CORRUPTION_ERROR);
+	if (got >= count)
+		return bb_count;
+	if (count == 1)
+		return bb_count + bb_output(start, READ_ERROR);
+
+	start += got;
+	buffer += got * block_size;
+	if (cmp)
+		cmp += got * cmp_stride;
+	count -= got;
+	if (got)
+		/* The block where the read stopped is most likely bad */
+		half = 1;
+	else
+		half = count / 2;
+	bb_count += bisect_read(dev, buffer, half, block_size, start,
+				cmp, cmp_stride);
+	bb_count += bisect_read(dev, buffer + half * block_size, count - half,
+				block_size, start + half,
+				cmp ? cmp + half * cmp_stride : NULL,
+				cmp_stride);
+	return bb_count;
+}
+
 static int host_dev;
 
 static void flush_bufs(void)
@@ -475,10 +567,8 @@ static unsigned int test_ro (int dev, blk_t last_block,
 {
 	unsigned char * blkbuf;
 	int try;
-	int got;
 	unsigned int bb_count = 0;
 	errcode_t errcode;
-	blk_t recover_block = ~0;
 
 	/* set up abend handler */
 	capture_terminate(NULL);
@@ -509,7 +599,7 @@ static unsigned int test_ro (int dev, blk_t last_block,
 			(unsigned long)first_block,
 			(unsigned long)last_block - 1);
 	}
-	if (t_flag) {
+	if (t_flag && report_fd < 0) {
 		fputs(_("Checking for bad blocks in read-only mode\n"), stderr);
 		pattern_fill(blkbuf + blocks_at_once * block_size,
 			     t_patts[0], block_size);
@@ -520,7 +610,7 @@ static unsigned int test_ro (int dev, blk_t last_block,
 	num_blocks = last_block - 1;
 	if (!t_flag && (s_flag || v_flag))
 		fputs(_("Checking for bad blocks (read-only test): "), stderr);
-	if (s_flag && v_flag <= 1)
+	if ((s_flag && v_flag <= 1) || report_fd >= 0)
 		alarm_intr(SIGALRM);
 	while (currently_testing < last_block)
 	{
@@ -542,30 +632,12 @@ static unsigned int test_ro (int dev, blk_t last_block,
 		}
 		if (currently_testing + try > last_block)
 			try = last_block - currently_testing;
-		got = do_read (dev, blkbuf, try, block_size, currently_testing);
-		if (t_flag) {
-			/* test the comparison between all the
-			   blocks successfully read  */
-			int i;
-			for (i = 0; i < got; ++i)
-				if (memcmp (blkbuf+i*block_size,
-					    blkbuf+blocks_at_once*block_size,
-					    block_size))
-					bb_count += bb_output(currently_testing + i, CORRUPTION_ERROR);
-		}
-		if (got == 0 && try == 1)
-			bb_count += bb_output(currently_testing++, READ_ERROR);
-		currently_testing += got;
-		if (got != try) {
-			try = 1;
-			if (recover_block == ~0U)
-				recover_block = currently_testing - got +
-					blocks_at_once;
-			continue;
-		} else if (currently_testing == recover_block) {
-			try = blocks_at_once;
-			recover_block = ~0;
-		}
+		bb_count += bisect_read(dev, blkbuf, try, block_size,
+					currently_testing, t_flag ?
+					blkbuf + blocks_at_once * block_size :
+					NULL, 0);
+		currently_testing += try;
+		try = blocks_at_once;
 	}
 	num_blocks = 0;
 	alarm(0);
@@ -582,6 +654,192 @@ static unsigned int test_ro (int dev, blk_t last_block,
 	return bb_count;
 }
 
+/*
+ * Read blocks start to end - 1, skipping the ones already known to be
+ * bad.  Returns the number of new bad blocks.
+ */
+static unsigned int read_chunk(int dev, unsigned char *blkbuf,
+			       unsigned char *cmp, int block_size,
+			       blk_t start, blk_t end)
+{
+	unsigned int	bb_count = 0;
+	blk_t		blk, run;
+
+	for (blk = run = start; ; blk++) {
+		if (blk < end && !ext2fs_badblocks_list_test(bb_list, blk))
+			continue;
+		bb_count += bisect_read(dev, blkbuf, blk - run, block_size,
+					run, cmp, 0);
+		if (blk >= end)
+			break;
+		run = blk + 1;
+	}
+	return bb_count;
+}
+
+/*
+ * Read-only test with num_jobs reader processes, each opening the
+ * device itself and taking every num_jobs'th chunk of blocks_at_once
+ * blocks, so that num_jobs reads are in flight at once.  The readers
+ * report bad blocks and finished chunks back through a pipe.  Any
+ * chunk which a reader didn't finish, because it failed or was
+ * killed, is read again here afterwards.
+ */
+static unsigned int test_ro_parallel(int dev, blk_t last_block,
+				     int block_size, blk_t first_block,
+				     unsigned int blocks_at_once)
+{
+	unsigned char	*blkbuf, *cmp, *done;
+	struct bb_report rep;
+	unsigned int	bb_count = 0;
+	pid_t		*pids;
+	int		fds[2], fd, i, running, status, aborted = 0;
+	blk_t		start, end, chunk, num_chunks;
+
+	num_chunks = (last_block - first_block + blocks_at_once - 1) /
+		blocks_at_once;
+	pids = calloc(num_jobs, sizeof(pid_t));
+	done = calloc(num_chunks ? num_chunks : 1, 1);
+	if (!pids || !done || pipe(fds) < 0) {
+		com_err(program_name, errno, "%s",
+			_("while starting reader processes"));
+		exit(1);
+	}
+	if (v_flag) {
+		fprintf(stderr, _("Checking blocks %lu to %lu\n"),
+			(unsigned long)first_block,
+			(unsigned long)last_block - 1);
+	}
+	flush_bufs();
+
+	for (running = 0; running < num_jobs; running++) {
+		pids[running] = fork();
+		if (pids[running] < 0) {
+			com_err(program_name, errno, "%s",
+				_("while starting reader processes"));
+			exit(1);
+		}
+		if (pids[running])
+			continue;
+
+		close(fds[0]);
+		report_fd = fds[1];
+		s_flag = v_flag = 0;
+		fd = open(device_name, O_RDONLY | O_LARGEFILE);
+		if (fd < 0) {
+			com_err(program_name, errno,
+				_("while trying to open %s"), device_name);
+			exit(1);
+		}
+		blkbuf = allocate_buffer((blocks_at_once + 1) * block_size);
+		if (!blkbuf) {
+			com_err(program_name, ENOMEM, "%s",
+				_("while allocating buffers"));
+			exit(1);
+		}
+		cmp = NULL;
+		if (t_flag) {
+			cmp = blkbuf + blocks_at_once * block_size;
+			pattern_fill(cmp, t_patts[0], block_size);
+		}
+		for (start = first_block +
+			     (blk_t) running * blocks_at_once;
+		     start < last_block;
+		     start += (blk_t) num_jobs * blocks_at_once) {
+			end = start + blocks_at_once;
+			if (end > last_block || end < start)
+				end = last_block;
+			read_chunk(fd, blkbuf, cmp, block_size, start, end);
+			send_report(REPORT_DONE, 0, start, end - start);
+			if (end == last_block)
+				break;
+		}
+		exit(0);
+	}
+	close(fds[1]);
+
+	capture_terminate(NULL);
+	if (t_flag && report_fd < 0)
+		fputs(_("Checking for bad blocks in read-only mode\n"),
+		      stderr);
+	else if (s_flag || v_flag)
+		fputs(_("Checking for bad blocks (read-only test): "), stderr);
+	currently_testing = first_block;
+	num_blocks = last_block - 1;
+	if ((s_flag && v_flag <= 1) || report_fd >= 0)
+		alarm_intr(SIGALRM);
+	while (1) {
+		i = read(fds[0], &rep, sizeof(rep));
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i != sizeof(rep))
+			break;
+		if (rep.type == REPORT_DONE) {
+			currently_testing += rep.total;
+			done[(rep.block - first_block) / blocks_at_once] = 1;
+		} else if (rep.type == REPORT_BAD)
+			bb_count += bb_output(rep.block, rep.error);
+		if (max_bb && bb_count >= max_bb) {
+			if (s_flag || v_flag)
+				fputs(_("Too many bad blocks, aborting test\n"),
+				      stderr);
+			for (i = 0; i < num_jobs; i++)
+				kill(pids[i], SIGTERM);
+			aborted = 1;
+			break;
+		}
+	}
+	close(fds[0]);
+	for (i = 0; i < num_jobs; i++) {
+		if (waitpid(pids[i], &status, 0) == pids[i] &&
+		    WIFEXITED(status) && !WEXITSTATUS(status))
+			continue;
+		if (!aborted)
+			com_err(program_name, 0,
+				_("reader %d failed; rereading its blocks"),
+				i);
+	}
+
+	blkbuf = NULL;
+	for (chunk = 0; chunk < num_chunks && !aborted; chunk++) {
+		if (max_bb && bb_count >= max_bb)
+			break;
+		if (done[chunk])
+			continue;
+		if (!blkbuf) {
+			blkbuf = allocate_buffer((blocks_at_once + 1) *
+						 block_size);
+			if (!blkbuf) {
+				com_err(program_name, ENOMEM, "%s",
+					_("while allocating buffers"));
+				exit(1);
+			}
+			cmp = NULL;
+			if (t_flag) {
+				cmp = blkbuf + blocks_at_once * block_size;
+				pattern_fill(cmp, t_patts[0], block_size);
+			}
+		}
+		start = first_block + chunk * blocks_at_once;
+		end = start + blocks_at_once;
+		if (end > last_block || end < start)
+			end = last_block;
+		bb_count += read_chunk(dev, blkbuf, cmp, block_size,
+				       start, end);
+		currently_testing += end - start;
+	}
+	free(blkbuf);
+	num_blocks = 0;
+	alarm(0);
+	if (s_flag || v_flag)
+		fputs(_(done_string), stderr);
+	fflush(stderr);
+	free(pids);
+	free(done);
+	uncapture_terminate();
+	return bb_count;
+}
+
 static unsigned int test_rw (int dev, blk_t last_block,
 			     int block_size, blk_t first_block,
 			     unsigned int blocks_at_once)
@@ -589,7 +847,7 @@ static unsigned int test_rw (int dev, blk_t last_block,
 	unsigned char *buffer, *read_buffer;
 	const unsigned int patterns[] = {0xaa, 0x55, 0xff, 0x00};
 	const unsigned int *pattern;
-	int i, try, got, nr_pattern, pat_idx;
+	int try, got, nr_pattern, pat_idx;
 	unsigned int bb_count = 0;
 	blk_t recover_block = ~0;
 
@@ -626,7 +884,7 @@ static unsigned int test_rw (int dev, blk_t last_block,
 			     blocks_at_once * block_size);
 		num_blocks = last_block - 1;
 		currently_testing = first_block;
-		if (s_flag && v_flag <= 1)
+		if ((s_flag && v_flag <= 1) || report_fd >= 0)
 			alarm_intr(SIGALRM);
 
 		try = blocks_at_once;
@@ -668,7 +926,7 @@ static unsigned int test_rw (int dev, blk_t last_block,
 			fputs(_("Reading and comparing: "), stderr);
 		num_blocks = last_block;
 		currently_testing = first_block;
-		if (s_flag && v_flag <= 1)
+		if ((s_flag && v_flag <= 1) || report_fd >= 0)
 			alarm_intr(SIGALRM);
 
 		try = blocks_at_once;
@@ -681,27 +939,10 @@ static unsigned int test_rw (int dev, blk_t last_block,
 			}
 			if (currently_testing + try > last_block)
 				try = last_block - currently_testing;
-			got = do_read (dev, read_buffer, try, block_size,
-				       currently_testing);
-			if (got == 0 && try == 1)
-				bb_count += bb_output(currently_testing++, READ_ERROR);
-			currently_testing += got;
-			if (got != try) {
-				try = 1;
-				if (recover_block == ~0U)
-					recover_block = currently_testing -
-						got + blocks_at_once;
-				continue;
-			} else if (currently_testing == recover_block) {
-				try = blocks_at_once;
-				recover_block = ~0U;
-			}
-			for (i=0; i < got; i++) {
-				if (memcmp(read_buffer + i * block_size,
-					   buffer + i * block_size,
-					   block_size))
-					bb_count += bb_output(currently_testing+i, CORRUPTION_ERROR);
-			}
+			bb_count += bisect_read(dev, read_buffer, try,
+						block_size, currently_testing,
+						buffer, block_size);
+			currently_testing += try;
 			if (v_flag > 1)
 				print_status();
 		}
@@ -816,7 +1057,7 @@ static unsigned int test_nd (int dev, blk_t last_block,
 		test_ptr = test_base;
 		currently_testing = first_block;
 		num_blocks = last_block - 1;
-		if (s_flag && v_flag <= 1)
+		if ((s_flag && v_flag <= 1) || report_fd >= 0)
 			alarm_intr(SIGALRM);
 
 		while (currently_testing < last_block) {
@@ -1010,6 +1251,19 @@ static void check_mount(char *device_name)
 
 }
 
+/*
+ * Return 1 if str would be accepted by parse_uint() below.
+ */
+static int is_uint(const char *str)
+{
+	char		*tmp;
+	unsigned long	ret;
+
+	errno = 0;
+	ret = strtoul(str, &tmp, 0);
+	return *str && !*tmp && !errno && ret <= UINT_MAX;
+}
+
 /*
  * This function will convert a string to an unsigned long, printing
  * an error message if it fails, and returning success or failure in err.
@@ -1029,10 +1283,161 @@ static unsigned int parse_uint(const char *str, const char *descr)
 	return ret;
 }
 
+struct device_state {
+	pid_t		pid;
+	blk_t		current;
+	blk_t		total;
+	unsigned int	bad;
+	int		done;
+};
+
+static void print_devices_status(struct device_state *devs, int count)
+{
+	struct timeval	now, left;
+	char		elapsed_buf[32], left_buf[32], line_buf[160];
+	float		percent = 0.0;
+	int		i, done = 0, len;
+
+	for (i = 0; i < count; i++) {
+		if (devs[i].done) {
+			percent += 100.0;
+			done++;
+		} else
+			percent += calc_percent(devs[i].current,
+						devs[i].total);
+	}
+	percent /= count;
+	gettimeofday(&now, 0);
+	left = now;
+	if (percent > 0.0)
+		left.tv_sec += (now.tv_sec - time_start.tv_sec) *
+			(100.0 - percent) / percent;
+	len = snprintf(line_buf, sizeof(line_buf),
+		       _("%6.2f%% done, %s elapsed, %s left. "
+			 "(%d/%d/%d errors, %d/%d devices done)"),
+		       percent, time_diff_format(&now, &time_start,
+						 elapsed_buf),
+		       percent > 0.0 ? time_diff_format(&left, &now, left_buf) :
+		       "?", num_read_errors, num_write_errors,
+		       num_corruption_errors, done, count);
+#ifdef HAVE_MBSTOWCS
+	len = mbstowcs(NULL, line_buf, sizeof(line_buf));
+#endif
+	fputs(line_buf, stderr);
+	memset(line_buf, '\b', len);
+	line_buf[len] = 0;
+	fputs(line_buf, stderr);
+	fflush(stderr);
+}
+
+/*
+ * Test several devices at once, one child process per device.  The
+ * children run the normal test and send bad blocks and status reports
+ * back; the parent prints the bad blocks prefixed by the device name
+ * and a combined progress line, and exits when all children are done.
+ * In the child, returns the name of the device it should test.
+ */
+static char *fork_devices(char **names, int count, const char *output_file)
+{
+	struct device_state *devs;
+	struct bb_report rep;
+	time_t		last_status = 0;
+	int		fds[2], i, status, ret = 0;
+
+	devs = calloc(count, sizeof(struct device_state));
+	if (!devs || pipe(fds) < 0) {
+		com_err(program_name, errno, "%s",
+			_("while starting device processes"));
+		exit(1);
+	}
+	/* Don't let the children inherit (and flush) unwritten output */
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < count; i++) {
+		devs[i].pid = fork();
+		if (devs[i].pid < 0) {
+			com_err(program_name, errno, "%s",
+				_("while starting device processes"));
+			exit(1);
+		}
+		if (devs[i].pid == 0) {
+			close(fds[0]);
+			report_fd = fds[1];
+			report_dev = i;
+			s_flag = v_flag = 0;
+			free(devs);
+			return names[i];
+		}
+	}
+	close(fds[1]);
+
+	if (output_file && strcmp(output_file, "-") != 0) {
+		out = fopen(output_file, "w");
+		if (out == NULL) {
+			com_err(program_name, errno,
+				_("while trying to open %s"), output_file);
+			exit(1);
+		}
+	} else
+		out = stdout;
+
+	gettimeofday(&time_start, 0);
+	while ((i = read(fds[0], &rep, sizeof(rep))) != 0) {
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i != sizeof(rep) || rep.dev < 0 || rep.dev >= count)
+			break;
+		switch (rep.type) {
+		case REPORT_BAD:
+			fprintf(out, "%s %lu\n", names[rep.dev],
+				(unsigned long) rep.block);
+			fflush(out);
+			devs[rep.dev].bad++;
+			if (rep.error == READ_ERROR)
+				num_read_errors++;
+			else if (rep.error == WRITE_ERROR)
+				num_write_errors++;
+			else
+				num_corruption_errors++;
+			break;
+		case REPORT_STATUS:
+			devs[rep.dev].current = rep.block;
+			devs[rep.dev].total = rep.total;
+			break;
+		case REPORT_DONE:
+			devs[rep.dev].done = 1;
+			break;
+		}
+		if (s_flag && time(0) != last_status) {
+			last_status = time(0);
+			print_devices_status(devs, count);
+		}
+	}
+	close(fds[0]);
+
+	for (i = 0; i < count; i++) {
+		if (waitpid(devs[i].pid, &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+		devs[i].done = 1;
+	}
+	if (s_flag)
+		print_devices_status(devs, count);
+	if (s_flag || v_flag) {
+		fputs("\n", stderr);
+		for (i = 0; i < count; i++)
+			fprintf(stderr, _("%s: %u bad blocks found\n"),
+				names[i], devs[i].bad);
+	}
+	if (out != stdout)
+		fclose(out);
+	free(devs);
+	exit(ret);
+}
+
 int main (int argc, char ** argv)
 {
 	int c;
-	char * device_name;
 	char * host_device_name = NULL;
 	char * input_file = NULL;
 	char * output_file = NULL;
@@ -1078,7 +1483,7 @@ int main (int argc, char ** argv)
 
 	if (argc && *argv)
 		program_name = *argv;
-	while ((c = getopt (argc, argv, "b:d:e:fi:o:svwnc:p:h:t:BX")) != EOF) {
+	while ((c = getopt (argc, argv, "b:d:e:fi:j:o:svwnc:p:h:t:BX")) != EOF) {
 		switch (c) {
 		case 'b':
 			block_size = parse_uint(optarg, "block size");
@@ -1089,6 +1494,11 @@ int main (int argc, char ** argv)
 		case 'i':
 			input_file = optarg;
 			break;
+		case 'j':
+			num_jobs = parse_uint(optarg, "number of jobs");
+			if (num_jobs < 1)
+				num_jobs = 1;
+			break;
 		case 'o':
 			output_file = optarg;
 			break;
@@ -1175,9 +1585,32 @@ int main (int argc, char ** argv)
 			exit(1);
 		}
 	}
+	if (num_jobs > 1) {
+		if (w_flag) {
+			com_err(program_name, 0, "%s",
+				_("-j can only be used in read-only mode"));
+			exit(1);
+		}
+		test_func = test_ro_parallel;
+	}
 	if (optind > argc - 1)
 		usage();
 	device_name = argv[optind++];
+	/*
+	 * More than one device given: test them all concurrently.  A
+	 * number after the device is its last block, as before.
+	 */
+	if (optind <= argc - 1 && !is_uint(argv[optind])) {
+		if (input_file || host_device_name) {
+			com_err(program_name, 0, "%s",
+				_("-i and -h can not be used when testing "
+				  "more than one device"));
+			exit(1);
+		}
+		device_name = fork_devices(argv + optind - 1,
+					   argc - optind + 1, output_file);
+		optind = argc;
+	}
 	if (optind > argc - 1) {
 		errcode = ext2fs_get_device_size2(device_name,
 						 block_size,
@@ -1250,7 +1683,9 @@ int main (int argc, char ** argv)
 			}
 		}
 	}
-	if (output_file && strcmp (output_file, "-") != 0)
+	if (report_fd >= 0)
+		out = stdout;
+	else if (output_file && strcmp (output_file, "-") != 0)
 	{
 		out = fopen (output_file, "w");
 		if (out == NULL)
@@ -1323,9 +1758,17 @@ int main (int argc, char ** argv)
 
 	} while (passes_clean < num_passes);
 
+	if (report_fd >= 0)
+		send_report(REPORT_DONE, 0, 0, 0);
 	close (dev);
 	if (out != stdout)
 		fclose (out);
 	free(t_patts);
+	if (report_fd >= 0) {
+		/* A child of fork_devices() */
+		fflush(stdout);
+		fflush(stderr);
+		_exit(0);
+	}
 	return 0;
 }
@@ -27,9 +27,15 @@
 #endif
 #include <ctype.h>
 #include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "fsck.h"
 
+#define SYS_BLOCK	"/sys/class/block/"
+
 /*
  * Required for the uber-silly devfs /dev/ide/host1/bus2/target3/lun3
  * pathames.
@@ -146,6 +152,142 @@ errout:
 	return NULL;
 }
 
+/*
+ * Find the whole disks that a block device lives on by walking sysfs:
+ * a partition is replaced by the disk holding it, and a stacked device
+ * (md, dm, ...) by the disks behind its slaves.  Returns an allocated,
+ * NULL-terminated list of disk names (e.g. "sda"), or NULL if the
+ * devices cannot be determined, in which case the caller should fall
+ * back to base_device().
+ */
+static int add_disk(char ***list, int *num, const char *name)
+{
+	char	**new_list;
+	int	i;
+
+	for (i = 0; i < *num; i++)
+		if (!strcmp((*list)[i], name))
+			return 0;
+	new_list = realloc(*list, (*num + 2) * sizeof(char *));
+	if (!new_list)
+		return -1;
+	*list = new_list;
+	new_list[*num] = malloc(strlen(name) + 1);
+	if (!new_list[*num])
+		return -1;
+	strcpy(new_list[*num], name);
+	new_list[++(*num)] = NULL;
+	return 0;
+}
+
+static int walk_disks(char ***list, int *num, const char *name, int depth)
+{
+	char		path[PATH_MAX], real[PATH_MAX];
+	struct stat	st;
+	DIR		*dir;
+	struct dirent	*de;
+	char		*cp;
+	int		found = 0, ret = 0;
+
+	if (depth > 8 || strlen(name) > NAME_MAX)
+		return -1;
+
+	snprintf(path, sizeof(path), SYS_BLOCK "%s/partition", name);
+	if (stat(path, &st) == 0) {
+		/* The parent directory of a partition is its disk */
+		snprintf(path, sizeof(path), SYS_BLOCK "%s", name);
+		if (!realpath(path, real))
+			return -1;
+		cp = strrchr(real, '/');
+		if (!cp)
+			return -1;
+		*cp = 0;
+		cp = strrchr(real, '/');
+		if (!cp)
+			return -1;
+		return walk_disks(list, num, cp + 1, depth + 1);
+	}
+
+	snprintf(path, sizeof(path), SYS_BLOCK "%s/slaves", name);
+	dir = opendir(path);
+	if (dir) {
+		while ((de = readdir(dir)) != NULL) {
+			if (de->d_name[0] == '.')
+				continue;
+			found++;
+			if (walk_disks(list, num, de->d_name, depth + 1)) {
+				ret = -1;
+				break;
+			}
+		}
+		closedir(dir);
+		if (found || ret)
+			return ret;
+	}
+
+	snprintf(path, sizeof(path), SYS_BLOCK "%s", name);
+	if (stat(path, &st) < 0)
+		return -1;
+	return add_disk(list, num, name);
+}
+
+void free_disk_list(char **disks)
+{
+	char	**cpp;
+
+	if (!disks)
+		return;
+	for (cpp = disks; *cpp; cpp++)
+		free(*cpp);
+	free(disks);
+}
+
+char **device_disks(const char *device)
+{
+	char	real[PATH_MAX], *name;
+	char	**list = NULL;
+	int	num = 0;
+
+	if (!realpath(device, real))
+		return NULL;
+	if (strncmp(real, "/dev/", 5) != 0)
+		return NULL;
+	name = strrchr(real, '/') + 1;
+	if (walk_disks(&list, &num, name, 0) || !num) {
+		free_disk_list(list);
+		return NULL;
+	}
+	return list;
+}
+
+/*
+ * Return the size of a device in bytes, from sysfs for block devices
+ * or the file size for images, or 0 if it is not known.
+ */
+unsigned long long device_size(const char *device)
+{
+	char			real[PATH_MAX], path[PATH_MAX];
+	unsigned long long	sectors;
+	struct stat		st;
+	FILE			*f;
+	int			ret;
+
+	if (stat(device, &st) < 0)
+		return 0;
+	if (S_ISREG(st.st_mode))
+		return st.st_size;
+	if (!realpath(device, real) || strncmp(real, "/dev/", 5) != 0)
+		return 0;
+	snprintf(path, sizeof(path), SYS_BLOCK "%s/size",
+		 strrchr(real, '/') + 1);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	ret = fscanf(f, "%llu", &sectors);
+	fclose(f);
+	return (ret == 1) ? sectors * 512 : 0;
+}
+
 #ifdef DEBUG
 int main(int argc, char** argv)
 {
@@ -0,0 +1,784 @@
+/*
+ * create_inode.c --- populate a new filesystem from a directory tree
+ * on the host, as used by mke2fs -d
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
+#include "ext2fs/ext2_fs.h"
+#include "ext2fs/ext2fs.h"
+#include "et/com_err.h"
+#include "nls-enable.h"
+#include "create_inode.h"
+
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* File data is streamed through a buffer of this size */
+#define COPY_BUFSIZE	(1024 * 1024)
+
+/* Number of hash chains used to find candidates for deduplication */
+#define DUP_HASH_SIZE	4096
+
+/* Source files with more than one link we have already created */
+struct hdlink {
+	dev_t		src_dev;
+	ino_t		src_ino;
+	ext2_ino_t	dst_ino;
+};
+
+/* Files which identical files may be hard linked to */
+struct dup_file {
+	__u64		size;
+	mode_t		mode;
+	uid_t		uid;
+	gid_t		gid;
+	int		have_crc;
+	__u32		crc;
+	char		*path;
+	ext2_ino_t	ino;
+	long		next;
+};
+
+struct populate_ctx {
+	ext2_filsys	fs;
+	int		flags;
+	char		*buf;
+	char		*cmp_buf;
+	char		*bmap_buf;
+	blk64_t		goal;
+	struct hdlink	*hdlinks;
+	unsigned long	num_hdlinks, max_hdlinks;
+	struct dup_file	*dups;
+	unsigned long	num_dups, max_dups;
+	long		*dup_hash;
+};
+
+static errcode_t grow_array(void *array, unsigned long *max,
+			    unsigned long num, size_t size)
+{
+	unsigned long	new_max;
+	errcode_t	retval;
+
+	if (num < *max)
+		return 0;
+	new_max = *max ? *max * 2 : 256;
+	retval = ext2fs_resize_mem(*max * size, new_max * size, array);
+	if (retval)
+		return retval;
+	*max = new_max;
+	return 0;
+}
+
+static void set_inode_attrs(struct ext2_inode *inode, struct stat *st)
+{
+	inode->i_mode = (inode->i_mode & LINUX_S_IFMT) | (st->st_mode & 07777);
+	inode->i_uid = st->st_uid;
+	inode->i_uid_high = st->st_uid >> 16;
+	inode->i_gid = st->st_gid;
+	inode->i_gid_high = st->st_gid >> 16;
+	inode->i_atime = st->st_atime;
+	inode->i_mtime = st->st_mtime;
+	inode->i_ctime = st->st_ctime;
+}
+
+static errcode_t update_inode_attrs(ext2_filsys fs, ext2_ino_t ino,
+				    struct stat *st)
+{
+	struct ext2_inode	inode;
+	errcode_t		retval;
+
+	retval = ext2fs_read_inode(fs, ino, &inode);
+	if (retval)
+		return retval;
+	set_inode_attrs(&inode, st);
+	return ext2fs_write_inode(fs, ino, &inode);
+}
+
+/* Link ino into parent, growing the directory if it is full */
+static errcode_t add_link(ext2_filsys fs, ext2_ino_t parent,
+			  const char *name, ext2_ino_t ino, int filetype)
+{
+	errcode_t	retval;
+
+	retval = ext2fs_link(fs, parent, name, ino, filetype);
+	if (retval == EXT2_ET_DIR_NO_SPACE) {
+		retval = ext2fs_expand_dir(fs, parent);
+		if (retval)
+			return retval;
+		retval = ext2fs_link(fs, parent, name, ino, filetype);
+	}
+	return retval;
+}
+
+static errcode_t add_hard_link(ext2_filsys fs, ext2_ino_t parent,
+			       const char *name, ext2_ino_t ino)
+{
+	struct ext2_inode	inode;
+	errcode_t		retval;
+
+	retval = add_link(fs, parent, name, ino, EXT2_FT_REG_FILE);
+	if (retval)
+		return retval;
+	retval = ext2fs_read_inode(fs, ino, &inode);
+	if (retval)
+		return retval;
+	inode.i_links_count++;
+	return ext2fs_write_inode(fs, ino, &inode);
+}
+
+static errcode_t do_mkdir(ext2_filsys fs, ext2_ino_t parent,
+			  const char *name, struct stat *st,
+			  ext2_ino_t *ino)
+{
+	struct ext2_inode	inode;
+	errcode_t		retval;
+
+	/* Reuse a directory which is already there (e.g., lost+found) */
+	retval = ext2fs_lookup(fs, parent, name, strlen(name), 0, ino);
+	if (retval == 0) {
+		retval = ext2fs_read_inode(fs, *ino, &inode);
+		if (retval)
+			return retval;
+		if (!LINUX_S_ISDIR(inode.i_mode))
+			return EXT2_ET_FILE_EXISTS;
+		return update_inode_attrs(fs, *ino, st);
+	}
+
+	retval = ext2fs_mkdir(fs, parent, 0, name);
+	if (retval == EXT2_ET_DIR_NO_SPACE) {
+		retval = ext2fs_expand_dir(fs, parent);
+		if (retval)
+			return retval;
+		retval = ext2fs_mkdir(fs, parent, 0, name);
+	}
+	if (retval)
+		return retval;
+	retval = ext2fs_lookup(fs, parent, name, strlen(name), 0, ino);
+	if (retval)
+		return retval;
+	return update_inode_attrs(fs, *ino, st);
+}
+
+static errcode_t do_symlink(ext2_filsys fs, ext2_ino_t parent,
+			    const char *name, const char *path,
+			    struct stat *st)
+{
+	char		target[PATH_MAX + 1];
+	ext2_ino_t	ino;
+	errcode_t	retval;
+	int		len;
+
+	len = readlink(path, target, sizeof(target) - 1);
+	if (len < 0)
+		return errno;
+	target[len] = 0;
+
+	retval = ext2fs_symlink(fs, parent, 0, name, target);
+	if (retval == EXT2_ET_DIR_NO_SPACE) {
+		retval = ext2fs_expand_dir(fs, parent);
+		if (retval)
+			return retval;
+		retval = ext2fs_symlink(fs, parent, 0, name, target);
+	}
+	if (retval)
+		return retval;
+	retval = ext2fs_lookup(fs, parent, name, strlen(name), 0, &ino);
+	if (retval)
+		return retval;
+	return update_inode_attrs(fs, ino, st);
+}
+
+static errcode_t do_mknod(ext2_filsys fs, ext2_ino_t parent,
+			  const char *name, struct stat *st)
+{
+	struct ext2_inode	inode;
+	ext2_ino_t		ino;
+	errcode_t		retval;
+	unsigned long		major = 0, minor = 0;
+	int			mode, filetype;
+
+	switch (st->st_mode & S_IFMT) {
+	case S_IFCHR:
+		mode = LINUX_S_IFCHR;
+		filetype = EXT2_FT_CHRDEV;
+		break;
+	case S_IFBLK:
+		mode = LINUX_S_IFBLK;
+		filetype = EXT2_FT_BLKDEV;
+		break;
+	case S_IFIFO:
+		mode = LINUX_S_IFIFO;
+		filetype = EXT2_FT_FIFO;
+		break;
+	case S_IFSOCK:
+		mode = LINUX_S_IFSOCK;
+		filetype = EXT2_FT_SOCK;
+		break;
+	default:
+		return EXT2_ET_INVALID_ARGUMENT;
+	}
+
+	retval = ext2fs_new_inode(fs, parent, 010755, 0, &ino);
+	if (retval)
+		return retval;
+	retval = add_link(fs, parent, name, ino, filetype);
+	if (retval)
+		return retval;
+	ext2fs_inode_alloc_stats2(fs, ino, +1, 0);
+
+	memset(&inode, 0, sizeof(inode));
+	inode.i_mode = mode;
+	set_inode_attrs(&inode, st);
+	if (filetype == EXT2_FT_CHRDEV || filetype == EXT2_FT_BLKDEV) {
+		major = major(st->st_rdev);
+		minor = minor(st->st_rdev);
+	}
+	if ((major < 256) && (minor < 256)) {
+		inode.i_block[0] = major * 256 + minor;
+		inode.i_block[1] = 0;
+	} else {
+		inode.i_block[0] = 0;
+		inode.i_block[1] = (minor & 0xff) | (major << 8) |
+				   ((minor & ~0xff) << 12);
+	}
+	inode.i_links_count = 1;
+	return ext2fs_write_new_inode(fs, ino, &inode);
+}
+
+static int is_zero_block(const char *buf, unsigned int len)
+{
+	while (len--)
+		if (*buf++)
+			return 0;
+	return 1;
+}
+
+/* Read as much of len as possible, stopping early only at EOF */
+static ssize_t read_full(int fd, char *buf, size_t len)
+{
+	size_t	done = 0;
+	ssize_t	got;
+
+	while (done < len) {
+		got = read(fd, buf + done, len - done);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (got == 0)
+			break;
+		done += got;
+	}
+	return done;
+}
+
+/*
+ * Find a run of up to want free blocks, starting the search at the
+ * allocation goal, and mark it in use.  The run returned is as long
+ * as the free space at that point allows.
+ */
+static errcode_t alloc_run(struct populate_ctx *ctx, blk64_t want,
+			   blk64_t *ret_start, blk64_t *ret_len)
+{
+	ext2_filsys	fs = ctx->fs;
+	blk64_t		start, len, goal, last;
+	errcode_t	retval;
+
+	last = ext2fs_blocks_count(fs->super) - 1;
+	goal = ctx->goal;
+	if (goal < fs->super->s_first_data_block || goal > last)
+		goal = fs->super->s_first_data_block;
+
+	retval = ext2fs_find_first_zero_block_bitmap2(fs->block_map, goal,
+						      last, &start);
+	if (retval == ENOENT && goal > fs->super->s_first_data_block)
+		retval = ext2fs_find_first_zero_block_bitmap2(fs->block_map,
+				fs->super->s_first_data_block, goal - 1,
+				&start);
+	if (retval == ENOENT)
+		return EXT2_ET_BLOCK_ALLOC_FAIL;
+	if (retval)
+		return retval;
+
+	for (len = 1; len < want && start + len <= last; len++)
+		if (ext2fs_fast_test_block_bitmap2(fs->block_map,
+						   start + len))
+			break;
+	for (goal = start; goal < start + len; goal++)
+		ext2fs_block_alloc_stats2(fs, goal, +1);
+
+	*ret_start = start;
+	*ret_len = len;
+	return 0;
+}
+
+/*
+ * Write count blocks of data for logical block lblk onwards.  Each
+ * run of free space found is written with a single I/O and then
+ * mapped into the file, so that a file laid down in empty space ends
+ * up as a few long extents.
+ */
+static errcode_t write_blocks(struct populate_ctx *ctx, ext2_ino_t ino,
+			      struct ext2_inode *inode, blk64_t lblk,
+			      const char *ptr, blk64_t count)
+{
+	ext2_filsys	fs = ctx->fs;
+	blk64_t		start, len, i, pblk;
+	errcode_t	retval;
+
+	while (count) {
+		retval = alloc_run(ctx, count, &start, &len);
+		if (retval)
+			return retval;
+		retval = io_channel_write_blk64(fs->io, start, len, ptr);
+		if (retval)
+			return retval;
+		for (i = 0; i < len; i++) {
+			pblk = start + i;
+			retval = ext2fs_bmap2(fs, ino, inode, ctx->bmap_buf,
+					      BMAP_ALLOC | BMAP_SET, lblk + i,
+					      0, &pblk);
+			if (retval)
+				return retval;
+		}
+		retval = ext2fs_iblk_add_blocks(fs, inode, len);
+		if (retval)
+			return retval;
+		ctx->goal = start + len;
+		lblk += len;
+		ptr += len * fs->blocksize;
+		count -= len;
+	}
+	return 0;
+}
+
+/*
+ * With bigalloc the block to cluster mapping rules make it simplest
+ * to let the file I/O routines do the allocation.
+ */
+static errcode_t copy_file_fileio(struct populate_ctx *ctx, int fd,
+				  ext2_ino_t ino, struct ext2_inode *inode)
+{
+	ext2_file_t	e2_file;
+	errcode_t	retval, close_ret;
+	ssize_t		got;
+	unsigned int	written;
+
+	retval = ext2fs_file_open2(ctx->fs, ino, inode, EXT2_FILE_WRITE,
+				   &e2_file);
+	if (retval)
+		return retval;
+	while ((got = read_full(fd, ctx->buf, COPY_BUFSIZE)) > 0) {
+		retval = ext2fs_file_write(e2_file, ctx->buf, got, &written);
+		if (retval)
+			break;
+	}
+	if (got < 0 && !retval)
+		retval = errno;
+	close_ret = ext2fs_file_close(e2_file);
+	if (!retval)
+		retval = close_ret;
+	if (!retval)
+		retval = ext2fs_read_inode(ctx->fs, ino, inode);
+	return retval;
+}
+
+static errcode_t copy_file_data(struct populate_ctx *ctx, int fd,
+				ext2_ino_t ino, struct ext2_inode *inode)
+{
+	ext2_filsys	fs = ctx->fs;
+	unsigned int	bs = fs->blocksize;
+	blk64_t		lblk = 0, nblocks, i, j;
+	ssize_t		got;
+	errcode_t	retval;
+
+	if (EXT2_HAS_RO_COMPAT_FEATURE(fs->super,
+				       EXT4_FEATURE_RO_COMPAT_BIGALLOC))
+		return copy_file_fileio(ctx, fd, ino, inode);
+
+	while ((got = read_full(fd, ctx->buf, COPY_BUFSIZE)) > 0) {
+		nblocks = (got + bs - 1) / bs;
+		if (got % bs)
+			memset(ctx->buf + got, 0, bs - (got % bs));
+
+		/* Write out each run of non-zero blocks; skip the holes */
+		for (i = 0; i < nblocks; i = j) {
+			if (is_zero_block(ctx->buf + i * bs, bs)) {
+				j = i + 1;
+				continue;
+			}
+			for (j = i + 1; j < nblocks; j++)
+				if (is_zero_block(ctx->buf + j * bs, bs))
+					break;
+			retval = write_blocks(ctx, ino, inode, lblk + i,
+					      ctx->buf + i * bs, j - i);
+			if (retval)
+				return retval;
+		}
+		lblk += nblocks;
+	}
+	if (got < 0)
+		return errno;
+	return 0;
+}
+
+static errcode_t file_crc(struct populate_ctx *ctx, const char *path,
+			  __u32 *crc)
+{
+	ssize_t	got;
+	int	fd;
+
+	fd = open(path, O_RDONLY | O_LARGEFILE);
+	if (fd < 0)
+		return errno;
+	*crc = ~0U;
+	while ((got = read_full(fd, ctx->buf, COPY_BUFSIZE)) > 0)
+		*crc = ext2fs_crc32c_le(*crc, (unsigned char *) ctx->buf, got);
+	close(fd);
+	if (got < 0)
+		return errno;
+	return 0;
+}
+
+static int files_equal(struct populate_ctx *ctx, const char *a,
+		       const char *b)
+{
+	ssize_t	got_a, got_b;
+	int	fd_a, fd_b, ret = 0;
+
+	fd_a = open(a, O_RDONLY | O_LARGEFILE);
+	if (fd_a < 0)
+		return 0;
+	fd_b = open(b, O_RDONLY | O_LARGEFILE);
+	if (fd_b < 0) {
+		close(fd_a);
+		return 0;
+	}
+	while (1) {
+		got_a = read_full(fd_a, ctx->buf, COPY_BUFSIZE);
+		got_b = read_full(fd_b, ctx->cmp_buf, COPY_BUFSIZE);
+		if (got_a != got_b || got_a < 0)
+			break;
+		if (got_a == 0) {
+			ret = 1;
+			break;
+		}
+		if (memcmp(ctx->buf, ctx->cmp_buf, got_a))
+			break;
+	}
+	close(fd_a);
+	close(fd_b);
+	return ret;
+}
+
+static struct dup_file *get_dup(struct populate_ctx *ctx, long i)
+{
+	return (i < 0) ? NULL : &ctx->dups[i];
+}
+
+/*
+ * Look for an already copied file with the same contents and
+ * attributes as path.  Checksums are only computed once two files of
+ * the same size turn up, and a checksum match is confirmed by
+ * comparing the files before they are merged.
+ */
+static ext2_ino_t find_dup(struct populate_ctx *ctx, const char *path,
+			   struct stat *st)
+{
+	struct dup_file	*d;
+	__u32		crc = 0;
+	int		have_crc = 0;
+
+	for (d = get_dup(ctx, ctx->dup_hash[st->st_size % DUP_HASH_SIZE]);
+	     d; d = get_dup(ctx, d->next)) {
+		if (d->size != (__u64) st->st_size || d->mode != st->st_mode ||
+		    d->uid != st->st_uid || d->gid != st->st_gid)
+			continue;
+		if (!have_crc) {
+			if (file_crc(ctx, path, &crc))
+				return 0;
+			have_crc = 1;
+		}
+		if (!d->have_crc) {
+			if (file_crc(ctx, d->path, &d->crc))
+				continue;
+			d->have_crc = 1;
+		}
+		if (d->crc == crc && files_equal(ctx, path, d->path))
+			return d->ino;
+	}
+	return 0;
+}
+
+static void add_dup(struct populate_ctx *ctx, const char *path,
+		    struct stat *st, ext2_ino_t ino)
+{
+	struct dup_file	*d;
+	long		*head;
+	char		*p;
+
+	if (grow_array(&ctx->dups, &ctx->max_dups, ctx->num_dups,
+		       sizeof(struct dup_file)))
+		return;
+	p = strdup(path);
+	if (!p)
+		return;
+	head = &ctx->dup_hash[st->st_size % DUP_HASH_SIZE];
+	d = &ctx->dups[ctx->num_dups];
+	memset(d, 0, sizeof(*d));
+	d->size = st->st_size;
+	d->mode = st->st_mode;
+	d->uid = st->st_uid;
+	d->gid = st->st_gid;
+	d->path = p;
+	d->ino = ino;
+	d->next = *head;
+	*head = ctx->num_dups++;
+}
+
+static errcode_t do_write_file(struct populate_ctx *ctx, ext2_ino_t parent,
+			       const char *name, const char *path,
+			       struct stat *st)
+{
+	ext2_filsys		fs = ctx->fs;
+	struct ext2_inode	inode;
+	struct hdlink		*h;
+	ext2_ino_t		ino;
+	errcode_t		retval;
+	unsigned long		i;
+	int			fd;
+
+	if (st->st_nlink > 1) {
+		for (i = 0, h = ctx->hdlinks; i < ctx->num_hdlinks; i++, h++)
+			if (h->src_dev == st->st_dev &&
+			    h->src_ino == st->st_ino)
+				return add_hard_link(fs, parent, name,
+						     h->dst_ino);
+	}
+	if ((ctx->flags & POPULATE_FL_DEDUP) && st->st_size) {
+		ino = find_dup(ctx, path, st);
+		if (ino)
+			return add_hard_link(fs, parent, name, ino);
+	}
+
+	fd = open(path, O_RDONLY | O_LARGEFILE);
+	if (fd < 0)
+		return errno;
+
+	retval = ext2fs_new_inode(fs, parent, 010755, 0, &ino);
+	if (retval)
+		goto out;
+	retval = add_link(fs, parent, name, ino, EXT2_FT_REG_FILE);
+	if (retval)
+		goto out;
+	ext2fs_inode_alloc_stats2(fs, ino, +1, 0);
+
+	memset(&inode, 0, sizeof(inode));
+	inode.i_mode = LINUX_S_IFREG;
+	set_inode_attrs(&inode, st);
+	inode.i_links_count = 1;
+	if (fs->super->s_feature_incompat & EXT3_FEATURE_INCOMPAT_EXTENTS) {
+		struct ext3_extent_header *eh;
+
+		eh = (struct ext3_extent_header *) &inode.i_block[0];
+		eh->eh_depth = 0;
+		eh->eh_entries = 0;
+		eh->eh_magic = ext2fs_cpu_to_le16(EXT3_EXT_MAGIC);
+		eh->eh_max = ext2fs_cpu_to_le16((sizeof(inode.i_block) -
+						 sizeof(*eh)) /
+						sizeof(struct ext3_extent));
+		inode.i_flags |= EXT4_EXTENTS_FL;
+	}
+	retval = ext2fs_write_new_inode(fs, ino, &inode);
+	if (retval)
+		goto out;
+
+	retval = copy_file_data(ctx, fd, ino, &inode);
+	if (retval)
+		goto out;
+
+	inode.i_size = st->st_size & 0xffffffff;
+	inode.i_size_high = (__u64) st->st_size >> 32;
+	if (ext2fs_needs_large_file_feature(st->st_size) &&
+	    !EXT2_HAS_RO_COMPAT_FEATURE(fs->super,
+					EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+		fs->super->s_feature_ro_compat |=
+			EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+		ext2fs_mark_super_dirty(fs);
+	}
+	retval = ext2fs_write_inode(fs, ino, &inode);
+	if (retval)
+		goto out;
+
+	if (st->st_nlink > 1 &&
+	    !grow_array(&ctx->hdlinks, &ctx->max_hdlinks, ctx->num_hdlinks,
+			sizeof(struct hdlink))) {
+		h = &ctx->hdlinks[ctx->num_hdlinks++];
+		h->src_dev = st->st_dev;
+		h->src_ino = st->st_ino;
+		h->dst_ino = ino;
+	}
+	if ((ctx->flags & POPULATE_FL_DEDUP) && st->st_size)
+		add_dup(ctx, path, st, ino);
+out:
+	close(fd);
+	return retval;
+}
+
+static errcode_t __populate_fs(struct populate_ctx *ctx,
+			       ext2_ino_t parent_ino, const char *source_dir)
+{
+	ext2_filsys	fs = ctx->fs;
+	DIR		*dh;
+	struct dirent	*dent;
+	struct stat	st;
+	char		path[PATH_MAX];
+	ext2_ino_t	ino;
+	errcode_t	retval = 0;
+
+	dh = opendir(source_dir);
+	if (!dh) {
+		retval = errno;
+		com_err(__func__, retval, _("while opening directory \"%s\""),
+			source_dir);
+		return retval;
+	}
+
+	while ((dent = readdir(dh))) {
+		if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+			continue;
+		if (snprintf(path, sizeof(path), "%s/%s", source_dir,
+			     dent->d_name) >= (int) sizeof(path)) {
+			retval = ENAMETOOLONG;
+			com_err(__func__, retval, "%s/%s", source_dir,
+				dent->d_name);
+			break;
+		}
+		if (lstat(path, &st)) {
+			retval = errno;
+			com_err(__func__, retval, _("while lstat \"%s\""),
+				path);
+			break;
+		}
+
+		switch (st.st_mode & S_IFMT) {
+		case S_IFDIR:
+			retval = do_mkdir(fs, parent_ino, dent->d_name, &st,
+					  &ino);
+			if (!retval)
+				retval = __populate_fs(ctx, ino, path);
+			break;
+		case S_IFREG:
+			retval = do_write_file(ctx, parent_ino, dent->d_name,
+					       path, &st);
+			break;
+		case S_IFLNK:
+			retval = do_symlink(fs, parent_ino, dent->d_name,
+					    path, &st);
+			break;
+		case S_IFCHR:
+		case S_IFBLK:
+		case S_IFIFO:
+		case S_IFSOCK:
+			retval = do_mknod(fs, parent_ino, dent->d_name, &st);
+			break;
+		default:
+			fprintf(stderr, _("ignoring entry \"%s\"\n"), path);
+			break;
+		}
+		if (retval) {
+			com_err(__func__, retval, _("while populating \"%s\""),
+				path);
+			break;
+		}
+	}
+	closedir(dh);
+	return retval;
+}
+
+/*
+ * Copy the contents of source_dir on the host into the directory
+ * parent_ino of the (freshly created) filesystem fs.
+ */
+errcode_t populate_fs(ext2_filsys fs, ext2_ino_t parent_ino,
+		      const char *source_dir, int flags)
+{
+	struct populate_ctx	ctx;
+	errcode_t		retval;
+	unsigned long		i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fs = fs;
+	ctx.flags = flags;
+
+	retval = ext2fs_get_mem(COPY_BUFSIZE + fs->blocksize, &ctx.buf);
+	if (retval)
+		goto out;
+	retval = ext2fs_get_array(3, fs->blocksize, &ctx.bmap_buf);
+	if (retval)
+		goto out;
+	if (flags & POPULATE_FL_DEDUP) {
+		retval = ext2fs_get_mem(COPY_BUFSIZE, &ctx.cmp_buf);
+		if (retval)
+			goto out;
+		retval = ext2fs_get_array(DUP_HASH_SIZE, sizeof(long),
+					  &ctx.dup_hash);
+		if (retval)
+			goto out;
+		for (i = 0; i < DUP_HASH_SIZE; i++)
+			ctx.dup_hash[i] = -1;
+	}
+
+	retval = ext2fs_read_bitmaps(fs);
+	if (retval)
+		goto out;
+
+	retval = __populate_fs(&ctx, parent_ino, source_dir);
+out:
+	for (i = 0; i < ctx.num_dups; i++)
+		free(ctx.dups[i].path);
+	if (ctx.dups)
+		ext2fs_free_mem(&ctx.dups);
+	if (ctx.dup_hash)
+		ext2fs_free_mem(&ctx.dup_hash);
+	if (ctx.hdlinks)
+		ext2fs_free_mem(&ctx.hdlinks);
+	if (ctx.cmp_buf)
+		ext2fs_free_mem(&ctx.cmp_buf);
+	if (ctx.bmap_buf)
+		ext2fs_free_mem(&ctx.bmap_buf);
+	if (ctx.buf)
+		ext2fs_free_mem(&ctx.buf);
+	return retval;
+}
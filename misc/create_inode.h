@@ -0,0 +1,21 @@
+/*
+ * create_inode.h - populate a new filesystem from a host directory
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#ifndef _CREATE_INODE_H
+#define _CREATE_INODE_H
+
+#include "ext2fs/ext2fs.h"
+
+/* Flags for populate_fs() */
+#define POPULATE_FL_DEDUP	0x0001	/* hard link identical files */
+
+extern errcode_t populate_fs(ext2_filsys fs, ext2_ino_t parent_ino,
+			     const char *source_dir, int flags);
+
+#endif /* _CREATE_INODE_H */
@@ -18,6 +18,9 @@
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#include <string.h>
+#include <errno.h>
+#include <sys/wait.h>
 #ifdef HAVE_GETOPT_H
 #include <getopt.h>
 #else
@@ -31,7 +34,7 @@ extern int optind;
 
 static void usage(const char *prog)
 {
-	fprintf(stderr, "usage: %s [-c chunksize in kb] [-h] "
+	fprintf(stderr, "usage: %s [-c chunksize in kb] [-g] [-j jobs] [-h] "
 		"device_name\n", prog);
 #ifndef DEBUGFS
 	exit(1);
@@ -73,10 +76,16 @@ static void init_chunk_info(ext2_filsys fs, struct chunk_info *info)
 	}
 }
 
-static void update_chunk_stats(struct chunk_info *info,
+/*
+ * Account for one free extent: the size histogram, and the number of
+ * whole, aligned chunks it covers.
+ */
+static void update_chunk_stats(struct chunk_info *info, blk64_t start,
 			       unsigned long chunk_size)
 {
 	unsigned long idx;
+	int bits = info->chunkbits - info->blocksize_bits;
+	blk64_t first, last;
 
 	idx = ul_log2(chunk_size) + 1;
 	if (idx >= MAX_HIST)
@@ -90,56 +99,274 @@ static void update_chunk_stats(struct chunk_info *info,
 		info->min = chunk_size;
 	info->avg += chunk_size;
 	info->real_free_chunks++;
+
+	first = (start + info->blks_in_chunk - 1) >> bits;
+	last = (start + chunk_size) >> bits;
+	if (last > first)
+		info->free_chunks += last - first;
 }
 
-static void scan_block_bitmap(ext2_filsys fs, struct chunk_info *info)
+static void merge_chunk_stats(struct chunk_info *info, struct chunk_info *from)
 {
-	unsigned long long blocks_count = ext2fs_blocks_count(fs->super);
-	unsigned long long chunks = (blocks_count + info->blks_in_chunk) >>
-				(info->chunkbits - info->blocksize_bits);
-	unsigned long long chunk_num;
-	unsigned long last_chunk_size = 0;
-	unsigned long long chunk_start_blk = 0;
-	int used;
-
-	for (chunk_num = 0; chunk_num < chunks; chunk_num++) {
-		unsigned long long blk, num_blks;
-		int chunk_free;
-
-		/* Last chunk may be smaller */
-		if (chunk_start_blk + info->blks_in_chunk > blocks_count)
-			num_blks = blocks_count - chunk_start_blk;
-		else
-			num_blks = info->blks_in_chunk;
-
-		chunk_free = 0;
-
-		/* Initialize starting block for first chunk correctly else
-		 * there is a segfault when blocksize = 1024 in which case
-		 * block_map->start = 1 */
-		for (blk = 0; blk < num_blks; blk++, chunk_start_blk++) {
-			if (chunk_num == 0 && blk == 0) {
-				blk = fs->super->s_first_data_block;
-				chunk_start_blk = blk;
-			}
-			used = ext2fs_fast_test_block_bitmap2(fs->block_map,
-				chunk_start_blk >> fs->cluster_ratio_bits);
-			if (!used) {
-				last_chunk_size++;
-				chunk_free++;
-			}
+	int i;
 
-			if (used && last_chunk_size != 0) {
-				update_chunk_stats(info, last_chunk_size);
-				last_chunk_size = 0;
-			}
+	for (i = 0; i < MAX_HIST; i++) {
+		info->histogram.fc_chunks[i] += from->histogram.fc_chunks[i];
+		info->histogram.fc_blocks[i] += from->histogram.fc_blocks[i];
+	}
+	if (from->max > info->max)
+		info->max = from->max;
+	if (from->min < info->min)
+		info->min = from->min;
+	info->avg += from->avg;
+	info->real_free_chunks += from->real_free_chunks;
+	info->free_chunks += from->free_chunks;
+}
+
+/* Add a free extent to the stats of every group it touches */
+static void update_group_stats(ext2_filsys fs, struct chunk_info *info,
+			       blk64_t start, blk64_t len)
+{
+	struct free_group_stats *gs;
+	dgrp_t group;
+	blk64_t n;
+
+	while (len) {
+		group = ext2fs_group_of_blk2(fs, start);
+		n = ext2fs_group_last_block2(fs, group) - start + 1;
+		if (n > len)
+			n = len;
+		gs = &info->group_stats[group];
+		gs->free_blocks += n;
+		gs->free_extents++;
+		if (n > gs->max_extent)
+			gs->max_extent = n;
+		start += n;
+		len -= n;
+	}
+}
+
+/*
+ * A range of whole block groups scanned by one process.  Free extents
+ * which touch either end of the range may continue into the
+ * neighbouring range, so they are reported as head/tail lengths and
+ * stitched together by the caller; everything else goes into info.
+ */
+struct scan_range {
+	blk64_t		start, end;	/* inclusive */
+	dgrp_t		first_group, last_group;
+	blk64_t		head, tail;
+	struct chunk_info info;
+};
+
+/*
+ * Walk the free extents of a range.  The bitmap backends find the next
+ * zero or set bit a word (or an rbtree extent) at a time, so this costs
+ * one pair of lookups per free extent rather than one test per block.
+ */
+static void scan_range(ext2_filsys fs, struct scan_range *r)
+{
+	blk64_t blk = r->start, next;
+	blk64_t len;
+
+	while (blk <= r->end) {
+		if (ext2fs_find_first_zero_block_bitmap2(fs->block_map, blk,
+							 r->end, &blk))
+			break;
+		if (ext2fs_find_first_set_block_bitmap2(fs->block_map, blk,
+							r->end, &next))
+			next = r->end + 1;
+		len = next - blk;
+
+		if (r->info.group_stats)
+			update_group_stats(fs, &r->info, blk, len);
+		if (blk == r->start)
+			r->head = len;
+		if (next == r->end + 1)
+			r->tail = len;
+		if (blk != r->start && next != r->end + 1)
+			update_chunk_stats(&r->info, blk, len);
+		blk = next;
+	}
+}
+
+static int read_all(int fd, void *buf, size_t count)
+{
+	char *cp = buf;
+	ssize_t ret;
+
+	while (count) {
+		ret = read(fd, cp, count);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		cp += ret;
+		count -= ret;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t count)
+{
+	const char *cp = buf;
+	ssize_t ret;
+
+	while (count) {
+		ret = write(fd, cp, count);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		cp += ret;
+		count -= ret;
+	}
+	return 0;
+}
+
+/*
+ * Scan every range in its own process.  The bitmap is already in
+ * memory, so the children simply inherit it; each one sends back its
+ * scan_range and its slice of the per-group stats over a pipe.  Any
+ * range whose child could not be started or did not report is scanned
+ * here instead.
+ */
+static void scan_ranges_parallel(ext2_filsys fs, struct scan_range *ranges,
+				 int nr)
+{
+	struct free_group_stats *gs;
+	pid_t *pids;
+	int *fds;
+	int i, pfd[2];
+	size_t gsize;
+
+	pids = calloc(nr, sizeof(pid_t));
+	fds = calloc(nr, sizeof(int));
+	if (!pids || !fds) {
+		free(pids);
+		free(fds);
+		for (i = 0; i < nr; i++)
+			scan_range(fs, &ranges[i]);
+		return;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < nr; i++) {
+		pids[i] = -1;
+		fds[i] = -1;
+		if (pipe(pfd) < 0)
+			continue;
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			close(pfd[0]);
+			close(pfd[1]);
+			continue;
 		}
+		if (pids[i] == 0) {
+			close(pfd[0]);
+			scan_range(fs, &ranges[i]);
+			gs = ranges[i].info.group_stats;
+			gsize = (ranges[i].last_group -
+				 ranges[i].first_group + 1) * sizeof(*gs);
+			if (write_all(pfd[1], &ranges[i],
+				      sizeof(struct scan_range)) == 0 && gs)
+				write_all(pfd[1], gs + ranges[i].first_group,
+					  gsize);
+			_exit(0);
+		}
+		close(pfd[1]);
+		fds[i] = pfd[0];
+	}
 
-		if (chunk_free == info->blks_in_chunk)
-			info->free_chunks++;
+	for (i = 0; i < nr; i++) {
+		struct scan_range r;
+
+		gs = ranges[i].info.group_stats;
+		gsize = (ranges[i].last_group - ranges[i].first_group + 1) *
+			sizeof(*gs);
+		if (fds[i] >= 0 &&
+		    read_all(fds[i], &r, sizeof(r)) == 0 &&
+		    (!gs || read_all(fds[i], gs + ranges[i].first_group,
+				     gsize) == 0)) {
+			r.info.group_stats = gs;
+			ranges[i] = r;
+		} else {
+			if (gs)
+				memset(gs + ranges[i].first_group, 0, gsize);
+			scan_range(fs, &ranges[i]);
+		}
+		if (fds[i] >= 0)
+			close(fds[i]);
+		if (pids[i] > 0)
+			waitpid(pids[i], 0, 0);
 	}
-	if (last_chunk_size != 0)
-		update_chunk_stats(info, last_chunk_size);
+	free(pids);
+	free(fds);
+}
+
+static void scan_block_bitmap(ext2_filsys fs, struct chunk_info *info)
+{
+	struct scan_range *ranges = NULL, one;
+	dgrp_t group = 0, per_range;
+	blk64_t carry_start = 0, carry_len = 0;
+	int i, nr;
+
+	nr = info->jobs > 1 ? info->jobs : 1;
+	if ((dgrp_t) nr > fs->group_desc_count)
+		nr = fs->group_desc_count;
+	if (nr > 1)
+		ranges = calloc(nr, sizeof(struct scan_range));
+	if (!ranges) {
+		memset(&one, 0, sizeof(one));
+		ranges = &one;
+		nr = 1;
+	}
+
+	per_range = (fs->group_desc_count + nr - 1) / nr;
+	for (i = 0; i < nr && group < fs->group_desc_count; i++) {
+		ranges[i].first_group = group;
+		group += per_range;
+		if (group > fs->group_desc_count)
+			group = fs->group_desc_count;
+		ranges[i].last_group = group - 1;
+		ranges[i].start = ext2fs_group_first_block2(fs,
+						ranges[i].first_group);
+		ranges[i].end = ext2fs_group_last_block2(fs,
+						ranges[i].last_group);
+		ranges[i].info = *info;
+	}
+	nr = i;
+
+	if (nr > 1)
+		scan_ranges_parallel(fs, ranges, nr);
+	else
+		scan_range(fs, &ranges[0]);
+
+	for (i = 0; i < nr; i++) {
+		struct scan_range *r = &ranges[i];
+
+		if (r->head == r->end - r->start + 1) {
+			if (!carry_len)
+				carry_start = r->start;
+			carry_len += r->head;
+			continue;
+		}
+		if (r->head) {
+			if (!carry_len)
+				carry_start = r->start;
+			carry_len += r->head;
+		}
+		if (carry_len)
+			update_chunk_stats(info, carry_start, carry_len);
+		merge_chunk_stats(info, &r->info);
+		carry_len = r->tail;
+		carry_start = r->end - r->tail + 1;
+	}
+	if (carry_len)
+		update_chunk_stats(info, carry_start, carry_len);
+	if (ranges != &one)
+		free(ranges);
 }
 
 static errcode_t get_chunk_info(ext2_filsys fs, struct chunk_info *info,
@@ -209,6 +436,22 @@ static errcode_t get_chunk_info(ext2_filsys fs, struct chunk_info *info,
 		}
 	}
 
+	if (info->group_stats) {
+		struct free_group_stats *gs;
+		dgrp_t group;
+
+		fprintf(f, "\nFREE SPACE BY GROUP:\n");
+		fprintf(f, "%8s  %12s  %12s  %16s\n", "Group", "Free blocks",
+			"Free extents", "Max. free extent");
+		for (group = 0; group < fs->group_desc_count; group++) {
+			gs = &info->group_stats[group];
+			fprintf(f, "%8u  %12u  %12u  %13llu KB\n", group,
+				gs->free_blocks, gs->free_extents,
+				((unsigned long long) gs->max_extent *
+				 fs->blocksize) >> 10);
+		}
+	}
+
 	return retval;
 }
 
@@ -235,8 +478,20 @@ static void collect_info(ext2_filsys fs, struct chunk_info *chunk_info, FILE *f)
 	}
 
 	init_chunk_info(fs, chunk_info);
+	if (chunk_info->flags & E2F_FLAG_GROUPS) {
+		chunk_info->group_stats = calloc(fs->group_desc_count,
+					sizeof(struct free_group_stats));
+		if (!chunk_info->group_stats) {
+			com_err(fs->device_name, ENOMEM,
+				"while allocating group stats");
+			close_device(fs->device_name, fs);
+			exit(1);
+		}
+	}
 
 	retval = get_chunk_info(fs, chunk_info, f);
+	free(chunk_info->group_stats);
+	chunk_info->group_stats = NULL;
 	if (retval) {
 		com_err(fs->device_name, retval, "while collecting chunk info");
                 close_device(fs->device_name, fs);
@@ -283,8 +538,12 @@ int main(int argc, char *argv[])
 #endif
 	progname = argv[0];
 	memset(&chunk_info, 0, sizeof(chunk_info));
+	chunk_info.jobs = 1;
 
-	while ((c = getopt(argc, argv, "c:h")) != EOF) {
+#ifdef DEBUGFS
+	reset_getopt();
+#endif
+	while ((c = getopt(argc, argv, "c:ghj:")) != EOF) {
 		switch (c) {
 		case 'c':
 			chunk_info.chunkbytes = strtoull(optarg, &end, 0);
@@ -301,6 +560,17 @@ int main(int argc, char *argv[])
 			}
 			chunk_info.chunkbytes *= 1024;
 			break;
+		case 'g':
+			chunk_info.flags |= E2F_FLAG_GROUPS;
+			break;
+		case 'j':
+			chunk_info.jobs = strtoul(optarg, &end, 0);
+			if (*end != '\0' || chunk_info.jobs < 1) {
+				fprintf(stderr, "%s: bad number of jobs '%s'\n",
+					progname, optarg);
+				usage(progname);
+			}
+			break;
 		case 'h':
 		default:
 			usage(progname);
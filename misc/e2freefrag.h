@@ -2,12 +2,21 @@
 
 #define DEFAULT_CHUNKSIZE (1024*1024)
 
+#define E2F_FLAG_GROUPS	0x0001		/* print per-group stats */
+
 #define MAX_HIST	32
 struct free_chunk_histogram {
 	unsigned long fc_chunks[MAX_HIST];
 	unsigned long fc_blocks[MAX_HIST];
 };
 
+/* Per-group free space summary, printed with -g */
+struct free_group_stats {
+	__u32 free_blocks;		/* free blocks in the group */
+	__u32 free_extents;		/* free extents, clipped to the group */
+	__u32 max_extent;		/* largest free extent, in blocks */
+};
+
 struct chunk_info {
 	unsigned long chunkbytes;	/* chunk size in bytes */
 	int chunkbits;			/* chunk size in bits */
@@ -17,4 +26,7 @@ struct chunk_info {
 	int blks_in_chunk;		/* number of blocks in a chunk */
 	unsigned long min, max, avg;	/* chunk size stats */
 	struct free_chunk_histogram histogram; /* histogram of all chunk sizes*/
+	int flags;			/* E2F_FLAG_* */
+	int jobs;			/* number of scanning processes */
+	struct free_group_stats *group_stats; /* per-group stats, or NULL */
 };
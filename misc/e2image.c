@@ -1243,6 +1243,9 @@ static void write_raw_image_file(ext2_filsys fs, int fd, int type, int flags)
 {
 	struct process_block_struct	pb;
 	struct ext2_inode		inode;
+	const struct ext2_inode		*disk_inode;
+	struct ext2_inode_batch		batch;
+	int				batch_idx = 0;
 	ext2_inode_scan			scan;
 	ext2_ino_t			ino;
 	errcode_t			retval;
@@ -1287,19 +1290,29 @@ static void write_raw_image_file(ext2_filsys fs, int fd, int type, int flags)
 
 	use_inode_shortcuts(fs, 1);
 	stashed_inode = &inode;
+	memset(&batch, 0, sizeof(batch));
 	while (1) {
-		retval = ext2fs_get_next_inode(scan, &ino, &inode);
-		if (retval == EXT2_ET_BAD_BLOCK_IN_INODE_TABLE)
-			continue;
-		if (retval) {
-			com_err(program_name, retval, "%s",
-				_("while getting next inode"));
-			exit(1);
+		if (batch_idx >= batch.count) {
+			batch_idx = 0;
+			retval = ext2fs_get_next_inode_batch(scan, &batch);
+			if (retval) {
+				com_err(program_name, retval, "%s",
+					_("while getting next inode"));
+				exit(1);
+			}
+			if (batch.count == 0)
+				break;
+			if (batch.flags & EXT2_IB_BAD_BLOCK) {
+				batch.count = 0;
+				continue;
+			}
 		}
-		if (ino == 0)
-			break;
-		if (!inode.i_links_count)
+		ino = batch.first_ino + batch_idx;
+		disk_inode = EXT2_BATCH_INODE(&batch, batch_idx);
+		batch_idx++;
+		if (!disk_inode->i_links_count)
 			continue;
+		inode = *disk_inode;
 		if (ext2fs_file_acl_block(fs, &inode)) {
 			ext2fs_mark_block_bitmap2(meta_block_map,
 					ext2fs_file_acl_block(fs, &inode));
@@ -40,7 +40,10 @@
 #include <sys/stat.h>
 #include <sys/statfs.h>
 #include <sys/syscall.h>
+#include <sys/time.h>
 #include <sys/vfs.h>
+#include <sys/wait.h>
+#include <time.h>
 
 /* A relatively new ioctl interface ... */
 #ifndef EXT4_IOC_MOVE_EXT
@@ -86,6 +89,7 @@
 /* The mode of defrag */
 #define DETAIL			0x01
 #define STATISTIC		0x02
+#define PLAN			0x04
 
 #define DEVNAME			0
 #define DIRNAME			1
@@ -114,7 +118,9 @@
 /* The following macros are error message */
 #define MSG_USAGE		\
 "Usage	: e4defrag [-v] file...| directory...| device...\n\
-	: e4defrag  -c  file...| directory...| device...\n"
+	: e4defrag  -c  file...| directory...| device...\n\
+	: e4defrag  -p [-v] [-j jobs] [-r MB/s] [-t minutes] \
+directory...| device...\n"
 
 #define NGMSG_EXT4		"Filesystem is not ext4 filesystem"
 #define NGMSG_FILE_EXTENT	"Failed to get file extents"
@@ -181,6 +187,45 @@ static __u32 feature_incompat;
 static ext4_fsblk_t	files_block_count;
 static struct frag_statistic_ino	frag_rank[SHOW_FRAG_FILES];
 
+/*
+ * Planning mode (-p): candidate files are collected first, ranked by
+ * the extents they would lose per block moved, and only scheduled if
+ * a model of the filesystem's free space says fallocate() can give
+ * them fewer extents than they have now.
+ */
+#define FREE_BUCKETS		64
+
+struct free_bucket {
+	__u64	count;		/* free extents in this log2 size range */
+	__u64	blocks;		/* free blocks in them */
+};
+
+struct plan_file {
+	char		*path;
+	int		now_count;
+	int		best_count;
+	ext4_fsblk_t	blocks;
+};
+
+/* Counters a worker process hands back to the parent */
+struct plan_result {
+	unsigned int	succeed_cnt;
+	unsigned int	frag_files_before_defrag;
+	unsigned int	frag_files_after_defrag;
+	int		extents_before_defrag;
+	int		extents_after_defrag;
+};
+
+static struct free_bucket	free_hist[FREE_BUCKETS];
+static int			have_free_hist;
+static struct plan_file		*plan_files;
+static unsigned int		plan_count, plan_max;
+static int			num_jobs = 1;
+static int			running_jobs = 1;
+static unsigned long long	rate_limit;	/* bytes per second */
+static time_t			window;		/* seconds, 0 = none */
+static time_t			deadline;
+
 
 /* Local definitions of some syscalls glibc may not yet have */
 
@@ -1339,6 +1384,35 @@ static void print_progress(const char *file, loff_t start, loff_t file_size)
 	return;
 }
 
+/*
+ * throttle_io() -	Sleep as needed to keep to the -r rate limit.
+ *
+ * @bytes:		the bytes just moved.
+ */
+static void throttle_io(unsigned long long bytes)
+{
+	static struct timeval	start;
+	static unsigned long long	total;
+	struct timeval	now;
+	double		elapsed, wanted;
+	struct timespec	ts;
+
+	if (!rate_limit)
+		return;
+	if (!start.tv_sec)
+		gettimeofday(&start, NULL);
+	total += bytes;
+	gettimeofday(&now, NULL);
+	elapsed = (now.tv_sec - start.tv_sec) +
+		(now.tv_usec - start.tv_usec) / 1000000.0;
+	wanted = (double) total * running_jobs / rate_limit;
+	if (wanted <= elapsed)
+		return;
+	ts.tv_sec = (time_t) (wanted - elapsed);
+	ts.tv_nsec = (long) ((wanted - elapsed - ts.tv_sec) * 1000000000.0);
+	nanosleep(&ts, NULL);
+}
+
 /*
  * call_defrag() -	Execute the defrag program.
  *
@@ -1420,6 +1494,9 @@ static int call_defrag(int fd, int donor_fd, const char *file,
 			}
 			return -1;
 		}
+		throttle_io((unsigned long long) move_data.moved_len *
+			    buf->st_blksize);
+
 		/* Adjust logical offset for next ioctl */
 		move_data.orig_start += move_data.moved_len;
 		move_data.donor_start = move_data.orig_start;
@@ -1711,6 +1788,335 @@ out:
 	return 0;
 }
 
+/*
+ * read_free_extents() -	Build the free extent histogram from the
+ *				filesystem's block bitmap.
+ *
+ * @fs:			the opened filesystem.
+ */
+static void read_free_extents(ext2_filsys fs)
+{
+	blk64_t	start, end, last = ext2fs_blocks_count(fs->super) - 1;
+	__u64	len;
+	int	bucket;
+
+	memset(free_hist, 0, sizeof(free_hist));
+	have_free_hist = 0;
+	if (ext2fs_read_block_bitmap(fs))
+		return;
+
+	start = fs->super->s_first_data_block;
+	while (start <= last) {
+		if (ext2fs_find_first_zero_block_bitmap2(fs->block_map, start,
+							 last, &start))
+			break;
+		if (ext2fs_find_first_set_block_bitmap2(fs->block_map, start,
+							last, &end))
+			end = last + 1;
+		len = end - start;
+		for (bucket = 0; bucket < FREE_BUCKETS - 1 &&
+			     (len >> (bucket + 1)); bucket++)
+			;
+		free_hist[bucket].count++;
+		free_hist[bucket].blocks += len;
+		start = end;
+	}
+	have_free_hist = 1;
+}
+
+/*
+ * free_hist_add() -	Return a free extent to the histogram.
+ *
+ * @hist:		the histogram.
+ * @len:		length of the free extent in blocks.
+ */
+static void free_hist_add(struct free_bucket *hist, __u64 len)
+{
+	int	bucket;
+
+	if (!len)
+		return;
+	for (bucket = 0; bucket < FREE_BUCKETS - 1 && (len >> (bucket + 1));
+	     bucket++)
+		;
+	hist[bucket].count++;
+	hist[bucket].blocks += len;
+}
+
+/*
+ * free_hist_take() -	Allocate blocks from the histogram the way the
+ *			allocator would for a large fallocate(), largest
+ *			free extents first, and return the number of
+ *			extents used.
+ *
+ * @hist:		the histogram.
+ * @need:		the number of blocks.
+ */
+static int free_hist_take(struct free_bucket *hist, __u64 need)
+{
+	int	bucket, extents = 0;
+	__u64	avg, take;
+
+	for (bucket = FREE_BUCKETS - 1; bucket >= 0 && need; bucket--) {
+		while (hist[bucket].count && need) {
+			avg = hist[bucket].blocks / hist[bucket].count;
+			take = min(avg, need);
+			hist[bucket].count--;
+			hist[bucket].blocks -= avg;
+			free_hist_add(hist, avg - take);
+			need -= take;
+			extents++;
+		}
+	}
+	/* Not enough free space */
+	if (need)
+		return INT_MAX;
+	return extents;
+}
+
+/*
+ * plan_collect() -	Record a fragmented file as a planning candidate.
+ *
+ * @file:		the file's name.
+ * @buf:		the pointer of the struct stat64.
+ * @flag:		file type.
+ * @ftwbuf:		the pointer of a struct FTW.
+ */
+static int plan_collect(const char *file, const struct stat64 *buf,
+			int flag EXT2FS_ATTR((unused)),
+			struct FTW *ftwbuf EXT2FS_ATTR((unused)))
+{
+	int	fd, now, best;
+	ext4_fsblk_t	blocks;
+	struct plan_file	*new_files;
+	struct fiemap_extent_list	*physical_list = NULL;
+	struct fiemap_extent_list	*logical_list = NULL;
+
+	if (lost_found_dir[0] != '\0' &&
+	    !memcmp(file, lost_found_dir, strnlen(lost_found_dir, PATH_MAX)))
+		return 0;
+	if (!S_ISREG(buf->st_mode) || buf->st_size == 0 ||
+	    buf->st_blocks == 0)
+		return 0;
+	if (current_uid != ROOT_UID && buf->st_uid != current_uid)
+		return 0;
+
+	fd = open64(file, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (get_file_extents(fd, &physical_list) < 0 ||
+	    change_physical_to_logical(&physical_list, &logical_list) < 0)
+		goto out;
+	now = get_logical_count(logical_list);
+	blocks = get_file_blocks(logical_list);
+	best = (current_uid == ROOT_UID) ? get_best_count(blocks) : 1;
+	if (now <= best)
+		goto out;
+
+	if (plan_count == plan_max) {
+		new_files = realloc(plan_files, (plan_max + 256) *
+				    sizeof(struct plan_file));
+		if (!new_files)
+			goto out;
+		plan_files = new_files;
+		plan_max += 256;
+	}
+	plan_files[plan_count].path = strdup(file);
+	if (!plan_files[plan_count].path)
+		goto out;
+	plan_files[plan_count].now_count = now;
+	plan_files[plan_count].best_count = best;
+	plan_files[plan_count].blocks = blocks;
+	plan_count++;
+out:
+	close(fd);
+	free_ext(physical_list);
+	free_ext(logical_list);
+	return 0;
+}
+
+/*
+ * plan_cmp() -		Order candidates by extents saved per block moved,
+ *			so that a limited I/O budget removes as many
+ *			extents as possible.
+ */
+static int plan_cmp(const void *a, const void *b)
+{
+	const struct plan_file	*pa = a, *pb = b;
+	double	ca = (double) (pa->now_count - pa->best_count) / pa->blocks;
+	double	cb = (double) (pb->now_count - pb->best_count) / pb->blocks;
+
+	if (ca != cb)
+		return ca > cb ? -1 : 1;
+	return strcmp(pa->path, pb->path);
+}
+
+/*
+ * make_plan() -	Rank the candidates and keep the ones worth moving.
+ *			Returns the number of files scheduled, which are
+ *			moved to the front of plan_files.
+ */
+static unsigned int make_plan(void)
+{
+	unsigned long long	budget = 0, cost;
+	unsigned int	i, n = 0;
+	int	extents = 0;
+	__u64	per_ext;
+	int	j;
+
+	qsort(plan_files, plan_count, sizeof(struct plan_file), plan_cmp);
+	if (rate_limit && window)
+		budget = rate_limit * window;
+
+	for (i = 0; i < plan_count; i++) {
+		struct plan_file *pf = &plan_files[i];
+
+		cost = (unsigned long long) pf->blocks * block_size;
+		if (budget && cost > budget)
+			goto skip;
+		if (have_free_hist) {
+			struct free_bucket trial[FREE_BUCKETS];
+
+			memcpy(trial, free_hist, sizeof(trial));
+			extents = free_hist_take(trial, pf->blocks);
+			if (extents >= pf->now_count)
+				goto skip;
+			memcpy(free_hist, trial, sizeof(trial));
+			/* The old extents become free once the file moves */
+			per_ext = pf->blocks / pf->now_count;
+			for (j = 0; j < pf->now_count - 1; j++)
+				free_hist_add(free_hist, per_ext);
+			free_hist_add(free_hist, pf->blocks -
+				      per_ext * (pf->now_count - 1));
+		}
+		if (budget)
+			budget -= cost;
+		if (mode_flag & DETAIL)
+			printf("plan: %s: %d -> %d extents, %llu KB\n",
+			       pf->path, pf->now_count,
+			       have_free_hist ? extents : pf->best_count,
+			       (unsigned long long) pf->blocks *
+			       block_size / 1024);
+		if (i != n) {
+			struct plan_file tmp = plan_files[n];
+
+			plan_files[n] = *pf;
+			plan_files[i] = tmp;
+		}
+		n++;
+		continue;
+	skip:
+		if (mode_flag & DETAIL)
+			printf("plan: %s: skipped\n", pf->path);
+	}
+	return n;
+}
+
+/*
+ * run_plan() -		Defrag the first count planned files, with
+ *			num_jobs worker processes each taking every
+ *			num_jobs'th file.
+ *
+ * @count:		the number of files scheduled.
+ */
+static void run_plan(unsigned int count)
+{
+	struct plan_result	res;
+	struct stat64	buf;
+	pid_t	*pids;
+	int	fds[2], jobs = num_jobs, w, status;
+	unsigned int	i;
+
+	if (window)
+		deadline = time(NULL) + window;
+	if ((unsigned int) jobs > count)
+		jobs = count ? count : 1;
+	running_jobs = jobs;
+	/* Don't let the workers inherit buffered output */
+	fflush(stdout);
+	pids = calloc(jobs, sizeof(pid_t));
+	if (!pids || (jobs > 1 && pipe(fds) < 0)) {
+		PRINT_ERR_MSG_WITH_ERRNO("Failed to start workers");
+		jobs = 1;
+	}
+
+	for (w = 0; w < jobs; w++) {
+		if (jobs > 1) {
+			pids[w] = fork();
+			if (pids[w] < 0) {
+				PRINT_ERR_MSG_WITH_ERRNO(
+					"Failed to start workers");
+				continue;
+			}
+			if (pids[w])
+				continue;
+			close(fds[0]);
+		}
+		for (i = w; i < count; i += jobs) {
+			if (deadline && time(NULL) >= deadline) {
+				if (mode_flag & DETAIL)
+					printf("Maintenance window is over\n");
+				break;
+			}
+			if (lstat64(plan_files[i].path, &buf) < 0)
+				continue;
+			defraged_file_count = i;
+			file_defrag(plan_files[i].path, &buf, FTW_F, NULL);
+		}
+		if (jobs == 1)
+			break;
+		res.succeed_cnt = succeed_cnt;
+		res.frag_files_before_defrag = frag_files_before_defrag;
+		res.frag_files_after_defrag = frag_files_after_defrag;
+		res.extents_before_defrag = extents_before_defrag;
+		res.extents_after_defrag = extents_after_defrag;
+		if (write(fds[1], &res, sizeof(res)) != sizeof(res))
+			exit(1);
+		exit(0);
+	}
+
+	if (jobs > 1) {
+		close(fds[1]);
+		while (read(fds[0], &res, sizeof(res)) == sizeof(res)) {
+			succeed_cnt += res.succeed_cnt;
+			frag_files_before_defrag +=
+				res.frag_files_before_defrag;
+			frag_files_after_defrag += res.frag_files_after_defrag;
+			extents_before_defrag += res.extents_before_defrag;
+			extents_after_defrag += res.extents_after_defrag;
+		}
+		close(fds[0]);
+		for (w = 0; w < jobs; w++)
+			if (pids[w] > 0)
+				waitpid(pids[w], &status, 0);
+	}
+	free(pids);
+}
+
+/*
+ * plan_defrag() -	Collect, plan and defrag the files under dir_name.
+ *
+ * @dir_name:		the directory to walk.
+ * @flags:		nftw flags.
+ */
+static void plan_defrag(const char *dir_name, int flags)
+{
+	unsigned int	i, count;
+
+	plan_count = 0;
+	nftw64(dir_name, plan_collect, FTW_OPEN_FD, flags);
+	count = make_plan();
+	printf("Planned %u of %u fragmented files\n", count, plan_count);
+
+	/* Files that need no defrag count as successes */
+	succeed_cnt = regular_count - plan_count;
+	run_plan(count);
+
+	for (i = 0; i < plan_count; i++)
+		free(plan_files[i].path);
+	plan_count = 0;
+}
+
 /*
  * main() -		Ext4 online defrag.
  *
@@ -1733,7 +2139,7 @@ int main(int argc, char *argv[])
 	if (argc == 1)
 		goto out;
 
-	while ((opt = getopt(argc, argv, "vc")) != EOF) {
+	while ((opt = getopt(argc, argv, "vcpj:r:t:")) != EOF) {
 		switch (opt) {
 		case 'v':
 			mode_flag |= DETAIL;
@@ -1741,10 +2147,26 @@ int main(int argc, char *argv[])
 		case 'c':
 			mode_flag |= STATISTIC;
 			break;
+		case 'p':
+			mode_flag |= PLAN;
+			break;
+		case 'j':
+			num_jobs = atoi(optarg);
+			if (num_jobs < 1)
+				goto out;
+			break;
+		case 'r':
+			rate_limit = strtoull(optarg, NULL, 0) * 1024 * 1024;
+			break;
+		case 't':
+			window = atol(optarg) * 60;
+			break;
 		default:
 			goto out;
 		}
 	}
+	if ((mode_flag & PLAN) && (mode_flag & STATISTIC))
+		goto out;
 
 	if (argc == optind)
 		goto out;
@@ -1765,6 +2187,7 @@ int main(int argc, char *argv[])
 		blocks_per_group = 0;
 		feature_incompat = 0;
 		log_groups_per_flex = 0;
+		have_free_hist = 0;
 
 		memset(dir_name, 0, PATH_MAX + 1);
 		memset(dev_name, 0, PATH_MAX + 1);
@@ -1859,6 +2282,8 @@ int main(int argc, char *argv[])
 			blocks_per_group = fs->super->s_blocks_per_group;
 			feature_incompat = fs->super->s_feature_incompat;
 			log_groups_per_flex = fs->super->s_log_groups_per_flex;
+			if (mode_flag & PLAN)
+				read_free_extents(fs);
 
 			ext2fs_close(fs);
 		}
@@ -1958,7 +2383,11 @@ int main(int argc, char *argv[])
 				break;
 			}
 			/* File tree walk */
-			nftw64(dir_name, file_defrag, FTW_OPEN_FD, flags);
+			if (mode_flag & PLAN)
+				plan_defrag(dir_name, flags);
+			else
+				nftw64(dir_name, file_defrag, FTW_OPEN_FD,
+				       flags);
 			printf("\n\tSuccess:\t\t\t[ %u/%u ]\n", succeed_cnt,
 				total_count);
 			printf("\tFailure:\t\t\t[ %u/%u ]\n",
@@ -28,16 +28,19 @@ int main(void) {
 #include <time.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #ifdef HAVE_GETOPT_H
 #include <getopt.h>
 #else
 extern char *optarg;
 extern int optind;
 #endif
+#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/vfs.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
 #include <linux/fd.h>
 #include <ext2fs/ext2fs.h>
 #include <ext2fs/ext2_types.h>
@@ -49,6 +52,9 @@ int sync_file = 0;	/* fsync file before getting the mapping */
 int xattr_map = 0;	/* get xattr mapping */
 int force_bmap;	/* force use of FIBMAP instead of FIEMAP */
 int force_extent;	/* print output in extent format always */
+int recursive;		/* descend into directories */
+int summary;		/* print aggregate statistics instead of per file */
+int jobs = 1;		/* number of worker processes */
 int logical_width = 8;
 int physical_width = 10;
 const char *ext_fmt = "%4d: %*llu..%*llu: %*llu..%*llu: %6llu: %s\n";
@@ -64,6 +70,34 @@ const char *hex_fmt = "%4d: %*llx..%*llx: %*llx..%*llx: %6llx: %s\n";
 #define	EXT4_EXTENTS_FL			0x00080000 /* Inode uses extents */
 #define	EXT3_IOC_GETFLAGS		_IOR('f', 1, long)
 
+/*
+ * Room for a few thousand extents per FIEMAP call, so that even badly
+ * fragmented files only need one or two trips into the kernel.
+ */
+#define FIEMAP_BUF_SIZE		(256 * 1024)
+
+#define WORST_FILES		10	/* most fragmented files to list */
+
+/* The outcome of mapping one file */
+struct frag_result {
+	int	status;		/* < 0 if the file could not be mapped */
+	int	num_extents;
+	int	expected;	/* ideal extent count, FIBMAP only */
+	int	is_ext2;
+};
+
+/* Sent from a worker to the parent for each file it has mapped */
+struct frag_record {
+	unsigned long		index;
+	struct frag_result	res;
+};
+
+struct file_list {
+	char		**names;
+	unsigned long	count;
+	unsigned long	size;
+};
+
 static int int_log2(int arg)
 {
 	int     l = 0;
@@ -182,10 +216,10 @@ static void print_extent_info(struct fiemap_extent *fm_extent, int cur_ex,
 static int filefrag_fiemap(int fd, int blk_shift, int *num_extents,
 			   ext2fs_struct_stat *st)
 {
-	char buf[16384];
-	struct fiemap *fiemap = (struct fiemap *)buf;
-	struct fiemap_extent *fm_ext = &fiemap->fm_extents[0];
-	int count = (sizeof(buf) - sizeof(*fiemap)) /
+	static char *buf;
+	struct fiemap *fiemap;
+	struct fiemap_extent *fm_ext;
+	int count = (FIEMAP_BUF_SIZE - sizeof(*fiemap)) /
 			sizeof(struct fiemap_extent);
 	unsigned long long expected = 0;
 	unsigned long flags = 0;
@@ -196,6 +230,15 @@ static int filefrag_fiemap(int fd, int blk_shift, int *num_extents,
 	int last = 0;
 	int rc;
 
+	if (!buf) {
+		buf = malloc(FIEMAP_BUF_SIZE);
+		if (!buf) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	fiemap = (struct fiemap *)buf;
+	fm_ext = &fiemap->fm_extents[0];
 	memset(fiemap, 0, sizeof(struct fiemap));
 
 	if (sync_file)
@@ -330,7 +373,7 @@ static int filefrag_fibmap(int fd, int blk_shift, int *num_extents,
 	return count;
 }
 
-static void frag_report(const char *filename)
+static int frag_scan(const char *filename, struct frag_result *res)
 {
 	static struct statfs fsinfo;
 	ext2fs_struct_stat st;
@@ -349,9 +392,10 @@ static void frag_report(const char *filename)
 #else
 	fd = open(filename, O_RDONLY);
 #endif
+	res->status = -1;
 	if (fd < 0) {
 		perror("open");
-		return;
+		return -1;
 	}
 
 #if defined(HAVE_FSTAT64) && !defined(__OSX_AVAILABLE_BUT_DEPRECATED)
@@ -361,14 +405,14 @@ static void frag_report(const char *filename)
 #endif
 		close(fd);
 		perror("stat");
-		return;
+		return -1;
 	}
 
 	if (last_device != st.st_dev) {
 		if (fstatfs(fd, &fsinfo) < 0) {
 			close(fd);
 			perror("fstatfs");
-			return;
+			return -1;
 		}
 		if (verbose)
 			printf("Filesystem type is: %lx\n",
@@ -430,40 +474,261 @@ static void frag_report(const char *filename)
 		expected = expected / data_blocks_per_cyl + 1;
 	}
 
-	if (num_extents == 1)
+	res->status = 0;
+	res->num_extents = num_extents;
+	res->expected = expected;
+	res->is_ext2 = is_ext2;
+out_close:
+	close(fd);
+	return res->status;
+}
+
+static void print_result(const char *filename, struct frag_result *res)
+{
+	if (res->status < 0)
+		return;
+
+	if (res->num_extents == 1)
 		printf("%s: 1 extent found", filename);
 	else
-		printf("%s: %d extents found", filename, num_extents);
+		printf("%s: %d extents found", filename, res->num_extents);
 	/* count, and thus expected, only set for indirect FIBMAP'd files */
-	if (is_ext2 && expected && expected < num_extents)
-		printf(", perfection would be %d extent%s\n", expected,
-			(expected > 1) ? "s" : "");
+	if (res->is_ext2 && res->expected &&
+	    res->expected < res->num_extents)
+		printf(", perfection would be %d extent%s\n", res->expected,
+			(res->expected > 1) ? "s" : "");
 	else
 		fputc('\n', stdout);
-out_close:
-	close(fd);
+}
+
+static void add_file(struct file_list *list, const char *name)
+{
+	char	**new_names;
+	char	*cp;
+
+	if (list->count == list->size) {
+		list->size = list->size ? list->size * 2 : 1024;
+		new_names = realloc(list->names,
+				    list->size * sizeof(char *));
+		if (!new_names) {
+			fprintf(stderr, "Couldn't allocate file list\n");
+			exit(1);
+		}
+		list->names = new_names;
+	}
+	cp = strdup(name);
+	if (!cp) {
+		fprintf(stderr, "Couldn't allocate file name\n");
+		exit(1);
+	}
+	list->names[list->count++] = cp;
+}
+
+/* Add every regular file below dirname; symlinks are not followed */
+static void walk_dir(struct file_list *list, const char *dirname)
+{
+	DIR		*dir;
+	struct dirent	*de;
+	struct stat	st;
+	char		*path;
+	size_t		len;
+
+	dir = opendir(dirname);
+	if (!dir) {
+		perror(dirname);
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		len = strlen(dirname) + strlen(de->d_name) + 2;
+		path = malloc(len);
+		if (!path) {
+			fprintf(stderr, "Couldn't allocate file name\n");
+			exit(1);
+		}
+		if (dirname[strlen(dirname) - 1] == '/')
+			sprintf(path, "%s%s", dirname, de->d_name);
+		else
+			sprintf(path, "%s/%s", dirname, de->d_name);
+		if (lstat(path, &st) < 0)
+			perror(path);
+		else if (S_ISDIR(st.st_mode))
+			walk_dir(list, path);
+		else if (S_ISREG(st.st_mode))
+			add_file(list, path);
+		free(path);
+	}
+	closedir(dir);
+}
+
+/*
+ * Map the files in separate processes.  File i goes to worker
+ * i % jobs, and each worker sends back a fixed-size frag_record per
+ * file.  Records are smaller than PIPE_BUF, so the workers can share
+ * one pipe.  Anything a worker failed to report is mapped here.
+ */
+static void scan_parallel(struct file_list *list, struct frag_result *results,
+			  char *done)
+{
+	struct frag_record	rec;
+	pid_t			*pids;
+	unsigned long		i;
+	int			pfd[2], w, nworkers = 0;
+
+	pids = calloc(jobs, sizeof(pid_t));
+	if (!pids || pipe(pfd) < 0) {
+		free(pids);
+		return;
+	}
+	fflush(stdout);
+	fflush(stderr);
+	for (w = 0; w < jobs; w++) {
+		pids[w] = fork();
+		if (pids[w] < 0)
+			break;
+		if (pids[w] == 0) {
+			close(pfd[0]);
+			for (i = w; i < list->count; i += jobs) {
+				rec.index = i;
+				frag_scan(list->names[i], &rec.res);
+				if (write(pfd[1], &rec, sizeof(rec)) !=
+				    sizeof(rec))
+					break;
+			}
+			fflush(stderr);
+			_exit(0);
+		}
+		nworkers++;
+	}
+	close(pfd[1]);
+
+	while (read(pfd[0], &rec, sizeof(rec)) == sizeof(rec)) {
+		if (rec.index >= list->count)
+			continue;
+		results[rec.index] = rec.res;
+		done[rec.index] = 1;
+	}
+	close(pfd[0]);
+
+	for (w = 0; w < nworkers; w++)
+		waitpid(pids[w], 0, 0);
+	free(pids);
+}
+
+static struct frag_result *sort_results;
+
+static int extents_cmp(const void *a, const void *b)
+{
+	unsigned long ia = *(const unsigned long *) a;
+	unsigned long ib = *(const unsigned long *) b;
+
+	if (sort_results[ia].num_extents != sort_results[ib].num_extents)
+		return (sort_results[ia].num_extents <
+			sort_results[ib].num_extents) ? 1 : -1;
+	return (ia < ib) ? -1 : (ia > ib);
+}
+
+static void print_summary(struct file_list *list, struct frag_result *results)
+{
+	unsigned long		*order, i, nr = 0, fragmented = 0;
+	unsigned long long	total = 0;
+	static const int	pct[] = { 50, 90, 99 };
+
+	order = malloc((list->count + 1) * sizeof(unsigned long));
+	if (!order) {
+		fprintf(stderr, "Couldn't allocate summary\n");
+		return;
+	}
+	for (i = 0; i < list->count; i++) {
+		if (results[i].status < 0)
+			continue;
+		order[nr++] = i;
+		total += results[i].num_extents;
+		if (results[i].num_extents > 1)
+			fragmented++;
+	}
+	sort_results = results;
+	qsort(order, nr, sizeof(unsigned long), extents_cmp);
+
+	printf("Files: %lu", nr);
+	if (nr != list->count)
+		printf(" (%lu could not be mapped)", list->count - nr);
+	printf("\nTotal extents: %llu\n", total);
+	if (!nr)
+		goto out;
+	printf("Fragmented files: %lu (%0.1f%%)\n", fragmented,
+	       (double) fragmented * 100 / nr);
+	printf("Extents per file: average %0.2f", (double) total / nr);
+	/* order[] is most fragmented first */
+	for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+		printf(", %d%% <= %d", pct[i],
+		       results[order[nr - (pct[i] * nr + 99) / 100]].
+		       num_extents);
+	printf(", max %d\n", results[order[0]].num_extents);
+
+	printf("\nMost fragmented files:\n");
+	for (i = 0; i < nr && i < WORST_FILES; i++) {
+		if (results[order[i]].num_extents <= 1)
+			break;
+		printf("%10d  %s\n", results[order[i]].num_extents,
+		       list->names[order[i]]);
+	}
+out:
+	free(order);
+}
+
+static void frag_report_list(struct file_list *list)
+{
+	struct frag_result	*results;
+	char			*done;
+	unsigned long		i;
+
+	results = calloc(list->count + 1, sizeof(struct frag_result));
+	done = calloc(list->count + 1, 1);
+	if (!results || !done) {
+		fprintf(stderr, "Couldn't allocate results\n");
+		exit(1);
+	}
+
+	if (jobs > 1 && list->count > 1)
+		scan_parallel(list, results, done);
+
+	for (i = 0; i < list->count; i++) {
+		if (!done[i])
+			frag_scan(list->names[i], &results[i]);
+		if (!summary)
+			print_result(list->names[i], &results[i]);
+	}
+	if (summary)
+		print_summary(list, results);
+
+	free(results);
+	free(done);
 }
 
 static void usage(const char *progname)
 {
-	fprintf(stderr, "Usage: %s [-b{blocksize}] [-BeklsvxX] file ...\n",
-		progname);
+	fprintf(stderr, "Usage: %s [-b{blocksize}] [-j jobs] [-BeklrsSvxX] "
+		"file ...\n", progname);
 	exit(1);
 }
 
 int main(int argc, char**argv)
 {
-	char **cpp;
+	struct file_list list;
+	struct stat st;
+	char **cpp, *end;
+	unsigned long num;
 	int c;
 
-	while ((c = getopt(argc, argv, "Bb::eksvxX")) != EOF)
+	while ((c = getopt(argc, argv, "Bb::ej:krsSvxX")) != EOF)
 		switch (c) {
 		case 'B':
 			force_bmap++;
 			break;
 		case 'b':
 			if (optarg) {
-				char *end;
 				blocksize = strtoul(optarg, &end, 0);
 				if (end) {
 					switch (end[0]) {
@@ -496,12 +761,27 @@ int main(int argc, char**argv)
 			if (!verbose)
 				verbose++;
 			break;
+		case 'j':
+			num = strtoul(optarg, &end, 0);
+			if (*optarg == 0 || *end || num < 1 || num > INT_MAX) {
+				fprintf(stderr, "%s: invalid number of jobs: "
+					"%s\n", argv[0], optarg);
+				usage(argv[0]);
+			}
+			jobs = num;
+			break;
 		case 'k':
 			blocksize = 1024;
 			break;
+		case 'r':
+			recursive++;
+			break;
 		case 's':
 			sync_file++;
 			break;
+		case 'S':
+			summary++;
+			break;
 		case 'v':
 			verbose++;
 			break;
@@ -517,8 +797,18 @@ int main(int argc, char**argv)
 		}
 	if (optind == argc)
 		usage(argv[0]);
-	for (cpp=argv+optind; *cpp; cpp++)
-		frag_report(*cpp);
+	/* Per-extent output from several processes would be interleaved */
+	if (verbose)
+		jobs = 1;
+
+	memset(&list, 0, sizeof(list));
+	for (cpp=argv+optind; *cpp; cpp++) {
+		if (recursive && stat(*cpp, &st) == 0 && S_ISDIR(st.st_mode))
+			walk_dir(&list, *cpp);
+		else
+			add_file(&list, *cpp);
+	}
+	frag_report_list(&list);
 	return 0;
 }
 #endif
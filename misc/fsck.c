@@ -235,6 +235,7 @@ static void free_instance(struct fsck_instance *i)
 	free(i->prog);
 	free(i->device);
 	free(i->base_device);
+	free_disk_list(i->disks);
 	free(i);
 	return;
 }
@@ -255,6 +256,8 @@ static struct fs_info *create_fs_device(const char *device, const char *mntpnt,
 	fs->freq = freq;
 	fs->passno = passno;
 	fs->flags = 0;
+	fs->disks = NULL;
+	fs->size = 0;
 	fs->next = NULL;
 
 	if (!filesys_info)
@@ -511,6 +514,7 @@ static int execute(const char *type, const char *device, const char *mntpt,
 	inst->type = string_copy(type);
 	inst->device = string_copy(device);
 	inst->base_device = base_device(device);
+	inst->disks = device_disks(device);
 	inst->start_time = time(0);
 	inst->next = NULL;
 
@@ -916,11 +920,25 @@ static int ignore(struct fs_info *fs)
 	return 0;
 }
 
+static int disks_overlap(char **a, char **b)
+{
+	char **cpp;
+
+	for (; *a; a++)
+		for (cpp = b; *cpp; cpp++)
+			if (!strcmp(*a, *cpp))
+				return 1;
+	return 0;
+}
+
 /*
  * Returns TRUE if a partition on the same disk is already being
- * checked.
+ * checked.  When sysfs tells us which disks a filesystem lives on
+ * (looking through partitions and md/dm slaves), filesystems sharing
+ * no disk are checked in parallel; otherwise fall back to guessing
+ * the disk from the device name.
  */
-static int device_already_active(char *device)
+static int device_already_active(struct fs_info *fs)
 {
 	struct fsck_instance *inst;
 	char *base;
@@ -928,15 +946,24 @@ static int device_already_active(char *device)
 	if (force_all_parallel)
 		return 0;
 
+	if (fs->disks) {
+		for (inst = instance_list; inst; inst = inst->next) {
+			if (!inst->disks ||
+			    disks_overlap(fs->disks, inst->disks))
+				return 1;
+		}
+		return 0;
+	}
+
 #ifdef BASE_MD
 	/* Don't check a soft raid disk with any other disk */
 	if (instance_list &&
 	    (!strncmp(instance_list->device, BASE_MD, sizeof(BASE_MD)-1) ||
-	     !strncmp(device, BASE_MD, sizeof(BASE_MD)-1)))
+	     !strncmp(fs->device, BASE_MD, sizeof(BASE_MD)-1)))
 		return 1;
 #endif
 
-	base = base_device(device);
+	base = base_device(fs->device);
 	/*
 	 * If we don't know the base device, assume that the device is
 	 * already active if there are any fsck instances running.
@@ -953,6 +980,51 @@ static int device_already_active(char *device)
 	return 0;
 }
 
+static int fs_size_cmp(const void *a, const void *b)
+{
+	const struct fs_info *fa = *(struct fs_info * const *) a;
+	const struct fs_info *fb = *(struct fs_info * const *) b;
+
+	if (fa->size != fb->size)
+		return fa->size > fb->size ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Order the filesystem list largest first, so that within a pass the
+ * longest checks are started as early as possible and the pass takes
+ * about as long as its slowest disk.  Filesystems of the same (or
+ * unknown) size keep their /etc/fstab order.
+ */
+static void sort_by_size(NOARGS)
+{
+	struct fs_info *fs, **list;
+	int i, j, n = 0;
+
+	for (fs = filesys_info; fs; fs = fs->next)
+		n++;
+	if (n < 2)
+		return;
+	list = malloc(n * sizeof(struct fs_info *));
+	if (!list)
+		return;
+	for (i = 0, fs = filesys_info; fs; fs = fs->next)
+		list[i++] = fs;
+	/* Insertion sort, since it is stable and n is small */
+	for (i = 1; i < n; i++) {
+		fs = list[i];
+		for (j = i; j > 0 && fs_size_cmp(&list[j - 1], &fs) > 0; j--)
+			list[j] = list[j - 1];
+		list[j] = fs;
+	}
+	filesys_info = list[0];
+	for (i = 0; i < n - 1; i++)
+		list[i]->next = list[i + 1];
+	list[n - 1]->next = NULL;
+	filesys_last = list[n - 1];
+	free(list);
+}
+
 /* Check all file systems, using the /etc/fstab table. */
 static int check_all(NOARGS)
 {
@@ -971,9 +1043,24 @@ static int check_all(NOARGS)
 	 * filesystem types (done as a side-effect of calling ignore()).
 	 */
 	for (fs = filesys_info; fs; fs = fs->next) {
-		if (ignore(fs))
+		if (ignore(fs)) {
 			fs->flags |= FLAG_DONE;
+			continue;
+		}
+		if (!force_all_parallel)
+			fs->disks = device_disks(fs->device);
+		fs->size = device_size(fs->device);
+		if (verbose > 1 && fs->disks) {
+			char **cpp;
+
+			printf("%s:", fs->device);
+			for (cpp = fs->disks; *cpp; cpp++)
+				printf(" %s", *cpp);
+			printf(" (%llu MB)\n", fs->size >> 20);
+		}
 	}
+	if (!serialize)
+		sort_by_size();
 
 	/*
 	 * Find and check the root filesystem.
@@ -1030,7 +1117,7 @@ static int check_all(NOARGS)
 			 * already been spawned, then we need to defer
 			 * this to another pass.
 			 */
-			if (device_already_active(fs->device)) {
+			if (device_already_active(fs)) {
 				pass_done = 0;
 				continue;
 			}
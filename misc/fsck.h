@@ -45,6 +45,8 @@ struct fs_info {
 	int   freq;
 	int   passno;
 	int   flags;
+	char  **disks;
+	unsigned long long size;
 	struct fs_info *next;
 };
 
@@ -63,10 +65,14 @@ struct fsck_instance {
 	char *	type;
 	char *	device;
 	char *	base_device;
+	char **	disks;
 	struct fsck_instance *next;
 };
 
 extern char *base_device(const char *device);
+extern char **device_disks(const char *device);
+extern void free_disk_list(char **disks);
+extern unsigned long long device_size(const char *device);
 extern const char *identify_fs(const char *fs_name, const char *fs_types);
 
 /* ismounted.h */
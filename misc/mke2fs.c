@@ -61,6 +61,7 @@ extern int optind;
 #include "../version.h"
 #include "nls-enable.h"
 #include "quota/mkquota.h"
+#include "create_inode.h"
 
 #define STRIDE_LENGTH 8
 
@@ -99,6 +100,8 @@ static int	lazy_itable_init;
 static char	*bad_blocks_filename = NULL;
 static __u32	fs_stride;
 static int	quotatype = -1;  /* Initialize both user and group quotas by default */
+static char	*src_root_dir;	/* Copy files from this directory into the fs */
+static int	populate_flags;
 
 static struct ext2_super_block fs_param;
 static char *fs_uuid = NULL;
@@ -118,6 +121,7 @@ static void usage(void)
 {
 	fprintf(stderr, _("Usage: %s [-c|-l filename] [-b block-size] "
 	"[-C cluster-size]\n\t[-i bytes-per-inode] [-I inode-size] "
+	"[-d root-directory] "
 	"[-J journal-options]\n"
 	"\t[-G flex-group-size] [-N number-of-inodes]\n"
 	"\t[-m reserved-blocks-percentage] [-o creator-os]\n"
@@ -854,6 +858,8 @@ static void parse_extended_opts(struct ext2_super_block *param,
 			discard = 1;
 		} else if (!strcmp(token, "nodiscard")) {
 			discard = 0;
+		} else if (!strcmp(token, "dedup")) {
+			populate_flags |= POPULATE_FL_DEDUP;
 		} else if (!strcmp(token, "quotatype")) {
 			if (!arg) {
 				r_usage++;
@@ -892,7 +898,8 @@ static void parse_extended_opts(struct ext2_super_block *param,
 			"\ttest_fs\n"
 			"\tdiscard\n"
 			"\tnodiscard\n"
-			"\tquotatype=<usr OR grp>\n\n"),
+			"\tquotatype=<usr OR grp>\n"
+			"\tdedup\n\n"),
 			badopt ? badopt : "");
 		free(buf);
 		exit(1);
@@ -1397,7 +1404,7 @@ profile_error:
 	}
 
 	while ((c = getopt (argc, argv,
-		    "b:cg:i:jl:m:no:qr:s:t:vC:DE:FG:I:J:KL:M:N:O:R:ST:U:V")) != EOF) {
+		    "b:cd:g:i:jl:m:no:qr:s:t:vC:DE:FG:I:J:KL:M:N:O:R:ST:U:V")) != EOF) {
 		switch (c) {
 		case 'b':
 			blocksize = parse_num_blocks2(optarg, -1);
@@ -1420,6 +1427,9 @@ profile_error:
 		case 'c':	/* Check for bad blocks */
 			cflag++;
 			break;
+		case 'd':
+			src_root_dir = optarg;
+			break;
 		case 'C':
 			cluster_size = parse_num_blocks2(optarg, -1);
 			if (cluster_size <= EXT2_MIN_CLUSTER_SIZE ||
@@ -2722,6 +2732,21 @@ no_journal:
 			       fs->super->s_mmp_update_interval);
 	}
 
+	if (src_root_dir) {
+		if (!quiet)
+			printf("%s", _("Copying files into the device: "));
+		fflush(stdout);
+		retval = populate_fs(fs, EXT2_ROOT_INO, src_root_dir,
+				     populate_flags);
+		if (retval) {
+			com_err(program_name, retval, "%s",
+				_("\n\twhile populating file system"));
+			exit(1);
+		}
+		if (!quiet)
+			printf("%s", _("done\n"));
+	}
+
 	if (EXT2_HAS_RO_COMPAT_FEATURE(&fs_param,
 				       EXT4_FEATURE_RO_COMPAT_BIGALLOC))
 		fix_cluster_bg_counts(fs);
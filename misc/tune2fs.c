@@ -1492,6 +1492,9 @@ static int inode_scan_and_fix(ext2_filsys fs, ext2fs_block_bitmap bmap)
 	blk64_t blk;
 	char *block_buf = 0;
 	struct ext2_inode inode;
+	const struct ext2_inode *disk_inode;
+	struct ext2_inode_batch batch;
+	int batch_idx = 0;
 	ext2_inode_scan	scan = NULL;
 
 	retval = ext2fs_get_mem(fs->blocksize * 3, &block_buf);
@@ -1502,16 +1505,27 @@ static int inode_scan_and_fix(ext2_filsys fs, ext2fs_block_bitmap bmap)
 	if (retval)
 		goto err_out;
 
+	memset(&batch, 0, sizeof(batch));
 	while (1) {
-		retval = ext2fs_get_next_inode(scan, &ino, &inode);
-		if (retval)
-			goto err_out;
-
-		if (!ino)
-			break;
+		if (batch_idx >= batch.count) {
+			batch_idx = 0;
+			retval = ext2fs_get_next_inode_batch(scan, &batch);
+			if (retval)
+				goto err_out;
+			if (!batch.count)
+				break;
+			if (batch.flags & EXT2_IB_BAD_BLOCK) {
+				retval = EXT2_ET_BAD_BLOCK_IN_INODE_TABLE;
+				goto err_out;
+			}
+		}
+		ino = batch.first_ino + batch_idx;
+		disk_inode = EXT2_BATCH_INODE(&batch, batch_idx);
+		batch_idx++;
 
-		if (inode.i_links_count == 0)
+		if (disk_inode->i_links_count == 0)
 			continue; /* inode not in use */
+		inode = *disk_inode;
 
 		/* FIXME!!
 		 * If we end up modifying the journal inode
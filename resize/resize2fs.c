@@ -1440,6 +1440,9 @@ static errcode_t inode_scan_and_fix(ext2_resize_t rfs)
 	struct process_block_struct	pb;
 	ext2_ino_t		ino, new_inode;
 	struct ext2_inode 	*inode = NULL;
+	const struct ext2_inode	*disk_inode;
+	struct ext2_inode_batch	batch;
+	int			batch_idx = 0;
 	ext2_inode_scan 	scan = NULL;
 	errcode_t		retval;
 	char			*block_buf = 0;
@@ -1496,14 +1499,26 @@ static errcode_t inode_scan_and_fix(ext2_resize_t rfs)
 	 * First, copy all of the inodes that need to be moved
 	 * elsewhere in the inode table
 	 */
+	memset(&batch, 0, sizeof(batch));
 	while (1) {
-		retval = ext2fs_get_next_inode_full(scan, &ino, inode, inode_size);
-		if (retval) goto errout;
-		if (!ino)
-			break;
+		if (batch_idx >= batch.count) {
+			batch_idx = 0;
+			retval = ext2fs_get_next_inode_batch(scan, &batch);
+			if (retval) goto errout;
+			if (!batch.count)
+				break;
+			if (batch.flags & EXT2_IB_BAD_BLOCK) {
+				retval = EXT2_ET_BAD_BLOCK_IN_INODE_TABLE;
+				goto errout;
+			}
+		}
+		ino = batch.first_ino + batch_idx;
+		disk_inode = EXT2_BATCH_INODE(&batch, batch_idx);
+		batch_idx++;
 
-		if (inode->i_links_count == 0 && ino != EXT2_RESIZE_INO)
+		if (disk_inode->i_links_count == 0 && ino != EXT2_RESIZE_INO)
 			continue; /* inode not in use */
+		memcpy(inode, disk_inode, inode_size);
 
 		pb.is_dir = LINUX_S_ISDIR(inode->i_mode);
 		pb.changed = 0;
@@ -1524,7 +1539,8 @@ static errcode_t inode_scan_and_fix(ext2_resize_t rfs)
 		    (rfs->bmap || pb.is_dir)) {
 			pb.ino = ino;
 			retval = ext2fs_block_iterate3(rfs->old_fs,
-						       ino, 0, block_buf,
+						       ino, BLOCK_FLAG_PREFETCH,
+						       block_buf,
 						       process_block, &pb);
 			if (retval)
 				goto errout;